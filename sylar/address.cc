@@ -3,6 +3,9 @@
 #include <netdb.h>
 #include <stddef.h>
 #include <sstream>
+#include "dns_resolver.h"
+#include "hook.h"
+#include "iomanager.h"
 #include "log.h"
 
 #include "endian.h"
@@ -51,6 +54,28 @@ IPAddress::ptr Address::LookupAnyIPAddress(const std::string& host, int family,
   return nullptr;
 }
 
+// 在 hook 的协程中解析域名时使用 DnsResolver, getaddrinfo 会阻塞线程
+static bool UseResolver(const std::string& node, const char* service,
+                        int family) {
+  if (family != AF_INET && family != AF_INET6 && family != AF_UNSPEC) {
+    return false;
+  }
+  if (!DnsResolver::IsEnabled() || !sylar::IOManager::GetThis() ||
+      !sylar::is_hook_enable()) {
+    return false;
+  }
+  // 服务名需要查 /etc/services, 交给 getaddrinfo
+  for (const char* p = service; p && *p; ++p) {
+    if (!isdigit(*p)) {
+      return false;
+    }
+  }
+  // 数字地址 getaddrinfo 不会查询 DNS
+  in6_addr buf;
+  return inet_pton(AF_INET, node.c_str(), &buf) != 1 &&
+         inet_pton(AF_INET6, node.c_str(), &buf) != 1;
+}
+
 bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
                      int family, int type, int protocol) {
   addrinfo hints, *results, *next;
@@ -93,6 +118,27 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
   if (node.empty()) {
     node = host;
   }
+  if (UseResolver(node, service, family)) {
+    std::vector<Address::ptr> addrs;
+    int32_t rt = DnsResolverMgr::GetInstance()->lookup(addrs, node, family);
+    // 没有配置 nameserver 时仍然使用 getaddrinfo
+    if (rt != DnsResolver::NO_SERVER) {
+      if (rt != DnsResolver::OK) {
+        SYLAR_LOG_DEBUG(g_logger) << "Address::Lookup resolve(" << host << ", "
+                                  << family << ") err=" << rt;
+      }
+      for (auto& i : addrs) {
+        auto addr = std::dynamic_pointer_cast<IPAddress>(
+            Create(i->getAddr(), i->getAddrLen()));
+        if (!addr) {
+          continue;
+        }
+        addr->setPort(service ? atoi(service) : 0);
+        result.push_back(addr);
+      }
+      return !result.empty();
+    }
+  }
   int error = getaddrinfo(node.c_str(), service, &hints, &results);
   if (error) {
     SYLAR_LOG_DEBUG(g_logger)
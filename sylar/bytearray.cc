@@ -638,7 +638,10 @@ uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers,
 // 从 position 处开始读取，原理与上面函数相同
 uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len,
                                    uint64_t position) const {
-  len = len > getReadSize() ? getReadSize() : len;
+  if (position >= m_size) {
+    return 0;
+  }
+  len = len > m_size - position ? m_size - position : len;
   if (len == 0) {
     return 0;
   }
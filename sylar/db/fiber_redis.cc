@@ -0,0 +1,768 @@
+#include "fiber_redis.h"
+#include <string.h>
+#include <algorithm>
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static std::string get_value(const std::map<std::string, std::string>& m,
+                             const std::string& key,
+                             const std::string& def = "") {
+  auto it = m.find(key);
+  return it == m.end() ? def : it->second;
+}
+
+namespace {
+
+/// 发送缓冲超过这个大小时提前写出
+const size_t s_send_buffer_size = 256 * 1024;
+const size_t s_recv_buffer_size = 16 * 1024;
+/// 集群一条命令最多跟随的重定向次数
+const int s_max_redirects = 5;
+const size_t s_cluster_slots = 16384;
+
+void SetStr(redisReply* r, const char* str, size_t len) {
+  r->str = (char*)malloc(len + 1);
+  memcpy(r->str, str, len);
+  r->str[len] = '\0';
+  r->len = len;
+}
+
+// CRC16-CCITT(XMODEM), redis 集群的槽位算法
+uint16_t Crc16(const char* buf, size_t len) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= (uint16_t)(uint8_t)buf[i] << 8;
+    for (int n = 0; n < 8; ++n) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+}  // namespace
+
+FiberRedisConnection::FiberRedisConnection() : AsyncSocketStream(nullptr) {}
+
+bool FiberRedisConnection::connect(sylar::Address::ptr addr,
+                                   uint64_t timeout_ms) {
+  m_socket = sylar::Socket::CreateTCP(addr);
+  return m_socket->connect(addr, timeout_ms);
+}
+
+std::vector<ReplyPtr> FiberRedisConnection::request(
+    const std::vector<std::string>& cmds, uint32_t timeout_ms) {
+  if (!isConnected() || cmds.empty()) {
+    return {};
+  }
+  RedisCtx::ptr ctx = std::make_shared<RedisCtx>();
+  ctx->cmds = cmds;
+  ctx->sn = sylar::Atomic::addFetch(m_sn, 1);
+  ctx->timeout = timeout_ms;
+  ctx->scheduler = sylar::Scheduler::GetThis();
+  ctx->fiber = sylar::Fiber::GetThis();
+  if (!addCtx(ctx)) {
+    SYLAR_LOG_ERROR(g_logger) << "FiberRedisConnection duplicate sn="
+                              << ctx->sn << " " << getRemoteAddressString();
+    return {};
+  }
+  enqueue(ctx);
+  sylar::Fiber::YieldToHold();
+  if (ctx->result != OK) {
+    return {};
+  }
+  return std::move(ctx->replies);
+}
+
+bool FiberRedisConnection::RedisCtx::doSend(AsyncSocketStream::ptr stream) {
+  return std::dynamic_pointer_cast<FiberRedisConnection>(stream)->writeCmds(
+      shared_from_this());
+}
+
+bool FiberRedisConnection::writeCmds(RedisCtx::ptr ctx) {
+  if (!m_passwd.empty() && !m_authSent) {
+    // 重连后其它线程可能在 startRead 之前就看到连接可用并入队了命令,
+    // 所以不依赖入队顺序, 由写协程在新连接的第一条命令之前写出 AUTH
+    m_authSent = true;
+    if (!ctx->auth) {
+      RedisCtx::ptr auth = std::make_shared<RedisCtx>();
+      auth->cmds.push_back(Encode({"AUTH", m_passwd}));
+      auth->auth = true;
+      if (!writeCmds(auth)) {
+        return false;
+      }
+    }
+  } else if (ctx->auth) {
+    // 已经在之前的命令前补发过
+    return true;
+  }
+  {
+    // 先登记再写出, 保证读协程收到回复时能找到请求
+    MutexType::Lock lock(m_pendingMutex);
+    m_pending.push_back(ctx);
+  }
+  for (auto& i : ctx->cmds) {
+    m_sendBuffer.append(i);
+  }
+  if (m_sendBuffer.size() >= s_send_buffer_size) {
+    return doFlush();
+  }
+  return true;
+}
+
+bool FiberRedisConnection::doFlush() {
+  if (m_sendBuffer.empty()) {
+    return true;
+  }
+  int rt = writeFixSize(m_sendBuffer.c_str(), m_sendBuffer.size());
+  size_t len = m_sendBuffer.size();
+  m_sendBuffer.clear();
+  if (rt <= 0) {
+    SYLAR_LOG_ERROR(g_logger) << "FiberRedisConnection flush fail, len=" << len
+                              << " rt=" << rt << " errno=" << errno << " - "
+                              << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+void FiberRedisConnection::startRead() {
+  {
+    // 上一个连接上没有收到回复的请求已经在 innerClose 中返回
+    MutexType::Lock lock(m_pendingMutex);
+    m_pending.clear();
+  }
+  m_recvBuffer.clear();
+  m_recvPos = 0;
+  // 写协程还没有启动
+  m_authSent = false;
+  if (!m_passwd.empty()) {
+    // 唤醒写协程尽早认证, 之前已入队的命令会先触发补发 AUTH
+    RedisCtx::ptr ctx = std::make_shared<RedisCtx>();
+    ctx->cmds.push_back(Encode({"AUTH", m_passwd}));
+    ctx->auth = true;
+    enqueue(ctx);
+  }
+  AsyncSocketStream::startRead();
+}
+
+AsyncSocketStream::Ctx::ptr FiberRedisConnection::doRecv() {
+  redisReply* r = readReply();
+  if (!r) {
+    innerClose();
+    return nullptr;
+  }
+  ReplyPtr rpy(r, freeReplyObject);
+  RedisCtx::ptr ctx;
+  {
+    MutexType::Lock lock(m_pendingMutex);
+    if (!m_pending.empty()) {
+      ctx = m_pending.front();
+    }
+  }
+  if (!ctx) {
+    SYLAR_LOG_ERROR(g_logger) << "FiberRedisConnection unexpected reply from "
+                              << getRemoteAddressString();
+    innerClose();
+    return nullptr;
+  }
+  ctx->replies.push_back(rpy);
+  if (ctx->replies.size() < ctx->cmds.size()) {
+    return nullptr;
+  }
+  {
+    MutexType::Lock lock(m_pendingMutex);
+    m_pending.pop_front();
+  }
+  if (ctx->auth) {
+    if (rpy->type == REDIS_REPLY_ERROR) {
+      SYLAR_LOG_ERROR(g_logger) << "auth error: " << rpy->str << "("
+                                << getRemoteAddressString() << ")";
+    }
+    return nullptr;
+  }
+  // 已经超时的请求不在在途表中, 回复直接丢弃
+  return getAndDelCtx(ctx->sn);
+}
+
+bool FiberRedisConnection::fill(size_t length) {
+  while (m_recvBuffer.size() - m_recvPos < length) {
+    if (m_recvPos) {
+      m_recvBuffer.erase(0, m_recvPos);
+      m_recvPos = 0;
+    }
+    size_t old = m_recvBuffer.size();
+    size_t want = std::max(length - old, s_recv_buffer_size);
+    m_recvBuffer.resize(old + want);
+    int rt = read(&m_recvBuffer[old], want);
+    m_recvBuffer.resize(old + std::max(rt, 0));
+    if (rt <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FiberRedisConnection::readLine(std::string& line) {
+  size_t pos;
+  while ((pos = m_recvBuffer.find("\r\n", m_recvPos)) == std::string::npos) {
+    if (!fill(m_recvBuffer.size() - m_recvPos + 1)) {
+      return false;
+    }
+  }
+  line = m_recvBuffer.substr(m_recvPos, pos - m_recvPos);
+  m_recvPos = pos + 2;
+  return true;
+}
+
+redisReply* FiberRedisConnection::readReply() {
+  std::string line;
+  if (!readLine(line) || line.empty()) {
+    return nullptr;
+  }
+  redisReply* r = (redisReply*)calloc(1, sizeof(*r));
+  long long v = strtoll(line.c_str() + 1, nullptr, 10);
+  switch (line[0]) {
+    case '+':
+    case '-':
+      r->type = line[0] == '+' ? REDIS_REPLY_STATUS : REDIS_REPLY_ERROR;
+      SetStr(r, line.c_str() + 1, line.size() - 1);
+      break;
+    case ':':
+      r->type = REDIS_REPLY_INTEGER;
+      r->integer = v;
+      break;
+    case '$':
+      if (v < 0) {
+        r->type = REDIS_REPLY_NIL;
+        break;
+      }
+      if (!fill(v + 2)) {
+        freeReplyObject(r);
+        return nullptr;
+      }
+      r->type = REDIS_REPLY_STRING;
+      SetStr(r, &m_recvBuffer[m_recvPos], v);
+      m_recvPos += v + 2;
+      break;
+    case '*':
+      if (v < 0) {
+        r->type = REDIS_REPLY_NIL;
+        break;
+      }
+      r->type = REDIS_REPLY_ARRAY;
+      if (v > 0) {
+        r->element = (redisReply**)calloc(v, sizeof(redisReply*));
+        r->elements = v;
+      }
+      for (long long i = 0; i < v; ++i) {
+        r->element[i] = readReply();
+        if (!r->element[i]) {
+          freeReplyObject(r);
+          return nullptr;
+        }
+      }
+      break;
+    default:
+      SYLAR_LOG_ERROR(g_logger) << "invalid redis reply: " << line << "("
+                                << getRemoteAddressString() << ")";
+      freeReplyObject(r);
+      return nullptr;
+  }
+  return r;
+}
+
+std::string FiberRedisConnection::Encode(const std::vector<std::string>& argv) {
+  size_t len = 16;
+  for (auto& i : argv) {
+    len += i.size() + 16;
+  }
+  std::string rt;
+  rt.reserve(len);
+  rt.append("*").append(std::to_string(argv.size())).append("\r\n");
+  for (auto& i : argv) {
+    rt.append("$").append(std::to_string(i.size())).append("\r\n");
+    rt.append(i).append("\r\n");
+  }
+  return rt;
+}
+
+std::string FiberRedisConnection::Format(const char* fmt, va_list ap) {
+  char* cmd = nullptr;
+  int len = redisvFormatCommand(&cmd, fmt, ap);
+  if (len <= 0 || !cmd) {
+    return "";
+  }
+  std::string rt(cmd, len);
+  free(cmd);
+  return rt;
+}
+
+std::vector<std::string> FiberRedisConnection::Decode(const std::string& cmd,
+                                                      size_t count) {
+  std::vector<std::string> rt;
+  if (cmd.empty() || cmd[0] != '*') {
+    return rt;
+  }
+  size_t pos = cmd.find("\r\n");
+  if (pos == std::string::npos) {
+    return rt;
+  }
+  size_t size = std::min((size_t)strtoul(cmd.c_str() + 1, nullptr, 10), count);
+  pos += 2;
+  for (size_t i = 0; i < size; ++i) {
+    size_t end = cmd.find("\r\n", pos);
+    if (cmd[pos] != '$' || end == std::string::npos) {
+      break;
+    }
+    size_t len = strtoul(cmd.c_str() + pos + 1, nullptr, 10);
+    if (end + 2 + len > cmd.size()) {
+      break;
+    }
+    rt.push_back(cmd.substr(end + 2, len));
+    pos = end + 2 + len + 2;
+  }
+  return rt;
+}
+
+ReplyPtr IFiberRedis::cmd(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  ReplyPtr rt = cmd(fmt, ap);
+  va_end(ap);
+  return rt;
+}
+
+ReplyPtr IFiberRedis::cmd(const char* fmt, va_list ap) {
+  std::string c = FiberRedisConnection::Format(fmt, ap);
+  if (c.empty()) {
+    if (m_logEnable) {
+      SYLAR_LOG_ERROR(g_logger)
+          << "redis format error: (" << fmt << ")(" << m_name << ")";
+    }
+    return nullptr;
+  }
+  auto rpys = doPipeline({c});
+  return checkReply(rpys.empty() ? nullptr : rpys[0], fmt);
+}
+
+ReplyPtr IFiberRedis::cmd(const std::vector<std::string>& argv) {
+  auto rpys = doPipeline({FiberRedisConnection::Encode(argv)});
+  return checkReply(rpys.empty() ? nullptr : rpys[0],
+                    argv.empty() ? "" : argv[0]);
+}
+
+std::vector<ReplyPtr> IFiberRedis::pipeline(
+    const std::vector<std::vector<std::string>>& cmds) {
+  std::vector<std::string> cs;
+  cs.reserve(cmds.size());
+  for (auto& i : cmds) {
+    cs.push_back(FiberRedisConnection::Encode(i));
+  }
+  auto rt = doPipeline(cs);
+  rt.resize(cmds.size());
+  return rt;
+}
+
+ReplyPtr IFiberRedis::multi(const std::vector<std::vector<std::string>>& cmds) {
+  std::vector<std::string> cs;
+  cs.reserve(cmds.size() + 2);
+  cs.push_back(FiberRedisConnection::Encode({"MULTI"}));
+  for (auto& i : cmds) {
+    cs.push_back(FiberRedisConnection::Encode(i));
+  }
+  cs.push_back(FiberRedisConnection::Encode({"EXEC"}));
+  auto rpys = doMulti(cs);
+  return checkReply(rpys.size() == cs.size() ? rpys.back() : nullptr, "EXEC");
+}
+
+ReplyPtr IFiberRedis::checkReply(ReplyPtr rpy, const std::string& cmd) {
+  if (rpy && rpy->type != REDIS_REPLY_ERROR) {
+    return rpy;
+  }
+  if (m_logEnable) {
+    SYLAR_LOG_ERROR(g_logger) << "redis cmd error: (" << cmd << ")(" << m_name
+                              << ")" << (rpy ? ": " : "")
+                              << (rpy ? rpy->str : "");
+  }
+  return nullptr;
+}
+
+FiberRedis::FiberRedis(const std::map<std::string, std::string>& conf) {
+  m_type = IRedis::FIBER_REDIS;
+  m_host = get_value(conf, "host");
+  m_passwd = get_value(conf, "passwd");
+  m_logEnable = sylar::TypeUtil::Atoi(get_value(conf, "log_enable", "1"));
+  auto tmp = get_value(conf, "timeout_com");
+  if (tmp.empty()) {
+    tmp = get_value(conf, "timeout");
+  }
+  m_cmdTimeout = sylar::TypeUtil::Atoi(tmp);
+  m_connectTimeout =
+      sylar::TypeUtil::Atoi(get_value(conf, "timeout_conn", "50"));
+  m_poolSize =
+      std::max<int64_t>(1, sylar::TypeUtil::Atoi(get_value(conf, "pool")));
+}
+
+FiberRedis::~FiberRedis() {
+  sylar::RWMutex::WriteLock lock(m_mutex);
+  for (auto& i : m_pools) {
+    for (auto& c : i.second.conns) {
+      c->close();
+    }
+  }
+}
+
+FiberRedisConnection::ptr FiberRedis::getConnection() {
+  sylar::IOManager* iom = sylar::IOManager::GetThis();
+  if (!iom) {
+    SYLAR_LOG_ERROR(g_logger) << "FiberRedis must be used in IOManager("
+                              << m_host << ", " << m_name << ")";
+    return nullptr;
+  }
+  uint64_t ts = sylar::GetCurrentMS();
+  while (true) {
+    {
+      sylar::RWMutex::WriteLock lock(m_mutex);
+      auto& pool = m_pools[iom];
+      if (pool.conns.size() + pool.connecting < m_poolSize) {
+        ++pool.connecting;
+        break;
+      }
+      for (size_t i = 0; i < pool.conns.size(); ++i) {
+        auto& conn = pool.conns[pool.idx++ % pool.conns.size()];
+        if (conn->isConnected()) {
+          return conn;
+        }
+      }
+      // 全部断开, 等待自动重连
+      if (!pool.connecting) {
+        return nullptr;
+      }
+    }
+    // 其它协程正在建立连接, 连接中会让出, 不能在锁内等待
+    if (sylar::GetCurrentMS() - ts > m_connectTimeout) {
+      return nullptr;
+    }
+    usleep(1000);
+  }
+
+  sylar::Address::ptr addr;
+  {
+    sylar::RWMutex::ReadLock lock(m_mutex);
+    addr = m_address;
+  }
+  if (!addr) {
+    // 解析可能让出协程, 不在锁内进行, 并发解析时保留先写入的结果
+    addr = sylar::Address::LookupAnyIPAddress(m_host);
+    sylar::RWMutex::WriteLock lock(m_mutex);
+    if (!m_address) {
+      m_address = addr;
+    } else {
+      addr = m_address;
+    }
+  }
+  if (!addr) {
+    // 解析失败不占用连接池的位置, 下次请求重新解析
+    SYLAR_LOG_ERROR(g_logger)
+        << "FiberRedis lookup fail(" << m_host << ", " << m_name << ")";
+    sylar::RWMutex::WriteLock lock(m_mutex);
+    --m_pools[iom].connecting;
+    return nullptr;
+  }
+  FiberRedisConnection::ptr conn = std::make_shared<FiberRedisConnection>();
+  conn->setPasswd(m_passwd);
+  bool ok = conn->connect(addr, m_connectTimeout);
+  if (!ok) {
+    SYLAR_LOG_ERROR(g_logger)
+        << "FiberRedis connect fail(" << m_host << ", " << m_name << ")";
+  }
+  // 连不上也放入连接池, 由 AsyncSocketStream 定时重连
+  conn->setAutoConnect(true);
+  conn->start();
+  sylar::RWMutex::WriteLock lock(m_mutex);
+  if (!ok && m_address == addr) {
+    // 地址可能已经变化, 后续新建的连接重新解析
+    m_address = nullptr;
+  }
+  auto& pool = m_pools[iom];
+  --pool.connecting;
+  pool.conns.push_back(conn);
+  return ok ? conn : nullptr;
+}
+
+std::vector<ReplyPtr> FiberRedis::request(
+    const std::vector<std::string>& cmds) {
+  auto conn = getConnection();
+  if (!conn) {
+    return {};
+  }
+  return conn->request(cmds, m_cmdTimeout);
+}
+
+std::vector<ReplyPtr> FiberRedis::doPipeline(
+    const std::vector<std::string>& cmds) {
+  return request(cmds);
+}
+
+std::vector<ReplyPtr> FiberRedis::doMulti(
+    const std::vector<std::string>& cmds) {
+  // 一次请求的命令在连接上连续写出, 不会和其它协程的命令交错
+  return request(cmds);
+}
+
+FiberRedisCluster::FiberRedisCluster(
+    const std::map<std::string, std::string>& conf)
+    : m_conf(conf) {
+  m_type = IRedis::FIBER_REDIS_CLUSTER;
+  m_passwd = get_value(conf, "passwd");
+  m_logEnable = sylar::TypeUtil::Atoi(get_value(conf, "log_enable", "1"));
+  auto tmp = get_value(conf, "timeout_com");
+  if (tmp.empty()) {
+    tmp = get_value(conf, "timeout");
+  }
+  m_cmdTimeout = sylar::TypeUtil::Atoi(tmp);
+  m_seeds = sylar::split(get_value(conf, "host"), ',');
+
+  auto slots = std::make_shared<SlotMap>();
+  slots->slots.resize(s_cluster_slots, -1);
+  m_slots = slots;
+}
+
+uint16_t FiberRedisCluster::GetSlot(const std::string& key) {
+  // 有 {} 且其中不为空时只计算 {} 中的部分
+  size_t begin = key.find('{');
+  if (begin != std::string::npos) {
+    size_t end = key.find('}', begin + 1);
+    if (end != std::string::npos && end != begin + 1) {
+      return Crc16(key.c_str() + begin + 1, end - begin - 1) &
+             (s_cluster_slots - 1);
+    }
+  }
+  return Crc16(key.c_str(), key.size()) & (s_cluster_slots - 1);
+}
+
+FiberRedis::ptr FiberRedisCluster::getNode(const std::string& host) {
+  {
+    sylar::RWMutex::ReadLock lock(m_mutex);
+    auto it = m_nodes.find(host);
+    if (it != m_nodes.end()) {
+      return it->second;
+    }
+  }
+  sylar::RWMutex::WriteLock lock(m_mutex);
+  auto& node = m_nodes[host];
+  if (!node) {
+    auto conf = m_conf;
+    conf["host"] = host;
+    node = std::make_shared<FiberRedis>(conf);
+    node->setName(m_name);
+  }
+  return node;
+}
+
+bool FiberRedisCluster::refresh() {
+  std::vector<std::string> hosts = m_seeds;
+  auto old = std::atomic_load(&m_slots);
+  hosts.insert(hosts.end(), old->nodes.begin(), old->nodes.end());
+  std::string cmd = FiberRedisConnection::Encode({"CLUSTER", "SLOTS"});
+  for (auto& host : hosts) {
+    auto rpys = getNode(host)->request({cmd});
+    if (rpys.empty() || rpys[0]->type != REDIS_REPLY_ARRAY) {
+      continue;
+    }
+    auto slots = std::make_shared<SlotMap>();
+    slots->slots.resize(s_cluster_slots, -1);
+    std::map<std::string, int16_t> idxs;
+    auto r = rpys[0];
+    for (size_t i = 0; i < r->elements; ++i) {
+      auto item = r->element[i];
+      if (item->type != REDIS_REPLY_ARRAY || item->elements < 3 ||
+          item->element[2]->type != REDIS_REPLY_ARRAY ||
+          item->element[2]->elements < 2) {
+        continue;
+      }
+      auto master = item->element[2];
+      std::string ip = master->element[0]->str ? master->element[0]->str : "";
+      if (ip.empty()) {
+        // 节点没有配置地址时就是当前节点
+        ip = host.substr(0, host.rfind(':'));
+      }
+      std::string node = ip + ":" + std::to_string(master->element[1]->integer);
+      auto it = idxs.find(node);
+      if (it == idxs.end()) {
+        it = idxs.insert(std::make_pair(node, slots->nodes.size())).first;
+        slots->nodes.push_back(node);
+      }
+      long long end = std::min(item->element[1]->integer,
+                               (long long)s_cluster_slots - 1);
+      for (long long s = item->element[0]->integer; s <= end; ++s) {
+        slots->slots[s] = it->second;
+      }
+    }
+    std::atomic_store(&m_slots, SlotMap::ptr(slots));
+    return true;
+  }
+  SYLAR_LOG_ERROR(g_logger) << "FiberRedisCluster refresh slots fail("
+                            << get_value(m_conf, "host") << ", " << m_name
+                            << ")";
+  return false;
+}
+
+void FiberRedisCluster::tryRefresh() {
+  if (!sylar::Atomic::compareAndSwapBool(m_refreshing, false, true)) {
+    return;
+  }
+  refresh();
+  m_refreshing = false;
+}
+
+FiberRedis::ptr FiberRedisCluster::route(const std::string& cmd) {
+  auto args = FiberRedisConnection::Decode(cmd, 4);
+  std::string key;
+  if (args.size() >= 2) {
+    std::string name = sylar::ToUpper(args[0]);
+    if (name == "EVAL" || name == "EVALSHA") {
+      if (args.size() >= 4 && sylar::TypeUtil::Atoi(args[2]) > 0) {
+        key = args[3];
+      }
+    } else {
+      key = args[1];
+    }
+  }
+  auto slots = std::atomic_load(&m_slots);
+  if (slots->nodes.empty()) {
+    tryRefresh();
+    slots = std::atomic_load(&m_slots);
+  }
+  int16_t idx = key.empty() ? -1 : slots->slots[GetSlot(key)];
+  if (idx >= 0) {
+    return getNode(slots->nodes[idx]);
+  }
+  if (!slots->nodes.empty()) {
+    return getNode(slots->nodes[0]);
+  }
+  return m_seeds.empty() ? nullptr : getNode(m_seeds[0]);
+}
+
+void FiberRedisCluster::moved(uint16_t slot, const std::string& host) {
+  // 只改一个槽位, 其余的等 refresh
+  auto old = std::atomic_load(&m_slots);
+  auto slots = std::make_shared<SlotMap>(*old);
+  auto it = std::find(slots->nodes.begin(), slots->nodes.end(), host);
+  if (it == slots->nodes.end()) {
+    it = slots->nodes.insert(slots->nodes.end(), host);
+  }
+  slots->slots[slot] = it - slots->nodes.begin();
+  std::atomic_store(&m_slots, SlotMap::ptr(slots));
+}
+
+FiberRedis::ptr FiberRedisCluster::redirect(ReplyPtr rpy, bool& asking,
+                                            bool& is_moved) {
+  if (!rpy || rpy->type != REDIS_REPLY_ERROR || !rpy->str) {
+    return nullptr;
+  }
+  // MOVED <slot> <ip:port> / ASK <slot> <ip:port>
+  auto parts = sylar::split(rpy->str, ' ');
+  if (parts.size() != 3) {
+    return nullptr;
+  }
+  if (parts[0] == "MOVED") {
+    moved(sylar::TypeUtil::Atoi(parts[1]) & (s_cluster_slots - 1), parts[2]);
+    asking = false;
+    is_moved = true;
+    return getNode(parts[2]);
+  }
+  if (parts[0] == "ASK") {
+    asking = true;
+    return getNode(parts[2]);
+  }
+  return nullptr;
+}
+
+std::vector<ReplyPtr> FiberRedisCluster::doPipeline(
+    const std::vector<std::string>& cmds) {
+  std::vector<ReplyPtr> rt(cmds.size());
+  // 按节点分组, 每个节点一次发送
+  std::map<FiberRedis::ptr, std::vector<size_t>> groups;
+  for (size_t i = 0; i < cmds.size(); ++i) {
+    auto node = route(cmds[i]);
+    if (node) {
+      groups[node].push_back(i);
+    }
+  }
+  for (auto& g : groups) {
+    std::vector<std::string> cs;
+    cs.reserve(g.second.size());
+    for (auto& i : g.second) {
+      cs.push_back(cmds[i]);
+    }
+    auto rpys = g.first->request(cs);
+    for (size_t i = 0; i < rpys.size(); ++i) {
+      rt[g.second[i]] = rpys[i];
+    }
+  }
+
+  // 重定向的命令逐条重试, 已经执行成功的不会重复执行
+  std::string asking_cmd = FiberRedisConnection::Encode({"ASKING"});
+  bool is_moved = false;
+  for (size_t i = 0; i < rt.size(); ++i) {
+    for (int n = 0; n < s_max_redirects; ++n) {
+      bool asking = false;
+      auto node = redirect(rt[i], asking, is_moved);
+      if (!node) {
+        break;
+      }
+      if (asking) {
+        auto rpys = node->request({asking_cmd, cmds[i]});
+        rt[i] = rpys.size() == 2 ? rpys[1] : nullptr;
+      } else {
+        auto rpys = node->request({cmds[i]});
+        rt[i] = rpys.empty() ? nullptr : rpys[0];
+      }
+    }
+  }
+  if (is_moved) {
+    tryRefresh();
+  }
+  return rt;
+}
+
+std::vector<ReplyPtr> FiberRedisCluster::doMulti(
+    const std::vector<std::string>& cmds) {
+  // 事务中的 key 需要在同一个槽位, 按第一条命令路由
+  auto node = route(cmds.size() > 2 ? cmds[1] : cmds[0]);
+  if (!node) {
+    return {};
+  }
+  auto rt = node->request(cmds);
+  std::string asking_cmd = FiberRedisConnection::Encode({"ASKING"});
+  bool is_moved = false;
+  for (int n = 0; n < s_max_redirects && rt.size() > 2; ++n) {
+    // 第一条命令入队时的回复, 重定向时 EXEC 会返回 EXECABORT
+    bool asking = false;
+    node = redirect(rt[1], asking, is_moved);
+    if (!node) {
+      break;
+    }
+    if (asking) {
+      std::vector<std::string> cs{asking_cmd};
+      cs.insert(cs.end(), cmds.begin(), cmds.end());
+      rt = node->request(cs);
+      if (!rt.empty()) {
+        rt.erase(rt.begin());
+      }
+    } else {
+      rt = node->request(cmds);
+    }
+  }
+  if (is_moved) {
+    tryRefresh();
+  }
+  return rt;
+}
+
+}  // namespace sylar
@@ -0,0 +1,247 @@
+#ifndef __SYLAR_DB_FIBER_REDIS_H__
+#define __SYLAR_DB_FIBER_REDIS_H__
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sylar/db/redis.h"
+#include "sylar/iomanager.h"
+#include "sylar/streams/async_socket_stream.h"
+
+namespace sylar {
+
+/**
+ * @brief 协程版 redis 连接, 在 hook 的 Socket 上直接收发 RESP
+ * @details 多个协程并发的命令进入发送队列, 写协程一次编码写出(自动 pipeline),
+ *          读协程按发送的顺序把回复交给对应的请求
+ */
+class FiberRedisConnection : public AsyncSocketStream {
+ public:
+  typedef std::shared_ptr<FiberRedisConnection> ptr;
+  FiberRedisConnection();
+
+  bool connect(sylar::Address::ptr addr, uint64_t timeout_ms = -1);
+
+  /**
+   * @brief 发送编码好的若干条命令, 一次写出, 按顺序返回全部回复
+   * @details 错误回复原样返回
+   * @return 超时, 连接断开时返回空
+   */
+  std::vector<ReplyPtr> request(const std::vector<std::string>& cmds,
+                                uint32_t timeout_ms);
+
+  /**
+   * @brief 每次连上后先发送 AUTH, 由写协程保证在其它命令之前写出
+   */
+  void setPasswd(const std::string& v) { m_passwd = v; }
+
+  /**
+   * @brief 按 RESP 编码一条命令
+   */
+  static std::string Encode(const std::vector<std::string>& argv);
+  /**
+   * @brief 按 hiredis 的格式(%s %b %d ...)编码一条命令
+   */
+  static std::string Format(const char* fmt, va_list ap);
+  /**
+   * @brief 解析编码后的命令, 最多返回前 count 个参数
+   */
+  static std::vector<std::string> Decode(const std::string& cmd,
+                                         size_t count = -1);
+
+ protected:
+  struct RedisCtx : public Ctx, public std::enable_shared_from_this<RedisCtx> {
+    typedef std::shared_ptr<RedisCtx> ptr;
+    std::vector<std::string> cmds;
+    /// 只在读协程中写入, 收齐后才唤醒请求的协程
+    std::vector<ReplyPtr> replies;
+    bool auth = false;
+
+    virtual bool doSend(AsyncSocketStream::ptr stream) override;
+  };
+
+  virtual Ctx::ptr doRecv() override;
+  virtual bool doFlush() override;
+  virtual void startRead() override;
+
+  bool writeCmds(RedisCtx::ptr ctx);
+
+  redisReply* readReply();
+  bool readLine(std::string& line);
+  bool fill(size_t length);
+
+ private:
+  std::string m_passwd;
+  /// 只在写协程中使用
+  std::string m_sendBuffer;
+  /// 当前连接上是否已写出 AUTH, startRead 在写协程启动前重置
+  bool m_authSent = false;
+  /// 已经写出等待回复的请求, 回复按这个顺序返回
+  MutexType m_pendingMutex;
+  std::deque<RedisCtx::ptr> m_pending;
+  /// 只在读协程中使用
+  std::string m_recvBuffer;
+  size_t m_recvPos = 0;
+};
+
+/**
+ * @brief 协程版 redis 客户端的公共接口
+ * @details 只能在 IOManager 的协程中使用. cmd 遇到错误回复时返回 nullptr,
+ *          pipeline 原样返回每条命令的回复
+ */
+class IFiberRedis : public IRedis {
+ public:
+  typedef std::shared_ptr<IFiberRedis> ptr;
+
+  virtual ReplyPtr cmd(const char* fmt, ...) override;
+  virtual ReplyPtr cmd(const char* fmt, va_list ap) override;
+  virtual ReplyPtr cmd(const std::vector<std::string>& argv) override;
+
+  /**
+   * @brief 一次发送多条命令, 按顺序返回回复, 失败的位置为空
+   */
+  std::vector<ReplyPtr> pipeline(
+      const std::vector<std::vector<std::string>>& cmds);
+  /**
+   * @brief 用 MULTI/EXEC 包起来一次发送, 返回 EXEC 的回复
+   */
+  ReplyPtr multi(const std::vector<std::vector<std::string>>& cmds);
+
+  uint32_t getTimeout() const { return m_cmdTimeout; }
+  void setTimeout(uint32_t v) { m_cmdTimeout = v; }
+
+ protected:
+  /**
+   * @brief 执行编码好的命令, 每条命令的回复一一对应
+   */
+  virtual std::vector<ReplyPtr> doPipeline(
+      const std::vector<std::string>& cmds) = 0;
+  /**
+   * @brief 执行编码好的 MULTI ... EXEC, 返回全部回复
+   */
+  virtual std::vector<ReplyPtr> doMulti(
+      const std::vector<std::string>& cmds) = 0;
+
+  ReplyPtr checkReply(ReplyPtr rpy, const std::string& cmd);
+
+ protected:
+  uint32_t m_cmdTimeout = 0;
+  uint32_t m_connectTimeout = 50;
+};
+
+/**
+ * @brief 协程版单机 redis
+ * @details 每个 IOManager 各自持有 pool 个连接, 连接的读写协程和调用方在
+ *          同一个 IOManager 中, 不需要跨线程切换. 断开后自动重连
+ */
+class FiberRedis : public IFiberRedis {
+ public:
+  typedef std::shared_ptr<FiberRedis> ptr;
+  /**
+   * @brief conf: host(ip:port), passwd, pool(每个 IOManager 的连接数),
+   *        timeout_com/timeout(命令超时毫秒), timeout_conn(连接超时毫秒)
+   */
+  FiberRedis(const std::map<std::string, std::string>& conf);
+  ~FiberRedis();
+
+  /**
+   * @brief 当前 IOManager 的一个可用连接, 不够 pool 个时新建
+   */
+  FiberRedisConnection::ptr getConnection();
+
+  /**
+   * @brief 在当前 IOManager 的连接上执行编码好的命令
+   */
+  std::vector<ReplyPtr> request(const std::vector<std::string>& cmds);
+
+  const std::string& getHost() const { return m_host; }
+
+ protected:
+  virtual std::vector<ReplyPtr> doPipeline(
+      const std::vector<std::string>& cmds) override;
+  virtual std::vector<ReplyPtr> doMulti(
+      const std::vector<std::string>& cmds) override;
+
+ private:
+  struct Pool {
+    std::vector<FiberRedisConnection::ptr> conns;
+    uint32_t connecting = 0;
+    uint32_t idx = 0;
+  };
+
+ private:
+  std::string m_host;
+  sylar::Address::ptr m_address;
+  uint32_t m_poolSize;
+  sylar::RWMutex m_mutex;
+  std::map<sylar::IOManager*, Pool> m_pools;
+};
+
+/**
+ * @brief 协程版 redis 集群
+ * @details 通过 CLUSTER SLOTS 得到槽位表, 按 key 的 CRC16 路由到节点,
+ *          每个节点是一个 FiberRedis. 收到 MOVED 时更新槽位并重新拉取槽位表,
+ *          收到 ASK 时带上 ASKING 发给目标节点
+ */
+class FiberRedisCluster : public IFiberRedis {
+ public:
+  typedef std::shared_ptr<FiberRedisCluster> ptr;
+  /**
+   * @brief conf 同 FiberRedis, host 为逗号分隔的种子节点
+   */
+  FiberRedisCluster(const std::map<std::string, std::string>& conf);
+
+  /**
+   * @brief 拉取槽位表
+   */
+  bool refresh();
+
+  /**
+   * @brief key 所在的槽位, 支持 {hash tag}
+   */
+  static uint16_t GetSlot(const std::string& key);
+
+ protected:
+  virtual std::vector<ReplyPtr> doPipeline(
+      const std::vector<std::string>& cmds) override;
+  virtual std::vector<ReplyPtr> doMulti(
+      const std::vector<std::string>& cmds) override;
+
+ private:
+  struct SlotMap {
+    typedef std::shared_ptr<const SlotMap> ptr;
+    std::vector<std::string> nodes;
+    /// 槽位对应 nodes 的下标, -1 表示未知
+    std::vector<int16_t> slots;
+  };
+
+  FiberRedis::ptr getNode(const std::string& host);
+  /**
+   * @brief 命令应该发往的节点, 没有 key 或者槽位未知时用种子节点
+   */
+  FiberRedis::ptr route(const std::string& cmd);
+  void moved(uint16_t slot, const std::string& host);
+  /**
+   * @brief 已经有协程在拉取槽位表时直接返回
+   */
+  void tryRefresh();
+  /**
+   * @brief 处理 MOVED/ASK, 需要重试时返回目标节点
+   */
+  FiberRedis::ptr redirect(ReplyPtr rpy, bool& asking, bool& is_moved);
+
+ private:
+  std::map<std::string, std::string> m_conf;
+  std::vector<std::string> m_seeds;
+  /// 通过 std::atomic_load/std::atomic_store 访问
+  SlotMap::ptr m_slots;
+  bool m_refreshing = false;
+  sylar::RWMutex m_mutex;
+  std::map<std::string, FiberRedis::ptr> m_nodes;
+};
+
+}  // namespace sylar
+
+#endif
@@ -1,4 +1,5 @@
 #include "redis.h"
+#include "sylar/db/fiber_redis.h"
 #include "sylar/log.h"
 #include "sylar/sylar.h"
 
@@ -1204,7 +1205,9 @@ IRedis::ptr RedisManager::get(const std::string& name) {
   auto r = it->second.front();
   it->second.pop_front();
   if (r->getType() == IRedis::FOX_REDIS ||
-      r->getType() == IRedis::FOX_REDIS_CLUSTER) {
+      r->getType() == IRedis::FOX_REDIS_CLUSTER ||
+      r->getType() == IRedis::FIBER_REDIS ||
+      r->getType() == IRedis::FIBER_REDIS_CLUSTER) {
     it->second.push_back(r);
     return std::shared_ptr<IRedis>(r, sylar::nop<IRedis>);
   }
@@ -1241,6 +1244,19 @@ void RedisManager::init() {
     auto type = get_value(i.second, "type");
     auto pool = sylar::TypeUtil::Atoi(get_value(i.second, "pool"));
     auto passwd = get_value(i.second, "passwd");
+    if (type == "fiber_redis" || type == "fiber_redis_cluster") {
+      // pool 为每个 IOManager 的连接数, 连接按需建立, 所有协程共用一个实例
+      IFiberRedis* rds = nullptr;
+      if (type == "fiber_redis") {
+        rds = new sylar::FiberRedis(i.second);
+      } else {
+        rds = new sylar::FiberRedisCluster(i.second);
+      }
+      rds->setName(i.first);
+      sylar::RWMutex::WriteLock lock(m_mutex);
+      m_datas[i.first].push_back(rds);
+      continue;
+    }
     total += pool;
     for (int n = 0; n < pool; ++n) {
       if (type == "redis") {
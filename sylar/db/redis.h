@@ -22,7 +22,9 @@ class IRedis {
     REDIS = 1,
     REDIS_CLUSTER = 2,
     FOX_REDIS = 3,
-    FOX_REDIS_CLUSTER = 4
+    FOX_REDIS_CLUSTER = 4,
+    FIBER_REDIS = 5,
+    FIBER_REDIS_CLUSTER = 6
   };
   typedef std::shared_ptr<IRedis> ptr;
   IRedis() : m_logEnable(true) {}
@@ -1,8 +1,11 @@
 #include "dns.h"
+#include <math.h>
+#include <random>
 #include "sylar/config.h"
 #include "sylar/http/http_connection.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
+#include "sylar/worker.h"
 
 namespace sylar {
 
@@ -114,6 +117,79 @@ struct DnsIniter {
 // 利用 RAII 设置回调函数
 static DnsIniter __dns_init;
 
+static sylar::ConfigVar<uint32_t>::ptr g_dns_pool_max_size =
+    sylar::Config::Lookup("dns.pool.max_size", (uint32_t)64,
+                          "dns max connections per address");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_pool_idle_timeout =
+    sylar::Config::Lookup("dns.pool.idle_timeout", (uint32_t)60000,
+                          "dns pool evict idle connections beyond target(ms)");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_pool_max_warm =
+    sylar::Config::Lookup("dns.pool.max_warm", (uint32_t)4,
+                          "dns pool max new connections per address "
+                          "per refresh");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_pool_connect_timeout =
+    sylar::Config::Lookup("dns.pool.connect_timeout", (uint32_t)20,
+                          "dns pool connect timeout on miss(ms)");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_check_timeout =
+    sylar::Config::Lookup("dns.check.timeout", (uint32_t)50,
+                          "dns health check timeout(ms)");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_check_backoff_base =
+    sylar::Config::Lookup("dns.check.backoff_base", (uint32_t)1000,
+                          "dns health check backoff after first failure(ms)");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_check_backoff_max =
+    sylar::Config::Lookup("dns.check.backoff_max", (uint32_t)30000,
+                          "dns health check max backoff(ms)");
+
+static uint32_t s_dns_pool_max_size = 0;
+static uint32_t s_dns_pool_idle_timeout = 0;
+static uint32_t s_dns_pool_max_warm = 0;
+static uint32_t s_dns_pool_connect_timeout = 0;
+static uint32_t s_dns_check_timeout = 0;
+static uint32_t s_dns_check_backoff_base = 0;
+static uint32_t s_dns_check_backoff_max = 0;
+
+namespace {
+
+struct _DnsPoolIniter {
+  _DnsPoolIniter() {
+#define XX(name)                                                          \
+  s_##name = g_##name->getValue();                                        \
+  g_##name->addListener(                                                  \
+      [](const uint32_t& ov, const uint32_t& nv) { s_##name = nv; });
+    XX(dns_pool_max_size);
+    XX(dns_pool_idle_timeout);
+    XX(dns_pool_max_warm);
+    XX(dns_pool_connect_timeout);
+    XX(dns_check_timeout);
+    XX(dns_check_backoff_base);
+    XX(dns_check_backoff_max);
+#undef XX
+  }
+};
+
+static _DnsPoolIniter s_pool_init;
+
+uint32_t Rand() {
+  static thread_local std::mt19937 s_rand(std::random_device{}());
+  return s_rand();
+}
+
+// 在协程中并发执行, 慢的地址不会拖住其他地址; 不在 IOManager 中时顺序执行
+void RunAll(const std::vector<std::function<void()>>& cbs) {
+  auto iom = sylar::IOManager::GetThis();
+  if (!iom || cbs.size() <= 1) {
+    for (auto& i : cbs) {
+      i();
+    }
+    return;
+  }
+  auto wg = sylar::WorkerGroup::Create(cbs.size(), iom);
+  wg->schedule(cbs);
+  wg->waitAll();
+}
+
+}  // namespace
+
 Dns::Dns(const std::string& domain, int type, uint32_t pool_size)
     : m_domain(domain), m_type(type), m_idx(0), m_poolSize(pool_size) {}
 
@@ -200,135 +276,287 @@ bool Dns::AddressItem::isValid() {
   return valid;
 }
 
+size_t Dns::AddressItem::getIdleSize() {
+  sylar::Spinlock::Lock lock(m_mutex);
+  return socks.size();
+}
+
 std::string Dns::AddressItem::toString() {
   std::stringstream ss;
   ss << *addr << ":" << valid;
   if (pool_size > 0) {
     sylar::Spinlock::Lock lock(m_mutex);
-    ss << ":" << socks.size();
+    ss << ":" << socks.size() << " (inflight=" << inflight
+       << " target=" << target_size << " rate=" << checkout_rate
+       << " hit=" << hit << " miss=" << miss << " evict=" << evict << ")";
   }
+  ss << " (probe=" << probe << " fail=" << fail_count
+     << " connect=" << connect << " connect_fail=" << connect_fail
+     << " connect_avg_us=" << (connect ? connect_us / connect : 0) << ")";
   return ss.str();
 }
 
+Socket* Dns::AddressItem::newSock(uint32_t timeout_ms) {
+  uint64_t start = sylar::GetCurrentUS();
+  sylar::Socket* sock =
+      new sylar::Socket(addr->getFamily(), sylar::Socket::TCP, 0);
+  if (!sock->connect(addr, timeout_ms)) {
+    sylar::Atomic::addFetch(connect_fail);
+    delete sock;
+    return nullptr;
+  }
+  sylar::Atomic::addFetch(connect);
+  sylar::Atomic::addFetch(connect_us, sylar::GetCurrentUS() - start);
+  return sock;
+}
+
+// 调用方持有 m_mutex
+// 按 Little 定律用借出速率和平均占用时间估算并发, 和借出峰值取大,
+// 需要扩大时立即扩大, 缩小时每次只减 1, 避免流量抖动时反复建连
+void Dns::AddressItem::adjust(uint64_t now) {
+  if (last_adjust == 0) {
+    last_adjust = now;
+    target_size = pool_size;
+    return;
+  }
+  if (now <= last_adjust) {
+    return;
+  }
+  double rate = checkouts * 1000.0 / (now - last_adjust);
+  checkout_rate = checkout_rate * 0.7 + rate * 0.3;
+  double hold = returns ? (double)hold_ms / returns : 0;
+  uint32_t demand = (uint32_t)ceil(checkout_rate * hold / 1000);
+  demand = std::max(demand, peak_inflight);
+
+  if (demand >= target_size) {
+    target_size = demand;
+  } else {
+    --target_size;
+  }
+  target_size = std::max(target_size, pool_size);
+  target_size = std::min(target_size, std::max(s_dns_pool_max_size, pool_size));
+
+  last_adjust = now;
+  peak_inflight = inflight;
+  checkouts = 0;
+  hold_ms = 0;
+  returns = 0;
+}
+
+// 调用方持有 m_mutex, 返回剩余的空闲连接数
+// 断开的连接全部删除, 超出期望大小且空闲超时的连接也删除
+size_t Dns::AddressItem::sweep(uint64_t now, std::vector<Socket*>& dels) {
+  size_t keep = target_size > inflight ? target_size - inflight : 0;
+  size_t alive = 0;
+  for (auto it = socks.begin(); it != socks.end();) {
+    if (!it->first->checkConnected() ||
+        (alive >= keep && it->second + s_dns_pool_idle_timeout <= now)) {
+      dels.push_back(it->first);
+      socks.erase(it++);
+      ++evict;
+    } else {
+      ++alive;
+      ++it;
+    }
+  }
+  return alive;
+}
+
+// 补足到期望大小, 每次最多新建 dns.pool.max_warm 个连接
+void Dns::AddressItem::warm(uint32_t timeout_ms) {
+  if (pool_size == 0) {
+    return;
+  }
+  sylar::Spinlock::Lock lock(m_mutex);
+  size_t total = socks.size() + inflight;
+  size_t need = target_size > total ? target_size - total : 0;
+  lock.unlock();
+
+  need = std::min(need, (size_t)s_dns_pool_max_warm);
+  for (size_t i = 0; i < need; ++i) {
+    Socket* sock = newSock(timeout_ms);
+    if (!sock) {
+      break;
+    }
+    lock.lock();
+    socks.push_back(std::make_pair(sock, sylar::GetCurrentMS()));
+    lock.unlock();
+  }
+}
+
+// 退避时间为 base * 2^(fail_count-1), 不超过 max, 再乘以 [0.5, 1.5) 的随机数,
+// 避免网络恢复后所有进程同时重连
+void Dns::AddressItem::backoff(uint64_t now) {
+  ++fail_count;
+  uint64_t wait = (uint64_t)s_dns_check_backoff_base
+                  << std::min(fail_count - 1, (uint32_t)20);
+  wait = std::min(wait, (uint64_t)s_dns_check_backoff_max);
+  // 抖动到 [0.5, 1.5) * wait
+  wait = wait / 2 + (wait ? Rand() % wait : 0);
+  next_probe = now + wait;
+}
+
 bool Dns::AddressItem::checkValid(uint32_t timeout_ms) {
+  uint64_t now = sylar::GetCurrentMS();
+  if (fail_count > 0 && now < next_probe) {
+    // 退避中
+    return false;
+  }
   if (pool_size > 0) {
     // 连接池 size > 0，需要检查已连接的 socket
     std::vector<Socket*> tmp;
     sylar::Spinlock::Lock lock(m_mutex);
-    for (auto it = socks.begin(); it != socks.end();) {
-      if ((*it)->checkConnected()) {
-        // 只要有一个 socket 状态是成功的，返回 true
-        return true;
-      } else {
-        tmp.push_back(*it);
-        socks.erase(it++);
-      }
-    }
+    adjust(now);
+    size_t alive = sweep(now, tmp);
     lock.unlock();
     for (auto& i : tmp) {
-      // 删除连接出错的 socket
+      // 删除连接出错和空闲超时的 socket
       delete i;
     }
+    if (alive > 0) {
+      // 只要有一个 socket 状态是成功的，返回 true
+      fail_count = 0;
+      valid = true;
+      warm(timeout_ms);
+      return true;
+    }
   }
   // 新建 socket 连接到域名对应的 ip
-  sylar::Socket* sock =
-      new sylar::Socket(addr->getFamily(), sylar::Socket::TCP, 0);
-  valid = sock->connect(addr, timeout_ms);
-
-  if (valid) {
-    if (!check_path.empty()) {
-      // 检查请求路径
-      sylar::http::HttpRequest::ptr req =
-          std::make_shared<sylar::http::HttpRequest>();
-      req->setPath(check_path);
-      req->setHeader("host", addr->toString());
-      sylar::Socket::ptr sock_ptr(sock, sylar::nop<sylar::Socket>);
-      auto rt =
-          sylar::http::HttpConnection::DoRequest(req, sock_ptr, timeout_ms);
-      if (!rt->response || (int)rt->response->getStatus() != 200) {
-        // 请求路径不合法
-        valid = false;
-        SYLAR_LOG_ERROR(g_logger)
-            << "health_check fail result=" << rt->result << " rsp.status="
-            << (rt->response ? (int)rt->response->getStatus() : -1)
-            << " check_path=" << check_path << " addr=" << addr->toString();
-      }
-    }
-    if (valid && pool_size > 0) {
-      // 设定了连接池，则保存 socket
-      sylar::Spinlock::Lock lock(m_mutex);
-      socks.push_back(sock);
-    } else {
-      delete sock;
+  sylar::Atomic::addFetch(probe);
+  sylar::Socket* sock = newSock(timeout_ms);
+  bool ok = sock != nullptr;
+
+  if (ok && !check_path.empty()) {
+    // 检查请求路径
+    sylar::http::HttpRequest::ptr req =
+        std::make_shared<sylar::http::HttpRequest>();
+    req->setPath(check_path);
+    req->setHeader("host", addr->toString());
+    sylar::Socket::ptr sock_ptr(sock, sylar::nop<sylar::Socket>);
+    auto rt = sylar::http::HttpConnection::DoRequest(req, sock_ptr, timeout_ms);
+    if (!rt->response || (int)rt->response->getStatus() != 200) {
+      // 请求路径不合法
+      ok = false;
+      SYLAR_LOG_ERROR(g_logger)
+          << "health_check fail result=" << rt->result << " rsp.status="
+          << (rt->response ? (int)rt->response->getStatus() : -1)
+          << " check_path=" << check_path << " addr=" << addr->toString();
     }
+  }
+
+  if (!ok) {
+    delete sock;
+    valid = false;
+    backoff(now);
+    return false;
+  }
+  fail_count = 0;
+  valid = true;
+  if (pool_size > 0) {
+    // 设定了连接池，则保存 socket
+    sylar::Spinlock::Lock lock(m_mutex);
+    socks.push_front(std::make_pair(sock, sylar::GetCurrentMS()));
+    lock.unlock();
+    warm(timeout_ms);
   } else {
     delete sock;
   }
-  return valid;
+  return true;
 }
 
 Dns::AddressItem::~AddressItem() {
   for (auto& i : socks) {
-    delete i;
+    delete i.first;
   }
 }
 
-void Dns::AddressItem::push(Socket* sock) {
-  if (sock->checkConnected()) {
-    sylar::Spinlock::Lock lock(m_mutex);
-    socks.push_back(sock);
-  } else {
-    delete sock;
+void Dns::AddressItem::push(Socket* sock, uint64_t checkout_ms) {
+  uint64_t now = sylar::GetCurrentMS();
+  bool connected = sock->checkConnected();
+  sylar::Spinlock::Lock lock(m_mutex);
+  --inflight;
+  hold_ms += now - std::min(now, checkout_ms);
+  ++returns;
+  // 和 adjust 一致, 配置的 pool_size 超过全局上限时以 pool_size 为准
+  if (connected &&
+      socks.size() + inflight < std::max(s_dns_pool_max_size, pool_size)) {
+    socks.push_front(std::make_pair(sock, now));
+    return;
   }
+  if (connected) {
+    ++evict;
+  }
+  lock.unlock();
+  delete sock;
 }
 
-static void ReleaseSock(Socket* sock, Dns::AddressItem::ptr ai) {
-  ai->push(sock);
+static void ReleaseSock(Socket* sock, Dns::AddressItem::ptr ai,
+                        uint64_t checkout_ms) {
+  ai->push(sock, checkout_ms);
+}
+
+// 调用方持有 m_mutex 时不能调用, 借出计数在这里加
+Socket::ptr Dns::AddressItem::wrap(Socket* sock) {
+  sylar::Spinlock::Lock lock(m_mutex);
+  ++inflight;
+  ++checkouts;
+  peak_inflight = std::max(peak_inflight, inflight);
+  lock.unlock();
+  return Socket::ptr(sock, std::bind(ReleaseSock, std::placeholders::_1,
+                                     shared_from_this(),
+                                     sylar::GetCurrentMS()));
 }
 
 Socket::ptr Dns::AddressItem::pop() {
   if (pool_size == 0) {
     return nullptr;
   }
+  std::vector<Socket*> tmp;
+  Socket* rt = nullptr;
   sylar::Spinlock::Lock lock(m_mutex);
-  if (socks.empty()) {
-    return nullptr;
+  while (!socks.empty()) {
+    auto sock = socks.front().first;
+    socks.pop_front();
+    if (sock->checkConnected()) {
+      rt = sock;
+      break;
+    }
+    tmp.push_back(sock);
+    ++evict;
   }
-  auto rt = socks.front();
-  socks.pop_front();
   lock.unlock();
-
-  Socket::ptr v(
-      rt, std::bind(ReleaseSock, std::placeholders::_1, shared_from_this()));
-  return v;
+  for (auto& i : tmp) {
+    delete i;
+  }
+  return rt ? wrap(rt) : nullptr;
 }
 
 Socket::ptr Dns::AddressItem::getSock() {
   if (pool_size > 0) {
-    do {
-      auto sock = pop();
-      if (!sock) {
-        break;
-      }
-      if (sock->checkConnected()) {
-        return sock;
-      }
-    } while (true);
-  } else if (valid) {
-    sylar::Socket* sock =
-        new sylar::Socket(addr->getFamily(), sylar::Socket::TCP, 0);
-    if (sock->connect(addr, 20)) {
-      if (pool_size > 0) {
-        Socket::ptr v(sock, std::bind(ReleaseSock, std::placeholders::_1,
-                                      shared_from_this()));
-      } else {
-        return sylar::Socket::ptr(sock);
-      }
-    } else {
-      delete sock;
+    auto sock = pop();
+    if (sock) {
+      sylar::Atomic::addFetch(hit);
+      return sock;
     }
+    sylar::Atomic::addFetch(miss);
   }
-  return nullptr;
+  if (!valid) {
+    return nullptr;
+  }
+  // 连接池为空时直接建连, 用完后归还到连接池
+  sylar::Socket* sock = newSock(s_dns_pool_connect_timeout);
+  if (!sock) {
+    return nullptr;
+  }
+  if (pool_size > 0) {
+    return wrap(sock);
+  }
+  return sylar::Socket::ptr(sock);
+}
+
+std::vector<Dns::AddressItem::ptr> Dns::getItems() {
+  RWMutexType::ReadLock lock(m_mutex);
+  return m_address;
 }
 
 void Dns::initAddress(const std::vector<Address::ptr>& result) {
@@ -346,24 +574,26 @@ void Dns::initAddress(const std::vector<Address::ptr>& result) {
 
   std::vector<AddressItem::ptr> address;
   address.resize(result.size());
-  std::map<std::string, AddressItem::ptr> m;
+  std::vector<std::function<void()>> checks;
+  uint32_t timeout = s_dns_check_timeout;
   for (size_t i = 0; i < result.size(); ++i) {
     auto it = old_address.find(result[i]->toString());
     // 查找域名对应的 ip 是否在旧 dns 信息里
     if (it != old_address.end()) {
-      // 更新 ip 地址的 socket 连接
-      it->second->checkValid(50);
       address[i] = it->second;
-      continue;
+    } else {
+      // 不在 dns 缓存里，就新建，并加入 dns 缓存
+      auto info = std::make_shared<AddressItem>();
+      info->addr = result[i];
+      info->pool_size = m_poolSize;
+      info->check_path = m_checkPath;
+      address[i] = info;
     }
-    // 不在 dns 缓存里，就新建连接，并加入 dns 缓存
-    auto info = std::make_shared<AddressItem>();
-    info->addr = result[i];
-    info->pool_size = m_poolSize;
-    info->check_path = m_checkPath;
-    info->checkValid(50);
-    address[i] = info;
+    // 更新 ip 地址的 socket 连接
+    checks.push_back(
+        std::bind(&AddressItem::checkValid, address[i], timeout));
   }
+  RunAll(checks);
 
   RWMutexType::WriteLock lock(m_mutex);
   m_address.swap(address);
@@ -446,9 +676,11 @@ void DnsManager::init() {
   RWMutexType::ReadLock lock(m_mutex);
   std::map<std::string, Dns::ptr> dns = m_dns;
   lock.unlock();
+  std::vector<std::function<void()>> cbs;
   for (auto& i : dns) {
-    i.second->refresh();
+    cbs.push_back(std::bind(&Dns::refresh, i.second));
   }
+  RunAll(cbs);
   m_refresh = false;
   m_lastUpdateTime = time(0);
 }
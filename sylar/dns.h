@@ -34,26 +34,75 @@ class Dns {
   void refresh();
 
  public:
+  /**
+   * @brief 一个地址的健康状态和连接池
+   * @details pool_size > 0 时维护预先建立的连接, pool_size 是最小大小,
+   *          实际大小随借出速率和借出峰值调整, 不超过 dns.pool.max_size。
+   *          探测失败后按指数退避加随机抖动等待, 退避期间不再连接该地址
+   */
   struct AddressItem : public std::enable_shared_from_this<AddressItem> {
     typedef std::shared_ptr<AddressItem> ptr;
     ~AddressItem();
     sylar::Address::ptr addr;
-    std::list<Socket*> socks;
+    // 空闲连接和归还时间(ms), 最近归还的在头部
+    std::list<std::pair<Socket*, uint64_t>> socks;
     sylar::Spinlock m_mutex;
     bool valid = false;
     uint32_t pool_size = 0;
     std::string check_path;  // 请求路径
 
+    // 期望的连接数(空闲 + 借出)
+    uint32_t target_size = 0;
+    // 借出中的连接数
+    uint32_t inflight = 0;
+    // 上次调整以来的借出峰值, 借出次数, 归还时累计的占用时间(ms)
+    uint32_t peak_inflight = 0;
+    uint64_t checkouts = 0;
+    uint64_t hold_ms = 0;
+    uint64_t returns = 0;
+    // 每秒借出次数的 EWMA
+    double checkout_rate = 0;
+    uint64_t last_adjust = 0;
+
+    // 连续探测失败次数, 下次允许探测的时间(ms)
+    uint32_t fail_count = 0;
+    uint64_t next_probe = 0;
+
+    // 统计
+    uint64_t hit = 0;
+    uint64_t miss = 0;
+    uint64_t evict = 0;
+    uint64_t probe = 0;
+    uint64_t connect = 0;
+    uint64_t connect_fail = 0;
+    uint64_t connect_us = 0;
+
     bool isValid();
+    /**
+     * @brief 检查地址是否可用, 并按借出情况调整和预热连接池
+     * @details 处于退避期间时直接返回 false
+     */
     bool checkValid(uint32_t timeout_ms);
 
-    void push(Socket* sock);
+    void push(Socket* sock, uint64_t checkout_ms);
     Socket::ptr pop();
     Socket::ptr getSock();
 
+    size_t getIdleSize();
+
     std::string toString();
+
+   private:
+    Socket* newSock(uint32_t timeout_ms);
+    Socket::ptr wrap(Socket* sock);
+    void adjust(uint64_t now);
+    size_t sweep(uint64_t now, std::vector<Socket*>& dels);
+    void warm(uint32_t timeout_ms);
+    void backoff(uint64_t now);
   };
 
+  std::vector<AddressItem::ptr> getItems();
+
  private:
   void init();
 
@@ -0,0 +1,827 @@
+#include "dns_resolver.h"
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/socket.h"
+#include "sylar/util.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_dns_resolver_enable =
+    sylar::Config::Lookup("dns.resolver.enable", false,
+                          "Address::Lookup resolve names with DnsResolver "
+                          "when running in a hooked fiber");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_cache_size =
+    sylar::Config::Lookup("dns.resolver.cache_size", (uint32_t)10000,
+                          "dns resolver lru cache size");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_max_ttl = sylar::Config::Lookup(
+    "dns.resolver.max_ttl", (uint32_t)300, "dns resolver max cache ttl(s)");
+static sylar::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+    sylar::Config::Lookup("dns.resolver.negative_ttl", (uint32_t)30,
+                          "dns resolver max cache ttl(s) of NXDOMAIN/NODATA");
+static sylar::ConfigVar<std::string>::ptr g_dns_resolv_conf =
+    sylar::Config::Lookup("dns.resolver.resolv_conf",
+                          std::string("/etc/resolv.conf"),
+                          "dns resolver nameserver config file");
+static sylar::ConfigVar<std::string>::ptr g_dns_hosts = sylar::Config::Lookup(
+    "dns.resolver.hosts", std::string("/etc/hosts"), "dns resolver hosts file");
+
+static bool s_dns_resolver_enable = false;
+static uint32_t s_dns_cache_size = 0;
+static uint32_t s_dns_max_ttl = 0;
+static uint32_t s_dns_negative_ttl = 0;
+
+namespace {
+
+struct _DnsResolverIniter {
+  _DnsResolverIniter() {
+#define XX(name, type)                                               \
+  s_##name = g_##name->getValue();                                   \
+  g_##name->addListener(                                             \
+      [](const type& ov, const type& nv) { s_##name = nv; });
+    XX(dns_resolver_enable, bool);
+    XX(dns_cache_size, uint32_t);
+    XX(dns_max_ttl, uint32_t);
+    XX(dns_negative_ttl, uint32_t);
+#undef XX
+  }
+};
+
+static _DnsResolverIniter s_init;
+
+void PutUint16(std::string& out, uint16_t v) {
+  out.push_back(v >> 8);
+  out.push_back(v & 0xff);
+}
+
+void PutUint32(std::string& out, uint32_t v) {
+  PutUint16(out, v >> 16);
+  PutUint16(out, v & 0xffff);
+}
+
+uint16_t GetUint16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+uint32_t GetUint32(const uint8_t* p) {
+  return ((uint32_t)GetUint16(p) << 16) | GetUint16(p + 2);
+}
+
+// 去掉结尾的 '.' 并转成小写
+std::string NormalizeName(const std::string& name) {
+  std::string rt = sylar::ToLower(name);
+  while (!rt.empty() && rt.back() == '.') {
+    rt.pop_back();
+  }
+  return rt;
+}
+
+bool EncodeName(std::string& out, const std::string& name) {
+  std::string n = NormalizeName(name);
+  if (n.size() > 253) {
+    return false;
+  }
+  size_t pos = 0;
+  while (pos < n.size()) {
+    size_t end = n.find('.', pos);
+    if (end == std::string::npos) {
+      end = n.size();
+    }
+    size_t len = end - pos;
+    if (len == 0 || len > 63) {
+      return false;
+    }
+    out.push_back(len);
+    out.append(n, pos, len);
+    pos = end + 1;
+  }
+  out.push_back(0);
+  return true;
+}
+
+// 解析可能带有压缩指针的名字, pos 移到名字之后
+bool DecodeName(const uint8_t* data, size_t len, size_t& pos,
+                std::string& name) {
+  name.clear();
+  size_t cur = pos;
+  bool jumped = false;
+  for (int jumps = 0; jumps < 32;) {
+    if (cur >= len) {
+      return false;
+    }
+    uint8_t c = data[cur];
+    if (c == 0) {
+      if (!jumped) {
+        pos = cur + 1;
+      }
+      return true;
+    }
+    if ((c & 0xc0) == 0xc0) {
+      if (cur + 1 >= len) {
+        return false;
+      }
+      if (!jumped) {
+        pos = cur + 2;
+      }
+      jumped = true;
+      cur = ((c & 0x3f) << 8) | data[cur + 1];
+      ++jumps;
+      continue;
+    }
+    if ((c & 0xc0) || cur + 1 + c > len) {
+      return false;
+    }
+    if (!name.empty()) {
+      name.push_back('.');
+    }
+    name.append((const char*)data + cur + 1, c);
+    cur += 1 + c;
+  }
+  return false;
+}
+
+bool DecodeRecord(const uint8_t* data, size_t len, size_t& pos,
+                  DnsRecord& r) {
+  if (!DecodeName(data, len, pos, r.name) || pos + 10 > len) {
+    return false;
+  }
+  r.name = NormalizeName(r.name);
+  r.type = GetUint16(data + pos);
+  r.cls = GetUint16(data + pos + 2);
+  r.ttl = GetUint32(data + pos + 4);
+  uint16_t rdlen = GetUint16(data + pos + 8);
+  pos += 10;
+  if (pos + rdlen > len) {
+    return false;
+  }
+  size_t end = pos + rdlen;
+  r.rdata.clear();
+  // 展开 rdata 中的名字, 之后可以不依赖原报文
+  std::string name;
+  switch (r.type) {
+    case DnsRecord::NS:
+    case DnsRecord::CNAME:
+      if (!DecodeName(data, len, pos, name) || !EncodeName(r.rdata, name)) {
+        return false;
+      }
+      break;
+    case DnsRecord::SRV:
+      if (rdlen < 7) {
+        return false;
+      }
+      r.rdata.append((const char*)data + pos, 6);
+      pos += 6;
+      if (!DecodeName(data, len, pos, name) || !EncodeName(r.rdata, name)) {
+        return false;
+      }
+      break;
+    case DnsRecord::SOA:
+      for (int i = 0; i < 2; ++i) {
+        if (!DecodeName(data, len, pos, name) || !EncodeName(r.rdata, name)) {
+          return false;
+        }
+      }
+      if (pos + 20 > end) {
+        return false;
+      }
+      r.rdata.append((const char*)data + pos, 20);
+      break;
+    default:
+      r.rdata.assign((const char*)data + pos, rdlen);
+      break;
+  }
+  pos = end;
+  return true;
+}
+
+uint16_t RandomId() {
+  static thread_local std::mt19937 s_rand(std::random_device{}());
+  return s_rand();
+}
+
+}  // namespace
+
+Address::ptr DnsRecord::getAddress() const {
+  if (type == A && rdata.size() == 4) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memcpy(&addr.sin_addr, rdata.c_str(), 4);
+    return std::make_shared<IPv4Address>(addr);
+  } else if (type == AAAA && rdata.size() == 16) {
+    return std::make_shared<IPv6Address>((const uint8_t*)rdata.c_str());
+  }
+  return nullptr;
+}
+
+bool DnsRecord::getSrv(DnsSrv& srv) const {
+  if (type != SRV || rdata.size() < 7) {
+    return false;
+  }
+  const uint8_t* p = (const uint8_t*)rdata.c_str();
+  srv.priority = GetUint16(p);
+  srv.weight = GetUint16(p + 2);
+  srv.port = GetUint16(p + 4);
+  size_t pos = 6;
+  if (!DecodeName(p, rdata.size(), pos, srv.target)) {
+    return false;
+  }
+  srv.target = NormalizeName(srv.target);
+  return true;
+}
+
+uint32_t DnsRecord::getSoaMinimum() const {
+  if (type != SOA || rdata.size() < 22) {
+    return 0;
+  }
+  return GetUint32((const uint8_t*)rdata.c_str() + rdata.size() - 4);
+}
+
+std::string DnsRecord::toString() const {
+  std::stringstream ss;
+  ss << "[DnsRecord name=" << name << " type=" << type << " ttl=" << ttl;
+  DnsSrv srv;
+  if (type == A || type == AAAA) {
+    auto addr = getAddress();
+    ss << " addr=" << (addr ? addr->toString() : "invalid");
+  } else if (getSrv(srv)) {
+    ss << " srv=" << srv.priority << " " << srv.weight << " " << srv.port
+       << " " << srv.target;
+  } else if (type == SOA) {
+    ss << " minimum=" << getSoaMinimum();
+  }
+  ss << "]";
+  return ss.str();
+}
+
+DnsRecord DnsRecord::CreateAddress(const std::string& name, uint32_t ttl,
+                                   Address::ptr addr) {
+  DnsRecord r;
+  r.name = NormalizeName(name);
+  r.ttl = ttl;
+  if (addr->getFamily() == AF_INET) {
+    auto in = (const sockaddr_in*)addr->getAddr();
+    r.type = A;
+    r.rdata.assign((const char*)&in->sin_addr, 4);
+  } else {
+    auto in6 = (const sockaddr_in6*)addr->getAddr();
+    r.type = AAAA;
+    r.rdata.assign((const char*)&in6->sin6_addr, 16);
+  }
+  return r;
+}
+
+DnsRecord DnsRecord::CreateSrv(const std::string& name, uint32_t ttl,
+                               const DnsSrv& srv) {
+  DnsRecord r;
+  r.name = NormalizeName(name);
+  r.type = SRV;
+  r.ttl = ttl;
+  PutUint16(r.rdata, srv.priority);
+  PutUint16(r.rdata, srv.weight);
+  PutUint16(r.rdata, srv.port);
+  EncodeName(r.rdata, srv.target);
+  return r;
+}
+
+DnsRecord DnsRecord::CreateSoa(const std::string& name, uint32_t ttl,
+                               uint32_t minimum) {
+  DnsRecord r;
+  r.name = NormalizeName(name);
+  r.type = SOA;
+  r.ttl = ttl;
+  EncodeName(r.rdata, "ns." + r.name);
+  EncodeName(r.rdata, "admin." + r.name);
+  // serial refresh retry expire minimum
+  PutUint32(r.rdata, 1);
+  PutUint32(r.rdata, 3600);
+  PutUint32(r.rdata, 600);
+  PutUint32(r.rdata, 86400);
+  PutUint32(r.rdata, minimum);
+  return r;
+}
+
+std::string DnsMessage::encode() const {
+  std::string out;
+  PutUint16(out, id);
+  PutUint16(out, flags);
+  PutUint16(out, qname.empty() ? 0 : 1);
+  PutUint16(out, answers.size());
+  PutUint16(out, authorities.size());
+  PutUint16(out, 0);
+  if (!qname.empty()) {
+    EncodeName(out, qname);
+    PutUint16(out, qtype);
+    PutUint16(out, 1);
+  }
+  for (auto* rs : {&answers, &authorities}) {
+    for (auto& r : *rs) {
+      EncodeName(out, r.name);
+      PutUint16(out, r.type);
+      PutUint16(out, r.cls);
+      PutUint32(out, r.ttl);
+      PutUint16(out, r.rdata.size());
+      out.append(r.rdata);
+    }
+  }
+  return out;
+}
+
+bool DnsMessage::decode(const void* buf, size_t len) {
+  const uint8_t* data = (const uint8_t*)buf;
+  if (len < 12) {
+    return false;
+  }
+  id = GetUint16(data);
+  flags = GetUint16(data + 2);
+  uint16_t qdcount = GetUint16(data + 4);
+  uint16_t ancount = GetUint16(data + 6);
+  uint16_t nscount = GetUint16(data + 8);
+  size_t pos = 12;
+  qname.clear();
+  qtype = 0;
+  answers.clear();
+  authorities.clear();
+  for (uint16_t i = 0; i < qdcount; ++i) {
+    std::string name;
+    if (!DecodeName(data, len, pos, name) || pos + 4 > len) {
+      return false;
+    }
+    if (i == 0) {
+      qname = NormalizeName(name);
+      qtype = GetUint16(data + pos);
+    }
+    pos += 4;
+  }
+  answers.resize(ancount);
+  for (auto& r : answers) {
+    if (!DecodeRecord(data, len, pos, r)) {
+      return false;
+    }
+  }
+  authorities.resize(nscount);
+  for (auto& r : authorities) {
+    if (!DecodeRecord(data, len, pos, r)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DnsResolver::IsEnabled() {
+  return s_dns_resolver_enable;
+}
+
+DnsResolver::DnsResolver() {
+  loadResolvConf(g_dns_resolv_conf->getValue());
+  loadHosts(g_dns_hosts->getValue());
+}
+
+bool DnsResolver::loadResolvConf(const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    SYLAR_LOG_WARN(g_logger) << "DnsResolver open " << path << " fail";
+    return false;
+  }
+  std::vector<Address::ptr> servers;
+  std::vector<std::string> search;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::stringstream ss(line.substr(0, line.find_first_of("#;")));
+    std::string key;
+    ss >> key;
+    if (key == "search" || key == "domain") {
+      // 和 glibc 一样, 以最后出现的 search 或 domain 为准
+      search.clear();
+      std::string domain;
+      while (ss >> domain) {
+        domain = NormalizeName(domain);
+        if (!domain.empty()) {
+          search.push_back(domain);
+        }
+      }
+    } else if (key == "nameserver") {
+      std::string ip;
+      ss >> ip;
+      auto addr = IPAddress::Create(ip.c_str(), 53);
+      if (addr) {
+        servers.push_back(addr);
+      } else {
+        SYLAR_LOG_WARN(g_logger) << path << " invalid nameserver " << ip;
+      }
+    } else if (key == "options") {
+      std::string opt;
+      while (ss >> opt) {
+        if (opt.compare(0, 8, "timeout:") == 0) {
+          m_timeout = std::max(atoi(opt.c_str() + 8), 1) * 1000;
+        } else if (opt.compare(0, 9, "attempts:") == 0) {
+          m_attempts = std::max(atoi(opt.c_str() + 9), 1);
+        } else if (opt.compare(0, 6, "ndots:") == 0) {
+          m_ndots = std::min(std::max(atoi(opt.c_str() + 6), 0), 15);
+        }
+      }
+    }
+  }
+  setServers(servers);
+  setSearch(search);
+  return true;
+}
+
+bool DnsResolver::loadHosts(const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    SYLAR_LOG_WARN(g_logger) << "DnsResolver open " << path << " fail";
+    return false;
+  }
+  decltype(m_hosts) hosts;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::stringstream ss(line.substr(0, line.find('#')));
+    std::string ip;
+    if (!(ss >> ip)) {
+      continue;
+    }
+    auto addr = IPAddress::Create(ip.c_str(), 0);
+    if (!addr) {
+      continue;
+    }
+    std::string name;
+    while (ss >> name) {
+      hosts[NormalizeName(name)].push_back(addr);
+    }
+  }
+  MutexType::Lock lock(m_mutex);
+  m_hosts.swap(hosts);
+  return true;
+}
+
+void DnsResolver::setServers(const std::vector<Address::ptr>& v) {
+  MutexType::Lock lock(m_mutex);
+  m_servers = v;
+}
+
+std::vector<Address::ptr> DnsResolver::getServers() {
+  MutexType::Lock lock(m_mutex);
+  return m_servers;
+}
+
+void DnsResolver::setSearch(const std::vector<std::string>& v) {
+  MutexType::Lock lock(m_mutex);
+  m_search = v;
+}
+
+std::vector<std::string> DnsResolver::getSearch() {
+  MutexType::Lock lock(m_mutex);
+  return m_search;
+}
+
+void DnsResolver::clearCache() {
+  MutexType::Lock lock(m_mutex);
+  m_cache.clear();
+  m_lru.clear();
+}
+
+size_t DnsResolver::getCacheSize() {
+  MutexType::Lock lock(m_mutex);
+  return m_cache.size();
+}
+
+DnsResolver::Result::ptr DnsResolver::queryHosts(const std::string& name,
+                                                 uint16_t type) {
+  if (type != DnsRecord::A && type != DnsRecord::AAAA) {
+    return nullptr;
+  }
+  MutexType::Lock lock(m_mutex);
+  auto it = m_hosts.find(name);
+  if (it == m_hosts.end()) {
+    return nullptr;
+  }
+  auto rt = std::make_shared<Result>();
+  int family = type == DnsRecord::A ? AF_INET : AF_INET6;
+  for (auto& i : it->second) {
+    if (i->getFamily() == family) {
+      rt->addrs.push_back(i);
+    }
+  }
+  // 和 glibc 一样, hosts 中有这个名字时不再查询 nameserver
+  rt->result = rt->addrs.empty() ? NOT_FOUND : OK;
+  return rt;
+}
+
+DnsResolver::Result::ptr DnsResolver::query(const std::string& name,
+                                            uint16_t type) {
+  std::string n = NormalizeName(name);
+  std::string tmp;
+  if (!EncodeName(tmp, n) || n.empty()) {
+    auto rt = std::make_shared<Result>();
+    rt->result = INVALID_NAME;
+    return rt;
+  }
+  auto rt = queryHosts(n, type);
+  if (rt) {
+    return rt;
+  }
+
+  std::string key = n + "#" + std::to_string(type);
+  Pending::ptr pending;
+  bool leader = false;
+  {
+    uint64_t now = sylar::GetCurrentMS();
+    MutexType::Lock lock(m_mutex);
+    auto it = m_cache.find(key);
+    if (it != m_cache.end()) {
+      if (it->second.expire > now) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.it);
+        return it->second.result;
+      }
+      m_lru.erase(it->second.it);
+      m_cache.erase(it);
+    }
+    auto& p = m_pendings[key];
+    if (!p) {
+      p = std::make_shared<Pending>();
+      leader = true;
+    } else {
+      ++p->waiters;
+    }
+    pending = p;
+  }
+  if (!leader) {
+    // 等待正在进行的同名查询
+    pending->sem.wait();
+    return pending->result;
+  }
+
+  rt = doQuery(n, type);
+  uint32_t waiters = 0;
+  {
+    MutexType::Lock lock(m_mutex);
+    m_pendings.erase(key);
+    pending->result = rt;
+    waiters = pending->waiters;
+    if (rt->result == OK || rt->result == NOT_FOUND) {
+      addCache(key, rt);
+    }
+  }
+  for (uint32_t i = 0; i < waiters; ++i) {
+    pending->sem.notify();
+  }
+  return rt;
+}
+
+void DnsResolver::addCache(const std::string& key, Result::ptr rt) {
+  if (!rt->ttl || !s_dns_cache_size) {
+    return;
+  }
+  auto& item = m_cache[key];
+  if (item.result) {
+    m_lru.erase(item.it);
+  }
+  m_lru.push_front(key);
+  item.it = m_lru.begin();
+  item.result = rt;
+  item.expire = sylar::GetCurrentMS() + rt->ttl * 1000ul;
+  while (m_cache.size() > s_dns_cache_size) {
+    m_cache.erase(m_lru.back());
+    m_lru.pop_back();
+  }
+}
+
+int32_t DnsResolver::lookup(std::vector<Address::ptr>& result,
+                            const std::string& name, int family) {
+  std::string n = NormalizeName(name);
+  std::vector<std::string> search;
+  {
+    MutexType::Lock lock(m_mutex);
+    // 绝对域名和 hosts 中的名字不展开
+    if (!n.empty() && name.back() != '.' && !m_hosts.count(n)) {
+      search = m_search;
+    }
+  }
+  if (search.empty()) {
+    return lookupName(result, n, family);
+  }
+  std::vector<std::string> names;
+  uint32_t dots = std::count(n.begin(), n.end(), '.');
+  bool absolute_first = dots >= m_ndots;
+  if (absolute_first) {
+    names.push_back(n);
+  }
+  for (auto& i : search) {
+    names.push_back(n + "." + i);
+  }
+  if (!absolute_first) {
+    names.push_back(n);
+  }
+  // 查到地址为止; 都没有时优先返回第一个超时等错误, 其次 NOT_FOUND
+  int32_t rt = INVALID_NAME;
+  for (auto& i : names) {
+    int32_t r = lookupName(result, i, family);
+    if (r == OK || r == NO_SERVER) {
+      return r;
+    }
+    if (rt == INVALID_NAME || (rt == NOT_FOUND && r != INVALID_NAME)) {
+      rt = r;
+    }
+  }
+  return rt;
+}
+
+int32_t DnsResolver::lookupName(std::vector<Address::ptr>& result,
+                                const std::string& name, int family) {
+  std::vector<uint16_t> types;
+  if (family == AF_INET || family == AF_UNSPEC) {
+    types.push_back(DnsRecord::A);
+  }
+  if (family == AF_INET6 || family == AF_UNSPEC) {
+    types.push_back(DnsRecord::AAAA);
+  }
+  int32_t rt = NOT_FOUND;
+  for (auto t : types) {
+    auto r = query(name, t);
+    if (r->result == OK) {
+      result.insert(result.end(), r->addrs.begin(), r->addrs.end());
+      rt = OK;
+    } else if (rt != OK) {
+      rt = r->result;
+    }
+  }
+  return rt;
+}
+
+DnsResolver::Result::ptr DnsResolver::doQuery(const std::string& name,
+                                              uint16_t type) {
+  auto servers = getServers();
+  uint32_t attempts = m_attempts;
+  auto rt = std::make_shared<Result>();
+  if (servers.empty()) {
+    rt->result = NO_SERVER;
+    return rt;
+  }
+  DnsMessage req;
+  req.id = RandomId();
+  req.flags = DnsMessage::RD;
+  req.qname = name;
+  req.qtype = type;
+  std::string data = req.encode();
+
+  rt->result = TIMEOUT;
+  for (uint32_t a = 0; a < attempts; ++a) {
+    for (auto& server : servers) {
+      DnsMessage rsp;
+      if (!exchangeUdp(server, data, req, rsp)) {
+        continue;
+      }
+      if (rsp.isTruncated() && !exchangeTcp(server, data, req, rsp)) {
+        continue;
+      }
+      uint8_t rcode = rsp.getRcode();
+      if (rcode == DnsMessage::NOERROR || rcode == DnsMessage::NXDOMAIN) {
+        return parseResult(rsp, type);
+      }
+      // SERVFAIL/REFUSED 等换下一个 nameserver
+      SYLAR_LOG_DEBUG(g_logger) << "DnsResolver " << name << " type=" << type
+                                << " server=" << *server
+                                << " rcode=" << (int)rcode;
+      rt->result = SERVER_FAIL;
+    }
+  }
+  SYLAR_LOG_WARN(g_logger) << "DnsResolver " << name << " type=" << type
+                           << " fail result=" << rt->result;
+  return rt;
+}
+
+DnsResolver::Result::ptr DnsResolver::parseResult(const DnsMessage& msg,
+                                                  uint16_t type) {
+  auto rt = std::make_shared<Result>();
+  uint32_t ttl = s_dns_max_ttl;
+  for (auto& i : msg.answers) {
+    // CNAME 链上最终名字的记录也在 answers 中, 按类型取
+    if (i.type != type) {
+      continue;
+    }
+    if (type == DnsRecord::SRV) {
+      DnsSrv srv;
+      if (i.getSrv(srv)) {
+        rt->srvs.push_back(srv);
+      }
+    } else {
+      auto addr = i.getAddress();
+      if (addr) {
+        rt->addrs.push_back(addr);
+      }
+    }
+    ttl = std::min(ttl, i.ttl);
+  }
+  std::stable_sort(rt->srvs.begin(), rt->srvs.end(),
+                   [](const DnsSrv& a, const DnsSrv& b) {
+                     return a.priority < b.priority ||
+                            (a.priority == b.priority && a.weight > b.weight);
+                   });
+  if (rt->addrs.empty() && rt->srvs.empty()) {
+    // NXDOMAIN 或者 NODATA, 按 SOA 的 minimum 缓存(RFC 2308)
+    rt->result = NOT_FOUND;
+    ttl = s_dns_negative_ttl;
+    for (auto& i : msg.authorities) {
+      if (i.type == DnsRecord::SOA) {
+        ttl = std::min(ttl, std::min(i.ttl, i.getSoaMinimum()));
+      }
+    }
+  }
+  rt->ttl = ttl;
+  return rt;
+}
+
+static bool CheckResponse(const DnsMessage& q, const DnsMessage& rsp) {
+  return rsp.isResponse() && rsp.id == q.id && rsp.qtype == q.qtype &&
+         rsp.qname == q.qname;
+}
+
+bool DnsResolver::exchangeUdp(Address::ptr server, const std::string& req,
+                              const DnsMessage& q, DnsMessage& rsp) {
+  auto sock = Socket::CreateUDP(server);
+  if (!sock->connect(server)) {
+    return false;
+  }
+  sock->setRecvTimeout(m_timeout);
+  Atomic::addFetch(m_sendCount, 1);
+  if (sock->send(req.c_str(), req.size()) != (int)req.size()) {
+    return false;
+  }
+  uint64_t deadline = sylar::GetCurrentMS() + m_timeout;
+  std::string buf(65536, '\0');
+  while (true) {
+    int rt = sock->recv(&buf[0], buf.size());
+    if (rt <= 0) {
+      return false;
+    }
+    // 忽略 id 或者问题不匹配的报文
+    if (rsp.decode(buf.c_str(), rt) && CheckResponse(q, rsp)) {
+      return true;
+    }
+    uint64_t now = sylar::GetCurrentMS();
+    if (now >= deadline) {
+      return false;
+    }
+    sock->setRecvTimeout(deadline - now);
+  }
+}
+
+bool DnsResolver::exchangeTcp(Address::ptr server, const std::string& req,
+                              const DnsMessage& q, DnsMessage& rsp) {
+  auto sock = Socket::CreateTCP(server);
+  if (!sock->connect(server, m_timeout)) {
+    return false;
+  }
+  sock->setRecvTimeout(m_timeout);
+  std::string data;
+  PutUint16(data, req.size());
+  data.append(req);
+  if (sock->send(data.c_str(), data.size()) != (int)data.size()) {
+    return false;
+  }
+  auto read_full = [&sock](void* buf, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+      int rt = sock->recv((char*)buf + offset, len - offset);
+      if (rt <= 0) {
+        return false;
+      }
+      offset += rt;
+    }
+    return true;
+  };
+  uint8_t len[2];
+  if (!read_full(len, 2)) {
+    return false;
+  }
+  std::string buf(GetUint16(len), '\0');
+  if (!read_full(&buf[0], buf.size())) {
+    return false;
+  }
+  return rsp.decode(buf.c_str(), buf.size()) && CheckResponse(q, rsp);
+}
+
+std::string DnsResolver::toString() {
+  std::stringstream ss;
+  MutexType::Lock lock(m_mutex);
+  ss << "[DnsResolver servers=[";
+  for (size_t i = 0; i < m_servers.size(); ++i) {
+    if (i) {
+      ss << ",";
+    }
+    ss << *m_servers[i];
+  }
+  ss << "] timeout=" << m_timeout << " attempts=" << m_attempts
+     << " hosts=" << m_hosts.size() << " cache=" << m_cache.size()
+     << " pending=" << m_pendings.size() << " send=" << m_sendCount << "]";
+  return ss.str();
+}
+
+}  // namespace sylar
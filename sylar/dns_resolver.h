@@ -0,0 +1,224 @@
+#ifndef __SYLAR_DNS_RESOLVER_H__
+#define __SYLAR_DNS_RESOLVER_H__
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sylar/address.h"
+#include "sylar/mutex.h"
+#include "sylar/singleton.h"
+
+namespace sylar {
+
+/**
+ * @brief SRV 记录的内容
+ */
+struct DnsSrv {
+  uint16_t priority = 0;
+  uint16_t weight = 0;
+  uint16_t port = 0;
+  std::string target;
+};
+
+/**
+ * @brief DNS 资源记录
+ * @details rdata 中的域名在解析时已经展开, 不包含压缩指针, 可以脱离原报文使用
+ */
+struct DnsRecord {
+  enum Type { A = 1, NS = 2, CNAME = 5, SOA = 6, AAAA = 28, SRV = 33 };
+
+  std::string name;
+  uint16_t type = 0;
+  uint16_t cls = 1;
+  uint32_t ttl = 0;
+  std::string rdata;
+
+  /**
+   * @brief A/AAAA 记录的地址, 端口为 0
+   */
+  Address::ptr getAddress() const;
+  bool getSrv(DnsSrv& srv) const;
+  /**
+   * @brief SOA 记录的 minimum 字段, 用于否定应答的缓存时间
+   */
+  uint32_t getSoaMinimum() const;
+
+  std::string toString() const;
+
+  static DnsRecord CreateAddress(const std::string& name, uint32_t ttl,
+                                 Address::ptr addr);
+  static DnsRecord CreateSrv(const std::string& name, uint32_t ttl,
+                             const DnsSrv& srv);
+  static DnsRecord CreateSoa(const std::string& name, uint32_t ttl,
+                             uint32_t minimum);
+};
+
+/**
+ * @brief DNS 报文, 只支持一个问题
+ */
+class DnsMessage {
+ public:
+  enum Flag {
+    QR = 0x8000,  // 应答
+    TC = 0x0200,  // 被截断
+    RD = 0x0100,  // 期望递归
+    RA = 0x0080,  // 支持递归
+  };
+  enum Rcode { NOERROR = 0, FORMERR = 1, SERVFAIL = 2, NXDOMAIN = 3 };
+
+  uint16_t id = 0;
+  uint16_t flags = 0;
+  std::string qname;
+  uint16_t qtype = 0;
+  std::vector<DnsRecord> answers;
+  std::vector<DnsRecord> authorities;
+
+  bool isResponse() const { return flags & QR; }
+  bool isTruncated() const { return flags & TC; }
+  uint8_t getRcode() const { return flags & 0xf; }
+  void setRcode(uint8_t v) { flags = (flags & ~0xf) | (v & 0xf); }
+
+  std::string encode() const;
+  bool decode(const void* data, size_t len);
+};
+
+/**
+ * @brief 基于 hook 的 UDP socket 实现的 DNS 解析, 在协程中等待不阻塞线程
+ * @details 支持 A/AAAA/SRV 查询, 先查 hosts 文件, 再查 LRU 缓存(按 TTL 过期,
+ *          NXDOMAIN 和没有记录的应答也会缓存), 同一个名字的并发查询只发送一次。
+ *          依次尝试 resolv.conf 中的 nameserver, 应答被截断时改用 TCP。
+ *          lookup 按 resolv.conf 的 search/domain 和 ndots 展开相对名字,
+ *          query 只按绝对域名查询
+ */
+class DnsResolver {
+ public:
+  typedef std::shared_ptr<DnsResolver> ptr;
+  typedef sylar::Mutex MutexType;
+
+  enum Error {
+    OK = 0,
+    // NXDOMAIN 或者没有该类型的记录
+    NOT_FOUND = -1,
+    TIMEOUT = -2,
+    SERVER_FAIL = -3,
+    // 没有可用的 nameserver
+    NO_SERVER = -4,
+    INVALID_NAME = -5,
+  };
+
+  struct Result {
+    typedef std::shared_ptr<const Result> ptr;
+    int32_t result = OK;
+    // A/AAAA 记录的地址, 端口为 0
+    std::vector<Address::ptr> addrs;
+    // 按 priority 升序, weight 降序
+    std::vector<DnsSrv> srvs;
+    // 缓存时间(秒)
+    uint32_t ttl = 0;
+  };
+
+  /**
+   * @brief 读取配置 dns.resolver.resolv_conf 和 dns.resolver.hosts 指定的文件
+   */
+  DnsResolver();
+
+  bool loadResolvConf(const std::string& path);
+  bool loadHosts(const std::string& path);
+
+  void setServers(const std::vector<Address::ptr>& v);
+  std::vector<Address::ptr> getServers();
+
+  // 每次请求的超时时间(ms)
+  void setTimeout(uint32_t v) { m_timeout = v; }
+  uint32_t getTimeout() const { return m_timeout; }
+  // 每个 nameserver 的尝试次数
+  void setAttempts(uint32_t v) { m_attempts = v; }
+  uint32_t getAttempts() const { return m_attempts; }
+  // 相对名字依次追加的 search 域
+  void setSearch(const std::vector<std::string>& v);
+  std::vector<std::string> getSearch();
+  // 名字中的点少于 ndots 时先尝试 search 域, 否则先按绝对域名查询
+  void setNdots(uint32_t v) { m_ndots = v; }
+  uint32_t getNdots() const { return m_ndots; }
+
+  /**
+   * @brief 查询一个名字, 需要在协程中调用
+   * @param[in] name 域名
+   * @param[in] type DnsRecord::Type
+   */
+  Result::ptr query(const std::string& name, uint16_t type);
+
+  /**
+   * @brief 查询域名的地址
+   * @details 不以 '.' 结尾且不在 hosts 中的名字按 search/ndots 展开,
+   *          依次查询直到查到地址, 规则与 glibc 相同
+   * @param[out] result 追加查到的地址, 端口为 0
+   * @param[in] family AF_INET 查 A, AF_INET6 查 AAAA, AF_UNSPEC 两者都查
+   * @return Error
+   */
+  int32_t lookup(std::vector<Address::ptr>& result, const std::string& name,
+                 int family = AF_INET);
+
+  void clearCache();
+  size_t getCacheSize();
+  // 实际发送到 nameserver 的请求数
+  uint64_t getSendCount() const { return m_sendCount; }
+
+  std::string toString();
+
+  /**
+   * @brief Address::Lookup 是否使用 DnsResolver(dns.resolver.enable)
+   * @details 默认关闭, 开启后进程内所有协程中的 Address::Lookup 都改走
+   *          DnsResolver
+   */
+  static bool IsEnabled();
+
+ private:
+  struct Pending {
+    typedef std::shared_ptr<Pending> ptr;
+    FiberSemaphore sem;
+    uint32_t waiters = 0;
+    Result::ptr result;
+  };
+
+  struct CacheItem {
+    Result::ptr result;
+    uint64_t expire = 0;  // ms
+    std::list<std::string>::iterator it;
+  };
+
+  Result::ptr queryHosts(const std::string& name, uint16_t type);
+  int32_t lookupName(std::vector<Address::ptr>& result, const std::string& name,
+                     int family);
+  Result::ptr doQuery(const std::string& name, uint16_t type);
+  Result::ptr parseResult(const DnsMessage& msg, uint16_t type);
+  bool exchangeUdp(Address::ptr server, const std::string& req,
+                   const DnsMessage& q, DnsMessage& rsp);
+  bool exchangeTcp(Address::ptr server, const std::string& req,
+                   const DnsMessage& q, DnsMessage& rsp);
+  void addCache(const std::string& key, Result::ptr rt);
+
+ private:
+  MutexType m_mutex;
+  std::vector<Address::ptr> m_servers;
+  uint32_t m_timeout = 5000;
+  uint32_t m_attempts = 2;
+  std::vector<std::string> m_search;
+  uint32_t m_ndots = 1;
+  // 名字 -> hosts 文件中的地址
+  std::unordered_map<std::string, std::vector<Address::ptr>> m_hosts;
+  // 名字#类型 -> 缓存, m_lru 头部是最近使用的
+  std::unordered_map<std::string, CacheItem> m_cache;
+  std::list<std::string> m_lru;
+  std::unordered_map<std::string, Pending::ptr> m_pendings;
+  uint64_t m_sendCount = 0;
+};
+
+typedef sylar::Singleton<DnsResolver> DnsResolverMgr;
+
+}  // namespace sylar
+
+#endif
@@ -0,0 +1,232 @@
+#include "grpc_server.h"
+#include "sylar/log.h"
+
+namespace sylar {
+namespace grpc {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+GrpcCall::GrpcCall(http2::Http2Stream::ptr session, http2::Stream::ptr stream)
+    : m_session(session), m_stream(stream), m_request(stream->getRequest()) {}
+
+GrpcCall::~GrpcCall() {
+  if (m_timer) {
+    m_timer->cancel();
+  }
+}
+
+void GrpcCall::start() {
+  int64_t timeout = GrpcParseTimeout(m_request->getHeader("grpc-timeout"));
+  if (timeout < 0) {
+    return;
+  }
+  m_deadline = sylar::GetCurrentMS() + timeout;
+  std::weak_ptr<GrpcCall> weak_call(shared_from_this());
+  m_timer = m_session->getIOManager()->addTimer(timeout, [weak_call]() {
+    auto call = weak_call.lock();
+    if (call) {
+      call->onDeadline();
+    }
+  });
+}
+
+void GrpcCall::onDeadline() {
+  SYLAR_LOG_DEBUG(g_logger) << "GrpcCall deadline exceeded, path="
+                            << getPath() << " id=" << getId();
+  m_deadlineExceeded = true;
+  finish((int32_t)GrpcStatus::DEADLINE_EXCEEDED, "deadline exceeded");
+  // 唤醒等待请求消息的处理协程
+  m_stream->cancel();
+}
+
+int64_t GrpcCall::getTimeout() const {
+  if (!m_deadline) {
+    return -1;
+  }
+  uint64_t now = sylar::GetCurrentMS();
+  return m_deadline > now ? m_deadline - now : 0;
+}
+
+int32_t GrpcCall::recv(google::protobuf::Message& message) {
+  while (true) {
+    const char* data = nullptr;
+    uint32_t length = 0;
+    int32_t rt = m_decoder.next(data, length);
+    if (rt > 0) {
+      if (!message.ParseFromArray(data, length)) {
+        m_error = "parse " + message.GetTypeName() + " fail";
+        return -1;
+      }
+      return 1;
+    }
+    if (rt < 0) {
+      m_error = "invalid message";
+      return -1;
+    }
+    std::string chunk;
+    rt = m_stream->recvData(chunk);
+    if (rt < 0) {
+      return -1;
+    }
+    if (rt == 0) {
+      if (!m_decoder.empty()) {
+        m_error = "incomplete message";
+        return -1;
+      }
+      return 0;
+    }
+    m_decoder.append(std::move(chunk));
+  }
+}
+
+bool GrpcCall::send(const google::protobuf::Message& message) {
+  std::string data;
+  if (!GrpcEncodeMessage(message, data)) {
+    return false;
+  }
+  // 对端不读取时挂起, 每个流最多积压一个对端窗口的数据.
+  // 不持有 m_mutex 等待, 超时的 finish 可以取消流来唤醒
+  if (!m_stream->waitSendable(m_session->getSendWindowSize())) {
+    return false;
+  }
+  MutexType::Lock lock(m_mutex);
+  if (m_finished || m_stream->isCancelled()) {
+    return false;
+  }
+  if (!m_headersSent) {
+    if (m_session->sendHeaders(getId(), responseHeaders(), false) < 0) {
+      return false;
+    }
+    m_headersSent = true;
+  }
+  m_stream->addSendPending(data.size());
+  return m_session->sendData(getId(), std::move(data), false) >= 0;
+}
+
+void GrpcCall::finish(int32_t status) {
+  finish(status, m_error);
+}
+
+void GrpcCall::finish(int32_t status, const std::string& message) {
+  MutexType::Lock lock(m_mutex);
+  if (m_finished) {
+    return;
+  }
+  m_finished = true;
+  if (m_timer) {
+    m_timer->cancel();
+    m_timer = nullptr;
+  }
+  if (m_stream->isCancelled()) {
+    // 客户端已经取消, 不需要再发送
+    return;
+  }
+  std::vector<std::pair<std::string, std::string>> trailers;
+  trailers.push_back(std::make_pair("grpc-status", std::to_string(status)));
+  if (!message.empty()) {
+    trailers.push_back(std::make_pair("grpc-message", message));
+  }
+  if (!m_headersSent) {
+    // 没有发送过消息, 头部和 trailers 合并为一个 HEADERS 帧
+    auto hs = responseHeaders();
+    hs.insert(hs.end(), trailers.begin(), trailers.end());
+    m_session->sendHeaders(getId(), hs, true);
+    m_headersSent = true;
+  } else {
+    m_session->sendTrailers(getId(), trailers);
+  }
+}
+
+void GrpcCall::addMetadata(const std::string& key, const std::string& value) {
+  MutexType::Lock lock(m_mutex);
+  m_metadata.push_back(std::make_pair(sylar::ToLower(key), value));
+}
+
+std::vector<std::pair<std::string, std::string>> GrpcCall::responseHeaders() {
+  std::vector<std::pair<std::string, std::string>> hs;
+  hs.reserve(m_metadata.size() + 4);
+  hs.push_back(std::make_pair(":status", "200"));
+  hs.push_back(std::make_pair("content-type", "application/grpc"));
+  hs.insert(hs.end(), m_metadata.begin(), m_metadata.end());
+  return hs;
+}
+
+GrpcServer::GrpcServer(sylar::IOManager* worker, sylar::IOManager* io_worker,
+                       sylar::IOManager* accept_worker)
+    : Http2Server("grpc", worker, io_worker, accept_worker) {}
+
+void GrpcServer::addMethod(const std::string& service,
+                           const std::string& method, MethodType type,
+                           CallHandler cb) {
+  Method::ptr m = std::make_shared<Method>();
+  m->type = type;
+  m->cb = cb;
+  RWMutexType::WriteLock lock(m_mutex);
+  m_methods["/" + service + "/" + method] = m;
+}
+
+void GrpcServer::delMethod(const std::string& service,
+                           const std::string& method) {
+  RWMutexType::WriteLock lock(m_mutex);
+  m_methods.erase("/" + service + "/" + method);
+}
+
+GrpcServer::Method::ptr GrpcServer::getMethod(const std::string& path) {
+  RWMutexType::ReadLock lock(m_mutex);
+  auto it = m_methods.find(path);
+  return it == m_methods.end() ? nullptr : it->second;
+}
+
+bool GrpcServer::handleStream(http2::Http2Stream::ptr session,
+                              http2::Stream::ptr stream) {
+  auto req = stream->getRequest();
+  // application/grpc 或者 application/grpc+proto 等
+  if (req->getHeader("content-type").compare(0, 16, "application/grpc")) {
+    return false;
+  }
+  GrpcCall::ptr call = std::make_shared<GrpcCall>(session, stream);
+  Method::ptr method = getMethod(req->getPath());
+  if (!method) {
+    SYLAR_LOG_WARN(g_logger) << "grpc method not found: " << req->getPath();
+    call->setError("method " + req->getPath() + " not found");
+    call->finish((int32_t)GrpcStatus::UNIMPLEMENTED);
+    // 之后收到的 DATA 会被丢弃
+    session->delStream(stream->getId());
+    return true;
+  }
+  call->start();
+  m_worker->schedule(std::bind(&GrpcServer::handleCall,
+                               std::static_pointer_cast<GrpcServer>(
+                                   shared_from_this()),
+                               call, session, method));
+  return true;
+}
+
+void GrpcServer::handleCall(GrpcCall::ptr call,
+                            http2::Http2Stream::ptr session,
+                            Method::ptr method) {
+  int32_t rt = method->cb(call);
+  call->finish(rt);
+  session->delStream(call->getId());
+}
+
+int32_t GrpcServer::RecvOne(GrpcCall::ptr call,
+                            google::protobuf::Message& message) {
+  int32_t rt = call->recv(message);
+  if (rt > 0) {
+    return 0;
+  }
+  if (call->isDeadlineExceeded()) {
+    return (int32_t)GrpcStatus::DEADLINE_EXCEEDED;
+  }
+  if (call->isCancelled()) {
+    return (int32_t)GrpcStatus::CANCELLED;
+  }
+  if (rt == 0) {
+    call->setError("missing request message");
+  }
+  return (int32_t)GrpcStatus::INTERNAL;
+}
+
+}  // namespace grpc
+}  // namespace sylar
@@ -0,0 +1,221 @@
+#ifndef __SYLAR_GRPC_GRPC_SERVER_H__
+#define __SYLAR_GRPC_GRPC_SERVER_H__
+
+#include <atomic>
+#include <unordered_map>
+#include "grpc_stream.h"
+#include "sylar/http2/http2_server.h"
+
+namespace sylar {
+namespace grpc {
+
+/**
+ * @brief 服务端的一次 gRPC 调用
+ * @details 请求消息由处理协程通过 recv 逐条读取, 应答消息通过 send 发送,
+ *          处理函数返回后以返回值作为 grpc-status 发送 trailers。
+ *          请求带有 grpc-timeout 时, 到达截止时间后直接以 DEADLINE_EXCEEDED
+ *          结束调用, 之后的 recv 和 send 都会失败
+ */
+class GrpcCall : public std::enable_shared_from_this<GrpcCall> {
+ public:
+  typedef std::shared_ptr<GrpcCall> ptr;
+  typedef sylar::Mutex MutexType;
+
+  GrpcCall(http2::Http2Stream::ptr session, http2::Stream::ptr stream);
+  ~GrpcCall();
+
+  /**
+   * @brief 按照 grpc-timeout 设置截止时间
+   */
+  void start();
+
+  /**
+   * @brief 读取一条请求消息
+   * @return 1 成功, 0 客户端已发送完毕, -1 调用已取消或者消息格式错误
+   */
+  int32_t recv(google::protobuf::Message& message);
+
+  /**
+   * @brief 发送一条应答消息, 第一次发送时先发送应答头部
+   * @details 已提交未发出的数据超过对端的流窗口时挂起, 直到对端读取
+   */
+  bool send(const google::protobuf::Message& message);
+
+  /**
+   * @brief 结束调用, 发送 grpc-status 和 getError(), 只有第一次调用有效
+   */
+  void finish(int32_t status);
+
+  /**
+   * @brief 添加应答头部, 在第一次 send 之前有效
+   */
+  void addMetadata(const std::string& key, const std::string& value);
+
+  http::HttpRequest::ptr getRequest() const { return m_request; }
+  const std::string& getPath() const { return m_request->getPath(); }
+  uint32_t getId() const { return m_stream->getId(); }
+
+  /**
+   * @brief 截止时间(GetCurrentMS), 0 表示没有
+   */
+  uint64_t getDeadline() const { return m_deadline; }
+
+  /**
+   * @brief 剩余的时间(毫秒), 用于向下游调用传递, 没有截止时间时返回 -1
+   */
+  int64_t getTimeout() const;
+
+  bool isCancelled() const { return m_stream->isCancelled(); }
+  bool isDeadlineExceeded() const { return m_deadlineExceeded; }
+  bool isFinished() const { return m_finished; }
+
+  const std::string& getError() const { return m_error; }
+  void setError(const std::string& v) { m_error = v; }
+
+ private:
+  void onDeadline();
+  void finish(int32_t status, const std::string& message);
+  std::vector<std::pair<std::string, std::string>> responseHeaders();
+
+ private:
+  http2::Http2Stream::ptr m_session;
+  http2::Stream::ptr m_stream;
+  http::HttpRequest::ptr m_request;
+  GrpcMessageDecoder m_decoder;
+
+  MutexType m_mutex;
+  bool m_headersSent = false;
+  bool m_finished = false;
+  std::vector<std::pair<std::string, std::string>> m_metadata;
+  std::string m_error;
+
+  uint64_t m_deadline = 0;
+  std::atomic<bool> m_deadlineExceeded = {false};
+  Timer::ptr m_timer;
+};
+
+/**
+ * @brief gRPC 服务器, 基于 Http2Server
+ * @details 按 :path (/package.Service/Method) 注册方法, 每个调用在 worker
+ *          中以独立的协程处理。content-type 不是 application/grpc 的请求
+ *          仍然交给 ServletDispatch
+ */
+class GrpcServer : public http2::Http2Server {
+ public:
+  typedef std::shared_ptr<GrpcServer> ptr;
+  typedef sylar::RWMutex RWMutexType;
+  typedef std::function<int32_t(GrpcCall::ptr call)> CallHandler;
+
+  enum class MethodType {
+    UNARY = 0,
+    CLIENT_STREAMING = 1,
+    SERVER_STREAMING = 2,
+    BIDI_STREAMING = 3,
+  };
+
+  GrpcServer(sylar::IOManager* worker = sylar::IOManager::GetThis(),
+             sylar::IOManager* io_worker = sylar::IOManager::GetThis(),
+             sylar::IOManager* accept_worker = sylar::IOManager::GetThis());
+
+  /**
+   * @brief 注册方法, 处理函数的返回值为 grpc-status
+   */
+  void addMethod(const std::string& service, const std::string& method,
+                 MethodType type, CallHandler cb);
+  void delMethod(const std::string& service, const std::string& method);
+
+  /**
+   * @brief 一元调用: 一条请求, 一条应答
+   */
+  template <class Req, class Rsp>
+  void addUnary(const std::string& service, const std::string& method,
+                std::function<int32_t(GrpcCall::ptr, const Req&, Rsp&)> cb) {
+    addMethod(service, method, MethodType::UNARY, [cb](GrpcCall::ptr call) {
+      Req req;
+      int32_t rt = RecvOne(call, req);
+      if (rt) {
+        return rt;
+      }
+      Rsp rsp;
+      rt = cb(call, req, rsp);
+      if (rt == 0 && !call->send(rsp)) {
+        return (int32_t)GrpcStatus::CANCELLED;
+      }
+      return rt;
+    });
+  }
+
+  /**
+   * @brief 客户端流: 处理函数通过 call->recv 读取请求, 返回一条应答
+   */
+  template <class Rsp>
+  void addClientStreaming(const std::string& service, const std::string& method,
+                          std::function<int32_t(GrpcCall::ptr, Rsp&)> cb) {
+    addMethod(service, method, MethodType::CLIENT_STREAMING,
+              [cb](GrpcCall::ptr call) {
+                Rsp rsp;
+                int32_t rt = cb(call, rsp);
+                if (rt == 0 && !call->send(rsp)) {
+                  return (int32_t)GrpcStatus::CANCELLED;
+                }
+                return rt;
+              });
+  }
+
+  /**
+   * @brief 服务端流: 一条请求, 处理函数通过 call->send 发送多条应答
+   */
+  template <class Req>
+  void addServerStreaming(
+      const std::string& service, const std::string& method,
+      std::function<int32_t(GrpcCall::ptr, const Req&)> cb) {
+    addMethod(service, method, MethodType::SERVER_STREAMING,
+              [cb](GrpcCall::ptr call) {
+                Req req;
+                int32_t rt = RecvOne(call, req);
+                if (rt) {
+                  return rt;
+                }
+                return cb(call, req);
+              });
+  }
+
+  /**
+   * @brief 双向流: 处理函数自行 recv 和 send
+   */
+  void addBidiStreaming(const std::string& service, const std::string& method,
+                        CallHandler cb) {
+    addMethod(service, method, MethodType::BIDI_STREAMING, cb);
+  }
+
+ protected:
+  virtual bool handleStream(http2::Http2Stream::ptr session,
+                            http2::Stream::ptr stream) override;
+
+ private:
+  struct Method {
+    typedef std::shared_ptr<Method> ptr;
+    MethodType type;
+    CallHandler cb;
+  };
+
+  Method::ptr getMethod(const std::string& path);
+  void handleCall(GrpcCall::ptr call, http2::Http2Stream::ptr session,
+                  Method::ptr method);
+
+  /**
+   * @brief 读取一元请求
+   * @return 0 成功, 否则为 grpc-status
+   */
+  static int32_t RecvOne(GrpcCall::ptr call,
+                         google::protobuf::Message& message);
+
+ private:
+  RWMutexType m_mutex;
+  std::unordered_map<std::string, Method::ptr> m_methods;
+};
+
+}  // namespace grpc
+}  // namespace sylar
+
+#endif
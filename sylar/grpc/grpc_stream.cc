@@ -1,5 +1,7 @@
 #include "grpc_stream.h"
 #include <sstream>
+#include "sylar/config.h"
+#include "sylar/endian.h"
 #include "sylar/log.h"
 
 namespace sylar {
@@ -7,6 +9,120 @@ namespace grpc {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_grpc_max_message_size =
+    sylar::Config::Lookup("grpc.max_message_size",
+                          (uint32_t)(1024 * 1024 * 4),
+                          "grpc max message size");
+
+static uint32_t s_grpc_max_message_size = 0;
+
+namespace {
+
+struct _GrpcIniter {
+  _GrpcIniter() {
+    s_grpc_max_message_size = g_grpc_max_message_size->getValue();
+    g_grpc_max_message_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_grpc_max_message_size = nv;
+        });
+  }
+};
+
+static _GrpcIniter s_init;
+
+}  // namespace
+
+bool GrpcEncodeMessage(const google::protobuf::Message& message,
+                       std::string& out) {
+  size_t size = message.ByteSizeLong();
+  if (size > 0xFFFFFFFFu) {
+    return false;
+  }
+  size_t pos = out.size();
+  out.resize(pos + GRPC_MESSAGE_PREFIX_SIZE + size);
+  uint8_t* ptr = (uint8_t*)&out[pos];
+  uint32_t length = sylar::byteswapOnLittleEndian((uint32_t)size);
+  ptr[0] = 0;
+  memcpy(ptr + 1, &length, sizeof(length));
+  message.SerializeWithCachedSizesToArray(ptr + GRPC_MESSAGE_PREFIX_SIZE);
+  return true;
+}
+
+int64_t GrpcParseTimeout(const std::string& v) {
+  // 最多 8 位数字加一个单位
+  if (v.size() < 2 || v.size() > 9) {
+    return -1;
+  }
+  int64_t n = 0;
+  for (size_t i = 0; i + 1 < v.size(); ++i) {
+    if (v[i] < '0' || v[i] > '9') {
+      return -1;
+    }
+    n = n * 10 + v[i] - '0';
+  }
+  switch (v.back()) {
+    case 'H':
+      return n * 3600 * 1000;
+    case 'M':
+      return n * 60 * 1000;
+    case 'S':
+      return n * 1000;
+    case 'm':
+      return n;
+    case 'u':
+      return (n + 999) / 1000;
+    case 'n':
+      return (n + 999999) / 1000000;
+    default:
+      return -1;
+  }
+}
+
+std::string GrpcTimeoutToString(uint64_t timeout_ms) {
+  if (timeout_ms < 100000000) {
+    return std::to_string(timeout_ms) + "m";
+  }
+  return std::to_string(std::min(timeout_ms / 1000, (uint64_t)99999999)) +
+         "S";
+}
+
+void GrpcMessageDecoder::append(std::string&& data) {
+  if (empty()) {
+    m_buffer.swap(data);
+    m_offset = 0;
+    return;
+  }
+  // 残留的是不完整的消息, 与新数据拼接
+  if (m_offset > 0) {
+    m_buffer.erase(0, m_offset);
+    m_offset = 0;
+  }
+  m_buffer.append(data);
+}
+
+int32_t GrpcMessageDecoder::next(const char*& data, uint32_t& length) {
+  size_t size = m_buffer.size() - m_offset;
+  if (size < GRPC_MESSAGE_PREFIX_SIZE) {
+    return 0;
+  }
+  const uint8_t* ptr = (const uint8_t*)&m_buffer[m_offset];
+  uint32_t len = 0;
+  memcpy(&len, ptr + 1, sizeof(len));
+  len = sylar::byteswapOnLittleEndian(len);
+  if (ptr[0] != 0 || len > s_grpc_max_message_size) {
+    SYLAR_LOG_ERROR(g_logger) << "GrpcMessageDecoder invalid message, flag="
+                              << (uint32_t)ptr[0] << " length=" << len;
+    return -1;
+  }
+  if (size < GRPC_MESSAGE_PREFIX_SIZE + len) {
+    return 0;
+  }
+  data = (const char*)ptr + GRPC_MESSAGE_PREFIX_SIZE;
+  length = len;
+  m_offset += GRPC_MESSAGE_PREFIX_SIZE + len;
+  return 1;
+}
+
 std::string GrpcRequest::toString() const {
   std::stringstream ss;
   ss << "[GrpcRequest request=" << m_request << " data=" << m_data << "]";
@@ -24,6 +140,12 @@ GrpcResponse::ptr GrpcConnection::request(GrpcRequest::ptr req,
                                           uint64_t timeout_ms) {
   auto http_req = req->getRequest();
   auto grpc_data = req->getData();
+  http_req->setHeader("content-type", "application/grpc");
+  http_req->setHeader("te", "trailers");
+  if (timeout_ms) {
+    // 服务端按照 grpc-timeout 设置截止时间
+    http_req->setHeader("grpc-timeout", GrpcTimeoutToString(timeout_ms));
+  }
   std::string data;
   data.resize(grpc_data->data.size() + 5);
   sylar::ByteArray::ptr ba(new sylar::ByteArray(&data[0], data.size()));
@@ -43,14 +165,17 @@ GrpcResponse::ptr GrpcConnection::request(GrpcRequest::ptr req,
     rsp->setError(result->response->getHeader("grpc-message"));
 
     auto& body = result->response->getBody();
-    sylar::ByteArray::ptr ba(
-        new sylar::ByteArray((void*)&body[0], body.size()));
-    GrpcMessage::ptr msg = std::make_shared<GrpcMessage>();
-    rsp->setData(msg);
-
-    msg->compressed = ba->readFuint8();
-    msg->length = ba->readFuint32();
-    msg->data = ba->toString();
+    if (body.size() >= GRPC_MESSAGE_PREFIX_SIZE) {
+      // 失败时可能只有 trailers 没有消息
+      sylar::ByteArray::ptr ba(
+          new sylar::ByteArray((void*)&body[0], body.size()));
+      GrpcMessage::ptr msg = std::make_shared<GrpcMessage>();
+      rsp->setData(msg);
+
+      msg->compressed = ba->readFuint8();
+      msg->length = ba->readFuint32();
+      msg->data = ba->toString();
+    }
   }
   return rsp;
 }
@@ -75,7 +200,6 @@ GrpcResponse::ptr GrpcConnection::request(
     rsp->setError("pb SerializeToString fail");
     return rsp;
   }
-  msg->compressed = msg->data.size();
   grpc_req->setData(msg);
   return request(grpc_req, timeout_ms);
 }
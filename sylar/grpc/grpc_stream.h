@@ -7,6 +7,78 @@
 namespace sylar {
 namespace grpc {
 
+// https://github.com/grpc/grpc/blob/master/doc/statuscodes.md
+enum class GrpcStatus {
+  OK = 0,
+  CANCELLED = 1,
+  UNKNOWN = 2,
+  INVALID_ARGUMENT = 3,
+  DEADLINE_EXCEEDED = 4,
+  NOT_FOUND = 5,
+  ALREADY_EXISTS = 6,
+  PERMISSION_DENIED = 7,
+  RESOURCE_EXHAUSTED = 8,
+  FAILED_PRECONDITION = 9,
+  ABORTED = 10,
+  OUT_OF_RANGE = 11,
+  UNIMPLEMENTED = 12,
+  INTERNAL = 13,
+  UNAVAILABLE = 14,
+  DATA_LOSS = 15,
+  UNAUTHENTICATED = 16,
+};
+
+/**
+ * @brief 消息前缀的长度: 1 字节压缩标志 + 4 字节大端长度
+ */
+static const uint32_t GRPC_MESSAGE_PREFIX_SIZE = 5;
+
+/**
+ * @brief 把 message 编码为带长度前缀的 gRPC 消息追加到 out,
+ *        直接序列化到 out 的内存中, 不经过中间字符串
+ */
+bool GrpcEncodeMessage(const google::protobuf::Message& message,
+                       std::string& out);
+
+/**
+ * @brief 解析 grpc-timeout 头部, 如 "100m", "5S"
+ * @return 超时时间(毫秒), 没有或者格式错误时返回 -1
+ */
+int64_t GrpcParseTimeout(const std::string& v);
+
+/**
+ * @brief 生成 grpc-timeout 头部
+ */
+std::string GrpcTimeoutToString(uint64_t timeout_ms);
+
+/**
+ * @brief gRPC 消息的解码器, 输入任意切分的 DATA 数据, 依次取出完整的消息
+ * @details 数据块中的完整消息直接在原数据上解析, 只有跨越数据块的消息才拷贝
+ */
+class GrpcMessageDecoder {
+ public:
+  /**
+   * @brief 追加一块数据, 之前的数据已经全部取出时直接接管 data 的内存
+   */
+  void append(std::string&& data);
+
+  /**
+   * @brief 取出下一条消息, data 在下一次 append 之前有效
+   * @return 1 取出消息, 0 数据不完整, -1 压缩的消息或者消息超过
+   *         grpc.max_message_size
+   */
+  int32_t next(const char*& data, uint32_t& length);
+
+  /**
+   * @brief 是否没有残留的不完整消息
+   */
+  bool empty() const { return m_offset == m_buffer.size(); }
+
+ private:
+  std::string m_buffer;
+  size_t m_offset = 0;
+};
+
 struct GrpcMessage {
   typedef std::shared_ptr<GrpcMessage> ptr;
 
@@ -0,0 +1,398 @@
+#include "async_http_connection.h"
+#include <string.h>
+#include "http_compress.h"
+#include "http_parser.h"
+#include "sylar/log.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+HttpResult::ptr AsyncHttpConnection::HttpCtx::toResult() {
+  int code = (int)HttpResult::Error::OK;
+  switch ((int32_t)result) {
+    case OK:
+      break;
+    case TIMEOUT:
+      code = (int)HttpResult::Error::TIMEOUT;
+      break;
+    case NOT_CONNECT:
+      code = (int)HttpResult::Error::CONNECT_FAIL;
+      break;
+    case DECODE_ERROR:
+      code = (int)HttpResult::Error::DECODE_ERROR;
+      break;
+    default:
+      code = (int)HttpResult::Error::SEND_SOCKET_ERROR;
+      break;
+  }
+  return std::make_shared<HttpResult>(code, response, resultStr);
+}
+
+bool AsyncHttpConnection::HttpCtx::doSend(AsyncSocketStream::ptr stream) {
+  auto conn = std::static_pointer_cast<AsyncHttpConnection>(stream);
+  if (!conn->getCtx(sn)) {
+    // 入队后已超时, 不必再发送
+    return true;
+  }
+  {
+    Spinlock::Lock lock(conn->m_inflightMutex);
+    conn->m_inflight.push_back(
+        std::make_pair(sn, request->getMethod() == HttpMethod::HEAD));
+  }
+  std::string data = request->toString();
+  return stream->writeFixSize(data.c_str(), data.size()) > 0;
+}
+
+void AsyncHttpConnection::HttpCtx::doRsp() {
+  if (!cb) {
+    Ctx::doRsp();
+    return;
+  }
+  bool expected = false;
+  if (!done.compare_exchange_strong(expected, true)) {
+    return;
+  }
+  if (timed) {
+    result = TIMEOUT;
+    resultStr = "timeout";
+  }
+  auto rt = toResult();
+  auto fn = cb;
+  if (worker) {
+    worker->schedule([fn, rt]() { fn(rt); });
+  } else {
+    fn(rt);
+  }
+}
+
+AsyncHttpConnection::ptr AsyncHttpConnection::Create(const std::string& url,
+                                                      bool auto_connect) {
+  Uri::ptr uri = Uri::Create(url);
+  if (!uri) {
+    SYLAR_LOG_ERROR(g_logger) << "invalid url=" << url;
+    return nullptr;
+  }
+  Address::ptr addr = uri->createAddress();
+  if (!addr) {
+    SYLAR_LOG_ERROR(g_logger) << "invalid host=" << uri->getHost();
+    return nullptr;
+  }
+  auto conn = std::make_shared<AsyncHttpConnection>();
+  conn->setHost(uri->getHost());
+  conn->setAutoConnect(auto_connect);
+  if (!conn->connect(addr, uri->getScheme() == "https")) {
+    SYLAR_LOG_ERROR(g_logger) << "connect fail: " << *addr;
+    if (!auto_connect) {
+      return nullptr;
+    }
+  }
+  conn->start();
+  return conn;
+}
+
+std::vector<HttpResult::ptr> AsyncHttpConnection::DoRequestAll(
+    const std::vector<std::pair<AsyncHttpConnection::ptr, HttpRequest::ptr>>&
+        reqs,
+    uint64_t timeout_ms) {
+  struct Gather {
+    std::vector<HttpResult::ptr> results;
+    std::atomic<size_t> left;
+    FiberSemaphore sem;
+  };
+  if (reqs.empty()) {
+    return {};
+  }
+  auto g = std::make_shared<Gather>();
+  g->results.resize(reqs.size());
+  g->left = reqs.size();
+  for (size_t i = 0; i < reqs.size(); ++i) {
+    auto cb = [g, i](HttpResult::ptr rt) {
+      g->results[i] = rt;
+      if (--g->left == 0) {
+        g->sem.notify();
+      }
+    };
+    if (!reqs[i].first) {
+      cb(std::make_shared<HttpResult>((int)HttpResult::Error::CONNECT_FAIL,
+                                      nullptr, "null connection"));
+      continue;
+    }
+    reqs[i].first->request(reqs[i].second, timeout_ms, cb);
+  }
+  g->sem.wait();
+  return g->results;
+}
+
+AsyncHttpConnection::AsyncHttpConnection(Socket::ptr sock)
+    : AsyncSocketStream(sock, true) {
+  m_bufferSize = HttpResponseParser::GetHttpResponseBufferSize();
+  m_buffer = new char[m_bufferSize + 1];
+  m_buffer[0] = '\0';
+}
+
+AsyncHttpConnection::~AsyncHttpConnection() {
+  SYLAR_LOG_DEBUG(g_logger) << "AsyncHttpConnection::~AsyncHttpConnection "
+                            << this;
+  delete[] m_buffer;
+}
+
+bool AsyncHttpConnection::connect(Address::ptr addr, bool is_https) {
+  m_socket = is_https ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+  return m_socket->connect(addr);
+}
+
+size_t AsyncHttpConnection::getInflightCount() {
+  Spinlock::Lock lock(m_inflightMutex);
+  return m_inflight.size();
+}
+
+AsyncHttpConnection::HttpCtx::ptr AsyncHttpConnection::prepare(
+    HttpRequest::ptr req, uint64_t timeout_ms) {
+  // 流水线要求连接保持
+  req->setClose(false);
+  if (req->getHeader("Host").empty() && !m_host.empty()) {
+    req->setHeader("Host", m_host);
+  }
+  if (req->getHeader("Accept-Encoding").empty()) {
+    std::string accept_encoding = HttpCompress::GetClientAcceptEncoding();
+    if (!accept_encoding.empty()) {
+      req->setHeader("Accept-Encoding", accept_encoding);
+    }
+  }
+  HttpCtx::ptr ctx = std::make_shared<HttpCtx>();
+  ctx->request = req;
+  ctx->sn = sylar::Atomic::addFetch(m_sn);
+  ctx->timeout = timeout_ms;
+  ctx->startTime = sylar::GetCurrentMS();
+  return ctx;
+}
+
+HttpResult::ptr AsyncHttpConnection::request(HttpRequest::ptr req,
+                                             uint64_t timeout_ms) {
+  if (!isConnected()) {
+    return std::make_shared<HttpResult>(
+        (int)HttpResult::Error::CONNECT_FAIL, nullptr,
+        "not_connect " + getRemoteAddressString());
+  }
+  HttpCtx::ptr ctx = prepare(req, timeout_ms);
+  ctx->scheduler = sylar::Scheduler::GetThis();
+  ctx->fiber = sylar::Fiber::GetThis();
+  if (!addCtx(ctx)) {
+    ctx->result = DUPLICATE_SN;
+    ctx->resultStr = "duplicate_sn " + std::to_string(ctx->sn);
+    return ctx->toResult();
+  }
+  enqueue(ctx);
+  sylar::Fiber::YieldToHold();
+  return ctx->toResult();
+}
+
+bool AsyncHttpConnection::request(HttpRequest::ptr req, uint64_t timeout_ms,
+                                  callback cb) {
+  if (!isConnected()) {
+    cb(std::make_shared<HttpResult>((int)HttpResult::Error::CONNECT_FAIL,
+                                    nullptr,
+                                    "not_connect " + getRemoteAddressString()));
+    return false;
+  }
+  HttpCtx::ptr ctx = prepare(req, timeout_ms);
+  ctx->cb = cb;
+  ctx->worker = m_worker ? m_worker : sylar::IOManager::GetThis();
+  if (!addCtx(ctx)) {
+    ctx->result = DUPLICATE_SN;
+    ctx->resultStr = "duplicate_sn " + std::to_string(ctx->sn);
+    ctx->doRsp();
+    return false;
+  }
+  enqueue(ctx);
+  return true;
+}
+
+std::vector<HttpResult::ptr> AsyncHttpConnection::requestAll(
+    const std::vector<HttpRequest::ptr>& reqs, uint64_t timeout_ms) {
+  std::vector<std::pair<AsyncHttpConnection::ptr, HttpRequest::ptr>> items;
+  auto self = std::static_pointer_cast<AsyncHttpConnection>(shared_from_this());
+  for (auto& i : reqs) {
+    items.push_back(std::make_pair(self, i));
+  }
+  return DoRequestAll(items, timeout_ms);
+}
+
+void AsyncHttpConnection::startRead() {
+  // 读写协程都已退出, 丢弃上一条连接遗留的状态
+  {
+    Spinlock::Lock lock(m_inflightMutex);
+    m_inflight.clear();
+  }
+  m_bufferLen = 0;
+  AsyncSocketStream::startRead();
+}
+
+AsyncSocketStream::Ctx::ptr AsyncHttpConnection::doRecv() {
+  auto rsp = recvResponse();
+  if (!rsp) {
+    innerClose();
+    return nullptr;
+  }
+  uint32_t sn = 0;
+  {
+    Spinlock::Lock lock(m_inflightMutex);
+    if (m_inflight.empty()) {
+      lock.unlock();
+      SYLAR_LOG_WARN(g_logger) << "AsyncHttpConnection unexpected response: "
+                               << getRemoteAddressString();
+      innerClose();
+      return nullptr;
+    }
+    sn = m_inflight.front().first;
+    m_inflight.pop_front();
+  }
+  HttpCtx::ptr ctx = getAndDelCtxAs<HttpCtx>(sn);
+  if (!ctx) {
+    SYLAR_LOG_WARN(g_logger)
+        << "AsyncHttpConnection request timeout sn=" << sn
+        << " server=" << getRemoteAddressString();
+    return nullptr;
+  }
+  // 超时的请求不必解压, 解压后同样受 http.response.max_body_size 限制
+  if (!HttpCompress::DecompressResponse(
+          rsp, HttpResponseParser::GetHttpResponseMaxBodySize())) {
+    ctx->result = DECODE_ERROR;
+    ctx->resultStr = "decode response body fail: " +
+                     getRemoteAddressString() + " content_encoding:" +
+                     rsp->getHeader("Content-Encoding");
+    return ctx;
+  }
+  ctx->result = OK;
+  ctx->resultStr = "ok";
+  ctx->response = rsp;
+  return ctx;
+}
+
+bool AsyncHttpConnection::fill() {
+  if (m_bufferLen >= m_bufferSize) {
+    return false;
+  }
+  int rt = read(m_buffer + m_bufferLen, m_bufferSize - m_bufferLen);
+  if (rt <= 0) {
+    return false;
+  }
+  m_bufferLen += rt;
+  m_buffer[m_bufferLen] = '\0';
+  return true;
+}
+
+void AsyncHttpConnection::consume(size_t len) {
+  memmove(m_buffer, m_buffer + len, m_bufferLen - len);
+  m_bufferLen -= len;
+  m_buffer[m_bufferLen] = '\0';
+}
+
+bool AsyncHttpConnection::readBody(std::string& body, uint64_t length) {
+  while (length > 0) {
+    if (m_bufferLen == 0) {
+      if (length >= m_bufferSize) {
+        // 大块数据直接读入 body, 不经过缓冲区
+        size_t offset = body.size();
+        body.resize(offset + length);
+        return readFixSize(&body[offset], length) > 0;
+      }
+      if (!fill()) {
+        return false;
+      }
+    }
+    size_t len = std::min<uint64_t>(length, m_bufferLen);
+    body.append(m_buffer, len);
+    consume(len);
+    length -= len;
+  }
+  return true;
+}
+
+HttpResponse::ptr AsyncHttpConnection::recvResponse() {
+  HttpResponseParser::ptr parser = std::make_shared<HttpResponseParser>();
+  while (true) {
+    if (m_bufferLen > 0) {
+      size_t nparse = parser->execute(m_buffer, m_bufferLen, false);
+      m_bufferLen -= nparse;
+      m_buffer[m_bufferLen] = '\0';
+      if (parser->hasError()) {
+        return nullptr;
+      }
+      if (parser->isFinished()) {
+        break;
+      }
+    }
+    if (!fill()) {
+      return nullptr;
+    }
+  }
+
+  HttpResponse::ptr rsp = parser->getData();
+  int status = (int)rsp->getStatus();
+  if (status / 100 == 1) {
+    // 1xx 是中间响应, 不对应请求
+    return recvResponse();
+  }
+  bool head = false;
+  {
+    Spinlock::Lock lock(m_inflightMutex);
+    if (!m_inflight.empty()) {
+      head = m_inflight.front().second;
+    }
+  }
+
+  uint64_t max_body = HttpResponseParser::GetHttpResponseMaxBodySize();
+  auto& client_parser = parser->getParser();
+  std::string body;
+  if (head || status == 204 || status == 304) {
+    // 没有 body
+  } else if (client_parser.chunked) {
+    do {
+      // 等到完整的 chunk 头再解析, 避免半行被解析器吞掉
+      while (!memmem(m_buffer, m_bufferLen, "\r\n", 2)) {
+        if (!fill()) {
+          return nullptr;
+        }
+      }
+      size_t nparse = parser->execute(m_buffer, m_bufferLen, true);
+      m_bufferLen -= nparse;
+      m_buffer[m_bufferLen] = '\0';
+      if (parser->hasError() || !parser->isFinished()) {
+        return nullptr;
+      }
+      if (body.size() + client_parser.content_len > max_body) {
+        return nullptr;
+      }
+      // chunk 数据及其后的 CRLF
+      if (!readBody(body, client_parser.content_len + 2)) {
+        return nullptr;
+      }
+      body.resize(body.size() - 2);
+    } while (!client_parser.chunks_done);
+  } else if (!rsp->getHeader("content-length").empty()) {
+    uint64_t length = parser->getContentLength();
+    if (length > max_body || !readBody(body, length)) {
+      return nullptr;
+    }
+  } else {
+    // 没有长度信息, body 到连接关闭为止
+    while (true) {
+      body.append(m_buffer, m_bufferLen);
+      m_bufferLen = 0;
+      if (body.size() > max_body || !fill()) {
+        break;
+      }
+    }
+  }
+  if (!body.empty()) {
+    rsp->setBody(body);
+  }
+  rsp->initConnection();
+  return rsp;
+}
+
+}  // namespace http
+}  // namespace sylar
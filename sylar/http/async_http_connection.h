@@ -0,0 +1,120 @@
+#ifndef __SYLAR_HTTP_ASYNC_HTTP_CONNECTION_H__
+#define __SYLAR_HTTP_ASYNC_HTTP_CONNECTION_H__
+
+#include <deque>
+#include "http_connection.h"
+#include "sylar/streams/async_socket_stream.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 异步 HTTP/1.1 客户端连接
+ * @details 基于 AsyncSocketStream 的发送队列和 ctx 表实现:
+ *          请求由写协程按入队顺序发出, 同一条 keep-alive 连接上可以同时
+ *          有多个未完成的请求(pipelining); 读协程按发送顺序把响应交给
+ *          对应的请求。每个请求有独立的超时定时器, 超时后其响应到达时被丢弃。
+ *          注意 HTTP/1.1 的响应严格按序返回, 慢请求会阻塞其后的请求
+ */
+class AsyncHttpConnection : public AsyncSocketStream {
+ public:
+  typedef std::shared_ptr<AsyncHttpConnection> ptr;
+  typedef std::function<void(HttpResult::ptr)> callback;
+
+  /**
+   * @brief 根据 url 创建连接并启动读写协程, 需要在 IOManager 中调用
+   * @param[in] auto_connect 断开后是否自动重连
+   */
+  static AsyncHttpConnection::ptr Create(const std::string& url,
+                                         bool auto_connect = true);
+
+  /**
+   * @brief 并发发出一组请求, 全部完成(或超时)后一次性返回
+   * @details 每个请求可以发往不同的连接, 同一连接上的请求会被流水线化。
+   *          返回结果与 reqs 一一对应
+   */
+  static std::vector<HttpResult::ptr> DoRequestAll(
+      const std::vector<std::pair<AsyncHttpConnection::ptr, HttpRequest::ptr>>&
+          reqs,
+      uint64_t timeout_ms);
+
+  AsyncHttpConnection(Socket::ptr sock = nullptr);
+  ~AsyncHttpConnection();
+
+  bool connect(Address::ptr addr, bool is_https = false);
+
+  /**
+   * @brief 发送请求并挂起当前协程直到收到响应或超时
+   */
+  HttpResult::ptr request(HttpRequest::ptr req, uint64_t timeout_ms);
+
+  /**
+   * @brief 异步发送请求, 结果在 worker 中回调
+   * @return 是否成功入队, 失败时 cb 已经以错误结果被调用
+   */
+  bool request(HttpRequest::ptr req, uint64_t timeout_ms, callback cb);
+
+  /**
+   * @brief 在本连接上流水线发送一组请求, 全部完成后返回
+   */
+  std::vector<HttpResult::ptr> requestAll(
+      const std::vector<HttpRequest::ptr>& reqs, uint64_t timeout_ms);
+
+  /**
+   * @brief 请求未带 Host 头时使用的默认值
+   */
+  const std::string& getHost() const { return m_host; }
+  void setHost(const std::string& v) { m_host = v; }
+
+  /**
+   * @brief 已发出但尚未收到响应的请求数
+   */
+  size_t getInflightCount();
+
+ protected:
+  /// 响应体解压失败, 与 AsyncSocketStream::Error 并列使用
+  static const int32_t DECODE_ERROR = -100;
+
+  struct HttpCtx : public Ctx {
+    typedef std::shared_ptr<HttpCtx> ptr;
+    HttpRequest::ptr request;
+    HttpResponse::ptr response;
+    uint64_t startTime = 0;
+
+    // 异步请求的回调及其执行的调度器
+    callback cb;
+    IOManager* worker = nullptr;
+    std::atomic<bool> done = {false};
+
+    HttpResult::ptr toResult();
+    virtual bool doSend(AsyncSocketStream::ptr stream) override;
+    virtual void doRsp() override;
+  };
+
+  virtual Ctx::ptr doRecv() override;
+  virtual void startRead() override;
+
+ private:
+  HttpCtx::ptr prepare(HttpRequest::ptr req, uint64_t timeout_ms);
+  HttpResponse::ptr recvResponse();
+  bool fill();
+  void consume(size_t len);
+  bool readBody(std::string& body, uint64_t length);
+
+ private:
+  std::string m_host;
+
+  // 已发出的请求, 按发送顺序与响应对应. first: sn, second: 是否 HEAD 请求
+  Spinlock m_inflightMutex;
+  std::deque<std::pair<uint32_t, bool>> m_inflight;
+
+  // 跨响应保留的接收缓冲区, 流水线下一次 read 可能带有后续响应的数据
+  char* m_buffer = nullptr;
+  size_t m_bufferSize = 0;
+  size_t m_bufferLen = 0;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
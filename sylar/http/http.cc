@@ -122,6 +122,12 @@ std::string HttpRequest::getCookie(const std::string& key,
   return it == m_cookies.end() ? def : it->second;
 }
 
+std::string HttpRequest::getRouteParam(const std::string& key,
+                                       const std::string& def) const {
+  auto it = m_routeParams.find(key);
+  return it == m_routeParams.end() ? def : it->second;
+}
+
 void HttpRequest::setHeader(const std::string& key, const std::string& val) {
   m_headers[key] = val;
 }
@@ -134,6 +140,11 @@ void HttpRequest::setCookie(const std::string& key, const std::string& val) {
   m_cookies[key] = val;
 }
 
+void HttpRequest::setRouteParam(const std::string& key,
+                                const std::string& val) {
+  m_routeParams[key] = val;
+}
+
 void HttpRequest::delHeader(const std::string& key) {
   m_headers.erase(key);
 }
@@ -199,6 +199,7 @@ class HttpRequest {
   const MapType& getHeaders() const { return m_headers; }
   const MapType& getParams() const { return m_params; }
   const MapType& getCookies() const { return m_cookies; }
+  const MapType& getRouteParams() const { return m_routeParams; }
 
   void setMethod(HttpMethod v) { m_method = v; }
   void setVersion(uint8_t v) { m_version = v; }
@@ -218,15 +219,19 @@ class HttpRequest {
 
   void setParams(const MapType& v) { m_params = v; }
   void setCookies(const MapType& v) { m_cookies = v; }
+  void setRouteParams(const MapType& v) { m_routeParams = v; }
 
   std::string getHeader(const std::string& key,
                         const std::string& def = "") const;
   std::string getParam(const std::string& key, const std::string& def = "");
   std::string getCookie(const std::string& key, const std::string& def = "");
+  std::string getRouteParam(const std::string& key,
+                            const std::string& def = "") const;
 
   void setHeader(const std::string& key, const std::string& val);
   void setParam(const std::string& key, const std::string& val);
   void setCookie(const std::string& key, const std::string& val);
+  void setRouteParam(const std::string& key, const std::string& val);
 
   void delHeader(const std::string& key);
   void delParam(const std::string& key);
@@ -260,6 +265,11 @@ class HttpRequest {
     return getAs(m_params, key, def);
   }
 
+  template <class T>
+  T getRouteParamAs(const std::string& key, const T& def = T()) {
+    return getAs(m_routeParams, key, def);
+  }
+
   template <class T>
   bool checkGetCookieAs(const std::string& key, T& val, const T& def = T()) {
     initCookies();
@@ -307,6 +317,8 @@ class HttpRequest {
   MapType m_params;
   /// 请求Cookie MAP
   MapType m_cookies;
+  /// 路由捕获的参数MAP, 如 /user/:id 中的 id
+  MapType m_routeParams;
 };
 
 class HttpResponse {
@@ -322,6 +334,7 @@ class HttpResponse {
   const std::string& getBody() const { return m_body; }
   const std::string& getReason() const { return m_reason; }
   const MapType& getHeaders() const { return m_headers; }
+  const std::vector<std::string>& getCookies() const { return m_cookies; }
 
   void setStatus(HttpStatus v) { m_status = v; }
   void setVersion(uint8_t v) { m_version = v; }
@@ -0,0 +1,362 @@
+#include "http_compress.h"
+#include <algorithm>
+#include "sylar/config.h"
+#include "sylar/ds/lru_cache.h"
+#include "sylar/log.h"
+#include "sylar/streams/zlib_stream.h"
+#include "sylar/util.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_http_compress_enable =
+    sylar::Config::Lookup("http.compress.enable", true,
+                          "http response compress enable");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_min_size =
+    sylar::Config::Lookup("http.compress.min_size", (uint64_t)1024,
+                          "http response compress min body size");
+
+static sylar::ConfigVar<int32_t>::ptr g_http_compress_level =
+    sylar::Config::Lookup("http.compress.level", (int32_t)6,
+                          "http response compress level");
+
+static sylar::ConfigVar<std::vector<std::string>>::ptr g_http_compress_types =
+    sylar::Config::Lookup(
+        "http.compress.types",
+        std::vector<std::string>{"text/", "application/json",
+                                 "application/javascript", "application/xml",
+                                 "image/svg+xml"},
+        "http response compress content types");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_cache_size =
+    sylar::Config::Lookup("http.compress.cache_size", (uint64_t)1024,
+                          "http precompressed response cache size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_cache_max_body_size =
+    sylar::Config::Lookup("http.compress.cache_max_body_size",
+                          (uint64_t)(1024 * 1024),
+                          "http precompressed response max body size");
+
+static sylar::ConfigVar<std::string>::ptr g_http_client_accept_encoding =
+    sylar::Config::Lookup("http.client.accept_encoding",
+                          std::string("gzip, deflate"),
+                          "http client accept encoding");
+
+namespace {
+
+struct CompressCacheItem {
+  typedef std::shared_ptr<CompressCacheItem> ptr;
+  // 压缩前的长度, 用于识别复用了 ETag 的不同内容
+  size_t rawSize;
+  std::string data;
+};
+
+typedef sylar::ds::LruCache<std::string, CompressCacheItem::ptr>
+    CompressCache;
+
+static bool s_enable = true;
+static uint64_t s_min_size = 0;
+static int32_t s_level = -1;
+static uint64_t s_cache_max_body_size = 0;
+static sylar::RWMutex s_types_mutex;
+static std::vector<std::string> s_types;
+static CompressCache s_cache;
+
+struct _CompressIniter {
+  _CompressIniter() {
+    s_enable = g_http_compress_enable->getValue();
+    s_min_size = g_http_compress_min_size->getValue();
+    s_level = g_http_compress_level->getValue();
+    s_types = g_http_compress_types->getValue();
+    s_cache.setMaxSize(g_http_compress_cache_size->getValue());
+    s_cache_max_body_size = g_http_compress_cache_max_body_size->getValue();
+
+    g_http_compress_enable->addListener(
+        [](const bool& ov, const bool& nv) { s_enable = nv; });
+    g_http_compress_min_size->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) { s_min_size = nv; });
+    g_http_compress_level->addListener(
+        [](const int32_t& ov, const int32_t& nv) { s_level = nv; });
+    g_http_compress_types->addListener(
+        [](const std::vector<std::string>& ov,
+           const std::vector<std::string>& nv) {
+          sylar::RWMutex::WriteLock lock(s_types_mutex);
+          s_types = nv;
+        });
+    g_http_compress_cache_size->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) {
+          s_cache.setMaxSize(nv);
+          if (nv == 0) {
+            s_cache.clear();
+          }
+        });
+    g_http_compress_cache_max_body_size->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) {
+          s_cache_max_body_size = nv;
+        });
+  }
+};
+static _CompressIniter _init;
+
+}  // namespace
+
+static bool is_compressible_type(const std::string& content_type) {
+  size_t len = content_type.find(';');
+  if (len == std::string::npos) {
+    len = content_type.size();
+  }
+  while (len > 0 && isspace(content_type[len - 1])) {
+    --len;
+  }
+  if (len == 0) {
+    return false;
+  }
+  sylar::RWMutex::ReadLock lock(s_types_mutex);
+  for (auto& i : s_types) {
+    if (i.empty()) {
+      continue;
+    }
+    if (i.back() == '/') {
+      if (len >= i.size() &&
+          strncasecmp(content_type.c_str(), i.c_str(), i.size()) == 0) {
+        return true;
+      }
+    } else if (len == i.size() &&
+               strncasecmp(content_type.c_str(), i.c_str(), len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* HttpCompress::EncodingToString(Encoding type) {
+  switch (type) {
+    case GZIP:
+      return "gzip";
+    case DEFLATE:
+      return "deflate";
+    default:
+      return "identity";
+  }
+}
+
+HttpCompress::Encoding HttpCompress::StringToEncoding(const std::string& v) {
+  std::string str = sylar::StringUtil::Trim(v);
+  if (strcasecmp(str.c_str(), "gzip") == 0 ||
+      strcasecmp(str.c_str(), "x-gzip") == 0) {
+    return GZIP;
+  }
+  if (strcasecmp(str.c_str(), "deflate") == 0) {
+    return DEFLATE;
+  }
+  return IDENTITY;
+}
+
+HttpCompress::Encoding HttpCompress::Negotiate(
+    const std::string& accept_encoding) {
+  double gzip_q = -1;
+  double deflate_q = -1;
+  double any_q = -1;
+  size_t pos = 0;
+  while (pos < accept_encoding.size()) {
+    size_t end = accept_encoding.find(',', pos);
+    if (end == std::string::npos) {
+      end = accept_encoding.size();
+    }
+    std::string item = accept_encoding.substr(pos, end - pos);
+    pos = end + 1;
+
+    double q = 1;
+    size_t semi = item.find(';');
+    if (semi != std::string::npos) {
+      std::string param = sylar::StringUtil::Trim(item.substr(semi + 1));
+      if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') &&
+          param[1] == '=') {
+        q = atof(param.c_str() + 2);
+      }
+      item.resize(semi);
+    }
+    item = sylar::StringUtil::Trim(item);
+    if (item == "*") {
+      any_q = q;
+    } else {
+      auto type = StringToEncoding(item);
+      if (type == GZIP) {
+        gzip_q = q;
+      } else if (type == DEFLATE) {
+        deflate_q = q;
+      }
+    }
+  }
+  if (gzip_q < 0) {
+    gzip_q = any_q;
+  }
+  if (deflate_q < 0) {
+    deflate_q = any_q;
+  }
+  if (gzip_q <= 0 && deflate_q <= 0) {
+    return IDENTITY;
+  }
+  return gzip_q >= deflate_q ? GZIP : DEFLATE;
+}
+
+bool HttpCompress::Compress(Encoding type, const std::string& in,
+                            std::string& out, int level) {
+  if (type == IDENTITY) {
+    return false;
+  }
+  if (level < -1 || level > 9) {
+    level = ZlibStream::DEFAULT_COMPRESSION;
+  }
+  // 文本类内容的压缩比一般在 4 倍以上, 按此估算输出块大小以减少分配次数
+  uint32_t buff_size = std::max<size_t>(
+      4096, std::min<size_t>(in.size() / 4, 256 * 1024));
+  // HTTP 的 deflate 指 zlib 格式(RFC 7230 4.2.2)
+  auto zs = ZlibStream::Create(
+      true, buff_size, type == GZIP ? ZlibStream::GZIP : ZlibStream::ZLIB,
+      level);
+  if (!zs) {
+    return false;
+  }
+  if (zs->write(in.c_str(), in.size()) != Z_OK || zs->flush() != Z_OK) {
+    return false;
+  }
+  zs->getResult().swap(out);
+  return true;
+}
+
+bool HttpCompress::Decompress(Encoding type, const std::string& in,
+                              std::string& out, size_t max_size) {
+  if (type == IDENTITY) {
+    return false;
+  }
+  ZlibStream::Type ztype = ZlibStream::GZIP;
+  if (type == DEFLATE) {
+    // 部分服务端的 deflate 不带 zlib 头, 按头部校验区分
+    ztype = ZlibStream::DEFLATE;
+    if (in.size() >= 2) {
+      uint8_t cmf = in[0];
+      uint8_t flg = in[1];
+      if ((cmf & 0x0f) == Z_DEFLATED && ((cmf << 8) | flg) % 31 == 0) {
+        ztype = ZlibStream::ZLIB;
+      }
+    }
+  }
+  size_t buff_size = in.size() * 2;
+  if (max_size) {
+    buff_size = std::min(buff_size, max_size);
+  }
+  auto zs = ZlibStream::Create(false, std::max<size_t>(4096, buff_size), ztype);
+  if (!zs) {
+    return false;
+  }
+  // 边解压边检查输出大小, 压缩炸弹不会整个解压到内存
+  zs->setMaxOutputSize(max_size);
+  if (zs->write(in.c_str(), in.size()) != Z_OK || zs->flush() != Z_OK) {
+    return false;
+  }
+  zs->getResult().swap(out);
+  return true;
+}
+
+bool HttpCompress::CompressResponse(HttpRequest::ptr req,
+                                    HttpResponse::ptr rsp) {
+  if (!s_enable || rsp->isWebsocket()) {
+    return false;
+  }
+  const std::string& body = rsp->getBody();
+  if (body.size() < s_min_size || body.size() < 32) {
+    return false;
+  }
+  if (!rsp->getHeader("Content-Encoding").empty()) {
+    return false;
+  }
+  auto status = (int)rsp->getStatus();
+  if (status < 200 || status == 204 || status == 206 || status == 304) {
+    return false;
+  }
+  if (!is_compressible_type(rsp->getHeader("Content-Type"))) {
+    return false;
+  }
+
+  std::string vary = rsp->getHeader("Vary");
+  if (vary.empty()) {
+    rsp->setHeader("Vary", "Accept-Encoding");
+  } else if (strcasestr(vary.c_str(), "accept-encoding") == nullptr) {
+    rsp->setHeader("Vary", vary + ", Accept-Encoding");
+  }
+
+  auto type = Negotiate(req->getHeader("Accept-Encoding"));
+  if (type == IDENTITY) {
+    return false;
+  }
+
+  std::string key;
+  std::string etag = rsp->getHeader("ETag");
+  if (!etag.empty() && s_cache.getMaxSize() > 0 &&
+      body.size() <= s_cache_max_body_size) {
+    key = std::string(EncodingToString(type)) + " " + req->getPath() + " " +
+          etag;
+    CompressCacheItem::ptr item;
+    if (s_cache.get(key, item) && item->rawSize == body.size()) {
+      rsp->setBody(item->data);
+      rsp->setHeader("Content-Encoding", EncodingToString(type));
+      rsp->delHeader("Content-Length");
+      return true;
+    }
+  }
+
+  std::string out;
+  if (!Compress(type, body, out, s_level)) {
+    SYLAR_LOG_WARN(g_logger)
+        << "compress response fail, path=" << req->getPath()
+        << " encoding=" << EncodingToString(type) << " size=" << body.size();
+    return false;
+  }
+  if (out.size() >= body.size()) {
+    return false;
+  }
+  if (!key.empty()) {
+    auto item = std::make_shared<CompressCacheItem>();
+    item->rawSize = body.size();
+    item->data = out;
+    s_cache.set(key, item);
+  }
+  rsp->setBody(out);
+  rsp->setHeader("Content-Encoding", EncodingToString(type));
+  rsp->delHeader("Content-Length");
+  return true;
+}
+
+bool HttpCompress::DecompressResponse(HttpResponse::ptr rsp,
+                                      size_t max_size) {
+  std::string content_encoding = rsp->getHeader("Content-Encoding");
+  if (content_encoding.empty() || rsp->getBody().empty()) {
+    return true;
+  }
+  auto type = StringToEncoding(content_encoding);
+  if (type == IDENTITY) {
+    return strcasecmp(content_encoding.c_str(), "identity") == 0;
+  }
+  std::string out;
+  if (!Decompress(type, rsp->getBody(), out, max_size)) {
+    SYLAR_LOG_WARN(g_logger)
+        << "decompress response fail, content_encoding=" << content_encoding
+        << " size=" << rsp->getBody().size() << " max_size=" << max_size;
+    return false;
+  }
+  rsp->setBody(out);
+  rsp->delHeader("Content-Encoding");
+  rsp->delHeader("Content-Length");
+  return true;
+}
+
+std::string HttpCompress::GetClientAcceptEncoding() {
+  return g_http_client_accept_encoding->getValue();
+}
+
+}  // namespace http
+}  // namespace sylar
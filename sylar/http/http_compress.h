@@ -0,0 +1,68 @@
+#ifndef __SYLAR_HTTP_COMPRESS_H__
+#define __SYLAR_HTTP_COMPRESS_H__
+
+#include <string>
+#include "http.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief HTTP 消息体压缩(Content-Encoding)
+ * @details 服务端按 Accept-Encoding 协商 gzip/deflate 压缩响应,
+ *          客户端按 Content-Encoding 解压响应。相关配置:
+ *          - http.compress.enable       是否压缩响应
+ *          - http.compress.min_size     小于该长度的 body 不压缩
+ *          - http.compress.level        压缩等级(-1, 0-9)
+ *          - http.compress.types        允许压缩的 Content-Type,
+ *                                       以 / 结尾的项按前缀匹配
+ *          - http.compress.cache_size   预压缩缓存条目数, 0 表示关闭
+ *          - http.compress.cache_max_body_size 可缓存的最大 body
+ *          - http.client.accept_encoding 客户端默认的 Accept-Encoding
+ */
+class HttpCompress {
+ public:
+  enum Encoding { IDENTITY = 0, GZIP = 1, DEFLATE = 2 };
+
+  /**
+   * @brief 按 Accept-Encoding(含 q 值)选出最合适的压缩方式
+   */
+  static Encoding Negotiate(const std::string& accept_encoding);
+
+  /**
+   * @brief 服务端压缩响应
+   * @details 不满足条件(未开启, 客户端不支持, 类型不在白名单, body 太小,
+   *          已有 Content-Encoding, 压缩后反而更大)时保持原样。
+   *          带 ETag 的响应视为静态内容, 压缩结果按 path+ETag 缓存
+   * @return 是否进行了压缩
+   */
+  static bool CompressResponse(HttpRequest::ptr req, HttpResponse::ptr rsp);
+
+  /**
+   * @brief 客户端解压响应, 成功后去掉 Content-Encoding/Content-Length
+   * @param[in] max_size 解压后 body 的上限, 0 表示不限制
+   * @return 无需解压或解压成功返回 true
+   */
+  static bool DecompressResponse(HttpResponse::ptr rsp, size_t max_size = 0);
+
+  static bool Compress(Encoding type, const std::string& in, std::string& out,
+                       int level = -1);
+  /**
+   * @param[in] max_size 输出超过该值时停止解压并返回 false, 0 表示不限制
+   */
+  static bool Decompress(Encoding type, const std::string& in,
+                         std::string& out, size_t max_size = 0);
+
+  static const char* EncodingToString(Encoding type);
+  static Encoding StringToEncoding(const std::string& v);
+
+  /**
+   * @brief 客户端请求默认携带的 Accept-Encoding, 为空时不携带
+   */
+  static std::string GetClientAcceptEncoding();
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
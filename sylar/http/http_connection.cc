@@ -1,8 +1,11 @@
 #include "http_connection.h"
+#include "http_compress.h"
 #include "http_parser.h"
+#include <algorithm>
+#include <thread>
 #include "sylar/dns.h"
+#include "sylar/iomanager.h"
 #include "sylar/log.h"
-#include "sylar/streams/zlib_stream.h"
 
 namespace sylar {
 namespace http {
@@ -23,6 +26,20 @@ HttpConnection::~HttpConnection() {
   SYLAR_LOG_DEBUG(g_logger) << "HttpConnection::~HttpConnection";
 }
 
+// recvResponse 已经解压过, Content-Encoding 还在说明解压失败或超过
+// http.response.max_body_size, 这里再确认一次并返回 DECODE_ERROR
+static HttpResult::ptr decode_response(HttpResponse::ptr rsp,
+                                       const std::string& server) {
+  if (HttpCompress::DecompressResponse(
+          rsp, HttpResponseParser::GetHttpResponseMaxBodySize())) {
+    return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+  }
+  return std::make_shared<HttpResult>(
+      (int)HttpResult::Error::DECODE_ERROR, nullptr,
+      "decode response body fail: " + server +
+          " content_encoding:" + rsp->getHeader("Content-Encoding"));
+}
+
 HttpResponse::ptr HttpConnection::recvResponse() {
   HttpResponseParser::ptr parser = std::make_shared<HttpResponseParser>();
   uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
@@ -131,22 +148,11 @@ HttpResponse::ptr HttpConnection::recvResponse() {
   }
 out:
   if (!body.empty()) {
-    // 如果 body 有内容，需要检查压缩方式
-    auto content_encoding = parser->getData()->getHeader("content-encoding");
-    SYLAR_LOG_DEBUG(g_logger)
-        << "content_encoding: " << content_encoding << " size=" << body.size();
-    if (strcasecmp(content_encoding.c_str(), "gzip") == 0) {
-      auto zs = ZlibStream::CreateGzip(false);
-      zs->write(body.c_str(), body.size());
-      zs->flush();
-      zs->getResult().swap(body);
-    } else if (strcasecmp(content_encoding.c_str(), "deflate") == 0) {
-      auto zs = ZlibStream::CreateDeflate(false);
-      zs->write(body.c_str(), body.size());
-      zs->flush();
-      zs->getResult().swap(body);
-    }
     parser->getData()->setBody(body);
+    // 如果 body 有内容，需要检查压缩方式; 解压失败时保持原样,
+    // DoRequest 等接口据此返回 DECODE_ERROR
+    HttpCompress::DecompressResponse(
+        parser->getData(), HttpResponseParser::GetHttpResponseMaxBodySize());
   }
   parser->getData()->initConnection();
   return parser->getData();
@@ -238,6 +244,12 @@ HttpResult::ptr HttpConnection::DoRequest(
   if (!has_host) {
     req->setHeader("Host", uri->getHost());
   }
+  if (req->getHeader("Accept-Encoding").empty()) {
+    std::string accept_encoding = HttpCompress::GetClientAcceptEncoding();
+    if (!accept_encoding.empty()) {
+      req->setHeader("Accept-Encoding", accept_encoding);
+    }
+  }
   req->setBody(body);
   return DoRequest(req, uri, timeout_ms);
 }
@@ -299,105 +311,426 @@ HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req,
         "recv response timeout: " + conn->getRemoteAddressString() +
             " timeout_ms:" + std::to_string(timeout_ms));
   }
-  return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+  return decode_response(rsp, conn->getRemoteAddressString());
+}
+
+// 淘汰/预热定时器的间隔
+static const uint64_t s_pool_timer_interval = 1000;
+// 空闲连接分片数上限
+static const uint32_t s_pool_max_shards = 16;
+
+std::string HttpConnectionPool::Stats::toString() const {
+  std::stringstream ss;
+  ss << "[Stats total=" << total << " idle=" << idle << " waiting=" << waiting
+     << " hit=" << hit << " miss=" << miss << " connect_fail=" << connectFail
+     << " wait=" << wait << " wait_timeout=" << waitTimeout
+     << " evict=" << evict << " prewarm=" << prewarm << "]";
+  return ss.str();
 }
 
-HttpConnectionPool::ptr HttpConnectionPool::Create(const std::string& uri,
-                                                   const std::string& vhost,
-                                                   uint32_t max_size,
-                                                   uint32_t max_alive_time,
-                                                   uint32_t max_request) {
+HttpConnectionPool::ptr HttpConnectionPool::Create(
+    const std::string& uri, const std::string& vhost, uint32_t max_size,
+    uint32_t max_alive_time, uint32_t max_request, uint32_t min_idle,
+    uint32_t max_idle_time) {
   Uri::ptr turi = Uri::Create(uri);
   if (!turi) {
     SYLAR_LOG_ERROR(g_logger) << "invalid uri=" << uri;
+    return nullptr;
   }
-  return std::make_shared<HttpConnectionPool>(
+  auto rt = std::make_shared<HttpConnectionPool>(
       turi->getHost(), vhost, turi->getPort(), turi->getScheme() == "https",
-      max_size, max_alive_time, max_request);
+      max_size, max_alive_time, max_request, min_idle, max_idle_time);
+  if (IOManager::GetThis()) {
+    rt->start();
+  }
+  return rt;
 }
 
 HttpConnectionPool::HttpConnectionPool(const std::string& host,
                                        const std::string& vhost, uint32_t port,
                                        bool is_https, uint32_t max_size,
                                        uint32_t max_alive_time,
-                                       uint32_t max_request)
+                                       uint32_t max_request, uint32_t min_idle,
+                                       uint32_t max_idle_time)
     : m_host(host),
       m_vhost(vhost),
       m_port(port ? port : (is_https ? 443 : 80)),
       m_maxSize(max_size),
       m_maxAliveTime(max_alive_time),
       m_maxRequest(max_request),
+      m_minIdle(min_idle),
+      m_maxIdleTime(max_idle_time),
       m_isHttps(is_https) {
   m_service = m_host + ":" + std::to_string(m_port);
+  uint32_t count = std::thread::hardware_concurrency();
+  count = std::max(1u, std::min(count, s_pool_max_shards));
+  for (uint32_t i = 0; i < count; ++i) {
+    m_shards.push_back(new Shard);
+  }
 }
 
-HttpConnection::ptr HttpConnectionPool::getConnection(uint64_t& timeout_ms) {
+HttpConnectionPool::~HttpConnectionPool() {
+  if (m_timer) {
+    m_timer->cancel();
+  }
+  // 唤醒所有等待者, 它们从 getConnection 返回 nullptr, 不再访问连接池
+  std::list<Waiter::ptr> waiters;
+  {
+    MutexType::Lock lock(m_waitMutex);
+    waiters.swap(m_waiters);
+    m_waiterCount = 0;
+  }
+  for (auto& i : waiters) {
+    if (i->timer) {
+      i->timer->cancel();
+    }
+    i->closed = true;
+    i->scheduler->schedule(i->fiber);
+  }
+  for (auto i : m_shards) {
+    for (auto c : i->conns) {
+      delete c;
+    }
+    delete i;
+  }
+}
+
+bool HttpConnectionPool::start() {
+  IOManager* iom = IOManager::GetThis();
+  if (!iom) {
+    return false;
+  }
+  bool expected = false;
+  if (!m_started.compare_exchange_strong(expected, true)) {
+    return true;
+  }
+  std::weak_ptr<HttpConnectionPool> weak = shared_from_this();
+  m_timer = iom->addConditionTimer(
+      s_pool_timer_interval,
+      [weak]() {
+        auto self = weak.lock();
+        if (self) {
+          self->onTimer();
+        }
+      },
+      weak, true);
+  prewarm();
+  return true;
+}
+
+HttpConnectionPool::Stats HttpConnectionPool::getStats() const {
+  Stats s;
+  s.total = m_total;
+  s.idle = m_idle;
+  s.hit = m_hit;
+  s.miss = m_miss;
+  s.connectFail = m_connectFail;
+  s.wait = m_wait;
+  s.waitTimeout = m_waitTimeout;
+  s.evict = m_evict;
+  s.prewarm = m_prewarm;
+  s.waiting = m_waiterCount;
+  return s;
+}
+
+HttpConnection::ptr HttpConnectionPool::wrap(HttpConnection* conn) {
+  return HttpConnection::ptr(conn, std::bind(&HttpConnectionPool::ReleasePtr,
+                                             std::placeholders::_1, this));
+}
+
+HttpConnectionPool::Shard* HttpConnectionPool::getShard() {
+  return m_shards[sylar::GetThreadId() % m_shards.size()];
+}
+
+bool HttpConnectionPool::isExpired(HttpConnection* conn,
+                                   uint64_t now_ms) const {
+  if (conn->m_createTime + m_maxAliveTime < now_ms) {
+    return true;
+  }
+  return m_maxIdleTime > 0 && conn->m_lastActiveTime + m_maxIdleTime < now_ms;
+}
+
+HttpConnection* HttpConnectionPool::popIdle(uint64_t now_ms) {
+  size_t idx = sylar::GetThreadId() % m_shards.size();
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    Shard* shard = m_shards[(idx + i) % m_shards.size()];
+    while (true) {
+      HttpConnection* conn = nullptr;
+      {
+        MutexType::Lock lock(shard->mutex);
+        if (shard->conns.empty()) {
+          break;
+        }
+        conn = shard->conns.back();
+        shard->conns.pop_back();
+      }
+      --m_idle;
+      if (!isExpired(conn, now_ms) && conn->checkConnected()) {
+        return conn;
+      }
+      // 已失效的连接直接释放, 继续取下一个
+      delete conn;
+      ++m_evict;
+      releaseSlot();
+    }
+  }
+  return nullptr;
+}
+
+void HttpConnectionPool::pushIdle(HttpConnection* conn) {
+  conn->m_lastActiveTime = sylar::GetCurrentMS();
+  Shard* shard = getShard();
+  {
+    MutexType::Lock shard_lock(shard->mutex);
+    shard->conns.push_back(conn);
+  }
+  ++m_idle;
+  // 先计入 m_idle 再读 m_waiterCount, waitConnection 顺序相反:
+  // 要么等待者看到 m_idle > 0, 要么这里看到等待者
+  if (m_waiterCount == 0) {
+    return;
+  }
+  Waiter::ptr waiter;
+  {
+    MutexType::Lock lock(m_waitMutex);
+    if (m_waiters.empty()) {
+      return;
+    }
+    // 从本分片队尾取回最新的空闲连接转交给等待者(不一定是刚放入的那个),
+    // 分片已被其它协程取空则无需转交
+    {
+      MutexType::Lock shard_lock(shard->mutex);
+      if (shard->conns.empty()) {
+        return;
+      }
+      conn = shard->conns.back();
+      shard->conns.pop_back();
+    }
+    --m_idle;
+    waiter = m_waiters.front();
+    m_waiters.pop_front();
+    --m_waiterCount;
+  }
+  waiter->conn = conn;
+  if (waiter->timer) {
+    waiter->timer->cancel();
+  }
+  waiter->scheduler->schedule(waiter->fiber);
+}
+
+HttpConnection* HttpConnectionPool::createConnection(uint64_t& timeout_ms) {
+  // IPAddress::ptr addr = Address::LookupAnyIPAddress(m_host);
+  auto addr = DnsMgr::GetInstance()->getAddress(m_service, true);
+  if (!addr) {
+    SYLAR_LOG_ERROR(g_logger) << "get addr fail: " << m_host;
+    ++m_connectFail;
+    return nullptr;
+  }
+  // addr->setPort(m_port);
+  Socket::ptr sock =
+      m_isHttps ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+  if (!sock) {
+    SYLAR_LOG_ERROR(g_logger) << "create sock fail: " << *addr;
+    ++m_connectFail;
+    return nullptr;
+  }
+  uint64_t ts1 = sylar::GetCurrentMS();
+  if (!sock->connect(addr, timeout_ms)) {
+    SYLAR_LOG_ERROR(g_logger) << "sock connect fail: " << *addr;
+    ++m_connectFail;
+    return nullptr;
+  }
   uint64_t now_ms = sylar::GetCurrentMS();
-  std::vector<HttpConnection*> invalid_conns;
-  HttpConnection* ptr = nullptr;
-  MutexType::Lock lock(m_mutex);
-  while (!m_conns.empty()) {
-    auto conn = *m_conns.begin();
-    m_conns.pop_front();
-
-    if ((conn->m_createTime + m_maxAliveTime) < now_ms) {
-      invalid_conns.push_back(conn);
-      continue;
+  uint64_t used = now_ms - ts1;
+  timeout_ms = timeout_ms > used ? timeout_ms - used : 0;
+
+  HttpConnection* conn = new HttpConnection(sock);
+  conn->m_createTime = now_ms;
+  conn->m_lastActiveTime = now_ms;
+  return conn;
+}
+
+bool HttpConnectionPool::tryReserve() {
+  uint32_t total = m_total;
+  do {
+    if (m_maxSize && total >= m_maxSize) {
+      return false;
     }
-    if (!conn->checkConnected()) {
-      invalid_conns.push_back(conn);
-      continue;
+  } while (!m_total.compare_exchange_weak(total, total + 1));
+  return true;
+}
+
+void HttpConnectionPool::releaseSlot() {
+  Waiter::ptr waiter;
+  {
+    MutexType::Lock lock(m_waitMutex);
+    if (m_waiters.empty()) {
+      --m_total;
+      return;
     }
-    ptr = conn;
-    break;
+    // 名额直接转交给等待者, 由其新建连接
+    waiter = m_waiters.front();
+    m_waiters.pop_front();
+    --m_waiterCount;
   }
-  lock.unlock();
-  for (auto i : invalid_conns) {
-    delete i;
+  if (waiter->timer) {
+    waiter->timer->cancel();
   }
-  m_total -= invalid_conns.size();
+  waiter->scheduler->schedule(waiter->fiber);
+}
 
-  if (!ptr) {
-    // IPAddress::ptr addr = Address::LookupAnyIPAddress(m_host);
-    auto addr = DnsMgr::GetInstance()->getAddress(m_service, true);
-    if (!addr) {
-      SYLAR_LOG_ERROR(g_logger) << "get addr fail: " << m_host;
-      return nullptr;
+int HttpConnectionPool::waitConnection(uint64_t& timeout_ms,
+                                       HttpConnection*& conn) {
+  IOManager* iom = IOManager::GetThis();
+  if (!iom || timeout_ms == 0) {
+    return -1;
+  }
+  Waiter::ptr waiter = std::make_shared<Waiter>();
+  waiter->scheduler = Scheduler::GetThis();
+  waiter->fiber = Fiber::GetThis();
+  std::weak_ptr<HttpConnectionPool> weak = shared_from_this();
+  {
+    MutexType::Lock lock(m_waitMutex);
+    // 先计入等待者再确认一次, 与 pushIdle 的顺序相反; releaseSlot
+    // 持有 m_waitMutex, 检查与入队之间归还的连接/名额不会无人领取
+    ++m_waiterCount;
+    if (m_idle > 0 || !m_maxSize || m_total < m_maxSize) {
+      --m_waiterCount;
+      return 0;
     }
-    // addr->setPort(m_port);
-    Socket::ptr sock =
-        m_isHttps ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-    if (!sock) {
-      SYLAR_LOG_ERROR(g_logger) << "create sock fail: " << *addr;
+    m_waiters.push_back(waiter);
+    // 定时器在锁内创建, 保证转交方看到的 waiter 已带有 timer
+    waiter->timer = iom->addTimer(timeout_ms, [weak, waiter]() {
+      auto self = weak.lock();
+      if (!self) {
+        return;
+      }
+      {
+        MutexType::Lock lock(self->m_waitMutex);
+        auto it = std::find(self->m_waiters.begin(), self->m_waiters.end(),
+                            waiter);
+        if (it == self->m_waiters.end()) {
+          return;
+        }
+        self->m_waiters.erase(it);
+        --self->m_waiterCount;
+      }
+      waiter->timed = true;
+      waiter->scheduler->schedule(waiter->fiber);
+    });
+  }
+  ++m_wait;
+  uint64_t ts = sylar::GetCurrentMS();
+  Fiber::YieldToHold();
+  if (waiter->closed) {
+    // 连接池已析构
+    return -1;
+  }
+  uint64_t used = sylar::GetCurrentMS() - ts;
+  timeout_ms = timeout_ms > used ? timeout_ms - used : 0;
+  if (waiter->timed) {
+    ++m_waitTimeout;
+    return -1;
+  }
+  conn = waiter->conn;
+  return 1;
+}
+
+HttpConnection::ptr HttpConnectionPool::getConnection(uint64_t& timeout_ms) {
+  if (!m_started) {
+    start();
+  }
+  HttpConnection* conn = popIdle(sylar::GetCurrentMS());
+  if (conn) {
+    ++m_hit;
+    return wrap(conn);
+  }
+
+  while (!tryReserve()) {
+    int rt = waitConnection(timeout_ms, conn);
+    if (rt < 0) {
       return nullptr;
     }
-    uint64_t ts1 = sylar::GetCurrentMS();
-    if (!sock->connect(addr, timeout_ms)) {
-      SYLAR_LOG_ERROR(g_logger) << "sock connect fail: " << *addr;
-      return nullptr;
+    if (rt == 0) {
+      // 入队前有连接或名额归还, 重新尝试
+      conn = popIdle(sylar::GetCurrentMS());
+      if (conn) {
+        ++m_hit;
+        return wrap(conn);
+      }
+      continue;
+    }
+    if (conn) {
+      ++m_hit;
+      return wrap(conn);
     }
-    timeout_ms -= sylar::GetCurrentMS() - ts1;
+    // 拿到了转交的名额, m_total 已由归还方计入
+    break;
+  }
 
-    ptr = new HttpConnection(sock);
-    ++m_total;
+  ++m_miss;
+  conn = createConnection(timeout_ms);
+  if (!conn) {
+    releaseSlot();
+    return nullptr;
   }
-  return HttpConnection::ptr(ptr, std::bind(&HttpConnectionPool::ReleasePtr,
-                                            std::placeholders::_1, this));
+  return wrap(conn);
 }
 
 void HttpConnectionPool::ReleasePtr(HttpConnection* ptr,
                                     HttpConnectionPool* pool) {
   ++ptr->m_request;
-  if ((pool->m_total >= pool->m_maxSize) || !ptr->isConnected() ||
-      (ptr->m_request >= pool->m_maxRequest) ||
+  if (!ptr->isConnected() || (ptr->m_request >= pool->m_maxRequest) ||
       ((ptr->m_createTime + pool->m_maxAliveTime) < sylar::GetCurrentMS()) ||
       !ptr->checkConnected()) {
     delete ptr;
-    --pool->m_total;
+    pool->releaseSlot();
     return;
   }
-  MutexType::Lock lock(pool->m_mutex);
-  pool->m_conns.push_back(ptr);
+  pool->pushIdle(ptr);
+}
+
+void HttpConnectionPool::onTimer() {
+  uint64_t now_ms = sylar::GetCurrentMS();
+  std::vector<HttpConnection*> expired;
+  for (auto shard : m_shards) {
+    MutexType::Lock lock(shard->mutex);
+    // 队头空闲最久, 遇到第一个未过期的连接即可停止
+    while (!shard->conns.empty() && isExpired(shard->conns.front(), now_ms)) {
+      expired.push_back(shard->conns.front());
+      shard->conns.pop_front();
+    }
+  }
+  m_idle -= expired.size();
+  m_evict += expired.size();
+  for (auto i : expired) {
+    delete i;
+    releaseSlot();
+  }
+  prewarm();
+}
+
+void HttpConnectionPool::prewarm() {
+  IOManager* iom = IOManager::GetThis();
+  if (!iom) {
+    return;
+  }
+  while (m_idle + m_warming < m_minIdle && tryReserve()) {
+    ++m_warming;
+    auto self = shared_from_this();
+    iom->schedule([self]() {
+      // 使用 tcp.connect.timeout
+      uint64_t timeout_ms = -1;
+      HttpConnection* conn = self->createConnection(timeout_ms);
+      --self->m_warming;
+      if (!conn) {
+        self->releaseSlot();
+        return;
+      }
+      ++self->m_prewarm;
+      self->pushIdle(conn);
+    });
+  }
 }
 
 HttpResult::ptr HttpConnectionPool::doGet(
@@ -466,6 +799,12 @@ HttpResult::ptr HttpConnectionPool::doRequest(
       req->setHeader("Host", m_vhost);
     }
   }
+  if (req->getHeader("Accept-Encoding").empty()) {
+    std::string accept_encoding = HttpCompress::GetClientAcceptEncoding();
+    if (!accept_encoding.empty()) {
+      req->setHeader("Accept-Encoding", accept_encoding);
+    }
+  }
   req->setBody(body);
   return doRequest(req, timeout_ms);
 }
@@ -515,7 +854,7 @@ HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req,
         "recv response timeout: " + sock->getRemoteAddress()->toString() +
             " timeout_ms:" + std::to_string(timeout_ms));
   }
-  return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+  return decode_response(rsp, sock->getRemoteAddress()->toString());
 }
 
 }  // namespace http
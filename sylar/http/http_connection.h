@@ -1,11 +1,14 @@
 #ifndef __SYLAR_HTTP_CONNECTION_H__
 #define __SYLAR_HTTP_CONNECTION_H__
 
+#include <deque>
 #include <list>
 
 #include "http.h"
+#include "sylar/fiber.h"
 #include "sylar/streams/socket_stream.h"
 #include "sylar/thread.h"
+#include "sylar/timer.h"
 #include "sylar/uri.h"
 
 namespace sylar {
@@ -34,6 +37,8 @@ struct HttpResult {
     POOL_GET_CONNECTION = 8,
     /// 无效的连接
     POOL_INVALID_CONNECTION = 9,
+    /// 响应体解码失败或解压后超过 http.response.max_body_size
+    DECODE_ERROR = 10,
   };
 
   HttpResult(int _result, HttpResponse::ptr _response,
@@ -101,28 +106,68 @@ class HttpConnection : public SocketStream {
 
   ~HttpConnection();
 
+  /**
+   * @brief 读取一个响应
+   * @details 按 Content-Encoding 解压 body, 解压后受
+   *          http.response.max_body_size 限制; 解压失败时 body 和
+   *          Content-Encoding 保持原样
+   */
   HttpResponse::ptr recvResponse();
   int sendRequest(HttpRequest::ptr req);
 
  private:
-  uint64_t m_createTime = 0;  // 创建时间
-  uint64_t m_request = 0;     // 处理请求的次数
+  uint64_t m_createTime = 0;      // 创建时间
+  uint64_t m_lastActiveTime = 0;  // 最近一次归还连接池的时间
+  uint64_t m_request = 0;         // 处理请求的次数
 };
 
-class HttpConnectionPool {
+/**
+ * @brief HTTP 连接池
+ * @details 空闲连接按线程分片存放, 取/还连接只访问当前线程的分片(O(1)),
+ *          本分片为空时才去其它分片窃取。每个分片按归还时间排序,
+ *          后进先出复用热连接, 空闲最久的连接由定时器从队头淘汰。
+ *          连接总数达到 max_size 后, 请求方在等待队列中挂起直到有连接归还
+ *          或超时; max_size 为 0 表示不限制。设置 min_idle 后由后台协程
+ *          预先建立连接, 使空闲连接数不低于该值
+ */
+class HttpConnectionPool
+    : public std::enable_shared_from_this<HttpConnectionPool> {
  public:
   typedef std::shared_ptr<HttpConnectionPool> ptr;
-  typedef Mutex MutexType;
+  typedef Spinlock MutexType;
+
+  /**
+   * @brief 连接池统计
+   */
+  struct Stats {
+    uint32_t total = 0;        // 存活及正在建立的连接数
+    uint32_t idle = 0;         // 空闲连接数
+    uint32_t waiting = 0;      // 等待队列长度
+    uint64_t hit = 0;          // 复用空闲连接的次数
+    uint64_t miss = 0;         // 新建连接的次数
+    uint64_t connectFail = 0;  // 建立连接失败的次数
+    uint64_t wait = 0;         // 进入等待队列的次数
+    uint64_t waitTimeout = 0;  // 等待超时的次数
+    uint64_t evict = 0;        // 因空闲超时/存活超时/断开被淘汰的连接数
+    uint64_t prewarm = 0;      // 后台预建立的连接数
+
+    std::string toString() const;
+  };
 
   static HttpConnectionPool::ptr Create(const std::string& uri,
                                         const std::string& vhost,
                                         uint32_t max_size,
                                         uint32_t max_alive_time,
-                                        uint32_t max_request);
+                                        uint32_t max_request,
+                                        uint32_t min_idle = 0,
+                                        uint32_t max_idle_time = 0);
 
   HttpConnectionPool(const std::string& host, const std::string& vhost,
                      uint32_t port, bool is_https, uint32_t max_size,
-                     uint32_t max_alive_time, uint32_t max_request);
+                     uint32_t max_alive_time, uint32_t max_request,
+                     uint32_t min_idle = 0, uint32_t max_idle_time = 0);
+
+  ~HttpConnectionPool();
 
   // 从 http 连接池中获取一个连接
   HttpConnection::ptr getConnection(uint64_t& timeout_ms);
@@ -155,22 +200,91 @@ class HttpConnectionPool {
 
   HttpResult::ptr doRequest(HttpRequest::ptr req, uint64_t timeout_ms);
 
+  /**
+   * @brief 启动淘汰/预热定时器
+   * @details 需要在 IOManager 中调用; 未显式调用时, 首次 getConnection
+   *          会自动启动
+   */
+  bool start();
+
+  Stats getStats() const;
+
+  uint32_t getMinIdle() const { return m_minIdle; }
+  void setMinIdle(uint32_t v) { m_minIdle = v; }
+  uint32_t getMaxIdleTime() const { return m_maxIdleTime; }
+  void setMaxIdleTime(uint32_t v) { m_maxIdleTime = v; }
+
  private:
+  struct Shard {
+    MutexType mutex;
+    // 按归还时间排序, 队尾最新
+    std::deque<HttpConnection*> conns;
+  };
+
+  struct Waiter {
+    typedef std::shared_ptr<Waiter> ptr;
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    Timer::ptr timer;
+    // 归还时直接转交的连接, 为空且未超时表示转交了一个新建连接的名额
+    HttpConnection* conn = nullptr;
+    bool timed = false;
+    // 连接池析构时唤醒
+    bool closed = false;
+  };
+
   static void ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool);
 
+  HttpConnection::ptr wrap(HttpConnection* conn);
+  Shard* getShard();
+  HttpConnection* popIdle(uint64_t now_ms);
+  /**
+   * @brief 归还空闲连接, 有等待者时直接转交
+   */
+  void pushIdle(HttpConnection* conn);
+  bool isExpired(HttpConnection* conn, uint64_t now_ms) const;
+  HttpConnection* createConnection(uint64_t& timeout_ms);
+  bool tryReserve();
+  void releaseSlot();
+  /**
+   * @brief 连接数已满时挂起等待
+   * @return 1: 拿到转交的连接(conn 非空)或新建名额, 0: 需要重试, -1: 失败或超时
+   */
+  int waitConnection(uint64_t& timeout_ms, HttpConnection*& conn);
+  void onTimer();
+  void prewarm();
+
  private:
   std::string m_host;
   std::string m_vhost;
   uint32_t m_port;          // 端口号
-  uint32_t m_maxSize;       // 连接池最大连接数
+  uint32_t m_maxSize;       // 连接池最大连接数, 0 表示不限制
   uint32_t m_maxAliveTime;  // 每个连接存活的时间
   uint32_t m_maxRequest;    // 每个连接最大请求次数
+  uint32_t m_minIdle;       // 预热保持的最少空闲连接数
+  uint32_t m_maxIdleTime;   // 连接最长空闲时间, 0 表示不限制
   bool m_isHttps;           // 是否 https
   std::string m_service;
 
-  MutexType m_mutex;
-  std::list<HttpConnection*> m_conns;   // 所有可用连接
-  std::atomic<uint32_t> m_total = {0};  // 存活连接数
+  std::vector<Shard*> m_shards;      // 按线程分片的空闲连接
+  mutable MutexType m_waitMutex;
+  std::list<Waiter::ptr> m_waiters;  // 等待连接的协程
+  // m_waiters 的大小, 归还连接时无锁判断是否有等待者
+  std::atomic<uint32_t> m_waiterCount = {0};
+
+  std::atomic<uint32_t> m_total = {0};    // 存活及正在建立的连接数
+  std::atomic<uint32_t> m_idle = {0};     // 空闲连接数
+  std::atomic<uint32_t> m_warming = {0};  // 正在预热的连接数
+  std::atomic<bool> m_started = {false};
+  Timer::ptr m_timer;
+
+  std::atomic<uint64_t> m_hit = {0};
+  std::atomic<uint64_t> m_miss = {0};
+  std::atomic<uint64_t> m_connectFail = {0};
+  std::atomic<uint64_t> m_wait = {0};
+  std::atomic<uint64_t> m_waitTimeout = {0};
+  std::atomic<uint64_t> m_evict = {0};
+  std::atomic<uint64_t> m_prewarm = {0};
 };
 
 }  // namespace http
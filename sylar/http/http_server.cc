@@ -1,4 +1,5 @@
 #include "http_server.h"
+#include "http_compress.h"
 #include "sylar/http/servlets/config_servlet.h"
 #include "sylar/http/servlets/status_servlet.h"
 #include "sylar/log.h"
@@ -24,39 +25,51 @@ void HttpServer::setName(const std::string& v) {
   m_dispatch->setDefault(std::make_shared<NotFoundServlet>(v));
 }
 
-void HttpServer::handleClient(Socket::ptr client) {
-  SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
-  HttpSession::ptr session = std::make_shared<HttpSession>(client);
+void ServeHttpSession(HttpSession::ptr session, ServletDispatch::ptr dispatch,
+                      sylar::IOManager* worker, const std::string& server_name,
+                      bool keepalive,
+                      std::function<bool(HttpRequest::ptr req)> upgrade) {
   do {
     auto req = session->recvRequest();
     if (!req) {
       SYLAR_LOG_DEBUG(g_logger)
           << "recv http request fail, errno=" << errno
-          << " errstr=" << strerror(errno) << " cliet:" << *client
-          << " keep_alive=" << m_isKeepalive;
+          << " errstr=" << strerror(errno)
+          << " cliet:" << session->getRemoteAddressString()
+          << " keep_alive=" << keepalive;
       break;
     }
+    if (upgrade && upgrade(req)) {
+      return;
+    }
 
     HttpResponse::ptr rsp = std::make_shared<HttpResponse>(
-        req->getVersion(), req->isClose() || !m_isKeepalive);
-    rsp->setHeader("Server", getName());
+        req->getVersion(), req->isClose() || !keepalive);
+    rsp->setHeader("Server", server_name);
     rsp->setHeader("Content-Type", "application/json;charset=utf8");
     {
       // 注意这里没有新建协程对象 !!!
       // 切换IO协程调度器到worker协程调度器，这里使用的是同一个协程对象
-      sylar::SchedulerSwitcher sw(m_worker);
+      sylar::SchedulerSwitcher sw(worker);
       // worker协程调度器继续调度执行这个协程
-      m_dispatch->handle(req, rsp, session);
+      dispatch->handle(req, rsp, session);
       // 当SchedulerSwitcher析构时，会自动切换回原来的协程调度器
+      HttpCompress::CompressResponse(req, rsp);
     }
     session->sendResponse(rsp);
 
-    if (!m_isKeepalive || req->isClose()) {
+    if (!keepalive || req->isClose()) {
       break;
     }
   } while (true);
   session->close();
 }
 
+void HttpServer::handleClient(Socket::ptr client) {
+  SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
+  HttpSession::ptr session = std::make_shared<HttpSession>(client);
+  ServeHttpSession(session, m_dispatch, m_worker, getName(), m_isKeepalive);
+}
+
 }  // namespace http
 }  // namespace sylar
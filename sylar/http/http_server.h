@@ -8,6 +8,18 @@
 namespace sylar {
 namespace http {
 
+/**
+ * @brief HttpServer 和 Http2Server 共用的 HTTP/1.x 请求循环, 结束时关闭 session
+ * @param[in] worker 执行 Servlet 的调度器
+ * @param[in] keepalive 是否保持长连接, false 时处理完一个请求就关闭
+ * @param[in] upgrade 非空时每个请求先交给它, 返回 true 表示连接已被接管
+ *            (如协议升级), 直接返回且不关闭 session
+ */
+void ServeHttpSession(
+    HttpSession::ptr session, ServletDispatch::ptr dispatch,
+    sylar::IOManager* worker, const std::string& server_name, bool keepalive,
+    std::function<bool(HttpRequest::ptr req)> upgrade = nullptr);
+
 class HttpServer : public TcpServer {
  public:
   typedef std::shared_ptr<HttpServer> ptr;
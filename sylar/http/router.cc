@@ -0,0 +1,272 @@
+#include "router.h"
+#include <fnmatch.h>
+#include <algorithm>
+#include "servlet.h"
+
+namespace sylar {
+namespace http {
+
+// INVALID_METHOD 所在的槽位保存不区分方法的路由
+static const size_t s_any_method = (size_t)HttpMethod::INVALID_METHOD;
+
+struct RadixRouter::Handlers {
+  struct Entry {
+    CreatorPtr creator;
+    // 参数名, 与匹配时捕获的参数按顺序对应
+    std::vector<std::string> names;
+  };
+
+  const Entry* get(HttpMethod method) const {
+    size_t idx = (size_t)method;
+    if (idx < s_any_method && entries[idx].creator) {
+      return &entries[idx];
+    }
+    return entries[s_any_method].creator ? &entries[s_any_method] : nullptr;
+  }
+
+  Entry entries[s_any_method + 1];
+};
+
+struct RadixRouter::Node {
+  ~Node() {
+    for (auto& i : children) {
+      delete i;
+    }
+    delete param;
+    delete leaf;
+    delete wildcard;
+  }
+
+  // 静态边的内容
+  std::string path;
+  // 每个静态子节点的首字符, 与 children 一一对应
+  std::string indices;
+  std::vector<Node*> children;
+  // 参数子节点(:name)
+  Node* param = nullptr;
+  // 在此节点结束的路由
+  Handlers* leaf = nullptr;
+  // 以此节点为前缀的通配路由(*)
+  Handlers* wildcard = nullptr;
+  // 字面前缀为此节点的 fnmatch 路由, 按添加顺序匹配
+  std::vector<std::pair<std::string, CreatorPtr>> globs;
+};
+
+RadixRouter::RadixRouter() : m_root(new Node), m_count(0) {}
+
+RadixRouter::~RadixRouter() {
+  delete m_root;
+}
+
+RadixRouter::Node* RadixRouter::insertStatic(Node* node, const std::string& str,
+                                             size_t begin, size_t end) {
+  while (begin < end) {
+    size_t idx = node->indices.find(str[begin]);
+    if (idx == std::string::npos) {
+      Node* child = new Node;
+      child->path = str.substr(begin, end - begin);
+      node->indices.push_back(str[begin]);
+      node->children.push_back(child);
+      return child;
+    }
+
+    Node* child = node->children[idx];
+    size_t len = std::min(child->path.size(), end - begin);
+    size_t common = 0;
+    while (common < len && child->path[common] == str[begin + common]) {
+      ++common;
+    }
+    if (common < child->path.size()) {
+      // 公共前缀比子节点短, 分裂子节点
+      Node* mid = new Node;
+      mid->path = child->path.substr(0, common);
+      child->path.erase(0, common);
+      mid->indices.push_back(child->path[0]);
+      mid->children.push_back(child);
+      node->children[idx] = mid;
+      child = mid;
+    }
+    node = child;
+    begin += common;
+  }
+  return node;
+}
+
+void RadixRouter::setHandler(Handlers*& hs, HttpMethod method,
+                             CreatorPtr creator,
+                             const std::vector<std::string>& names) {
+  if (!hs) {
+    hs = new Handlers;
+  }
+  size_t idx = (size_t)method;
+  if (idx > s_any_method) {
+    idx = s_any_method;
+  }
+  auto& e = hs->entries[idx];
+  if (!e.creator) {
+    ++m_count;
+  }
+  e.creator = creator;
+  e.names = names;
+}
+
+void RadixRouter::addExact(const std::string& uri, CreatorPtr creator) {
+  Node* node = insertStatic(m_root, uri, 0, uri.size());
+  setHandler(node->leaf, HttpMethod::INVALID_METHOD, creator, {});
+}
+
+void RadixRouter::addGlob(const std::string& pattern, CreatorPtr creator) {
+  size_t pos = pattern.find_first_of("*?[\\");
+  if (pos == std::string::npos) {
+    addExact(pattern, creator);
+    return;
+  }
+  Node* node = insertStatic(m_root, pattern, 0, pos);
+  if (pos + 1 == pattern.size() && pattern[pos] == '*') {
+    setHandler(node->wildcard, HttpMethod::INVALID_METHOD, creator, {});
+    return;
+  }
+  for (auto& i : node->globs) {
+    if (i.first == pattern) {
+      i.second = creator;
+      return;
+    }
+  }
+  node->globs.push_back(std::make_pair(pattern, creator));
+  ++m_count;
+}
+
+bool RadixRouter::addRoute(HttpMethod method, const std::string& pattern,
+                           CreatorPtr creator) {
+  std::vector<std::string> names;
+  Node* node = m_root;
+  size_t begin = 0;
+  size_t pos = 0;
+  while (pos < pattern.size()) {
+    char c = pattern[pos];
+    if ((c != ':' && c != '*') || (pos > 0 && pattern[pos - 1] != '/')) {
+      ++pos;
+      continue;
+    }
+    size_t end = pattern.find('/', pos);
+    if (end == std::string::npos) {
+      end = pattern.size();
+    }
+    std::string name = pattern.substr(pos + 1, end - pos - 1);
+    node = insertStatic(node, pattern, begin, pos);
+    if (c == '*') {
+      // 通配符只能出现在最后一段
+      if (end != pattern.size()) {
+        return false;
+      }
+      if (!name.empty()) {
+        names.push_back(name);
+      }
+      setHandler(node->wildcard, method, creator, names);
+      return true;
+    }
+    if (name.empty()) {
+      return false;
+    }
+    names.push_back(name);
+    if (!node->param) {
+      node->param = new Node;
+    }
+    node = node->param;
+    begin = pos = end;
+  }
+  node = insertStatic(node, pattern, begin, pattern.size());
+  setHandler(node->leaf, method, creator, names);
+  return true;
+}
+
+RadixRouter::CreatorPtr RadixRouter::match(HttpMethod method,
+                                           const std::string& path,
+                                           Params* params) const {
+  std::vector<size_t> caps;
+  CreatorPtr creator;
+  if (params) {
+    params->clear();
+  }
+  matchNode(m_root, path, 0, method, caps, creator, params);
+  return creator;
+}
+
+static void fill_params(const std::vector<std::string>& names,
+                        const std::vector<size_t>& caps,
+                        const std::string& path, size_t wildcard,
+                        RadixRouter::Params* params) {
+  if (!params) {
+    return;
+  }
+  size_t count = caps.size() / 2;
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (i < count) {
+      params->push_back(std::make_pair(
+          names[i], path.substr(caps[i * 2], caps[i * 2 + 1] - caps[i * 2])));
+    } else if (wildcard != std::string::npos) {
+      params->push_back(std::make_pair(names[i], path.substr(wildcard)));
+    }
+  }
+}
+
+bool RadixRouter::matchNode(const Node* node, const std::string& path,
+                            size_t pos, HttpMethod method,
+                            std::vector<size_t>& caps, CreatorPtr& creator,
+                            Params* params) const {
+  if (pos == path.size() && node->leaf) {
+    auto e = node->leaf->get(method);
+    if (e) {
+      creator = e->creator;
+      fill_params(e->names, caps, path, std::string::npos, params);
+      return true;
+    }
+  }
+
+  if (pos < path.size()) {
+    size_t idx = node->indices.find(path[pos]);
+    if (idx != std::string::npos) {
+      const Node* child = node->children[idx];
+      if (path.compare(pos, child->path.size(), child->path) == 0 &&
+          matchNode(child, path, pos + child->path.size(), method, caps,
+                    creator, params)) {
+        return true;
+      }
+    }
+
+    if (node->param) {
+      size_t end = path.find('/', pos);
+      if (end == std::string::npos) {
+        end = path.size();
+      }
+      if (end > pos) {
+        caps.push_back(pos);
+        caps.push_back(end);
+        if (matchNode(node->param, path, end, method, caps, creator, params)) {
+          return true;
+        }
+        caps.resize(caps.size() - 2);
+      }
+    }
+  }
+
+  for (auto& i : node->globs) {
+    if (!fnmatch(i.first.c_str(), path.c_str(), 0)) {
+      creator = i.second;
+      return true;
+    }
+  }
+
+  if (node->wildcard) {
+    auto e = node->wildcard->get(method);
+    if (e) {
+      creator = e->creator;
+      fill_params(e->names, caps, path, pos, params);
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace http
+}  // namespace sylar
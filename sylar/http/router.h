@@ -0,0 +1,87 @@
+#ifndef __SYLAR_HTTP_ROUTER_H__
+#define __SYLAR_HTTP_ROUTER_H__
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "http.h"
+#include "sylar/noncopyable.h"
+
+namespace sylar {
+namespace http {
+
+class IServletCreator;
+
+/**
+ * @brief 基数树(radix tree)路由表
+ * @details 构建完成后只读，由 ServletDispatch 以 copy-on-write 方式整体替换，
+ *          因此 match 无需加锁。支持的路由形式:
+ *          - 精确路径: /sylar/xx
+ *          - 参数段:   /user/:id/profile (匹配一个非空路径段)
+ *          - 通配符:   最后一段为 *path 或 *, 匹配剩余全部内容
+ *          - 兼容 fnmatch 的 glob: 按第一个通配字符之前的字面前缀挂到树上
+ */
+class RadixRouter : Noncopyable {
+ public:
+  typedef std::shared_ptr<RadixRouter> ptr;
+  typedef std::shared_ptr<IServletCreator> CreatorPtr;
+  typedef std::vector<std::pair<std::string, std::string>> Params;
+
+  RadixRouter();
+  ~RadixRouter();
+
+  /**
+   * @brief 添加精确匹配路由, 不解析 ':' 和 '*'
+   */
+  void addExact(const std::string& uri, CreatorPtr creator);
+
+  /**
+   * @brief 添加 fnmatch 风格的模糊匹配路由
+   * @details 末尾单个 '*' 的模式直接编译成树上的通配节点,
+   *          其余模式挂在字面前缀节点上, 只在前缀命中时才调用 fnmatch
+   */
+  void addGlob(const std::string& pattern, CreatorPtr creator);
+
+  /**
+   * @brief 添加带参数的路由
+   * @param[in] method 请求方法, INVALID_METHOD 表示匹配任意方法
+   * @param[in] pattern 路由模式, 如 /user/:id, 通配段写作 *path
+   * @return 模式非法时返回 false
+   */
+  bool addRoute(HttpMethod method, const std::string& pattern,
+                CreatorPtr creator);
+
+  /**
+   * @brief 查找路由
+   * @details 优先级: 静态段 > 参数段 > glob > 通配符, 同一节点上
+   *          指定方法的路由优先于任意方法的路由
+   * @param[out] params 命中时输出捕获到的参数, 可以为 nullptr
+   * @return 未命中返回 nullptr
+   */
+  CreatorPtr match(HttpMethod method, const std::string& path,
+                   Params* params = nullptr) const;
+
+  size_t getRouteCount() const { return m_count; }
+
+ private:
+  struct Node;
+  struct Handlers;
+
+  Node* insertStatic(Node* node, const std::string& str, size_t begin,
+                     size_t end);
+  void setHandler(Handlers*& hs, HttpMethod method, CreatorPtr creator,
+                  const std::vector<std::string>& names);
+  bool matchNode(const Node* node, const std::string& path, size_t pos,
+                 HttpMethod method, std::vector<size_t>& caps,
+                 CreatorPtr& creator, Params* params) const;
+
+ private:
+  Node* m_root;
+  size_t m_count;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
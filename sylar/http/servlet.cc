@@ -1,5 +1,4 @@
 #include "servlet.h"
-#include <fnmatch.h>
 
 namespace sylar {
 namespace http {
@@ -15,12 +14,13 @@ int32_t FunctionServlet::handle(sylar::http::HttpRequest::ptr request,
 
 ServletDispatch::ServletDispatch() : Servlet("ServletDispatch") {
   m_default = std::make_shared<NotFoundServlet>("sylar/1.0");
+  m_router = std::make_shared<RadixRouter>();
 }
 
 int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request,
                                 sylar::http::HttpResponse::ptr response,
                                 sylar::http::HttpSession::ptr session) {
-  auto slt = getMatchedServlet(request->getPath());
+  auto slt = getMatchedServlet(request);
   if (slt) {
     slt->handle(request, response, session);
   }
@@ -30,12 +30,14 @@ int32_t ServletDispatch::handle(sylar::http::HttpRequest::ptr request,
 void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
   RWMutexType::WriteLock lock(m_mutex);
   m_datas[uri] = std::make_shared<HoldServletCreator>(slt);
+  rebuild();
 }
 
 void ServletDispatch::addServletCreator(const std::string& uri,
                                         IServletCreator::ptr creator) {
   RWMutexType::WriteLock lock(m_mutex);
   m_datas[uri] = creator;
+  rebuild();
 }
 
 void ServletDispatch::addGlobServletCreator(const std::string& uri,
@@ -48,6 +50,7 @@ void ServletDispatch::addGlobServletCreator(const std::string& uri,
     }
   }
   m_globs.push_back(std::make_pair(uri, creator));
+  rebuild();
 }
 
 void ServletDispatch::addServlet(const std::string& uri,
@@ -55,6 +58,7 @@ void ServletDispatch::addServlet(const std::string& uri,
   RWMutexType::WriteLock lock(m_mutex);
   m_datas[uri] = std::make_shared<HoldServletCreator>(
       std::make_shared<FunctionServlet>(cb));
+  rebuild();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri, Servlet::ptr slt) {
@@ -67,6 +71,7 @@ void ServletDispatch::addGlobServlet(const std::string& uri, Servlet::ptr slt) {
   }
   m_globs.push_back(
       std::make_pair(uri, std::make_shared<HoldServletCreator>(slt)));
+  rebuild();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri,
@@ -77,6 +82,7 @@ void ServletDispatch::addGlobServlet(const std::string& uri,
 void ServletDispatch::delServlet(const std::string& uri) {
   RWMutexType::WriteLock lock(m_mutex);
   m_datas.erase(uri);
+  rebuild();
 }
 
 void ServletDispatch::delGlobServlet(const std::string& uri) {
@@ -87,6 +93,52 @@ void ServletDispatch::delGlobServlet(const std::string& uri) {
       break;
     }
   }
+  rebuild();
+}
+
+bool ServletDispatch::addRoute(HttpMethod method, const std::string& pattern,
+                               Servlet::ptr slt) {
+  return addRouteCreator(method, pattern,
+                         std::make_shared<HoldServletCreator>(slt));
+}
+
+bool ServletDispatch::addRoute(HttpMethod method, const std::string& pattern,
+                               FunctionServlet::callback cb) {
+  return addRoute(method, pattern, std::make_shared<FunctionServlet>(cb));
+}
+
+bool ServletDispatch::addRouteCreator(HttpMethod method,
+                                      const std::string& pattern,
+                                      IServletCreator::ptr creator) {
+  // 先在空树上校验模式, 非法模式不进入路由表
+  RadixRouter check;
+  if (!check.addRoute(method, pattern, creator)) {
+    return false;
+  }
+  RWMutexType::WriteLock lock(m_mutex);
+  m_routes[std::make_pair(method, pattern)] = creator;
+  rebuild();
+  return true;
+}
+
+void ServletDispatch::delRoute(HttpMethod method, const std::string& pattern) {
+  RWMutexType::WriteLock lock(m_mutex);
+  m_routes.erase(std::make_pair(method, pattern));
+  rebuild();
+}
+
+void ServletDispatch::rebuild() {
+  auto router = std::make_shared<RadixRouter>();
+  for (auto& i : m_datas) {
+    router->addExact(i.first, i.second);
+  }
+  for (auto& i : m_globs) {
+    router->addGlob(i.first, i.second);
+  }
+  for (auto& i : m_routes) {
+    router->addRoute(i.first.first, i.first.second, i.second);
+  }
+  std::atomic_store(&m_router, router);
 }
 
 Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
@@ -106,17 +158,23 @@ Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
 }
 
 Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri) {
-  RWMutexType::ReadLock lock(m_mutex);
-  auto mit = m_datas.find(uri);
-  if (mit != m_datas.end()) {
-    return mit->second->get();
+  auto router = std::atomic_load(&m_router);
+  auto creator = router->match(HttpMethod::INVALID_METHOD, uri);
+  return creator ? creator->get() : m_default;
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(HttpRequest::ptr request) {
+  auto router = std::atomic_load(&m_router);
+  RadixRouter::Params params;
+  auto creator =
+      router->match(request->getMethod(), request->getPath(), &params);
+  if (!creator) {
+    return m_default;
   }
-  for (auto it = m_globs.begin(); it != m_globs.end(); ++it) {
-    if (!fnmatch(it->first.c_str(), uri.c_str(), 0)) {
-      return it->second->get();
-    }
+  for (auto& i : params) {
+    request->setRouteParam(i.first, i.second);
   }
-  return m_default;
+  return creator->get();
 }
 
 void ServletDispatch::listAllServletCreator(
@@ -135,6 +193,15 @@ void ServletDispatch::listAllGlobServletCreator(
   }
 }
 
+void ServletDispatch::listAllRouteCreator(
+    std::map<std::pair<HttpMethod, std::string>, IServletCreator::ptr>&
+        infos) {
+  RWMutexType::ReadLock lock(m_mutex);
+  for (auto& i : m_routes) {
+    infos[i.first] = i.second;
+  }
+}
+
 NotFoundServlet::NotFoundServlet(const std::string& name)
     : Servlet("NotFoundServlet"), m_name(name) {
   m_content =
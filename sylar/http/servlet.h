@@ -8,6 +8,7 @@
 #include <vector>
 #include "http.h"
 #include "http_session.h"
+#include "router.h"
 #include "sylar/thread.h"
 #include "sylar/util.h"
 
@@ -109,8 +110,22 @@ class ServletDispatch : public Servlet {
     addGlobServletCreator(uri, std::make_shared<ServletCreator<T>>());
   }
 
+  /**
+   * @brief 添加带参数的路由
+   * @param[in] method 请求方法, INVALID_METHOD 表示不区分方法
+   * @param[in] pattern 如 /user/:id/profile, 通配段写作 *path
+   * @return 模式非法时返回 false
+   */
+  bool addRoute(HttpMethod method, const std::string& pattern,
+                Servlet::ptr slt);
+  bool addRoute(HttpMethod method, const std::string& pattern,
+                FunctionServlet::callback cb);
+  bool addRouteCreator(HttpMethod method, const std::string& pattern,
+                       IServletCreator::ptr creator);
+
   void delServlet(const std::string& uri);
   void delGlobServlet(const std::string& uri);
+  void delRoute(HttpMethod method, const std::string& pattern);
 
   Servlet::ptr getDefault() const { return m_default; }
   void setDefault(Servlet::ptr v) { m_default = v; }
@@ -119,14 +134,25 @@ class ServletDispatch : public Servlet {
   Servlet::ptr getGlobServlet(const std::string& uri);
 
   Servlet::ptr getMatchedServlet(const std::string& uri);
+  /**
+   * @brief 按请求方法和路径匹配, 并把捕获的参数写入 request
+   */
+  Servlet::ptr getMatchedServlet(HttpRequest::ptr request);
 
   void listAllServletCreator(
       std::map<std::string, IServletCreator::ptr>& infos);
   void listAllGlobServletCreator(
       std::map<std::string, IServletCreator::ptr>& infos);
+  void listAllRouteCreator(
+      std::map<std::pair<HttpMethod, std::string>, IServletCreator::ptr>&
+          infos);
+
+ private:
+  // 由路由表重建基数树并发布, 调用方需持有写锁
+  void rebuild();
 
  private:
-  // 读写互斥量
+  // 读写互斥量, 只保护下面的路由表, 匹配时不加锁
   RWMutexType m_mutex;
   // 精确匹配 servlet Map
   // uri(/sylar/xxx) -> servlet
@@ -134,6 +160,12 @@ class ServletDispatch : public Servlet {
   // 模糊匹配 servlet 数组
   // uri(/sylar/*) -> servlet
   std::vector<std::pair<std::string, IServletCreator::ptr>> m_globs;
+  // 带参数的路由
+  // (method, /user/:id) -> servlet
+  std::map<std::pair<HttpMethod, std::string>, IServletCreator::ptr> m_routes;
+  // 由上面三张表编译出的只读基数树, 修改时整体替换(copy-on-write)
+  // 通过 std::atomic_load/std::atomic_store 访问
+  RadixRouter::ptr m_router;
   // 默认servlet，所有路径都没匹配到时使用
   Servlet::ptr m_default;
 };
@@ -0,0 +1,366 @@
+#include "cache_servlet.h"
+#include "sylar/config.h"
+#include "sylar/ds/timed_lru_cache.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util/hash_util.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_cache_max_size =
+    sylar::Config::Lookup("http.cache.max_size", (uint64_t)10000,
+                          "http response cache max size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_cache_ttl =
+    sylar::Config::Lookup("http.cache.ttl", (uint64_t)(60 * 1000),
+                          "http response cache default ttl(ms)");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_cache_max_body_size =
+    sylar::Config::Lookup("http.cache.max_body_size", (uint64_t)(1024 * 1024),
+                          "http response cache max body size");
+
+static sylar::ConfigVar<uint64_t>::ptr g_http_cache_coalesce_timeout =
+    sylar::Config::Lookup("http.cache.coalesce_timeout", (uint64_t)(3 * 1000),
+                          "http response cache coalesced request wait "
+                          "timeout(ms), 0 disables coalescing");
+
+namespace {
+
+struct CacheEntry {
+  typedef std::shared_ptr<CacheEntry> ptr;
+  HttpStatus status;
+  std::string reason;
+  HttpResponse::MapType headers;
+  std::string body;
+  std::string etag;
+  uint64_t createTime;
+};
+
+// 等待同一缓存键结果的协程
+struct PendingWaiter {
+  typedef std::shared_ptr<PendingWaiter> ptr;
+  Scheduler* scheduler = nullptr;
+  Fiber::ptr fiber;
+  Timer::ptr timer;
+  bool timed = false;
+};
+
+// 正在执行 Servlet 的缓存键, 并发的未命中请求在此等待
+struct PendingEntry {
+  typedef std::shared_ptr<PendingEntry> ptr;
+  std::list<PendingWaiter::ptr> waiters;  // 由 s_pending_mutex 保护
+  CacheEntry::ptr entry;
+};
+
+typedef sylar::ds::TimedLruCache<std::string, CacheEntry::ptr> ResponseCache;
+
+static uint64_t s_ttl = 0;
+static uint64_t s_max_body_size = 0;
+static uint64_t s_coalesce_timeout = 0;
+static ResponseCache s_cache;
+static sylar::Mutex s_pending_mutex;
+static std::unordered_map<std::string, PendingEntry::ptr> s_pending;
+static std::atomic<uint64_t> s_instance_id = {0};
+static std::atomic<uint64_t> s_coalesced = {0};
+static std::atomic<uint64_t> s_not_modified = {0};
+static std::atomic<uint64_t> s_coalesce_timeouts = {0};
+
+struct _CacheIniter {
+  _CacheIniter() {
+    s_cache.setMaxSize(g_http_cache_max_size->getValue());
+    s_ttl = g_http_cache_ttl->getValue();
+    s_max_body_size = g_http_cache_max_body_size->getValue();
+    s_coalesce_timeout = g_http_cache_coalesce_timeout->getValue();
+
+    g_http_cache_max_size->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) {
+          s_cache.setMaxSize(nv);
+          if (nv == 0) {
+            s_cache.clear();
+          }
+        });
+    g_http_cache_ttl->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) { s_ttl = nv; });
+    g_http_cache_max_body_size->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) { s_max_body_size = nv; });
+    g_http_cache_coalesce_timeout->addListener(
+        [](const uint64_t& ov, const uint64_t& nv) {
+          s_coalesce_timeout = nv;
+        });
+  }
+};
+static _CacheIniter _init;
+
+// 发布结果并唤醒等待者; Servlet 抛出异常时也要执行
+struct PendingGuard {
+  PendingGuard(const std::string& k, PendingEntry::ptr p)
+      : key(k), pending(p) {}
+  ~PendingGuard() {
+    std::list<PendingWaiter::ptr> waiters;
+    {
+      sylar::Mutex::Lock lock(s_pending_mutex);
+      s_pending.erase(key);
+      waiters.swap(pending->waiters);
+    }
+    for (auto& i : waiters) {
+      if (i->timer) {
+        i->timer->cancel();
+      }
+      i->scheduler->schedule(i->fiber);
+    }
+  }
+  std::string key;
+  PendingEntry::ptr pending;
+};
+
+}  // namespace
+
+/**
+ * @brief 查找 Cache-Control 中的指令
+ * @param[out] value 指令的值(如 max-age 的秒数), 可为空
+ */
+static bool find_directive(const std::string& cache_control, const char* name,
+                           std::string* value = nullptr) {
+  auto items = sylar::split(cache_control, ',');
+  for (auto& i : items) {
+    std::string item = sylar::StringUtil::Trim(i);
+    size_t pos = item.find('=');
+    std::string key = sylar::StringUtil::Trim(item.substr(0, pos));
+    if (strcasecmp(key.c_str(), name) != 0) {
+      continue;
+    }
+    if (value) {
+      *value = pos == std::string::npos
+                   ? ""
+                   : sylar::StringUtil::Trim(item.substr(pos + 1), " \t\"");
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool etag_match(const std::string& if_none_match,
+                       const std::string& etag) {
+  if (etag.empty()) {
+    return false;
+  }
+  // If-None-Match 使用弱比较, 忽略 W/ 前缀
+  auto strip = [](const std::string& v) {
+    return v.compare(0, 2, "W/") == 0 ? v.substr(2) : v;
+  };
+  std::string tag = strip(etag);
+  auto items = sylar::split(if_none_match, ',');
+  for (auto& i : items) {
+    std::string item = sylar::StringUtil::Trim(i);
+    if (item == "*" || strip(item) == tag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 响应可缓存时返回缓存时间, 否则返回 0
+static uint64_t response_ttl(HttpResponse::ptr rsp, uint64_t def) {
+  switch (rsp->getStatus()) {
+    case HttpStatus::OK:
+    case HttpStatus::NON_AUTHORITATIVE_INFORMATION:
+    case HttpStatus::MOVED_PERMANENTLY:
+    case HttpStatus::NOT_FOUND:
+    case HttpStatus::GONE:
+      break;
+    default:
+      return 0;
+  }
+  if (rsp->isWebsocket() || !rsp->getCookies().empty() ||
+      rsp->getBody().size() > s_max_body_size) {
+    return 0;
+  }
+  std::string cc = rsp->getHeader("Cache-Control");
+  if (cc.empty()) {
+    return def;
+  }
+  if (find_directive(cc, "no-store") || find_directive(cc, "no-cache") ||
+      find_directive(cc, "private")) {
+    return 0;
+  }
+  std::string age;
+  if (find_directive(cc, "s-maxage", &age) ||
+      find_directive(cc, "max-age", &age)) {
+    return sylar::TypeUtil::Atoi(age) * 1000;
+  }
+  return def;
+}
+
+static void write_entry(CacheEntry::ptr entry, HttpResponse::ptr rsp) {
+  rsp->setStatus(entry->status);
+  rsp->setReason(entry->reason);
+  rsp->setHeaders(entry->headers);
+  rsp->setBody(entry->body);
+}
+
+static void check_not_modified(HttpRequest::ptr req, HttpResponse::ptr rsp) {
+  if (rsp->getStatus() != HttpStatus::OK) {
+    return;
+  }
+  std::string inm = req->getHeader("If-None-Match");
+  if (inm.empty() || !etag_match(inm, rsp->getHeader("ETag"))) {
+    return;
+  }
+  rsp->setStatus(HttpStatus::NOT_MODIFIED);
+  rsp->setReason("");
+  rsp->setBody("");
+  rsp->delHeader("Content-Length");
+  ++s_not_modified;
+}
+
+CacheServlet::CacheServlet(Servlet::ptr servlet,
+                           const std::vector<std::string>& vary_headers,
+                           uint64_t ttl_ms)
+    : Servlet("CacheServlet"),
+      m_servlet(servlet),
+      m_varyHeaders(vary_headers),
+      m_ttl(ttl_ms),
+      m_id(++s_instance_id) {}
+
+void CacheServlet::clear() {
+  m_id = ++s_instance_id;
+}
+
+std::string CacheServlet::makeKey(HttpRequest::ptr req) const {
+  std::stringstream ss;
+  ss << m_id << ' ' << HttpMethodToString(req->getMethod()) << ' '
+     << req->getPath();
+  if (!req->getQuery().empty()) {
+    ss << '?' << req->getQuery();
+  }
+  for (auto& i : m_varyHeaders) {
+    ss << '\n' << i << ':' << req->getHeader(i);
+  }
+  return ss.str();
+}
+
+int32_t CacheServlet::handle(sylar::http::HttpRequest::ptr request,
+                             sylar::http::HttpResponse::ptr response,
+                             sylar::http::HttpSession::ptr session) {
+  auto method = request->getMethod();
+  if (s_cache.getMaxSize() == 0 ||
+      (method != HttpMethod::GET && method != HttpMethod::HEAD)) {
+    return m_servlet->handle(request, response, session);
+  }
+  std::string req_cc = request->getHeader("Cache-Control");
+  if (find_directive(req_cc, "no-store")) {
+    return m_servlet->handle(request, response, session);
+  }
+  std::string age;
+  bool no_cache = find_directive(req_cc, "no-cache") ||
+                  (find_directive(req_cc, "max-age", &age) && age == "0");
+
+  std::string key = makeKey(request);
+  uint64_t now = sylar::GetCurrentMS();
+  CacheEntry::ptr entry;
+  PendingEntry::ptr pending;
+  if (!no_cache) {
+    // TimedLruCache 不主动淘汰过期条目, 这里按过期时间判断
+    if (s_cache.get(key, entry) <= (int64_t)now) {
+      entry = nullptr;
+    }
+    if (!entry) {
+      sylar::IOManager* iom = sylar::IOManager::GetThis();
+      uint64_t timeout = s_coalesce_timeout;
+      sylar::Mutex::Lock lock(s_pending_mutex);
+      auto it = s_pending.find(key);
+      if (it == s_pending.end()) {
+        pending = std::make_shared<PendingEntry>();
+        s_pending[key] = pending;
+      } else if (iom && timeout > 0) {
+        PendingEntry::ptr leader = it->second;
+        PendingWaiter::ptr waiter = std::make_shared<PendingWaiter>();
+        waiter->scheduler = Scheduler::GetThis();
+        waiter->fiber = Fiber::GetThis();
+        leader->waiters.push_back(waiter);
+        // 定时器在锁内创建, 保证 PendingGuard 看到的 waiter 已带有 timer
+        waiter->timer = iom->addTimer(timeout, [leader, waiter]() {
+          {
+            sylar::Mutex::Lock lock(s_pending_mutex);
+            auto it = std::find(leader->waiters.begin(),
+                                leader->waiters.end(), waiter);
+            if (it == leader->waiters.end()) {
+              return;
+            }
+            leader->waiters.erase(it);
+          }
+          waiter->timed = true;
+          waiter->scheduler->schedule(waiter->fiber);
+        });
+        lock.unlock();
+        Fiber::YieldToHold();
+        if (waiter->timed) {
+          // 执行者卡住时不再等待, 自己执行 Servlet
+          ++s_coalesce_timeouts;
+          SYLAR_LOG_WARN(g_logger)
+              << "cache coalesce wait timeout=" << timeout
+              << " path=" << request->getPath();
+        } else {
+          entry = leader->entry;
+          if (entry) {
+            ++s_coalesced;
+          }
+        }
+      }
+    }
+  }
+
+  if (entry) {
+    write_entry(entry, response);
+    uint64_t age_sec = (now - entry->createTime) / 1000;
+    response->setHeader("Age", std::to_string(age_sec));
+    response->setHeader("X-Cache", "HIT");
+    check_not_modified(request, response);
+    return 0;
+  }
+
+  std::shared_ptr<PendingGuard> guard;
+  if (pending) {
+    guard = std::make_shared<PendingGuard>(key, pending);
+  }
+  int32_t rt = m_servlet->handle(request, response, session);
+  uint64_t ttl = rt == 0 ? response_ttl(response, m_ttl ? m_ttl : s_ttl) : 0;
+  if (ttl > 0) {
+    if (response->getHeader("ETag").empty()) {
+      const std::string& body = response->getBody();
+      uint64_t hash = sylar::murmur3_hash64(body.c_str(), body.size());
+      response->setHeader(
+          "ETag",
+          "\"" + sylar::hexstring_from_data(&hash, sizeof(hash)) + "\"");
+    }
+    entry = std::make_shared<CacheEntry>();
+    entry->status = response->getStatus();
+    entry->reason = response->getReason();
+    entry->headers = response->getHeaders();
+    entry->body = response->getBody();
+    entry->etag = response->getHeader("ETag");
+    entry->createTime = now;
+    s_cache.set(key, entry, ttl);
+    if (pending) {
+      pending->entry = entry;
+    }
+  }
+  guard = nullptr;
+  response->setHeader("X-Cache", "MISS");
+  check_not_modified(request, response);
+  return rt;
+}
+
+std::string CacheServlet::ToStatusString() {
+  std::stringstream ss;
+  ss << s_cache.toStatusString() << " coalesced=" << s_coalesced
+     << " coalesce_timeouts=" << s_coalesce_timeouts
+     << " not_modified=" << s_not_modified;
+  return ss.str();
+}
+
+}  // namespace http
+}  // namespace sylar
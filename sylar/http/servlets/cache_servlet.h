@@ -0,0 +1,68 @@
+#ifndef __SYLAR_HTTP_SERVLETS_CACHE_SERVLET_H__
+#define __SYLAR_HTTP_SERVLETS_CACHE_SERVLET_H__
+
+#include <atomic>
+#include "sylar/http/servlet.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief 响应缓存, 包装一个 Servlet 按需开启
+ * @details 只缓存 GET/HEAD 请求, 缓存键为 方法+路径+查询串+指定的请求头。
+ *          - 响应 Cache-Control 含 no-store/no-cache/private, 或带 Set-Cookie
+ *            时不缓存; max-age/s-maxage 优先于默认 ttl
+ *          - 请求 Cache-Control: no-store 直接透传, no-cache/max-age=0
+ *            跳过查找但仍会更新缓存
+ *          - 缓存的响应没有 ETag 时按 body 生成, 请求带 If-None-Match
+ *            且匹配时返回 304
+ *          - 同一缓存键并发未命中时只有一个协程执行 Servlet, 其余协程等待
+ *            其结果, 等待超过 http.cache.coalesce_timeout 后自己执行
+ *          相关配置: http.cache.max_size, http.cache.ttl,
+ *          http.cache.max_body_size, http.cache.coalesce_timeout
+ */
+class CacheServlet : public Servlet {
+ public:
+  typedef std::shared_ptr<CacheServlet> ptr;
+
+  /**
+   * @param[in] servlet 被缓存的 Servlet
+   * @param[in] vary_headers 参与缓存键的请求头
+   * @param[in] ttl_ms 缓存时间, 0 表示使用 http.cache.ttl
+   */
+  CacheServlet(Servlet::ptr servlet,
+               const std::vector<std::string>& vary_headers = {},
+               uint64_t ttl_ms = 0);
+
+  virtual int32_t handle(sylar::http::HttpRequest::ptr request,
+                         sylar::http::HttpResponse::ptr response,
+                         sylar::http::HttpSession::ptr session) override;
+
+  /**
+   * @brief 清除本 Servlet 的缓存
+   * @details 通过更换缓存键前缀实现, 旧条目由 LRU 自然淘汰
+   */
+  void clear();
+
+  Servlet::ptr getServlet() const { return m_servlet; }
+  uint64_t getTtl() const { return m_ttl; }
+
+  /**
+   * @brief 全局缓存统计
+   */
+  static std::string ToStatusString();
+
+ private:
+  std::string makeKey(HttpRequest::ptr req) const;
+
+ private:
+  Servlet::ptr m_servlet;
+  std::vector<std::string> m_varyHeaders;
+  uint64_t m_ttl;
+  std::atomic<uint64_t> m_id;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
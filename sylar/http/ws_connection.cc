@@ -55,9 +55,12 @@ std::pair<HttpResult::ptr, WSConnection::ptr> WSConnection::Create(
   req->setMethod(HttpMethod::GET);
   bool has_host = false;
   bool has_conn = false;
+  bool has_ext = false;
   for (auto& i : headers) {
     if (strcasecmp(i.first.c_str(), "connection") == 0) {
       has_conn = true;
+    } else if (strcasecmp(i.first.c_str(), "Sec-WebSocket-Extensions") == 0) {
+      has_ext = true;
     } else if (!has_host && strcasecmp(i.first.c_str(), "host") == 0) {
       has_host = !i.second.empty();
     }
@@ -79,6 +82,11 @@ std::pair<HttpResult::ptr, WSConnection::ptr> WSConnection::Create(
   if (!has_host) {
     req->setHeader("Host", uri->getHost());
   }
+  // 协商 permessage-deflate(RFC 7692)
+  if (!has_ext && WSDeflate::IsEnabled()) {
+    req->setHeader("Sec-WebSocket-Extensions", WSDeflate::ClientOffer());
+    has_ext = true;
+  }
 
   int rt = conn->sendRequest(req);
   if (rt == 0) {
@@ -111,31 +119,65 @@ std::pair<HttpResult::ptr, WSConnection::ptr> WSConnection::Create(
             50, rsp, "not websocket server " + addr->toString()),
         nullptr);
   }
+  if (has_ext) {
+    bool error = false;
+    conn->m_deflate = WSDeflate::ClientAccept(
+        rsp->getHeader("Sec-WebSocket-Extensions"), error);
+    if (error) {
+      return std::make_pair(
+          std::make_shared<HttpResult>(
+              51, rsp, "invalid Sec-WebSocket-Extensions " + addr->toString()),
+          nullptr);
+    }
+    conn->m_writer.setDeflate(conn->m_deflate);
+  }
   return std::make_pair(
       std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok"),
       conn);
 }
 
 WSFrameMessage::ptr WSConnection::recvMessage() {
-  return WSRecvMessage(this, true);
+  return WSRecvMessage(this, true, &m_writer, m_deflate.get());
 }
 
 int32_t WSConnection::sendMessage(WSFrameMessage::ptr msg, bool fin) {
-  return WSSendMessage(this, msg, true, fin);
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_writer.send(this, msg, true, fin);
 }
 
 int32_t WSConnection::sendMessage(const std::string& msg, int32_t opcode,
                                   bool fin) {
-  return WSSendMessage(this, std::make_shared<WSFrameMessage>(opcode, msg),
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_writer.send(this, std::make_shared<WSFrameMessage>(opcode, msg),
                        true, fin);
 }
 
+int32_t WSConnection::sendMessages(
+    const std::vector<WSFrameMessage::ptr>& msgs) {
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_writer.send(this, msgs, true);
+}
+
 int32_t WSConnection::ping() {
-  return WSPing(this);
+  if (!isConnected()) {
+    return -1;
+  }
+  auto msg = std::make_shared<WSFrameMessage>(WSFrameHead::PING);
+  return m_writer.send(this, msg, true);
 }
 
 int32_t WSConnection::pong() {
-  return WSPong(this);
+  if (!isConnected()) {
+    return -1;
+  }
+  auto msg = std::make_shared<WSFrameMessage>(WSFrameHead::PONG);
+  return m_writer.send(this, msg, true);
 }
 
 }  // namespace http
@@ -22,8 +22,21 @@ class WSConnection : public HttpConnection {
   int32_t sendMessage(const std::string& msg,
                       int32_t opcode = WSFrameHead::TEXT_FRAME,
                       bool fin = true);
+  /**
+   * @brief 批量发送, 所有帧合并为一次 writev
+   */
+  int32_t sendMessages(const std::vector<WSFrameMessage::ptr>& msgs);
   int32_t ping();
   int32_t pong();
+
+  /**
+   * @brief 握手协商出的 permessage-deflate, 未启用时为空
+   */
+  WSDeflate::ptr getDeflate() const { return m_deflate; }
+
+ private:
+  WSFrameWriter m_writer;
+  WSDeflate::ptr m_deflate;
 };
 
 }  // namespace http
@@ -0,0 +1,302 @@
+#include "ws_deflate.h"
+#include <algorithm>
+#include <set>
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_ws_deflate_enable = sylar::Config::Lookup(
+    "websocket.deflate.enable", true, "websocket permessage-deflate enable");
+
+static sylar::ConfigVar<uint32_t>::ptr g_ws_deflate_min_size =
+    sylar::Config::Lookup("websocket.deflate.min_size", (uint32_t)256,
+                          "websocket permessage-deflate min message size");
+
+static sylar::ConfigVar<int>::ptr g_ws_deflate_level =
+    sylar::Config::Lookup("websocket.deflate.level", (int)-1,
+                          "websocket permessage-deflate level");
+
+static sylar::ConfigVar<int>::ptr g_ws_deflate_server_max_window_bits =
+    sylar::Config::Lookup("websocket.deflate.server_max_window_bits", (int)15,
+                          "websocket permessage-deflate server window bits");
+
+static sylar::ConfigVar<int>::ptr g_ws_deflate_client_max_window_bits =
+    sylar::Config::Lookup("websocket.deflate.client_max_window_bits", (int)15,
+                          "websocket permessage-deflate client window bits");
+
+static sylar::ConfigVar<bool>::ptr g_ws_deflate_server_no_context_takeover =
+    sylar::Config::Lookup("websocket.deflate.server_no_context_takeover", false,
+                          "websocket permessage-deflate "
+                          "server_no_context_takeover");
+
+static sylar::ConfigVar<bool>::ptr g_ws_deflate_client_no_context_takeover =
+    sylar::Config::Lookup("websocket.deflate.client_no_context_takeover", false,
+                          "websocket permessage-deflate "
+                          "client_no_context_takeover");
+
+static const char* s_extension_name = "permessage-deflate";
+
+// zlib 的 raw deflate 不支持 8 位窗口, 本端压缩使用 9-15
+static int window_bits(int v) {
+  return std::max(9, std::min(15, v));
+}
+
+std::string WSDeflate::Params::toString() const {
+  std::stringstream ss;
+  ss << s_extension_name;
+  if (serverNoContextTakeover) {
+    ss << "; server_no_context_takeover";
+  }
+  if (clientNoContextTakeover) {
+    ss << "; client_no_context_takeover";
+  }
+  if (serverMaxWindowBits < 15) {
+    ss << "; server_max_window_bits=" << serverMaxWindowBits;
+  }
+  if (hasClientMaxWindowBits && clientMaxWindowBits < 15) {
+    ss << "; client_max_window_bits=" << clientMaxWindowBits;
+  }
+  return ss.str();
+}
+
+bool WSDeflate::IsEnabled() {
+  return g_ws_deflate_enable->getValue();
+}
+
+std::string WSDeflate::ClientOffer() {
+  std::stringstream ss;
+  ss << s_extension_name;
+  if (g_ws_deflate_server_no_context_takeover->getValue()) {
+    ss << "; server_no_context_takeover";
+  }
+  if (g_ws_deflate_client_no_context_takeover->getValue()) {
+    ss << "; client_no_context_takeover";
+  }
+  int server_bits =
+      window_bits(g_ws_deflate_server_max_window_bits->getValue());
+  if (server_bits < 15) {
+    ss << "; server_max_window_bits=" << server_bits;
+  }
+  // 不带值表示客户端支持该参数, 由服务端决定
+  ss << "; client_max_window_bits";
+  int client_bits =
+      window_bits(g_ws_deflate_client_max_window_bits->getValue());
+  if (client_bits < 15) {
+    ss << "=" << client_bits;
+  }
+  return ss.str();
+}
+
+bool WSDeflate::ParseParams(const std::string& ext, Params& params) {
+  auto items = sylar::split(ext, ';');
+  if (items.empty() || sylar::StringUtil::Trim(items[0]) != s_extension_name) {
+    return false;
+  }
+  std::set<std::string> names;
+  for (size_t i = 1; i < items.size(); ++i) {
+    std::string item = sylar::StringUtil::Trim(items[i]);
+    size_t pos = item.find('=');
+    std::string name = sylar::StringUtil::Trim(item.substr(0, pos));
+    std::string value;
+    if (pos != std::string::npos) {
+      value = sylar::StringUtil::Trim(item.substr(pos + 1), " \t\"");
+    }
+    // 同一参数不能出现两次
+    if (!names.insert(name).second) {
+      return false;
+    }
+    if (name == "server_no_context_takeover" ||
+        name == "client_no_context_takeover") {
+      if (pos != std::string::npos) {
+        return false;
+      }
+      if (name[0] == 's') {
+        params.serverNoContextTakeover = true;
+      } else {
+        params.clientNoContextTakeover = true;
+      }
+    } else if (name == "server_max_window_bits" ||
+               name == "client_max_window_bits") {
+      bool is_server = name[0] == 's';
+      if (is_server) {
+        if (value.empty()) {
+          return false;
+        }
+      } else {
+        params.hasClientMaxWindowBits = true;
+        if (pos == std::string::npos) {
+          continue;
+        }
+      }
+      if (value.empty() || value.size() > 2 ||
+          value.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+      }
+      int bits = sylar::TypeUtil::Atoi(value);
+      if (bits < 8 || bits > 15) {
+        return false;
+      }
+      if (is_server) {
+        params.serverMaxWindowBits = bits;
+      } else {
+        params.clientMaxWindowBits = bits;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+WSDeflate::ptr WSDeflate::ServerAccept(const std::string& offers,
+                                       std::string& response) {
+  if (!IsEnabled()) {
+    return nullptr;
+  }
+  // 按客户端给出的顺序, 接受第一个可以满足的 offer
+  auto exts = sylar::split(offers, ',');
+  for (auto& ext : exts) {
+    Params params;
+    if (!ParseParams(ext, params)) {
+      continue;
+    }
+    if (params.serverMaxWindowBits < 9) {
+      continue;
+    }
+    params.serverMaxWindowBits =
+        std::min(params.serverMaxWindowBits,
+                 window_bits(g_ws_deflate_server_max_window_bits->getValue()));
+    if (g_ws_deflate_server_no_context_takeover->getValue()) {
+      params.serverNoContextTakeover = true;
+    }
+    if (g_ws_deflate_client_no_context_takeover->getValue()) {
+      params.clientNoContextTakeover = true;
+    }
+    if (params.hasClientMaxWindowBits) {
+      params.clientMaxWindowBits = std::min(
+          params.clientMaxWindowBits,
+          window_bits(g_ws_deflate_client_max_window_bits->getValue()));
+    }
+    response = params.toString();
+    return std::make_shared<WSDeflate>(false, params);
+  }
+  return nullptr;
+}
+
+WSDeflate::ptr WSDeflate::ClientAccept(const std::string& response,
+                                       bool& error) {
+  error = false;
+  if (sylar::StringUtil::Trim(response).empty()) {
+    return nullptr;
+  }
+  auto exts = sylar::split(response, ',');
+  Params params;
+  if (exts.size() != 1 || !ParseParams(exts[0], params)) {
+    SYLAR_LOG_INFO(g_logger) << "invalid Sec-WebSocket-Extensions: "
+                             << response;
+    error = true;
+    return nullptr;
+  }
+  if (params.hasClientMaxWindowBits && params.clientMaxWindowBits < 9) {
+    SYLAR_LOG_INFO(g_logger) << "unsupported client_max_window_bits="
+                             << params.clientMaxWindowBits;
+    error = true;
+    return nullptr;
+  }
+  params.clientMaxWindowBits =
+      std::min(params.clientMaxWindowBits,
+               window_bits(g_ws_deflate_client_max_window_bits->getValue()));
+  if (g_ws_deflate_client_no_context_takeover->getValue()) {
+    params.clientNoContextTakeover = true;
+  }
+  return std::make_shared<WSDeflate>(true, params);
+}
+
+WSDeflate::WSDeflate(bool client, const Params& params)
+    : m_params(params), m_minSize(g_ws_deflate_min_size->getValue()) {
+  int bits;
+  if (client) {
+    bits = params.clientMaxWindowBits;
+    m_encodeNoContext = params.clientNoContextTakeover;
+    m_decodeNoContext = params.serverNoContextTakeover;
+  } else {
+    bits = params.serverMaxWindowBits;
+    m_encodeNoContext = params.serverNoContextTakeover;
+    m_decodeNoContext = params.clientNoContextTakeover;
+  }
+  int level = g_ws_deflate_level->getValue();
+  if (level < -1 || level > 9) {
+    level = ZlibStream::DEFAULT_COMPRESSION;
+  }
+  m_encoder = ZlibStream::Create(true, 4096, ZlibStream::DEFLATE, level,
+                                 window_bits(bits));
+  // 对端窗口不超过 15, 解压始终使用最大窗口
+  m_decoder = ZlibStream::Create(false, 4096, ZlibStream::DEFLATE);
+}
+
+bool WSDeflate::compress(const std::string& in, std::string& out) {
+  if (!m_encoder) {
+    return false;
+  }
+  if (m_encoder->write(in.c_str(), in.size()) != Z_OK ||
+      m_encoder->syncFlush() != Z_OK) {
+    // 共享窗口的状态已不可信, 之后的消息不再压缩
+    SYLAR_LOG_ERROR(g_logger) << "permessage-deflate compress error";
+    m_encoder = nullptr;
+    return false;
+  }
+  out = m_encoder->getResult();
+  m_encoder->clearBuffers();
+  // 去掉 Z_SYNC_FLUSH 产生的 00 00 ff ff
+  if (out.size() >= 4 &&
+      out.compare(out.size() - 4, 4, "\0\0\xff\xff", 4) == 0) {
+    out.resize(out.size() - 4);
+  }
+  if (m_encodeNoContext) {
+    m_encoder->reset();
+  }
+  return true;
+}
+
+bool WSDeflate::decompress(const std::string& in, std::string& out,
+                           size_t max_size) {
+  if (!m_decoder) {
+    return false;
+  }
+  static const char s_tail[] = {0x00, 0x00, (char)0xff, (char)0xff};
+  // 在 inflate 循环内检查上限, 超过时返回 Z_BUF_ERROR, 不会整条解压到内存
+  m_decoder->setMaxOutputSize(max_size);
+  int rt = m_decoder->write(in.c_str(), in.size());
+  // 对端用 BFINAL 结束了压缩流时, 补上的空块已无意义
+  if (rt == Z_OK && !m_decoder->isStreamEnd()) {
+    rt = m_decoder->write(s_tail, sizeof(s_tail));
+  }
+  size_t size = 0;
+  for (auto& i : m_decoder->getBuffers()) {
+    size += i.iov_len;
+  }
+  if (rt != Z_OK) {
+    SYLAR_LOG_WARN(g_logger) << "permessage-deflate decompress error rt=" << rt
+                             << " size=" << size << " max_size=" << max_size;
+    m_decoder->clearBuffers();
+    m_decoder = nullptr;
+    return false;
+  }
+  out = m_decoder->getResult();
+  m_decoder->clearBuffers();
+  if (m_decodeNoContext) {
+    m_decoder->reset();
+  } else if (m_decoder->isStreamEnd()) {
+    // 压缩流结束后无法继续 inflate, 保留窗口开始新的流
+    m_decoder->reset(true);
+  }
+  return true;
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,102 @@
+#ifndef __SYLAR_HTTP_WS_DEFLATE_H__
+#define __SYLAR_HTTP_WS_DEFLATE_H__
+
+#include <memory>
+#include <string>
+#include "sylar/streams/zlib_stream.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief WebSocket permessage-deflate 扩展(RFC 7692)
+ * @details 通过 Sec-WebSocket-Extensions 协商。压缩的消息第一帧置 RSV1,
+ *          payload 为去掉末尾 00 00 ff ff 的 deflate 数据。
+ *          未设置 no_context_takeover 时, 同一方向上的消息共享滑动窗口,
+ *          因此压缩顺序必须与发送顺序一致。相关配置:
+ *          - websocket.deflate.enable       是否启用
+ *          - websocket.deflate.min_size     小于该长度的消息不压缩
+ *          - websocket.deflate.level        压缩等级(-1, 0-9)
+ *          - websocket.deflate.server_max_window_bits
+ *          - websocket.deflate.client_max_window_bits
+ *          - websocket.deflate.server_no_context_takeover
+ *          - websocket.deflate.client_no_context_takeover
+ */
+class WSDeflate {
+ public:
+  typedef std::shared_ptr<WSDeflate> ptr;
+
+  /**
+   * @brief 协商结果
+   */
+  struct Params {
+    bool serverNoContextTakeover = false;
+    bool clientNoContextTakeover = false;
+    int serverMaxWindowBits = 15;
+    int clientMaxWindowBits = 15;
+    // 客户端是否声明了 client_max_window_bits
+    bool hasClientMaxWindowBits = false;
+
+    /**
+     * @brief 序列化为 Sec-WebSocket-Extensions 的值
+     */
+    std::string toString() const;
+  };
+
+  static bool IsEnabled();
+
+  /**
+   * @brief 客户端握手请求中的 Sec-WebSocket-Extensions
+   */
+  static std::string ClientOffer();
+
+  /**
+   * @brief 服务端按请求的 Sec-WebSocket-Extensions 协商
+   * @param[out] response 响应中的 Sec-WebSocket-Extensions
+   * @return 没有可接受的 offer 时返回 nullptr
+   */
+  static WSDeflate::ptr ServerAccept(const std::string& offers,
+                                     std::string& response);
+
+  /**
+   * @brief 客户端解析服务端响应中的 Sec-WebSocket-Extensions
+   * @param[out] error 响应不合法时返回 true, 此时应断开连接
+   * @return 服务端未启用扩展时返回 nullptr
+   */
+  static WSDeflate::ptr ClientAccept(const std::string& response,
+                                     bool& error);
+
+  /**
+   * @brief 解析单个扩展, 名字不是 permessage-deflate 或参数非法时返回 false
+   */
+  static bool ParseParams(const std::string& ext, Params& params);
+
+  WSDeflate(bool client, const Params& params);
+
+  const Params& getParams() const { return m_params; }
+
+  /**
+   * @brief 消息是否需要压缩
+   */
+  bool needCompress(size_t size) const { return size >= m_minSize; }
+
+  bool compress(const std::string& in, std::string& out);
+
+  /**
+   * @param[in] max_size 解压后的最大长度, 超过时返回 false
+   */
+  bool decompress(const std::string& in, std::string& out, size_t max_size);
+
+ private:
+  Params m_params;
+  uint32_t m_minSize;
+  bool m_encodeNoContext;
+  bool m_decodeNoContext;
+  ZlibStream::ptr m_encoder;
+  ZlibStream::ptr m_decoder;
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
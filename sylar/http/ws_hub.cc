@@ -0,0 +1,260 @@
+#include "ws_hub.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+
+namespace sylar {
+namespace http {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint64_t>::ptr g_ws_hub_max_queue_bytes =
+    sylar::Config::Lookup("websocket.hub.max_queue_bytes",
+                          (uint64_t)(4 * 1024 * 1024),
+                          "websocket hub per session max queued bytes");
+
+static sylar::ConfigVar<std::string>::ptr g_ws_hub_overflow_policy =
+    sylar::Config::Lookup("websocket.hub.overflow_policy",
+                          std::string("drop_new"),
+                          "websocket hub overflow policy: "
+                          "drop_new, drop_oldest, close");
+
+static WSFrameWriter::OverflowPolicy StringToPolicy(const std::string& v) {
+  if (strcasecmp(v.c_str(), "drop_oldest") == 0) {
+    return WSFrameWriter::DROP_OLDEST;
+  } else if (strcasecmp(v.c_str(), "close") == 0) {
+    return WSFrameWriter::CLOSE;
+  }
+  return WSFrameWriter::DROP_NEW;
+}
+
+std::string WSHub::Stats::toString() const {
+  std::stringstream ss;
+  ss << "[Stats published=" << published << " delivered=" << delivered
+     << " dropped=" << dropped << " closed=" << closed
+     << " sessions=" << sessions << "]";
+  return ss.str();
+}
+
+WSHub::WSHub(IOManager* worker)
+    : m_worker(worker),
+      m_maxQueueBytes(g_ws_hub_max_queue_bytes->getValue()),
+      m_policy(StringToPolicy(g_ws_hub_overflow_policy->getValue())) {
+  std::vector<int> threads;
+  if (m_worker) {
+    threads = m_worker->getThreadIds();
+  }
+  if (threads.empty()) {
+    threads.push_back(-1);
+  }
+  for (auto i : threads) {
+    Shard* shard = new Shard;
+    shard->thread = i;
+    m_shards.push_back(shard);
+  }
+}
+
+WSHub::~WSHub() {
+  for (auto i : m_shards) {
+    delete i;
+  }
+}
+
+WSHub::Shard* WSHub::getShard(uint64_t id, bool create) {
+  Mutex::Lock lock(m_mutex);
+  auto it = m_sessionShards.find(id);
+  if (it != m_sessionShards.end()) {
+    return it->second;
+  }
+  if (!create) {
+    return nullptr;
+  }
+  // 优先归属当前线程的分片, 扇出与连接的读写在同一线程上
+  Shard* shard = nullptr;
+  int tid = sylar::GetThreadId();
+  for (auto i : m_shards) {
+    if (i->thread == tid) {
+      shard = i;
+      break;
+    }
+  }
+  if (!shard) {
+    shard = m_shards[id % m_shards.size()];
+  }
+  m_sessionShards[id] = shard;
+  return shard;
+}
+
+bool WSHub::subscribe(const std::string& topic, WSSession::ptr session) {
+  uint64_t id = session->getId();
+  while (true) {
+    Shard* shard = getShard(id, true);
+    RWMutexType::WriteLock lock(shard->mutex);
+    {
+      // 取分片之后最后一个订阅可能被取消, 归属关系已删除或者换了分片
+      Mutex::Lock slock(m_mutex);
+      Shard*& cur = m_sessionShards[id];
+      if (cur && cur != shard) {
+        continue;
+      }
+      cur = shard;
+    }
+    shard->sessions[id].insert(topic);
+    return shard->topics[topic].insert(session).second;
+  }
+}
+
+bool WSHub::unsubscribe(const std::string& topic, WSSession::ptr session) {
+  uint64_t id = session->getId();
+  Shard* shard = getShard(id, false);
+  if (!shard) {
+    return false;
+  }
+  RWMutexType::WriteLock lock(shard->mutex);
+  auto it = shard->topics.find(topic);
+  if (it == shard->topics.end() || !it->second.erase(session)) {
+    return false;
+  }
+  if (it->second.empty()) {
+    shard->topics.erase(it);
+  }
+  auto sit = shard->sessions.find(id);
+  if (sit != shard->sessions.end()) {
+    sit->second.erase(topic);
+    if (sit->second.empty()) {
+      // 最后一个订阅, 删除连接的记录
+      shard->sessions.erase(sit);
+      Mutex::Lock slock(m_mutex);
+      auto mit = m_sessionShards.find(id);
+      if (mit != m_sessionShards.end() && mit->second == shard) {
+        m_sessionShards.erase(mit);
+      }
+    }
+  }
+  return true;
+}
+
+void WSHub::unsubscribeAll(WSSession::ptr session) {
+  Shard* shard = nullptr;
+  {
+    Mutex::Lock lock(m_mutex);
+    auto it = m_sessionShards.find(session->getId());
+    if (it == m_sessionShards.end()) {
+      return;
+    }
+    shard = it->second;
+    m_sessionShards.erase(it);
+  }
+  RWMutexType::WriteLock lock(shard->mutex);
+  auto it = shard->sessions.find(session->getId());
+  if (it == shard->sessions.end()) {
+    return;
+  }
+  for (auto& topic : it->second) {
+    auto tit = shard->topics.find(topic);
+    if (tit == shard->topics.end()) {
+      continue;
+    }
+    tit->second.erase(session);
+    if (tit->second.empty()) {
+      shard->topics.erase(tit);
+    }
+  }
+  shard->sessions.erase(it);
+}
+
+void WSHub::publish(const std::string& topic, const std::string& data,
+                    int opcode) {
+  publish(topic, std::make_shared<WSEncodedFrame>(opcode, data));
+}
+
+void WSHub::publish(const std::string& topic, WSEncodedFrame::ptr frame) {
+  ++m_published;
+  auto self = shared_from_this();
+  for (auto shard : m_shards) {
+    {
+      RWMutexType::ReadLock lock(shard->mutex);
+      if (shard->topics.find(topic) == shard->topics.end()) {
+        continue;
+      }
+    }
+    if (!m_worker) {
+      // 不在IOManager中创建的hub, 直接在发布者的线程上扇出
+      deliver(shard, topic, frame);
+      continue;
+    }
+    m_worker->schedule(
+        [self, shard, topic, frame]() { self->deliver(shard, topic, frame); },
+        shard->thread);
+  }
+}
+
+void WSHub::deliver(Shard* shard, const std::string& topic,
+                    WSEncodedFrame::ptr frame) {
+  std::vector<WSSession::ptr> sessions;
+  {
+    RWMutexType::ReadLock lock(shard->mutex);
+    auto it = shard->topics.find(topic);
+    if (it == shard->topics.end()) {
+      return;
+    }
+    sessions.assign(it->second.begin(), it->second.end());
+  }
+
+  // 需要写出时 postFrame 在分片线程上调度写出协程, 慢连接不影响其它连接
+  std::vector<WSSession::ptr> closes;
+  uint64_t delivered = 0;
+  uint64_t dropped = 0;
+  for (auto& session : sessions) {
+    if (!session->isConnected()) {
+      continue;
+    }
+    switch (session->postFrame(frame, m_maxQueueBytes, m_policy, m_worker,
+                               shard->thread)) {
+      case WSFrameWriter::POSTED:
+        ++delivered;
+        break;
+      case WSFrameWriter::DROPPED:
+        ++dropped;
+        break;
+      case WSFrameWriter::OVERFLOW:
+        closes.push_back(session);
+        break;
+    }
+  }
+  m_delivered += delivered;
+  m_dropped += dropped;
+
+  for (auto& session : closes) {
+    SYLAR_LOG_INFO(g_logger) << "ws hub close slow consumer "
+                             << session->getRemoteAddressString()
+                             << " max_queue_bytes=" << m_maxQueueBytes;
+    ++m_closed;
+    session->close();
+  }
+}
+
+size_t WSHub::getSubscriberCount(const std::string& topic) {
+  size_t count = 0;
+  for (auto shard : m_shards) {
+    RWMutexType::ReadLock lock(shard->mutex);
+    auto it = shard->topics.find(topic);
+    if (it != shard->topics.end()) {
+      count += it->second.size();
+    }
+  }
+  return count;
+}
+
+WSHub::Stats WSHub::getStats() {
+  Stats stats;
+  stats.published = m_published;
+  stats.delivered = m_delivered;
+  stats.dropped = m_dropped;
+  stats.closed = m_closed;
+  Mutex::Lock lock(m_mutex);
+  stats.sessions = m_sessionShards.size();
+  return stats;
+}
+
+}  // namespace http
+}  // namespace sylar
@@ -0,0 +1,111 @@
+#ifndef __SYLAR_HTTP_WS_HUB_H__
+#define __SYLAR_HTTP_WS_HUB_H__
+
+#include <atomic>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include "sylar/iomanager.h"
+#include "ws_session.h"
+
+namespace sylar {
+namespace http {
+
+/**
+ * @brief WebSocket 广播中心, 按主题订阅与扇出
+ * @details - 订阅关系按 worker 的线程分片, 连接归属于首次订阅时所在线程
+ *            对应的分片, 每个分片的扇出作为一个任务在该线程上执行
+ *          - 每条消息只编码一次(WSEncodedFrame), 所有订阅者按引用共享
+ *          - 扇出只把帧放入各连接的发送队列, 不会被慢连接阻塞;
+ *            由每个连接的写出协程把积压的帧合并为一次 writev
+ *          - 每个连接的发送队列有上限, 超过时按 OverflowPolicy 丢弃或断开
+ *          - 广播帧不做 permessage-deflate 压缩(压缩上下文属于单个连接)
+ *          相关配置: websocket.hub.max_queue_bytes,
+ *          websocket.hub.overflow_policy(drop_new, drop_oldest, close)
+ */
+class WSHub : public std::enable_shared_from_this<WSHub> {
+ public:
+  typedef std::shared_ptr<WSHub> ptr;
+  typedef RWMutex RWMutexType;
+
+  struct Stats {
+    uint64_t published = 0;  // 发布的消息数
+    uint64_t delivered = 0;  // 放入连接发送队列的帧数
+    uint64_t dropped = 0;    // 因队列已满丢弃的帧数
+    uint64_t closed = 0;     // 因慢消费被断开的连接数
+    uint32_t sessions = 0;   // 订阅中的连接数
+
+    std::string toString() const;
+  };
+
+  /**
+   * @param[in] worker 扇出使用的调度器, 为空时在publish的调用线程上同步扇出
+   */
+  WSHub(IOManager* worker = IOManager::GetThis());
+  ~WSHub();
+
+  /**
+   * @return 是否为新增的订阅
+   */
+  bool subscribe(const std::string& topic, WSSession::ptr session);
+  bool unsubscribe(const std::string& topic, WSSession::ptr session);
+
+  /**
+   * @brief 取消连接的全部订阅, 一般在 WSServlet::onClose 中调用
+   */
+  void unsubscribeAll(WSSession::ptr session);
+
+  /**
+   * @brief 异步发布到主题的全部订阅者
+   */
+  void publish(const std::string& topic, const std::string& data,
+               int opcode = WSFrameHead::TEXT_FRAME);
+  void publish(const std::string& topic, WSEncodedFrame::ptr frame);
+
+  size_t getSubscriberCount(const std::string& topic);
+  Stats getStats();
+
+  uint64_t getMaxQueueBytes() const { return m_maxQueueBytes; }
+  void setMaxQueueBytes(uint64_t v) { m_maxQueueBytes = v; }
+
+  WSFrameWriter::OverflowPolicy getOverflowPolicy() const { return m_policy; }
+  void setOverflowPolicy(WSFrameWriter::OverflowPolicy v) { m_policy = v; }
+
+ private:
+  struct Shard {
+    RWMutexType mutex;
+    // 主题 -> 订阅的连接
+    std::unordered_map<std::string, std::unordered_set<WSSession::ptr>>
+        topics;
+    // 连接 id -> 订阅的主题
+    std::unordered_map<uint64_t, std::set<std::string>> sessions;
+    // 扇出任务执行的线程, -1 表示任意线程
+    int thread = -1;
+  };
+
+  Shard* getShard(uint64_t id, bool create);
+  void deliver(Shard* shard, const std::string& topic,
+               WSEncodedFrame::ptr frame);
+
+ private:
+  IOManager* m_worker;
+  std::vector<Shard*> m_shards;
+
+  // 连接 id -> 所属的分片, 加锁顺序: 分片锁在前
+  Mutex m_mutex;
+  std::unordered_map<uint64_t, Shard*> m_sessionShards;
+
+  // 扇出时无锁读取, 可以在运行中修改
+  std::atomic<uint64_t> m_maxQueueBytes;
+  std::atomic<WSFrameWriter::OverflowPolicy> m_policy;
+
+  std::atomic<uint64_t> m_published = {0};
+  std::atomic<uint64_t> m_delivered = {0};
+  std::atomic<uint64_t> m_dropped = {0};
+  std::atomic<uint64_t> m_closed = {0};
+};
+
+}  // namespace http
+}  // namespace sylar
+
+#endif
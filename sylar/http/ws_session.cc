@@ -54,6 +54,16 @@ HttpRequest::ptr WSSession::handleShake() {
     rsp->setHeader("Connection", "Upgrade");
     rsp->setHeader("Sec-WebSocket-Accept", v);
 
+    std::string exts = req->getHeader("Sec-WebSocket-Extensions");
+    if (!exts.empty()) {
+      std::string accepted;
+      m_deflate = WSDeflate::ServerAccept(exts, accepted);
+      if (m_deflate) {
+        rsp->setHeader("Sec-WebSocket-Extensions", accepted);
+        m_writer.setDeflate(m_deflate);
+      }
+    }
+
     sendResponse(rsp);
     SYLAR_LOG_DEBUG(g_logger) << *req;
     SYLAR_LOG_DEBUG(g_logger) << *rsp;
@@ -68,6 +78,18 @@ HttpRequest::ptr WSSession::handleShake() {
 WSFrameMessage::WSFrameMessage(int opcode, const std::string& data)
     : m_opcode(opcode), m_data(data) {}
 
+static uint8_t ws_encode_head(char* buf, int opcode, bool fin, bool client,
+                              uint64_t size, const char* mask,
+                              bool rsv1 = false);
+
+WSEncodedFrame::WSEncodedFrame(int opcode, const std::string& data) {
+  char head[14];
+  uint8_t len = ws_encode_head(head, opcode, true, false, data.size(), nullptr);
+  m_data.reserve(len + data.size());
+  m_data.append(head, len);
+  m_data.append(data);
+}
+
 std::string WSFrameHead::toString() const {
   std::stringstream ss;
   ss << "[WSFrameHead fin=" << fin << " rsv1=" << rsv1 << " rsv2=" << rsv2
@@ -77,25 +99,128 @@ std::string WSFrameHead::toString() const {
 }
 
 WSFrameMessage::ptr WSSession::recvMessage() {
-  return WSRecvMessage(this, false);
+  return WSRecvMessage(this, false, &m_writer, m_deflate.get());
 }
 
 int32_t WSSession::sendMessage(WSFrameMessage::ptr msg, bool fin) {
-  return WSSendMessage(this, msg, false, fin);
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_writer.send(this, msg, false, fin);
 }
 
 int32_t WSSession::sendMessage(const std::string& msg, int32_t opcode,
                                bool fin) {
-  return WSSendMessage(this, std::make_shared<WSFrameMessage>(opcode, msg),
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_writer.send(this, std::make_shared<WSFrameMessage>(opcode, msg),
                        false, fin);
 }
 
+int32_t WSSession::sendMessages(const std::vector<WSFrameMessage::ptr>& msgs) {
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_writer.send(this, msgs, false);
+}
+
 int32_t WSSession::ping() {
-  return WSPing(this);
+  if (!isConnected()) {
+    return -1;
+  }
+  auto msg = std::make_shared<WSFrameMessage>(WSFrameHead::PING);
+  return m_writer.send(this, msg, false);
 }
 
-WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
+void WSMask(void* dst, const void* src, size_t len, const char* mask) {
+  unsigned char* d = (unsigned char*)dst;
+  const unsigned char* s = (const unsigned char*)src;
+  // 掩码重复两次拼成 64 位, 每次异或 8 字节
+  uint64_t mask64;
+  memcpy(&mask64, mask, 4);
+  memcpy((char*)&mask64 + 4, mask, 4);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, s + i, sizeof(v));
+    v ^= mask64;
+    memcpy(d + i, &v, sizeof(v));
+  }
+  // i 是 8 的倍数, 尾部仍从 mask[0] 开始对齐
+  for (; i < len; ++i) {
+    d[i] = s[i] ^ (unsigned char)mask[i & 3];
+  }
+}
+
+void WSMask(void* data, size_t len, const char* mask) {
+  WSMask(data, data, len, mask);
+}
+
+/**
+ * @brief 编码帧头(含扩展长度和掩码)
+ * @return 帧头长度
+ */
+static uint8_t ws_encode_head(char* buf, int opcode, bool fin, bool client,
+                              uint64_t size, const char* mask, bool rsv1) {
+  WSFrameHead ws_head;
+  memset(&ws_head, 0, sizeof(ws_head));
+  ws_head.fin = fin;
+  ws_head.rsv1 = rsv1;
+  ws_head.opcode = opcode;
+  ws_head.mask = client;
+  uint8_t len = sizeof(ws_head);
+  if (size < 126) {
+    ws_head.payload = size;
+  } else if (size < 65536) {
+    ws_head.payload = 126;
+    uint16_t v = sylar::byteswapOnLittleEndian((uint16_t)size);
+    memcpy(buf + len, &v, sizeof(v));
+    len += sizeof(v);
+  } else {
+    ws_head.payload = 127;
+    uint64_t v = sylar::byteswapOnLittleEndian(size);
+    memcpy(buf + len, &v, sizeof(v));
+    len += sizeof(v);
+  }
+  memcpy(buf, &ws_head, sizeof(ws_head));
+  if (client) {
+    memcpy(buf + len, mask, 4);
+    len += 4;
+  }
+  return len;
+}
+
+static uint64_t ws_read_length(Stream* stream, const WSFrameHead& ws_head,
+                               bool& ok) {
+  ok = true;
+  if (ws_head.payload == 126) {
+    // 当头部 payload 的字段为 126 时，后面紧跟的是 16 位无符号整数
+    // 表示的是 payload 的实际长度
+    uint16_t len = 0;
+    if (stream->readFixSize(&len, sizeof(len)) <= 0) {
+      ok = false;
+      return 0;
+    }
+    return sylar::byteswapOnLittleEndian(len);
+  } else if (ws_head.payload == 127) {
+    // 当头部 payload 字段为 127 时，后面紧跟的是 64 位无符号整数
+    // 表示的是 payload 的实际长度
+    uint64_t len = 0;
+    if (stream->readFixSize(&len, sizeof(len)) <= 0) {
+      ok = false;
+      return 0;
+    }
+    return sylar::byteswapOnLittleEndian(len);
+  }
+  // 否则的话，payload字段 就是 payload 的实际长度
+  return ws_head.payload;
+}
+
+WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client,
+                                  WSFrameWriter* writer, WSDeflate* deflate) {
   int opcode = 0;
+  bool compressed = false;
   std::string data;
   int cur_len = 0;
   do {
@@ -104,15 +229,50 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
       break;
     }
     SYLAR_LOG_DEBUG(g_logger) << "WSFrameHead " << ws_head.toString();
+    if (ws_head.rsv2 || ws_head.rsv3) {
+      SYLAR_LOG_INFO(g_logger) << "WSFrameHead rsv2/rsv3 != 0";
+      break;
+    }
+    if (ws_head.rsv1) {
+      // permessage-deflate 只在消息的第一个数据帧上置 RSV1
+      if (!deflate || opcode || (ws_head.opcode != WSFrameHead::TEXT_FRAME &&
+                                 ws_head.opcode != WSFrameHead::BIN_FRAME)) {
+        SYLAR_LOG_INFO(g_logger) << "WSFrameHead unexpected rsv1";
+        break;
+      }
+      compressed = true;
+    }
 
-    if (ws_head.opcode == WSFrameHead::PING) {
-      SYLAR_LOG_INFO(g_logger) << "PING";
-      if (WSPong(stream) <= 0) {
-        // ping pong回复
+    if (ws_head.opcode == WSFrameHead::PING ||
+        ws_head.opcode == WSFrameHead::PONG) {
+      // 控制帧的 payload 不超过 125 字节, 需要读出以免影响后续帧
+      bool ok = false;
+      uint64_t length = ws_read_length(stream, ws_head, ok);
+      if (!ok || length > 125) {
         break;
       }
-    } else if (ws_head.opcode == WSFrameHead::PONG) {
-      // do nothing
+      char mask[4] = {0};
+      if (ws_head.mask && stream->readFixSize(mask, sizeof(mask)) <= 0) {
+        break;
+      }
+      std::string payload(length, '\0');
+      if (length > 0 && stream->readFixSize(&payload[0], length) <= 0) {
+        break;
+      }
+      if (ws_head.opcode == WSFrameHead::PING) {
+        SYLAR_LOG_INFO(g_logger) << "PING";
+        if (ws_head.mask) {
+          WSMask(&payload[0], length, mask);
+        }
+        // ping pong回复, 带回 ping 的 payload
+        auto pong =
+            std::make_shared<WSFrameMessage>(WSFrameHead::PONG, payload);
+        int32_t rt = writer ? writer->send(stream, pong, client)
+                            : WSSendMessage(stream, pong, client, true);
+        if (rt < 0) {
+          return nullptr;
+        }
+      }
     } else if (ws_head.opcode == WSFrameHead::CONTINUE ||
                ws_head.opcode == WSFrameHead::TEXT_FRAME ||
                ws_head.opcode == WSFrameHead::BIN_FRAME) {
@@ -121,26 +281,10 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
         SYLAR_LOG_INFO(g_logger) << "WSFrameHead mask != 1";
         break;
       }
-      uint64_t length = 0;
-      if (ws_head.payload == 126) {
-        // 当头部 payload 的字段为 126 时，后面紧跟的是 16 位无符号整数
-        // 表示的是 payload 的实际长度
-        uint16_t len = 0;
-        if (stream->readFixSize(&len, sizeof(len)) <= 0) {
-          break;
-        }
-        length = sylar::byteswapOnLittleEndian(len);
-      } else if (ws_head.payload == 127) {
-        // 当头部 payload 字段为 127 时，后面紧跟的是 64 位无符号整数
-        // 表示的是 payload 的实际长度
-        uint64_t len = 0;
-        if (stream->readFixSize(&len, sizeof(len)) <= 0) {
-          break;
-        }
-        length = sylar::byteswapOnLittleEndian(len);
-      } else {
-        // 否则的话，payload字段 就是 payload 的实际长度
-        length = ws_head.payload;
+      bool ok = false;
+      uint64_t length = ws_read_length(stream, ws_head, ok);
+      if (!ok) {
+        break;
       }
 
       if ((cur_len + length) >= g_websocket_message_max_size->getValue()) {
@@ -157,14 +301,12 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
         }
       }
       data.resize(cur_len + length);
-      if (stream->readFixSize(&data[cur_len], length) <= 0) {
+      if (length > 0 && stream->readFixSize(&data[cur_len], length) <= 0) {
         break;
       }
       if (ws_head.mask) {
-        for (int i = 0; i < (int)length; ++i) {
-          // 填充异或掩码后的值
-          data[cur_len + i] ^= mask[i % 4];
-        }
+        // 填充异或掩码后的值
+        WSMask(&data[cur_len], length, mask);
       }
       cur_len += length;
 
@@ -175,6 +317,14 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
 
       if (ws_head.fin) {
         // 拼帧结束，得到完成的数据包
+        if (compressed) {
+          std::string out;
+          if (!deflate->decompress(data, out,
+                                   g_websocket_message_max_size->getValue())) {
+            break;
+          }
+          data.swap(out);
+        }
         SYLAR_LOG_DEBUG(g_logger) << data;
         return std::make_shared<WSFrameMessage>(opcode, std::move(data));
       }
@@ -188,60 +338,270 @@ WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client) {
 
 int32_t WSSendMessage(Stream* stream, WSFrameMessage::ptr msg, bool client,
                       bool fin) {
-  do {
-    WSFrameHead ws_head;
-    memset(&ws_head, 0, sizeof(ws_head));
-    ws_head.fin = fin;
-    ws_head.opcode = msg->getOpcode();
-    ws_head.mask = client;
-    uint64_t size = msg->getData().size();
-    if (size < 126) {
-      ws_head.payload = size;
-    } else if (size < 65536) {
-      ws_head.payload = 126;
-    } else {
-      ws_head.payload = 127;
+  const std::string& data = msg->getData();
+  uint64_t size = data.size();
+  char head[14];
+  char mask[4] = {0};
+  std::string masked;
+  iovec iovs[2];
+  if (client) {
+    uint32_t rand_value = rand();
+    memcpy(mask, &rand_value, sizeof(mask));
+    masked.resize(size);
+    WSMask(&masked[0], data.c_str(), size, mask);
+    iovs[1].iov_base = (void*)masked.c_str();
+  } else {
+    iovs[1].iov_base = (void*)data.c_str();
+  }
+  iovs[1].iov_len = size;
+  iovs[0].iov_base = head;
+  iovs[0].iov_len =
+      ws_encode_head(head, msg->getOpcode(), fin, client, size, mask);
+  // 帧头和 payload 一次写出
+  if (stream->writevFixSize(iovs, size ? 2 : 1) <= 0) {
+    stream->close();
+    return -1;
+  }
+  return size + iovs[0].iov_len;
+}
+
+size_t WSFrameWriter::addFrame(WSFrameMessage::ptr msg, bool client,
+                               bool fin) {
+  Frame frame;
+  frame.msg = msg;
+  int opcode = msg->getOpcode();
+  const std::string& data = msg->getData();
+  char mask[4] = {0};
+  if (client) {
+    uint32_t rand_value = rand();
+    memcpy(mask, &rand_value, sizeof(mask));
+  }
+  // 只压缩完整的(未分片)文本/二进制消息
+  if (m_deflate && fin &&
+      (opcode == WSFrameHead::TEXT_FRAME || opcode == WSFrameHead::BIN_FRAME) &&
+      m_deflate->needCompress(data.size())) {
+    sylar::Mutex::Lock lock(m_deflateMutex);
+    if (m_deflate->compress(data, frame.data)) {
+      frame.hasData = true;
+      if (client) {
+        WSMask(&frame.data[0], frame.data.size(), mask);
+      }
+      frame.headLen = ws_encode_head(frame.head, opcode, fin, client,
+                                     frame.data.size(), mask, true);
+      // 持有 m_deflateMutex 入队, 保证发送顺序与压缩顺序一致
+      size_t size = frame.size();
+      pushFrame(frame, opcode, fin);
+      return size;
     }
+  }
+  if (client) {
+    frame.hasData = true;
+    frame.data.resize(data.size());
+    WSMask(&frame.data[0], data.c_str(), data.size(), mask);
+  }
+  frame.headLen =
+      ws_encode_head(frame.head, opcode, fin, client, data.size(), mask);
+  size_t size = frame.size();
+  pushFrame(frame, opcode, fin);
+  return size;
+}
 
-    if (stream->writeFixSize(&ws_head, sizeof(ws_head)) <= 0) {
-      break;
+void WSFrameWriter::pushFrame(Frame& frame, int opcode, bool fin) {
+  MutexType::Lock lock(m_mutex);
+  ++m_pushSeq;
+  m_queuedBytes += frame.size();
+  m_frames.push_back(std::move(frame));
+  // 控制帧可以插在分片之间, 数据帧决定分片消息的开始和结束
+  if (opcode & 0x8) {
+    return;
+  }
+  if (!fin) {
+    m_fragmenting = true;
+  } else if (m_fragmenting) {
+    m_fragmenting = false;
+    for (auto& i : m_held) {
+      m_frames.push_back(std::move(i));
     }
-    if (ws_head.payload == 126) {
-      uint16_t len = size;
-      len = sylar::byteswapOnLittleEndian(len);
-      if (stream->writeFixSize(&len, sizeof(len)) <= 0) {
-        break;
-      }
-    } else if (ws_head.payload == 127) {
-      uint64_t len = sylar::byteswapOnLittleEndian(size);
-      if (stream->writeFixSize(&len, sizeof(len)) <= 0) {
-        break;
-      }
+    m_held.clear();
+  }
+}
+
+WSFrameWriter::PostResult WSFrameWriter::post(Stream::ptr stream,
+                                              WSEncodedFrame::ptr frame,
+                                              uint64_t max_queue_bytes,
+                                              OverflowPolicy policy,
+                                              Scheduler* scheduler,
+                                              int thread) {
+  MutexType::Lock lock(m_mutex);
+  if (max_queue_bytes && m_queuedBytes + frame->size() > max_queue_bytes) {
+    if (policy == CLOSE) {
+      return OVERFLOW;
     }
-    if (client) {
-      char mask[4];
-      uint32_t rand_value = rand();
-      memcpy(mask, &rand_value, sizeof(mask));
-      std::string& data = msg->getData();
-      for (size_t i = 0; i < data.size(); ++i) {
-        data[i] ^= mask[i % 4];
+    if (policy == DROP_OLDEST) {
+      // 只能丢弃完整的预编码帧, 普通帧可能是分片的一部分
+      for (auto q : {&m_frames, &m_held}) {
+        for (auto it = q->begin();
+             it != q->end() &&
+             m_queuedBytes + frame->size() > max_queue_bytes;) {
+          if (it->encoded) {
+            m_queuedBytes -= it->size();
+            it = q->erase(it);
+          } else {
+            ++it;
+          }
+        }
       }
+    }
+    if (m_queuedBytes + frame->size() > max_queue_bytes) {
+      return DROPPED;
+    }
+  }
+  Frame f;
+  f.headLen = 0;
+  f.encoded = frame;
+  m_queuedBytes += f.size();
+  if (m_fragmenting) {
+    // 分片消息发送中, 等 FIN 帧入队后再放入发送队列, 由发送 FIN 的协程写出
+    m_held.push_back(std::move(f));
+    return POSTED;
+  }
+  m_frames.push_back(std::move(f));
+  if (m_sending) {
+    return POSTED;
+  }
+  // 由这里安排写出, 调用方无需也无法遗漏 flush, 否则之后的 send 会一直等待
+  m_sending = true;
+  lock.unlock();
+  if (!scheduler) {
+    scheduler = Scheduler::GetThis();
+  }
+  if (scheduler) {
+    // stream 持有本 writer, 写出完成前保持存活
+    scheduler->schedule([this, stream]() { flush(stream.get()); }, thread);
+  } else {
+    flush(stream.get());
+  }
+  return POSTED;
+}
 
-      if (stream->writeFixSize(mask, sizeof(mask)) <= 0) {
-        break;
+int32_t WSFrameWriter::flush(Stream* stream) {
+  MutexType::Lock lock(m_mutex);
+  return doFlush(stream, lock);
+}
+
+int32_t WSFrameWriter::send(Stream* stream, WSFrameMessage::ptr msg,
+                            bool client, bool fin) {
+  int32_t size = addFrame(msg, client, fin);
+  MutexType::Lock lock(m_mutex);
+  return sendQueued(stream, lock) < 0 ? -1 : size;
+}
+
+int32_t WSFrameWriter::send(Stream* stream,
+                            const std::vector<WSFrameMessage::ptr>& msgs,
+                            bool client) {
+  int32_t total = 0;
+  for (auto& i : msgs) {
+    total += addFrame(i, client, true);
+  }
+  MutexType::Lock lock(m_mutex);
+  return sendQueued(stream, lock) < 0 ? -1 : total;
+}
+
+int32_t WSFrameWriter::sendQueued(Stream* stream, MutexType::Lock& lock) {
+  if (!m_sending) {
+    m_sending = true;
+    return doFlush(stream, lock);
+  }
+  // 正在写出的协程会把已入队的帧一起发送, 等到写出这一批后返回其结果
+  auto waiter = std::make_shared<Waiter>();
+  waiter->seq = m_pushSeq;
+  m_waiters.push_back(waiter);
+  lock.unlock();
+  waiter->sem.wait();
+  return waiter->result;
+}
+
+void WSFrameWriter::wakeWaiters(uint64_t seq, int32_t result,
+                                MutexType::Lock& lock) {
+  std::vector<std::shared_ptr<Waiter>> waiters;
+  for (auto it = m_waiters.begin(); it != m_waiters.end();) {
+    if ((*it)->seq <= seq) {
+      (*it)->result = result;
+      waiters.push_back(*it);
+      it = m_waiters.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (waiters.empty()) {
+    return;
+  }
+  lock.unlock();
+  for (auto& i : waiters) {
+    i->sem.notify();
+  }
+  lock.lock();
+}
+
+int32_t WSFrameWriter::doFlush(Stream* stream, MutexType::Lock& lock) {
+  std::deque<Frame> frames;
+  std::vector<iovec> iovs;
+  while (!m_frames.empty()) {
+    frames.clear();
+    frames.swap(m_frames);
+    // 这一批包含序号不超过 seq 的所有 send 帧
+    uint64_t seq = m_pushSeq;
+    lock.unlock();
+
+    // 写出完成前这些字节仍计入 m_queuedBytes
+    uint64_t bytes = 0;
+    iovs.clear();
+    iovs.reserve(frames.size() * 2);
+    for (auto& i : frames) {
+      bytes += i.size();
+      iovec iov;
+      if (i.encoded) {
+        iov.iov_base = (void*)i.encoded->getData().c_str();
+        iov.iov_len = i.encoded->size();
+        iovs.push_back(iov);
+        continue;
+      }
+      iov.iov_base = i.head;
+      iov.iov_len = i.headLen;
+      iovs.push_back(iov);
+      const std::string& data = i.payload();
+      if (!data.empty()) {
+        iov.iov_base = (void*)data.c_str();
+        iov.iov_len = data.size();
+        iovs.push_back(iov);
       }
     }
-    if (stream->writeFixSize(msg->getData().c_str(), size) <= 0) {
-      break;
+    int rt = stream->writevFixSize(&iovs[0], iovs.size());
+
+    lock.lock();
+    if (rt <= 0) {
+      m_frames.clear();
+      m_held.clear();
+      m_queuedBytes = 0;
+      m_sending = false;
+      wakeWaiters(UINT64_MAX, -1, lock);
+      lock.unlock();
+      stream->close();
+      return -1;
     }
-    return size + sizeof(ws_head);
-  } while (0);
-  stream->close();
-  return -1;
+    m_queuedBytes -= bytes;
+    wakeWaiters(seq, 0, lock);
+  }
+  m_sending = false;
+  return 0;
 }
 
 int32_t WSSession::pong() {
-  return WSPong(this);
+  if (!isConnected()) {
+    return -1;
+  }
+  auto msg = std::make_shared<WSFrameMessage>(WSFrameHead::PONG);
+  return m_writer.send(this, msg, false);
 }
 
 int32_t WSPing(Stream* stream) {
@@ -2,8 +2,11 @@
 #define __SYLAR_HTTP_WS_SESSION_H__
 
 #include <stdint.h>
+#include <deque>
+#include <list>
 #include "sylar/config.h"
 #include "sylar/http/http_session.h"
+#include "sylar/http/ws_deflate.h"
 #include "sylar/streams/socket_stream.h"
 
 namespace sylar {
@@ -58,7 +61,147 @@ class WSFrameMessage {
   std::string m_data;
 };
 
-class WSSession : public HttpSession {
+/**
+ * @brief 预先编码好的服务端帧(帧头 + payload)
+ * @details 广播时只编码一次, 由多个连接按引用共享写出。
+ *          服务端帧不带掩码, 客户端帧每帧的掩码不同, 不能共享
+ */
+class WSEncodedFrame {
+ public:
+  typedef std::shared_ptr<WSEncodedFrame> ptr;
+  WSEncodedFrame(int opcode, const std::string& data);
+
+  const std::string& getData() const { return m_data; }
+  size_t size() const { return m_data.size(); }
+
+ private:
+  std::string m_data;
+};
+
+/**
+ * @brief 帧发送器, 合并同一连接上并发发送的帧
+ * @details 帧头与 payload 通过 writev 一次写出。多个协程同时发送时,
+ *          第一个进入的协程负责写出, 其余协程的帧追加到队列后立即返回,
+ *          由写出协程在下一轮 writev 中一并发送, 同时保证帧之间不会交错。
+ *          入队后的消息在写出前不能再修改。
+ *          设置了 WSDeflate 时, 完整的文本/二进制消息按阈值压缩,
+ *          压缩与入队在同一把锁内完成, 保证共享窗口的压缩顺序与发送顺序一致
+ */
+class WSFrameWriter {
+ public:
+  typedef Spinlock MutexType;
+
+  /**
+   * @brief post 时队列超过上限的处理方式
+   */
+  enum OverflowPolicy {
+    /// 丢弃新的帧
+    DROP_NEW = 0,
+    /// 丢弃队列中最早的预编码帧
+    DROP_OLDEST = 1,
+    /// 视为慢消费者, 由调用方断开连接
+    CLOSE = 2
+  };
+
+  enum PostResult {
+    /// 已入队, 由正在写出的协程或者 post 安排的协程写出
+    POSTED = 0,
+    /// 队列已满, 帧被丢弃
+    DROPPED = 1,
+    /// 队列已满, 策略为 CLOSE
+    OVERFLOW = 2
+  };
+
+  /**
+   * @brief 发送帧, 其它协程正在写出时由它一起写出, 当前协程等到写完再返回
+   * @return 写出的帧长度(帧头 + payload), 与 WSSendMessage 相同,
+   *         失败返回 -1 并关闭 stream
+   */
+  int32_t send(Stream* stream, WSFrameMessage::ptr msg, bool client,
+               bool fin = true);
+  int32_t send(Stream* stream, const std::vector<WSFrameMessage::ptr>& msgs,
+               bool client);
+
+  /**
+   * @brief 预编码帧入队, 不会阻塞调用协程
+   * @details 没有协程在写出时, 在 scheduler 上调度一个协程写出, scheduler
+   *          为空且不在调度器中时直接写出。分片消息(fin=false 的 send)
+   *          未结束时暂存, FIN 帧之后再写出, 不会插在分片之间
+   * @param[in] stream 本 writer 所属的 stream, 写出期间保持存活
+   * @param[in] max_queue_bytes 未写出数据的上限, 0 表示不限制
+   * @param[in] scheduler 写出协程的调度器, 为空时使用当前调度器
+   * @param[in] thread 写出协程的线程, -1 表示任意线程
+   */
+  PostResult post(Stream::ptr stream, WSEncodedFrame::ptr frame,
+                  uint64_t max_queue_bytes, OverflowPolicy policy,
+                  Scheduler* scheduler = nullptr, int thread = -1);
+
+  /**
+   * @brief 已入队尚未写完的字节数, 包括正在写出的一批
+   */
+  uint64_t getQueuedBytes() const { return m_queuedBytes; }
+
+  WSDeflate::ptr getDeflate() const { return m_deflate; }
+  /**
+   * @brief 设置 permessage-deflate, 需要在开始发送前调用
+   */
+  void setDeflate(WSDeflate::ptr v) { m_deflate = v; }
+
+ private:
+  struct Frame {
+    // 最长 2 字节头 + 8 字节长度 + 4 字节掩码
+    char head[14];
+    uint8_t headLen;
+    WSFrameMessage::ptr msg;
+    // 压缩或掩码后的 payload, 不修改原消息
+    std::string data;
+    bool hasData = false;
+    // 预编码帧, 不为空时忽略以上字段
+    WSEncodedFrame::ptr encoded;
+
+    const std::string& payload() const {
+      return hasData ? data : msg->getData();
+    }
+    size_t size() const {
+      return encoded ? encoded->size() : headLen + payload().size();
+    }
+  };
+
+  /**
+   * @return 帧长度(帧头 + payload)
+   */
+  size_t addFrame(WSFrameMessage::ptr msg, bool client, bool fin);
+  // send 等待写出的协程, seq 为入队时的 m_pushSeq
+  struct Waiter {
+    uint64_t seq = 0;
+    int32_t result = 0;
+    FiberSemaphore sem;
+  };
+
+  void pushFrame(Frame& frame, int opcode, bool fin);
+  int32_t flush(Stream* stream);
+  int32_t sendQueued(Stream* stream, MutexType::Lock& lock);
+  void wakeWaiters(uint64_t seq, int32_t result, MutexType::Lock& lock);
+  int32_t doFlush(Stream* stream, MutexType::Lock& lock);
+
+ private:
+  MutexType m_mutex;
+  std::deque<Frame> m_frames;
+  // 分片消息发送期间 post 的预编码帧
+  std::deque<Frame> m_held;
+  bool m_fragmenting = false;
+  uint64_t m_queuedBytes = 0;
+  bool m_sending = false;
+  // send 入队的帧数, 用于判断等待的帧是否已写出
+  uint64_t m_pushSeq = 0;
+  std::list<std::shared_ptr<Waiter>> m_waiters;
+  // 压缩耗时较长, 使用单独的互斥量
+  Mutex m_deflateMutex;
+  WSDeflate::ptr m_deflate;
+};
+
+class WSSession : public HttpSession,
+                  public std::enable_shared_from_this<WSSession> {
  public:
   typedef std::shared_ptr<WSSession> ptr;
   WSSession(Socket::ptr sock, bool owner = true);
@@ -67,20 +210,66 @@ class WSSession : public HttpSession {
   HttpRequest::ptr handleShake();
 
   WSFrameMessage::ptr recvMessage();
+  /**
+   * @return 写出的帧长度(帧头 + payload), 失败返回 -1
+   */
   int32_t sendMessage(WSFrameMessage::ptr msg, bool fin = true);
   int32_t sendMessage(const std::string& msg,
                       int32_t opcode = WSFrameHead::TEXT_FRAME,
                       bool fin = true);
+  /**
+   * @brief 批量发送, 所有帧合并为一次 writev
+   */
+  int32_t sendMessages(const std::vector<WSFrameMessage::ptr>& msgs);
   int32_t ping();
   int32_t pong();
 
+  /**
+   * @brief 握手协商出的 permessage-deflate, 未启用时为空
+   */
+  WSDeflate::ptr getDeflate() const { return m_deflate; }
+
+  /**
+   * @brief 非阻塞地发送预编码帧, 见 WSFrameWriter::post
+   */
+  WSFrameWriter::PostResult postFrame(WSEncodedFrame::ptr frame,
+                                      uint64_t max_queue_bytes,
+                                      WSFrameWriter::OverflowPolicy policy,
+                                      Scheduler* scheduler = nullptr,
+                                      int thread = -1) {
+    return m_writer.post(shared_from_this(), frame, max_queue_bytes, policy,
+                         scheduler, thread);
+  }
+
  private:
   bool handleServerShake();
   bool handleClientShake();
+
+ private:
+  WSFrameWriter m_writer;
+  WSDeflate::ptr m_deflate;
 };
 
 extern sylar::ConfigVar<uint32_t>::ptr g_websocket_message_max_size;
-WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client);
+
+/**
+ * @brief 按 RFC 6455 5.3 对 payload 加/去掩码(两者相同)
+ * @details 按 8 字节一组异或, 不足 8 字节的尾部按字节处理
+ * @param[in] mask 4 字节掩码
+ */
+void WSMask(void* data, size_t len, const char* mask);
+/**
+ * @brief 掩码后写入 dst, src 保持不变
+ */
+void WSMask(void* dst, const void* src, size_t len, const char* mask);
+
+/**
+ * @param[in] writer 回复 PONG 使用的发送器, 为空时直接写 stream
+ * @param[in] deflate 协商出的 permessage-deflate, 用于解压 RSV1 消息
+ */
+WSFrameMessage::ptr WSRecvMessage(Stream* stream, bool client,
+                                  WSFrameWriter* writer = nullptr,
+                                  WSDeflate* deflate = nullptr);
 int32_t WSSendMessage(Stream* stream, WSFrameMessage::ptr msg, bool client,
                       bool fin);
 int32_t WSPing(Stream* stream);
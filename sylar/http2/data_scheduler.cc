@@ -0,0 +1,289 @@
+#include "data_scheduler.h"
+
+namespace sylar {
+namespace http2 {
+
+const uint8_t DataScheduler::DEFAULT_URGENCY;
+const uint32_t DataScheduler::DEFAULT_WEIGHT;
+const int64_t DataScheduler::MAX_WINDOW_SIZE;
+
+// 计算虚拟时间时把帧头也算作发送量, 避免空帧不推进虚拟时间
+static const uint64_t FRAME_OVERHEAD = 9;
+
+// 连接窗口的初始值固定为 65535, 不受 SETTINGS 影响
+static const int64_t INITIAL_CONN_WINDOW = 65535;
+
+DataScheduler::DataScheduler() : m_connWindow(INITIAL_CONN_WINDOW) {}
+
+DataScheduler::Entry* DataScheduler::get(uint32_t id) {
+  auto it = m_entries.find(id);
+  return it == m_entries.end() ? nullptr : &it->second;
+}
+
+DataScheduler::Entry* DataScheduler::getOrCreate(uint32_t id, int64_t window) {
+  Entry* e = get(id);
+  if (!e) {
+    // 流已被 reset 或者未经 open, 数据发完后删除
+    e = &m_entries[id];
+    e->id = id;
+    e->window = window;
+    e->released = true;
+  } else if (e->expects) {
+    --e->expects;
+  }
+  return e;
+}
+
+void DataScheduler::deactivate(Entry* e) {
+  if (e->active) {
+    m_active.erase(Key(e->urgency, e->vtime, e->id));
+    e->active = false;
+  }
+}
+
+void DataScheduler::update(Entry* e) {
+  // 有数据且流窗口可用(或只剩 END_STREAM)的流才参与调度
+  bool sendable = e->hasData() && (e->window > 0 || e->pending() == 0);
+  if (sendable == e->active) {
+    return;
+  }
+  if (sendable) {
+    // 空闲后重新加入的流不能带着过去的虚拟时间插队
+    e->vtime = std::max(e->vtime, m_vtime);
+    m_active.insert(Key(e->urgency, e->vtime, e->id));
+    e->active = true;
+  } else {
+    deactivate(e);
+  }
+}
+
+void DataScheduler::eraseIfDone(Entry* e) {
+  if (e->released && !e->hasData() && e->expects == 0) {
+    deactivate(e);
+    m_entries.erase(e->id);
+  }
+}
+
+void DataScheduler::open(uint32_t id, int64_t window) {
+  MutexType::Lock lock(m_mutex);
+  Entry& e = m_entries[id];
+  e.id = id;
+  e.window = window;
+}
+
+void DataScheduler::release(uint32_t id) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = get(id);
+  if (e) {
+    e->released = true;
+    eraseIfDone(e);
+  }
+}
+
+void DataScheduler::reset(uint32_t id) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = get(id);
+  if (e) {
+    deactivate(e);
+    m_entries.erase(id);
+  }
+}
+
+void DataScheduler::clear() {
+  MutexType::Lock lock(m_mutex);
+  m_entries.clear();
+  m_active.clear();
+  m_connWindow = INITIAL_CONN_WINDOW;
+  m_vtime = 0;
+}
+
+void DataScheduler::expect(uint32_t id) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = get(id);
+  if (e) {
+    ++e->expects;
+  }
+}
+
+void DataScheduler::push(uint32_t id, std::string data, bool end_stream,
+                         int64_t window) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = getOrCreate(id, window);
+  if (e->offset > 0 && e->offset == e->data.size()) {
+    e->data.clear();
+    e->offset = 0;
+  }
+  if (e->data.empty()) {
+    e->data.swap(data);
+  } else {
+    e->data.append(data);
+  }
+  e->endStream = e->endStream || end_stream;
+  update(e);
+}
+
+void DataScheduler::pushTrailers(uint32_t id, const Headers& trailers,
+                                 int64_t window) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = getOrCreate(id, window);
+  e->trailers = trailers;
+  e->hasTrailers = true;
+  update(e);
+}
+
+bool DataScheduler::updateWindow(uint32_t id, uint32_t increment) {
+  MutexType::Lock lock(m_mutex);
+  if (id == 0) {
+    m_connWindow += increment;
+    return m_connWindow <= MAX_WINDOW_SIZE;
+  }
+  Entry* e = get(id);
+  if (!e) {
+    // 已经发送完成的流, 忽略
+    return true;
+  }
+  e->window += increment;
+  update(e);
+  return e->window <= MAX_WINDOW_SIZE;
+}
+
+bool DataScheduler::updateInitialWindow(int64_t delta) {
+  MutexType::Lock lock(m_mutex);
+  bool ok = true;
+  for (auto& i : m_entries) {
+    i.second.window += delta;
+    if (i.second.window > MAX_WINDOW_SIZE) {
+      ok = false;
+    }
+    update(&i.second);
+  }
+  return ok;
+}
+
+void DataScheduler::setWeight(uint32_t id, uint32_t weight) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = get(id);
+  if (!e || weight == 0) {
+    return;
+  }
+  e->weight = weight;
+}
+
+void DataScheduler::setUrgency(uint32_t id, uint8_t urgency,
+                               bool incremental) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = get(id);
+  if (!e) {
+    return;
+  }
+  bool active = e->active;
+  deactivate(e);
+  e->urgency = std::min(urgency, (uint8_t)7);
+  e->incremental = incremental;
+  if (active) {
+    update(e);
+  }
+}
+
+std::set<DataScheduler::Key>::iterator DataScheduler::findSendable() {
+  if (m_connWindow > 0) {
+    return m_active.begin();
+  }
+  // 连接窗口用尽时, 只有空的 END_STREAM 帧和 trailers 不占用窗口,
+  // 跳过还有数据待发的流, 它们等待 WINDOW_UPDATE
+  for (auto it = m_active.begin(); it != m_active.end(); ++it) {
+    Entry* e = get(std::get<2>(*it));
+    if (e->pending() == 0) {
+      return it;
+    }
+  }
+  return m_active.end();
+}
+
+Frame::ptr DataScheduler::next(uint32_t max_frame_size, Headers* trailers) {
+  MutexType::Lock lock(m_mutex);
+  auto it = findSendable();
+  if (it == m_active.end()) {
+    return nullptr;
+  }
+  Entry* e = get(std::get<2>(*it));
+  if (e->pending() == 0 && e->hasTrailers) {
+    // 数据已发完, trailers 不受流控限制
+    m_active.erase(it);
+    e->active = false;
+    Frame::ptr frame = std::make_shared<Frame>();
+    frame->header.type = (uint8_t)FrameType::HEADERS;
+    frame->header.flags = (uint8_t)FrameFlagHeaders::END_HEADERS |
+                          (uint8_t)FrameFlagHeaders::END_STREAM;
+    frame->header.identifier = e->id;
+    if (trailers) {
+      trailers->swap(e->trailers);
+    }
+    e->trailers.clear();
+    e->hasTrailers = false;
+    e->endStream = false;
+    eraseIfDone(e);
+    return frame;
+  }
+  int64_t n = std::min((int64_t)e->pending(), (int64_t)max_frame_size);
+  n = std::min(n, std::min(e->window, m_connWindow));
+  // 只剩 END_STREAM 的流窗口可能已经为负, 发送空帧
+  n = std::max(n, (int64_t)0);
+  m_active.erase(it);
+  e->active = false;
+
+  Frame::ptr frame = std::make_shared<Frame>();
+  frame->header.type = (uint8_t)FrameType::DATA;
+  frame->header.identifier = e->id;
+  auto data = std::make_shared<DataFrame>();
+  data->data = e->data.substr(e->offset, n);
+  frame->data = data;
+
+  e->offset += n;
+  e->window -= n;
+  m_connWindow -= n;
+  if (e->pending() == 0) {
+    e->data.clear();
+    e->offset = 0;
+    if (e->endStream) {
+      frame->header.flags = (uint8_t)FrameFlagData::END_STREAM;
+      e->endStream = false;
+    }
+  }
+
+  m_vtime = e->vtime;
+  if (e->incremental) {
+    e->vtime += (n + FRAME_OVERHEAD) * 256 / e->weight;
+  }
+  update(e);
+  eraseIfDone(e);
+  return frame;
+}
+
+bool DataScheduler::hasSendable() {
+  MutexType::Lock lock(m_mutex);
+  return findSendable() != m_active.end();
+}
+
+int64_t DataScheduler::getConnWindow() {
+  MutexType::Lock lock(m_mutex);
+  return m_connWindow;
+}
+
+int64_t DataScheduler::getStreamWindow(uint32_t id) {
+  MutexType::Lock lock(m_mutex);
+  Entry* e = get(id);
+  return e ? e->window : 0;
+}
+
+size_t DataScheduler::getPendingSize() {
+  MutexType::Lock lock(m_mutex);
+  size_t size = 0;
+  for (auto& i : m_entries) {
+    size += i.second.pending();
+  }
+  return size;
+}
+
+}  // namespace http2
+}  // namespace sylar
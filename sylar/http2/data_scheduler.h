@@ -0,0 +1,141 @@
+#ifndef __SYLAR_HTTP2_DATA_SCHEDULER_H__
+#define __SYLAR_HTTP2_DATA_SCHEDULER_H__
+
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "frame.h"
+#include "sylar/mutex.h"
+
+namespace sylar {
+namespace http2 {
+
+/**
+ * @brief DATA 帧的流控与调度
+ * @details - 连接级和流级的发送窗口(RFC 7540 6.9), 窗口用尽的流暂停调度,
+ *            收到 WINDOW_UPDATE 后恢复
+ *          - 先按 urgency(RFC 9218, 0 最高)严格分级, 同一级内按虚拟时间做
+ *            加权公平调度: 流每发送 n 字节, 虚拟时间增加 n * 256 / weight,
+ *            每次选择虚拟时间最小的流。新加入的流从当前虚拟时间开始,
+ *            因此小响应会插在大响应之前尽快发完
+ *          - weight 来自 PRIORITY 帧或 HEADERS 的优先级字段(依赖关系忽略);
+ *            请求头 priority 中显式声明为非增量(没有 i)的流不推进虚拟时间,
+ *            同级内按到达顺序独占发送
+ */
+class DataScheduler {
+ public:
+  typedef Spinlock MutexType;
+  typedef std::vector<std::pair<std::string, std::string>> Headers;
+
+  static const uint8_t DEFAULT_URGENCY = 3;
+  static const uint32_t DEFAULT_WEIGHT = 16;
+  static const int64_t MAX_WINDOW_SIZE = 0x7FFFFFFF;
+
+  DataScheduler();
+
+  /**
+   * @brief 新建流, window 为对端的 INITIAL_WINDOW_SIZE
+   */
+  void open(uint32_t id, int64_t window);
+
+  /**
+   * @brief 流不再使用, 待发送数据发完后删除
+   */
+  void release(uint32_t id);
+
+  /**
+   * @brief 丢弃流的待发送数据并删除(RST_STREAM)
+   */
+  void reset(uint32_t id);
+
+  /**
+   * @brief 删除所有流并恢复连接窗口, 用于重连
+   */
+  void clear();
+
+  /**
+   * @brief 声明将要 push 的数据, 在 push 之前 release 不会删除流
+   */
+  void expect(uint32_t id);
+
+  /**
+   * @brief 追加待发送数据, 没有积压时直接接管 data 的内存
+   * @param[in] window 流不存在时使用的初始窗口
+   */
+  void push(uint32_t id, std::string data, bool end_stream, int64_t window);
+
+  /**
+   * @brief 设置 trailers, 在流的数据发送完后作为带 END_STREAM 的 HEADERS 帧取出
+   */
+  void pushTrailers(uint32_t id, const Headers& trailers, int64_t window);
+
+  /**
+   * @brief 处理 WINDOW_UPDATE, id 为 0 时更新连接窗口
+   * @return 窗口超过 2^31-1 时返回 false
+   */
+  bool updateWindow(uint32_t id, uint32_t increment);
+
+  /**
+   * @brief 对端修改 INITIAL_WINDOW_SIZE, 所有流的窗口增加 delta
+   */
+  bool updateInitialWindow(int64_t delta);
+
+  void setWeight(uint32_t id, uint32_t weight);
+  void setUrgency(uint32_t id, uint8_t urgency, bool incremental);
+
+  /**
+   * @brief 取出下一个可以发送的 DATA 帧
+   * @param[out] trailers 取出的是 trailers 的 HEADERS 帧时, 返回待编码的头部
+   * @details 连接窗口用尽时仍会取出空的 END_STREAM 帧和 trailers
+   * @return 没有可发送的数据或窗口用尽时返回 nullptr
+   */
+  Frame::ptr next(uint32_t max_frame_size, Headers* trailers = nullptr);
+
+  bool hasSendable();
+  int64_t getConnWindow();
+  int64_t getStreamWindow(uint32_t id);
+  size_t getPendingSize();
+
+ private:
+  struct Entry {
+    uint32_t id = 0;
+    int64_t window = 0;
+    std::string data;
+    size_t offset = 0;
+    bool endStream = false;
+    bool hasTrailers = false;
+    Headers trailers;
+    bool released = false;
+    uint32_t expects = 0;
+
+    uint8_t urgency = DEFAULT_URGENCY;
+    bool incremental = true;
+    uint32_t weight = DEFAULT_WEIGHT;
+    uint64_t vtime = 0;
+    bool active = false;
+
+    size_t pending() const { return data.size() - offset; }
+    bool hasData() const { return pending() > 0 || endStream || hasTrailers; }
+  };
+  typedef std::tuple<uint8_t, uint64_t, uint32_t> Key;
+
+  Entry* get(uint32_t id);
+  Entry* getOrCreate(uint32_t id, int64_t window);
+  void update(Entry* e);
+  void deactivate(Entry* e);
+  void eraseIfDone(Entry* e);
+  std::set<Key>::iterator findSendable();
+
+ private:
+  MutexType m_mutex;
+  std::unordered_map<uint32_t, Entry> m_entries;
+  std::set<Key> m_active;
+  int64_t m_connWindow;
+  uint64_t m_vtime = 0;
+};
+
+}  // namespace http2
+}  // namespace sylar
+
+#endif
@@ -74,63 +74,137 @@ static std::vector<std::pair<std::string, std::string>> s_static_headers = {
 #undef XX
 };
 
+namespace {
+
+// 静态表的索引: name -> 第一个同名表项, 以及同名的各个 value
+struct StaticIndex {
+  struct Item {
+    int32_t index = -1;
+    std::vector<std::pair<std::string, int32_t>> values;
+  };
+
+  StaticIndex() {
+    for (size_t i = 1; i < s_static_headers.size(); ++i) {
+      Item& item = items[s_static_headers[i].first];
+      if (item.index == -1) {
+        item.index = i;
+      }
+      item.values.push_back(std::make_pair(s_static_headers[i].second, i));
+    }
+  }
+
+  std::unordered_map<std::string, Item> items;
+};
+
+static StaticIndex& GetStaticIndex() {
+  static StaticIndex s_index;
+  return s_index;
+}
+
+}  // namespace
+
 std::pair<std::string, std::string> DynamicTable::GetStaticHeaders(
     uint32_t idx) {
   return s_static_headers[idx];
 }
 
 int32_t DynamicTable::GetStaticHeadersIndex(const std::string& name) {
-  for (int i = 1; i < (int)s_static_headers.size(); ++i) {
-    if (s_static_headers[i].first == name) {
-      return i;
-    }
-  }
-  return -1;
+  auto& items = GetStaticIndex().items;
+  auto it = items.find(name);
+  return it == items.end() ? -1 : it->second.index;
 }
 
 std::pair<int32_t, bool> DynamicTable::GetStaticHeadersPair(
     const std::string& name, const std::string& val) {
-  std::pair<int32_t, bool> rt = std::make_pair(-1, false);
-  for (int i = 0; i < (int)s_static_headers.size(); ++i) {
-    if (s_static_headers[i].first == name) {
-      if (rt.first == -1) {
-        rt.first = i;
-      }
-    } else {
-      continue;
-    }
-    if (s_static_headers[i].second == val) {
-      rt.first = i;
-      rt.second = true;
-      break;
+  auto& items = GetStaticIndex().items;
+  auto it = items.find(name);
+  if (it == items.end()) {
+    return std::make_pair(-1, false);
+  }
+  for (auto& i : it->second.values) {
+    if (i.first == val) {
+      return std::make_pair(i.second, true);
     }
   }
-  return rt;
+  return std::make_pair(it->second.index, false);
+}
+
+size_t DynamicTable::HashPair(const std::string& name,
+                              const std::string& value) {
+  std::hash<std::string> h;
+  size_t seed = h(name);
+  return seed ^ (h(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
 }
 
-DynamicTable::DynamicTable() : m_maxDataSize(4 * 1024), m_dataSize(0) {}
+DynamicTable::DynamicTable()
+    : m_maxDataSize(4 * 1024),
+      m_dataSize(0),
+      m_datas(16),
+      m_head(0),
+      m_count(0),
+      m_seq(0) {}
+
+void DynamicTable::evict() {
+  Entry& e = m_datas[m_head];
+  uint64_t seq = m_seq - m_count;
+  // 索引仍指向被淘汰的表项, 说明没有更新的同名表项
+  auto it = m_names.find(std::hash<std::string>()(e.first));
+  if (it != m_names.end() && it->second == seq) {
+    m_names.erase(it);
+  }
+  it = m_pairs.find(HashPair(e.first, e.second));
+  if (it != m_pairs.end() && it->second == seq) {
+    m_pairs.erase(it);
+  }
+  m_dataSize -= e.first.length() + e.second.length() + 32;
+  e = Entry();
+  m_head = (m_head + 1) & (m_datas.size() - 1);
+  --m_count;
+}
+
+void DynamicTable::setMaxDataSize(int32_t v) {
+  m_maxDataSize = v;
+  while (m_dataSize > m_maxDataSize && m_count) {
+    evict();
+  }
+}
 
 int32_t DynamicTable::update(const std::string& name,
                              const std::string& value) {
   int len = name.length() + value.length() + 32;
-  while ((m_dataSize + len) > m_maxDataSize && !m_datas.empty()) {
-    auto& p = m_datas[0];
-    m_dataSize -= p.first.length() + p.second.length() + 32;
-    m_datas.erase(m_datas.begin());
+  while ((m_dataSize + len) > m_maxDataSize && m_count) {
+    evict();
   }
+  if (len > m_maxDataSize) {
+    // 大于整个表的表项使表清空, 但不插入
+    return 0;
+  }
+  if (m_count == m_datas.size()) {
+    std::vector<Entry> datas(m_datas.size() * 2);
+    for (size_t i = 0; i < m_count; ++i) {
+      datas[i].swap(m_datas[(m_head + i) & (m_datas.size() - 1)]);
+    }
+    m_datas.swap(datas);
+    m_head = 0;
+  }
+  m_datas[(m_head + m_count) & (m_datas.size() - 1)] =
+      std::make_pair(name, value);
+  ++m_count;
   m_dataSize += len;
-  m_datas.push_back(std::make_pair(name, value));
+  m_names[std::hash<std::string>()(name)] = m_seq;
+  m_pairs[HashPair(name, value)] = m_seq;
+  ++m_seq;
   return 0;
 }
 
 int32_t DynamicTable::findIndex(const std::string& name) const {
   int32_t idx = GetStaticHeadersIndex(name);
   if (idx == -1) {
-    size_t len = m_datas.size() - 1;
-    for (size_t i = 0; i < m_datas.size(); ++i) {
-      if (m_datas[len - i].first == name) {
-        idx = i + 62;
-        break;
+    auto it = m_names.find(std::hash<std::string>()(name));
+    if (it != m_names.end()) {
+      int32_t i = seqToIndex(it->second);
+      if (at(i - 62).first == name) {
+        idx = i;
       }
     }
   }
@@ -141,21 +215,17 @@ std::pair<int32_t, bool> DynamicTable::findPair(
     const std::string& name, const std::string& value) const {
   auto p = GetStaticHeadersPair(name, value);
   if (!p.second) {
-    size_t len = m_datas.size() - 1;
-    for (size_t i = 0; i < m_datas.size(); ++i) {
-      if (m_datas[len - i].first == name) {
-        if (p.first == -1) {
-          p.first = i + 62;
-        }
-      } else {
-        continue;
-      }
-      if (m_datas[len - i].second == value) {
-        p.first = i + 62;
-        p.second = true;
-        break;
+    auto it = m_pairs.find(HashPair(name, value));
+    if (it != m_pairs.end()) {
+      int32_t i = seqToIndex(it->second);
+      auto& e = at(i - 62);
+      if (e.first == name && e.second == value) {
+        return std::make_pair(i, true);
       }
     }
+    if (p.first == -1) {
+      p.first = findIndex(name);
+    }
   }
   return p;
 }
@@ -165,8 +235,8 @@ std::pair<std::string, std::string> DynamicTable::getPair(uint32_t idx) const {
     return GetStaticHeaders(idx);
   }
   idx -= 62;
-  if (idx < m_datas.size()) {
-    return m_datas[m_datas.size() - idx - 1];
+  if (idx < m_count) {
+    return at(idx);
   }
   return std::make_pair("", "");
 }
@@ -179,9 +249,8 @@ std::string DynamicTable::toString() const {
   std::stringstream ss;
   ss << "[DynamicTable max_data_size=" << m_maxDataSize
      << " data_size=" << m_dataSize << "]" << std::endl;
-  int idx = 62;
-  for (int i = m_datas.size() - 1; i >= 0; --i) {
-    ss << "\t" << idx++ << ":" << m_datas[i].first << " - " << m_datas[i].second
+  for (size_t i = 0; i < m_count; ++i) {
+    ss << "\t" << i + 62 << ":" << at(i).first << " - " << at(i).second
        << std::endl;
   }
   return ss.str();
@@ -3,11 +3,18 @@
 
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace sylar {
 namespace http2 {
 
+/**
+ * @brief HPACK 动态表(RFC 7541 2.3.2)
+ * @details 环形缓冲区保存表项, 插入和淘汰都是 O(1);
+ *          name 和 name+value 的哈希索引指向最新插入的表项,
+ *          findIndex/findPair 不再线性扫描静态表和动态表
+ */
 class DynamicTable {
  public:
   DynamicTable();
@@ -19,7 +26,10 @@ class DynamicTable {
   std::string getName(uint32_t idx) const;
   std::string toString() const;
 
-  void setMaxDataSize(int32_t v) { m_maxDataSize = v; }
+  void setMaxDataSize(int32_t v);
+  int32_t getMaxDataSize() const { return m_maxDataSize; }
+  int32_t getDataSize() const { return m_dataSize; }
+  size_t size() const { return m_count; }
 
  public:
   static std::pair<std::string, std::string> GetStaticHeaders(uint32_t idx);
@@ -27,10 +37,34 @@ class DynamicTable {
   static std::pair<int32_t, bool> GetStaticHeadersPair(const std::string& name,
                                                        const std::string& val);
 
+ private:
+  typedef std::pair<std::string, std::string> Entry;
+
+  /**
+   * @brief 第 i 新的表项, 0 为最新
+   */
+  const Entry& at(size_t i) const {
+    return m_datas[(m_head + m_count - 1 - i) & (m_datas.size() - 1)];
+  }
+  int32_t seqToIndex(uint64_t seq) const {
+    return 62 + (int32_t)(m_seq - 1 - seq);
+  }
+  void evict();
+
+  static size_t HashPair(const std::string& name, const std::string& value);
+
  private:
   int32_t m_maxDataSize;
   int32_t m_dataSize;
-  std::vector<std::pair<std::string, std::string>> m_datas;
+  // 环形缓冲区, 容量为 2 的幂, m_head 为最早插入的表项
+  std::vector<Entry> m_datas;
+  size_t m_head;
+  size_t m_count;
+  // 已插入的表项总数, 表项的序号即插入时的 m_seq
+  uint64_t m_seq;
+  // 哈希值 -> 最新表项的序号, 冲突时只会少命中, 查找时再比较内容
+  std::unordered_map<size_t, uint64_t> m_names;
+  std::unordered_map<size_t, uint64_t> m_pairs;
 };
 
 }  // namespace http2
@@ -648,5 +648,85 @@ int32_t FrameCodec::serializeTo(Stream::ptr stream, Frame::ptr frame) {
   return ba->getSize();
 }
 
+FrameBuffer::FrameBuffer(size_t base_size)
+    : m_ba(new ByteArray(base_size)), m_size(0), m_count(0) {}
+
+bool FrameBuffer::append(Frame::ptr frame) {
+  uint64_t start = m_ba->getPosition();
+  auto data = std::dynamic_pointer_cast<DataFrame>(frame->data);
+  if (data && !(frame->header.flags & (uint8_t)FrameFlagData::PADDED)) {
+    frame->header.length = data->data.size();
+    frame->header.writeTo(m_ba);
+  } else {
+    frame->header.writeTo(m_ba);
+    if (frame->data) {
+      if (!frame->data->writeTo(m_ba, frame->header)) {
+        SYLAR_LOG_ERROR(g_logger)
+            << "FrameBuffer append fail, type="
+            << FrameTypeToString((FrameType)frame->header.type);
+        m_ba->setPosition(start);
+        return false;
+      }
+      uint64_t end = m_ba->getPosition();
+      frame->header.length = end - start - FrameHeader::SIZE;
+      m_ba->setPosition(start);
+      frame->header.writeTo(m_ba);
+      m_ba->setPosition(end);
+    }
+    data = nullptr;
+  }
+  SYLAR_LOG_DEBUG(g_logger) << "FrameBuffer append " << frame->toString();
+
+  // 与上一段连续的 ByteArray 数据合并
+  uint64_t len = m_ba->getPosition() - start;
+  if (!m_segments.empty() && !m_segments.back().data) {
+    m_segments.back().len += len;
+  } else {
+    m_segments.push_back(Segment{start, len, nullptr});
+  }
+  m_size += len;
+  if (data && !data->data.empty()) {
+    m_segments.push_back(Segment{0, data->data.size(), &data->data});
+    m_frames.push_back(frame);
+    m_size += data->data.size();
+  }
+  ++m_count;
+  return true;
+}
+
+int32_t FrameBuffer::flush(Stream::ptr stream) {
+  if (m_segments.empty()) {
+    return 0;
+  }
+  m_iovs.clear();
+  for (auto& i : m_segments) {
+    if (i.data) {
+      iovec iov;
+      iov.iov_base = (void*)i.data->c_str();
+      iov.iov_len = i.len;
+      m_iovs.push_back(iov);
+    } else {
+      m_ba->getReadBuffers(m_iovs, i.len, i.pos);
+    }
+  }
+  int rt = stream->writevFixSize(&m_iovs[0], m_iovs.size());
+  clear();
+  if (rt <= 0) {
+    SYLAR_LOG_ERROR(g_logger) << "FrameBuffer flush fail, rt=" << rt
+                              << " errno=" << errno << " - "
+                              << strerror(errno);
+    return -1;
+  }
+  return rt;
+}
+
+void FrameBuffer::clear() {
+  m_ba->clear();
+  m_segments.clear();
+  m_frames.clear();
+  m_size = 0;
+  m_count = 0;
+}
+
 }  // namespace http2
 }  // namespace sylar
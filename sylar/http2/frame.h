@@ -346,6 +346,44 @@ std::string FrameRToString(FrameR r);
 
 #pragma pack(pop)
 
+/**
+ * @brief 帧的发送缓冲, 把多个帧合并为一次 writev
+ * @details 帧序列化到复用的 ByteArray 中, 不再每帧分配一个 ByteArray;
+ *          DATA 帧只写入帧头, 载荷不拷贝, 持有帧的引用直接作为 iovec 发送
+ */
+class FrameBuffer {
+ public:
+  FrameBuffer(size_t base_size = 64 * 1024);
+
+  bool append(Frame::ptr frame);
+
+  /**
+   * @brief 一次写出缓冲中的全部帧并清空
+   * @return 写出的字节数, 小于 0 表示失败
+   */
+  int32_t flush(Stream::ptr stream);
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  size_t getFrameCount() const { return m_count; }
+  void clear();
+
+ private:
+  struct Segment {
+    // data 为空时是 m_ba 中 [pos, pos + len) 的数据
+    uint64_t pos;
+    uint64_t len;
+    const std::string* data;
+  };
+
+  ByteArray::ptr m_ba;
+  std::vector<Segment> m_segments;
+  std::vector<Frame::ptr> m_frames;
+  std::vector<iovec> m_iovs;
+  size_t m_size;
+  size_t m_count;
+};
+
 }  // namespace http2
 }  // namespace sylar
 
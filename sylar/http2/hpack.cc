@@ -46,7 +46,7 @@ int HPack::WriteVarInt(ByteArray::ptr ba, int32_t prefix, uint64_t value,
   ba->writeFuint8(v | flags);
   value -= v;
   while (value >= 128) {
-    ba->writeFuint8((0x8 | (value & 0x7f)));
+    ba->writeFuint8((0x80 | (value & 0x7f)));
     value >>= 7;
   }
   ba->writeFuint8(value);
@@ -149,6 +149,11 @@ int HPack::parse(ByteArray::ptr ba, int length) {
         header.type = idx > 0 ? IndexType::NERVER_INDEXED_INDEXED_NAME
                               : IndexType::NERVER_INDEXED_NEW_NAME;
         header.index = idx;
+      } else if ((type & 0xE0) == 0x20) {
+        // 动态表大小更新
+        m_table.setMaxDataSize(ReadVarInt(ba, type, 5));
+        parsed = ba->getPosition() - pos;
+        continue;
       } else {
         return -1;
       }
@@ -233,6 +238,7 @@ int HPack::pack(const std::vector<std::pair<std::string, std::string>>& headers,
 int HPack::pack(const std::vector<std::pair<std::string, std::string>>& headers,
                 ByteArray::ptr ba) {
   int rt = 0;
+  m_headers.reserve(m_headers.size() + headers.size());
   for (auto& i : headers) {
     HeaderField h;
     auto p = m_table.findPair(i.first, i.second);
@@ -1,4 +1,5 @@
 #include "http2_server.h"
+#include <string.h>
 #include "sylar/http/servlets/config_servlet.h"
 #include "sylar/http/servlets/status_servlet.h"
 #include "sylar/log.h"
@@ -8,6 +9,10 @@ namespace http2 {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static const char CLIENT_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+// "PRI " 不是 HTTP/1.1 的方法, 读到这 4 个字节就可以确定协议
+static const int PREFACE_SNIFF_SIZE = 4;
+
 Http2Server::Http2Server(const std::string& type, sylar::IOManager* worker,
                          sylar::IOManager* io_worker,
                          sylar::IOManager* accept_worker)
@@ -23,10 +28,75 @@ void Http2Server::setName(const std::string& v) {
   m_dispatch->setDefault(std::make_shared<http::NotFoundServlet>(v));
 }
 
+bool Http2Server::bind(const std::vector<Address::ptr>& addrs,
+                       std::vector<Address::ptr>& fails, bool ssl) {
+  if (!TcpServer::bind(addrs, fails, ssl)) {
+    return false;
+  }
+  std::vector<std::string> protos = {"h2"};
+  if (m_acceptHttp1) {
+    protos.push_back("http/1.1");
+  }
+  for (auto& i : m_socks) {
+    auto ssl_socket = std::dynamic_pointer_cast<SSLSocket>(i);
+    if (ssl_socket) {
+      ssl_socket->setAlpnProtocols(protos);
+    }
+  }
+  return true;
+}
+
 void Http2Server::handleClient(Socket::ptr client) {
   SYLAR_LOG_DEBUG(g_logger) << "handleClient " << *client;
+  if (!m_acceptHttp1) {
+    handleHttp2(client);
+    return;
+  }
+  auto ssl_socket = std::dynamic_pointer_cast<SSLSocket>(client);
+  if (ssl_socket) {
+    std::string proto = ssl_socket->getAlpnProtocol();
+    if (proto == "h2") {
+      handleHttp2(client);
+      return;
+    } else if (!proto.empty()) {
+      handleHttp1(client);
+      return;
+    }
+    // 客户端不支持 ALPN, 按明文连接的方式探测
+  }
+  std::string head;
+  int rt = sniffPreface(client, head);
+  if (rt > 0) {
+    handleHttp2(client, head);
+  } else if (rt == 0) {
+    handleHttp1(client, head);
+  } else {
+    client->close();
+  }
+}
+
+int Http2Server::sniffPreface(Socket::ptr client, std::string& head) {
+  char buf[PREFACE_SNIFF_SIZE];
+  size_t offset = 0;
+  while (offset < sizeof(buf)) {
+    // 阻塞读直到收到数据或者 recv_timeout 超时
+    int rt = client->recv(buf + offset, sizeof(buf) - offset);
+    if (rt <= 0) {
+      return -1;
+    }
+    head.append(buf + offset, rt);
+    offset += rt;
+    if (memcmp(buf, CLIENT_PREFACE, offset)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void Http2Server::handleHttp2(Socket::ptr client, const std::string& head) {
   sylar::http2::Http2Session::ptr session =
       std::make_shared<sylar::http2::Http2Session>(client, this);
+  session->unread(head.c_str(), head.size());
   if (!session->handleShakeServer()) {
     SYLAR_LOG_WARN(g_logger) << "http2 session handleShake fail, "
                              << session->getRemoteAddressString();
@@ -37,5 +107,49 @@ void Http2Server::handleClient(Socket::ptr client) {
   session->start();
 }
 
+static bool IsH2cUpgrade(http::HttpRequest::ptr req) {
+  return strcasecmp(req->getHeader("Upgrade").c_str(), "h2c") == 0 &&
+         req->hasHeader("HTTP2-Settings");
+}
+
+void Http2Server::handleHttp1(Socket::ptr client, const std::string& head) {
+  // 升级为 HTTP/2 后 socket 由 Http2Session 接管, 这里不能关闭
+  http::HttpSession::ptr session =
+      std::make_shared<http::HttpSession>(client, false);
+  session->unread(head.c_str(), head.size());
+  http::ServeHttpSession(
+      session, m_dispatch, m_worker, getName(), m_isKeepalive,
+      [this, session](http::HttpRequest::ptr req) {
+        // h2c 只用于明文连接
+        if (m_ssl || !IsH2cUpgrade(req)) {
+          return false;
+        }
+        handleUpgrade(session, req);
+        return true;
+      });
+}
+
+void Http2Server::handleUpgrade(http::HttpSession::ptr session,
+                                http::HttpRequest::ptr req) {
+  static const std::string s_data =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: h2c\r\n\r\n";
+  if (session->writeFixSize(s_data.c_str(), s_data.size()) <= 0) {
+    session->close();
+    return;
+  }
+  sylar::http2::Http2Session::ptr h2session =
+      std::make_shared<sylar::http2::Http2Session>(session->getSocket(), this);
+  h2session->setWorker(m_worker);
+  if (!h2session->handleUpgradeServer(req)) {
+    SYLAR_LOG_WARN(g_logger) << "http2 session upgrade fail, "
+                             << h2session->getRemoteAddressString();
+    h2session->close();
+    return;
+  }
+  h2session->start();
+}
+
 }  // namespace http2
 }  // namespace sylar
@@ -2,12 +2,22 @@
 #define __SYLAR_HTTP2_SERVER_H__
 
 #include "http2_stream.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_session.h"
 #include "sylar/http/servlet.h"
 #include "sylar/tcp_server.h"
 
 namespace sylar {
 namespace http2 {
 
+/**
+ * @brief HTTP/2 服务器
+ * @details 同一个端口同时接受 HTTP/1.1 和 HTTP/2: 明文连接读取开头几个
+ *          字节探测连接前言(prior-knowledge), 读出的字节交给选定的协议栈,
+ *          其它连接按 HTTP/1.1 处理, 请求带 Upgrade: h2c 时回复 101 后
+ *          切换为 HTTP/2;
+ *          SSL 连接按 ALPN 协商的结果(h2 / http/1.1)选择协议
+ */
 class Http2Server : public TcpServer {
  public:
   typedef std::shared_ptr<Http2Server> ptr;
@@ -21,11 +31,57 @@ class Http2Server : public TcpServer {
 
   virtual void setName(const std::string& v) override;
 
+  using TcpServer::bind;
+  virtual bool bind(const std::vector<Address::ptr>& addrs,
+                    std::vector<Address::ptr>& fails,
+                    bool ssl = false) override;
+
+  /**
+   * @brief 是否接受 HTTP/1.1 连接(包括 h2c 升级), 默认接受,
+   *        SSL 时影响 ALPN 的协议列表, 需要在 bind 之前设置
+   */
+  bool isAcceptHttp1() const { return m_acceptHttp1; }
+  void setAcceptHttp1(bool v) { m_acceptHttp1 = v; }
+
+  /**
+   * @brief HTTP/1.1 连接是否保持长连接, 默认保持
+   */
+  bool isKeepalive() const { return m_isKeepalive; }
+  void setKeepalive(bool v) { m_isKeepalive = v; }
+
+  /**
+   * @brief 收到请求头部时调用, 返回 true 表示由子类以流的方式处理请求,
+   *        之后的 DATA 通过 Stream::recvData 读取, 不再交给 Servlet
+   */
+  virtual bool handleStream(Http2Stream::ptr session, Stream::ptr stream) {
+    return false;
+  }
+
  protected:
   virtual void handleClient(Socket::ptr client) override;
 
+  /**
+   * @param[in] head 探测协议时已经读出的数据
+   */
+  void handleHttp2(Socket::ptr client, const std::string& head = "");
+  void handleHttp1(Socket::ptr client, const std::string& head = "");
+
+  /**
+   * @brief 回复 101 后把连接切换为 HTTP/2, 升级请求作为流 1 处理
+   */
+  void handleUpgrade(http::HttpSession::ptr session,
+                     http::HttpRequest::ptr req);
+
+  /**
+   * @brief 读取开头的数据探测 HTTP/2 连接前言, 读出的数据放到 head 中
+   * @return 1 是连接前言, 0 不是, -1 读取失败或超时
+   */
+  int sniffPreface(Socket::ptr client, std::string& head);
+
  private:
   http::ServletDispatch::ptr m_dispatch;
+  bool m_acceptHttp1 = true;
+  bool m_isKeepalive = true;
 };
 
 }  // namespace http2
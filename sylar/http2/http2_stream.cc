@@ -1,5 +1,6 @@
 #include "http2_stream.h"
 #include "http2_server.h"
+#include "sylar/config.h"
 #include "sylar/log.h"
 
 namespace sylar {
@@ -9,6 +10,75 @@ static const std::string CLIENT_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_http2_send_quantum =
+    sylar::Config::Lookup("http2.send_quantum", (uint32_t)(64 * 1024),
+                          "http2 max data bytes sent before yielding "
+                          "to other frames");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_recv_window_size =
+    sylar::Config::Lookup("http2.recv_window_size", (uint32_t)(1024 * 1024),
+                          "http2 connection and stream receive window size");
+
+static sylar::ConfigVar<uint32_t>::ptr g_http2_send_buffer_size =
+    sylar::Config::Lookup("http2.send_buffer_size", (uint32_t)(256 * 1024),
+                          "http2 bytes of frames buffered before one writev");
+
+static uint32_t s_http2_send_quantum = 0;
+static uint32_t s_http2_recv_window_size = 0;
+static uint32_t s_http2_send_buffer_size = 0;
+
+namespace {
+
+struct _Http2StreamIniter {
+  _Http2StreamIniter() {
+    s_http2_send_quantum = g_http2_send_quantum->getValue();
+    g_http2_send_quantum->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_http2_send_quantum = nv;
+        });
+    s_http2_recv_window_size = g_http2_recv_window_size->getValue();
+    g_http2_recv_window_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_http2_recv_window_size = nv;
+        });
+    s_http2_send_buffer_size = g_http2_send_buffer_size->getValue();
+    g_http2_send_buffer_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_http2_send_buffer_size = nv;
+        });
+  }
+};
+
+static _Http2StreamIniter s_init;
+
+}  // namespace
+
+/**
+ * @brief 解析 RFC 9218 的 priority 头部, 如 "u=1, i"
+ * @return 是否显式声明了优先级
+ */
+static bool ParsePriority(const std::string& v, uint8_t& urgency,
+                          bool& incremental) {
+  if (v.empty()) {
+    return false;
+  }
+  urgency = DataScheduler::DEFAULT_URGENCY;
+  incremental = false;
+  auto items = sylar::split(v, ',');
+  for (auto& i : items) {
+    std::string item = sylar::StringUtil::Trim(i);
+    if (item.size() == 3 && item[0] == 'u' && item[1] == '=' &&
+        item[2] >= '0' && item[2] <= '7') {
+      urgency = item[2] - '0';
+    } else if (item == "i" || item == "i=?1") {
+      incremental = true;
+    } else if (item == "i=?0") {
+      incremental = false;
+    }
+  }
+  return true;
+}
+
 static const std::vector<std::string> s_http2error_strings = {
     "OK",
     "PROTOCOL_ERROR",
@@ -75,7 +145,9 @@ bool Http2Stream::handleShakeClient() {
 
   Frame::ptr frame = std::make_shared<Frame>();
   frame->header.type = (uint8_t)FrameType::SETTINGS;
-  frame->data = std::make_shared<SettingsFrame>();
+  auto settings = std::make_shared<SettingsFrame>();
+  settings->items = initRecvWindow();
+  frame->data = settings;
 
   rt = m_codec->serializeTo(shared_from_this(), frame);
   if (rt <= 0) {
@@ -83,17 +155,28 @@ bool Http2Stream::handleShakeClient() {
                               << " errno=" << errno << " - " << strerror(errno);
     return false;
   }
+  if (m_recvWindow > DEFAULT_INITIAL_WINDOW_SIZE) {
+    frame = std::make_shared<Frame>();
+    frame->header.type = (uint8_t)FrameType::WINDOW_UPDATE;
+    auto data = std::make_shared<WindowUpdateFrame>();
+    data->increment = m_recvWindow - DEFAULT_INITIAL_WINDOW_SIZE;
+    frame->data = data;
+    if (m_codec->serializeTo(shared_from_this(), frame) <= 0) {
+      SYLAR_LOG_ERROR(g_logger) << "handleShakeClient WindowUpdate fail";
+      return false;
+    }
+  }
   return true;
 }
 
-bool Http2Stream::handleShakeServer() {
+Frame::ptr Http2Stream::recvPreface() {
   ByteArray::ptr ba = std::make_shared<ByteArray>();
   int rt = readFixSize(ba, CLIENT_PREFACE.size());
   if (rt <= 0) {
     SYLAR_LOG_ERROR(g_logger)
         << "handleShakeServer recv CLIENT_PREFACE fail, rt=" << rt
         << " errno=" << errno << " - " << strerror(errno);
-    return false;
+    return nullptr;
   }
   ba->setPosition(0);
   if (ba->toString() != CLIENT_PREFACE) {
@@ -101,26 +184,100 @@ bool Http2Stream::handleShakeServer() {
         << "handleShakeServer recv CLIENT_PREFACE fail, rt=" << rt
         << " errno=" << errno << " - " << strerror(errno)
         << " hex: " << ba->toHexString();
-    return false;
+    return nullptr;
   }
   auto frame = m_codec->parseFrom(shared_from_this());
   if (!frame) {
     SYLAR_LOG_ERROR(g_logger) << "handleShakeServer recv SettingsFrame fail,"
                               << " errno=" << errno << " - " << strerror(errno);
-    return false;
+    return nullptr;
   }
   if (frame->header.type != (uint8_t)FrameType::SETTINGS) {
     SYLAR_LOG_ERROR(g_logger)
         << "handleShakeServer recv Frame not SettingsFrame, type="
         << FrameTypeToString((FrameType)frame->header.type);
+    return nullptr;
+  }
+  return frame;
+}
+
+bool Http2Stream::handleShakeServer() {
+  auto frame = recvPreface();
+  if (!frame) {
     return false;
   }
   handleRecvSetting(frame);
   sendSettingsAck();
-  sendSettings({});
+  sendSettings(initRecvWindow());
+  if (m_recvWindow > DEFAULT_INITIAL_WINDOW_SIZE) {
+    sendWindowUpdate(0, m_recvWindow - DEFAULT_INITIAL_WINDOW_SIZE);
+  }
   return true;
 }
 
+bool Http2Stream::handleUpgradeServer(http::HttpRequest::ptr req) {
+  // HTTP2-Settings 是 SETTINGS 帧负载的 base64url 编码, 不带填充
+  std::string payload = req->getHeader("HTTP2-Settings");
+  payload.append((4 - payload.size() % 4) % 4, '=');
+  payload = sylar::base64decode(payload, true);
+  if (payload.size() % sizeof(SettingsItem)) {
+    SYLAR_LOG_ERROR(g_logger) << "handleUpgradeServer invalid HTTP2-Settings: "
+                              << req->getHeader("HTTP2-Settings");
+    return false;
+  }
+  if (!payload.empty()) {
+    ByteArray::ptr ba = std::make_shared<ByteArray>();
+    ba->write(payload.c_str(), payload.size());
+    ba->setPosition(0);
+    FrameHeader header;
+    header.length = payload.size();
+    auto settings = std::make_shared<SettingsFrame>();
+    if (!settings->readFrom(ba, header)) {
+      return false;
+    }
+    updateSettings(m_owner, settings);
+  }
+
+  // 101 之后服务端的第一个帧必须是 SETTINGS, 客户端随后发送连接前言
+  sendSettings(initRecvWindow());
+  if (m_recvWindow > DEFAULT_INITIAL_WINDOW_SIZE) {
+    sendWindowUpdate(0, m_recvWindow - DEFAULT_INITIAL_WINDOW_SIZE);
+  }
+  auto frame = recvPreface();
+  if (!frame) {
+    return false;
+  }
+  handleRecvSetting(frame);
+  sendSettingsAck();
+
+  // 升级请求作为流 1 的请求, 应答通过 HTTP/2 发送
+  auto stream = newStream(1);
+  stream->setUpgradeRequest(req);
+  m_worker->schedule(std::bind(&Http2Stream::handleRequest,
+                               std::static_pointer_cast<Http2Stream>(
+                                   shared_from_this()),
+                               req, stream));
+  return true;
+}
+
+std::vector<SettingsItem> Http2Stream::initRecvWindow() {
+  uint32_t size = std::max(s_http2_recv_window_size,
+                           DEFAULT_INITIAL_WINDOW_SIZE);
+  size = std::min(size, (uint32_t)DataScheduler::MAX_WINDOW_SIZE);
+  m_recvWindow = size;
+  m_recvConsumed = 0;
+  m_peer.initial_window_size = size;
+
+  std::vector<SettingsItem> items;
+  if (size != DEFAULT_INITIAL_WINDOW_SIZE) {
+    SettingsItem item;
+    item.identifier = (uint16_t)SettingsFrame::Settings::INITIAL_WINDOW_SIZE;
+    item.value = size;
+    items.push_back(item);
+  }
+  return items;
+}
+
 int32_t Http2Stream::sendFrame(Frame::ptr frame) {
   if (isConnected()) {
     FrameSendCtx::ptr ctx = std::make_shared<FrameSendCtx>();
@@ -132,6 +289,180 @@ int32_t Http2Stream::sendFrame(Frame::ptr frame) {
   }
 }
 
+int32_t Http2Stream::sendHeaders(
+    uint32_t id,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    bool end_stream) {
+  if (!isConnected()) {
+    return -1;
+  }
+  HeadersSendCtx::ptr ctx = std::make_shared<HeadersSendCtx>();
+  ctx->id = id;
+  ctx->endStream = end_stream;
+  ctx->headers = headers;
+  enqueue(ctx);
+  return 1;
+}
+
+int32_t Http2Stream::sendData(uint32_t id, const std::string& data,
+                              bool end_stream) {
+  return sendData(id, std::string(data), end_stream);
+}
+
+int32_t Http2Stream::sendData(uint32_t id, std::string&& data,
+                              bool end_stream) {
+  if (!isConnected()) {
+    return -1;
+  }
+  // 在 DataSendCtx 执行前 delStream 不会删除流的发送窗口
+  m_dataScheduler.expect(id);
+  DataSendCtx::ptr ctx = std::make_shared<DataSendCtx>();
+  ctx->push = true;
+  ctx->id = id;
+  ctx->endStream = end_stream;
+  ctx->data.swap(data);
+  enqueue(ctx);
+  return 1;
+}
+
+int32_t Http2Stream::sendTrailers(
+    uint32_t id,
+    const std::vector<std::pair<std::string, std::string>>& trailers) {
+  if (!isConnected()) {
+    return -1;
+  }
+  m_dataScheduler.expect(id);
+  DataSendCtx::ptr ctx = std::make_shared<DataSendCtx>();
+  ctx->push = true;
+  ctx->id = id;
+  ctx->hasTrailers = true;
+  ctx->trailers = trailers;
+  enqueue(ctx);
+  return 1;
+}
+
+bool Http2Stream::pumpData() {
+  m_pumpQueued = false;
+  auto self = shared_from_this();
+  uint32_t sent = 0;
+  DataScheduler::Headers trailers;
+  while (sent < s_http2_send_quantum) {
+    Frame::ptr frame = m_dataScheduler.next(m_owner.max_frame_size, &trailers);
+    if (!frame) {
+      return true;
+    }
+    if (frame->header.type == (uint8_t)FrameType::HEADERS) {
+      HeadersFrame::ptr data = std::make_shared<HeadersFrame>();
+      HPack hp(m_sendTable);
+      hp.pack(trailers, data->data);
+      frame->data = data;
+    }
+    size_t size = 0;
+    if (frame->header.type == (uint8_t)FrameType::DATA) {
+      size = std::static_pointer_cast<DataFrame>(frame->data)->data.size();
+    }
+    if (!writeFrame(frame)) {
+      return false;
+    }
+    if (size) {
+      // 唤醒等待对端窗口的发送协程
+      auto stream = getStream(frame->header.identifier);
+      if (stream) {
+        stream->onDataSent(size);
+      }
+    }
+    sent += frame->header.length + FrameHeader::SIZE;
+  }
+  if (m_dataScheduler.hasSendable()) {
+    schedulePump();
+  }
+  return true;
+}
+
+bool Http2Stream::writeFrame(Frame::ptr frame) {
+  if (!m_sendBuffer.append(frame)) {
+    return false;
+  }
+  if (m_sendBuffer.size() >= s_http2_send_buffer_size) {
+    return m_sendBuffer.flush(shared_from_this()) >= 0;
+  }
+  return true;
+}
+
+bool Http2Stream::doFlush() {
+  return m_sendBuffer.flush(shared_from_this()) >= 0;
+}
+
+void Http2Stream::schedulePump() {
+  if (m_pumpQueued.exchange(true)) {
+    return;
+  }
+  enqueue(std::make_shared<DataSendCtx>());
+}
+
+void Http2Stream::handleWindowUpdate(Frame::ptr frame) {
+  auto data = std::dynamic_pointer_cast<WindowUpdateFrame>(frame->data);
+  uint32_t id = frame->header.identifier;
+  if (data->increment == 0) {
+    if (id) {
+      sendRstStream(id, (uint32_t)Http2Error::PROTOCOL_ERROR);
+      m_dataScheduler.reset(id);
+    } else {
+      sendGoAway(m_sn, (uint32_t)Http2Error::PROTOCOL_ERROR, "");
+    }
+    return;
+  }
+  if (!m_dataScheduler.updateWindow(id, data->increment)) {
+    SYLAR_LOG_ERROR(g_logger) << "window overflow id=" << id
+                              << " increment=" << data->increment;
+    if (id) {
+      sendRstStream(id, (uint32_t)Http2Error::FLOW_CONTROL_ERROR);
+      m_dataScheduler.reset(id);
+    } else {
+      sendGoAway(m_sn, (uint32_t)Http2Error::FLOW_CONTROL_ERROR, "");
+    }
+    return;
+  }
+  schedulePump();
+}
+
+bool Http2Stream::handleRecvData(Frame::ptr frame, http2::Stream::ptr stream) {
+  uint32_t n = frame->header.length;
+  if (n == 0) {
+    return true;
+  }
+  m_recvConsumed += n;
+  if (m_recvConsumed > m_recvWindow) {
+    SYLAR_LOG_ERROR(g_logger) << "recv data exceed connection window, "
+                              << m_recvConsumed;
+    sendGoAway(m_sn, (uint32_t)Http2Error::FLOW_CONTROL_ERROR, "");
+    return false;
+  }
+  if (m_recvConsumed >= m_recvWindow / 2) {
+    sendWindowUpdate(0, m_recvConsumed);
+    m_recvConsumed = 0;
+  }
+  if (!stream) {
+    // 已经处理完成的流, 只计入连接窗口
+    return true;
+  }
+  auto data = std::dynamic_pointer_cast<DataFrame>(frame->data);
+  uint32_t payload = data ? std::min<size_t>(data->data.size(), n) : 0;
+  int64_t v =
+      stream->consumeRecvWindow(n, payload, m_peer.initial_window_size);
+  if (v < 0) {
+    SYLAR_LOG_ERROR(g_logger) << "recv data exceed stream window, id="
+                              << stream->getId();
+    sendRstStream(stream->getId(), (uint32_t)Http2Error::FLOW_CONTROL_ERROR);
+    return false;
+  }
+  // 流已结束就不需要再补充窗口
+  if (v > 0 && !(frame->header.flags & (uint8_t)FrameFlagData::END_STREAM)) {
+    sendWindowUpdate(stream->getId(), v);
+  }
+  return true;
+}
+
 // 只有客户端才会返回 ctx
 AsyncSocketStream::Ctx::ptr Http2Stream::doRecv() {
   // 解析获取完整的 frame
@@ -141,15 +472,43 @@ AsyncSocketStream::Ctx::ptr Http2Stream::doRecv() {
     return nullptr;
   }
   SYLAR_LOG_DEBUG(g_logger) << frame->toString();
+  if (frame->header.type == (uint8_t)FrameType::WINDOW_UPDATE) {
+    // 流可能已经处理完成, 只剩待发送的数据
+    handleWindowUpdate(frame);
+    return nullptr;
+  }
   if (frame->header.identifier) {
+    if (frame->header.type == (uint8_t)FrameType::PRIORITY) {
+      // 只使用权重, 依赖关系忽略(RFC 9113 已废弃)
+      auto data = std::dynamic_pointer_cast<PriorityFrame>(frame->data);
+      m_dataScheduler.setWeight(frame->header.identifier, data->weight + 1);
+      return nullptr;
+    }
+    if (frame->header.type == (uint8_t)FrameType::RST_STREAM) {
+      m_dataScheduler.reset(frame->header.identifier);
+    }
     // 取出帧序号对应的流
     auto stream = getStream(frame->header.identifier);
+    if (!stream && frame->header.type == (uint8_t)FrameType::RST_STREAM) {
+      return nullptr;
+    }
     if (!stream) {
       if (m_isClient) {
         SYLAR_LOG_ERROR(g_logger)
             << "doRecv stream id=" << frame->header.identifier << " not exists "
             << frame->toString();
         return nullptr;
+      } else if (frame->header.identifier <= m_sn) {
+        // 流已处理完成(如流式处理提前结束), 丢弃对端继续发送的帧,
+        // HEADERS 仍需解码以保持动态表同步
+        if (frame->header.type == (uint8_t)FrameType::DATA) {
+          handleRecvData(frame, nullptr);
+        } else if (frame->header.type == (uint8_t)FrameType::HEADERS) {
+          auto data = std::dynamic_pointer_cast<HeadersFrame>(frame->data);
+          HPack hp(m_recvTable);
+          hp.parse(data->data);
+        }
+        return nullptr;
       } else {
         // 服务端接收数据时，流不存在，则创建
         stream = newStream(frame->header.identifier);
@@ -160,8 +519,38 @@ AsyncSocketStream::Ctx::ptr Http2Stream::doRecv() {
         }
       }
     }
+    if (frame->header.type == (uint8_t)FrameType::HEADERS &&
+        (frame->header.flags & (uint8_t)FrameFlagHeaders::PRIORITY)) {
+      auto data = std::dynamic_pointer_cast<HeadersFrame>(frame->data);
+      m_dataScheduler.setWeight(stream->getId(), data->priority.weight + 1);
+    } else if (frame->header.type == (uint8_t)FrameType::DATA &&
+               !handleRecvData(frame, stream)) {
+      m_dataScheduler.reset(stream->getId());
+      delStream(stream->getId());
+      return nullptr;
+    }
     // 处理收到的帧
+    bool opened = !m_isClient && !stream->getRequest();
     stream->handleFrame(frame, m_isClient);
+    if (opened && stream->getRequest()) {
+      // 请求头部已完整
+      uint8_t urgency = 0;
+      bool incremental = false;
+      if (ParsePriority(stream->getRequest()->getHeader("priority"), urgency,
+                        incremental)) {
+        m_dataScheduler.setUrgency(stream->getId(), urgency, incremental);
+      }
+      if (m_server &&
+          m_server->handleStream(
+              std::dynamic_pointer_cast<Http2Stream>(shared_from_this()),
+              stream)) {
+        stream->setStreaming(true);
+      }
+    }
+    if (stream->isStreaming()) {
+      // 流式请求由处理协程读取数据, 处理完成后删除流
+      return nullptr;
+    }
     if (stream->getState() == http2::Stream::State::CLOSED) {
       if (m_isClient) {
         // 客户端流的状态为 CLOSED，说明收到的 frame 组成了一个完整的应答
@@ -220,8 +609,35 @@ void Http2Stream::handleRequest(http::HttpRequest::ptr req,
 }
 
 bool Http2Stream::FrameSendCtx::doSend(AsyncSocketStream::ptr stream) {
-  return std::dynamic_pointer_cast<Http2Stream>(stream)->m_codec->serializeTo(
-             stream, frame) > 0;
+  return std::dynamic_pointer_cast<Http2Stream>(stream)->writeFrame(frame);
+}
+
+bool Http2Stream::HeadersSendCtx::doSend(AsyncSocketStream::ptr stream) {
+  auto h2stream = std::dynamic_pointer_cast<Http2Stream>(stream);
+  Frame::ptr frame = std::make_shared<Frame>();
+  frame->header.type = (uint8_t)FrameType::HEADERS;
+  frame->header.flags = (uint8_t)FrameFlagHeaders::END_HEADERS;
+  if (endStream) {
+    frame->header.flags |= (uint8_t)FrameFlagHeaders::END_STREAM;
+  }
+  frame->header.identifier = id;
+  HeadersFrame::ptr data = std::make_shared<HeadersFrame>();
+  HPack hp(h2stream->m_sendTable);
+  hp.pack(headers, data->data);
+  frame->data = data;
+  return h2stream->writeFrame(frame);
+}
+
+bool Http2Stream::DataSendCtx::doSend(AsyncSocketStream::ptr stream) {
+  auto h2stream = std::dynamic_pointer_cast<Http2Stream>(stream);
+  if (push && hasTrailers) {
+    h2stream->m_dataScheduler.pushTrailers(
+        id, trailers, h2stream->m_owner.initial_window_size);
+  } else if (push) {
+    h2stream->m_dataScheduler.push(id, std::move(data), endStream,
+                                   h2stream->m_owner.initial_window_size);
+  }
+  return h2stream->pumpData();
 }
 
 bool Http2Stream::RequestCtx::doSend(AsyncSocketStream::ptr stream) {
@@ -252,24 +668,16 @@ bool Http2Stream::RequestCtx::doSend(AsyncSocketStream::ptr stream) {
   hp.pack(hs, data->data);
   headers->data = data;
   // 发送头部帧
-  bool ok =
-      std::dynamic_pointer_cast<Http2Stream>(stream)->m_codec->serializeTo(
-          stream, headers) > 0;
+  bool ok = h2stream->writeFrame(headers);
   if (!ok) {
     SYLAR_LOG_INFO(g_logger) << "sendHeaders fail";
     return ok;
   }
   if (!request->getBody().empty()) {
     // 发送数据帧
-    Frame::ptr body = std::make_shared<Frame>();
-    body->header.type = (uint8_t)FrameType::DATA;
-    body->header.flags = (uint8_t)FrameFlagData::END_STREAM;
-    body->header.identifier = sn;
-    auto data = std::make_shared<DataFrame>();
-    data->data = request->getBody();
-    body->data = data;
-    ok = std::dynamic_pointer_cast<Http2Stream>(stream)->m_codec->serializeTo(
-             stream, body) > 0;
+    h2stream->m_dataScheduler.push(sn, request->getBody(), true,
+                                   h2stream->m_owner.initial_window_size);
+    ok = h2stream->pumpData();
   }
   return ok;
 }
@@ -278,18 +686,30 @@ http::HttpResult::ptr Http2Stream::request(http::HttpRequest::ptr req,
                                            uint64_t timeout_ms) {
   if (isConnected()) {
     Http2InitRequestForWrite(req, m_ssl);
-    auto stream = newStream();
     RequestCtx::ptr ctx = std::make_shared<RequestCtx>();
     ctx->request = req;
-    ctx->sn = stream->getId();
     ctx->timeout = timeout_ms;
     ctx->scheduler = sylar::Scheduler::GetThis();
     ctx->fiber = sylar::Fiber::GetThis();
-    addCtx(ctx);
-    ctx->timer = sylar::IOManager::GetThis()->addTimer(
-        timeout_ms,
-        std::bind(&Http2Stream::onTimeOut, shared_from_this(), ctx));
-    enqueue(ctx);
+    {
+      // 流 id 必须按 HEADERS 的发送顺序递增, 否则对端会拒绝较小的 id,
+      // 跳过其头部块导致 HPACK 动态表不一致
+      MutexType::Lock lock(m_newStreamMutex);
+      auto stream = newStream();
+      uint8_t urgency = 0;
+      bool incremental = false;
+      if (ParsePriority(req->getHeader("priority"), urgency, incremental)) {
+        m_dataScheduler.setUrgency(stream->getId(), urgency, incremental);
+      }
+      ctx->sn = stream->getId();
+      if (!addCtx(ctx)) {
+        delStream(ctx->sn);
+        return std::make_shared<http::HttpResult>(
+            AsyncSocketStream::DUPLICATE_SN, nullptr,
+            "duplicate_sn " + std::to_string(ctx->sn));
+      }
+      enqueue(ctx);
+    }
     sylar::Fiber::YieldToHold();
     auto rt = std::make_shared<http::HttpResult>(ctx->result, ctx->response,
                                                  ctx->resultStr);
@@ -398,6 +818,20 @@ void Http2Stream::updateSettings(Http2Settings& sts, SettingsFrame::ptr frame) {
         sts.max_concurrent_streams = i.value;
         break;
       case SettingsFrame::Settings::INITIAL_WINDOW_SIZE:
+        if (i.value > (uint32_t)DataScheduler::MAX_WINDOW_SIZE) {
+          SYLAR_LOG_ERROR(g_logger) << "invalid initial_window_size="
+                                    << i.value;
+          sendGoAway(m_sn, (uint32_t)Http2Error::FLOW_CONTROL_ERROR, "");
+          break;
+        }
+        if (&sts == &m_owner) {
+          // 对端修改初始窗口时, 所有流的发送窗口按差值调整
+          int64_t delta = (int64_t)i.value - sts.initial_window_size;
+          m_dataScheduler.updateInitialWindow(delta);
+          if (delta > 0) {
+            schedulePump();
+          }
+        }
         sts.initial_window_size = i.value;
         break;
       case SettingsFrame::Settings::MAX_FRAME_SIZE:
@@ -430,6 +864,7 @@ http2::Stream::ptr Http2Stream::newStream(uint32_t id) {
   http2::Stream::ptr stream = std::make_shared<http2::Stream>(
       std::dynamic_pointer_cast<Http2Stream>(shared_from_this()), id);
   m_streamMgr.add(stream);
+  m_dataScheduler.open(id, m_owner.initial_window_size);
   return stream;
 }
 
@@ -438,6 +873,7 @@ http2::Stream::ptr Http2Stream::newStream() {
       std::dynamic_pointer_cast<Http2Stream>(shared_from_this()),
       sylar::Atomic::addFetch(m_sn, 2));
   m_streamMgr.add(stream);
+  m_dataScheduler.open(stream->getId(), m_owner.initial_window_size);
   return stream;
 }
 
@@ -446,12 +882,18 @@ http2::Stream::ptr Http2Stream::getStream(uint32_t id) {
 }
 
 void Http2Stream::delStream(uint32_t id) {
+  // 发送窗口保留到数据发送完成
+  m_dataScheduler.release(id);
   return m_streamMgr.del(id);
 }
 
 Http2Session::Http2Session(Socket::ptr sock, Http2Server* server)
     : Http2Stream(sock, false) {
   m_server = server;
+  m_disconnectCb = [](AsyncSocketStream::ptr stream) {
+    // 唤醒还在等待请求数据的流式处理协程
+    std::static_pointer_cast<Http2Session>(stream)->m_streamMgr.clear();
+  };
 }
 
 static bool Http2ConnectionOnConnect(AsyncSocketStream::ptr as) {
@@ -473,6 +915,10 @@ void Http2Connection::reset() {
   m_recvTable = DynamicTable();
   m_owner = Http2Settings();
   m_peer = Http2Settings();
+  m_dataScheduler.clear();
+  m_sendBuffer.clear();
+  m_recvWindow = DEFAULT_INITIAL_WINDOW_SIZE;
+  m_recvConsumed = 0;
 }
 
 bool Http2Connection::connect(sylar::Address::ptr addr, bool ssl) {
@@ -481,7 +927,9 @@ bool Http2Connection::connect(sylar::Address::ptr addr, bool ssl) {
     m_socket = sylar::Socket::CreateTCP(addr);
     return m_socket->connect(addr);
   } else {
-    m_socket = sylar::SSLSocket::CreateTCP(addr);
+    auto sock = sylar::SSLSocket::CreateTCP(addr);
+    sock->setAlpnProtocols({"h2"});
+    m_socket = sock;
     return m_socket->connect(addr);
   }
 }
@@ -502,7 +950,7 @@ void Http2InitRequestForRead(sylar::http::HttpRequest::ptr req) {
   req->setMethod(http::StringToHttpMethod(req->getHeader(":method")));
   if (req->hasHeader(":path", nullptr)) {
     req->setUri(req->getHeader(":path"));
-    SYLAR_LOG_INFO(g_logger) << req->getPath() << " - " << req->getQuery()
+    SYLAR_LOG_DEBUG(g_logger) << req->getPath() << " - " << req->getQuery()
                              << " - " << req->getFragment();
   }
 }
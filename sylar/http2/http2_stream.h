@@ -1,6 +1,8 @@
 #ifndef __SYLAR_HTTP2_HTTP2_STREAM_H__
 #define __SYLAR_HTTP2_HTTP2_STREAM_H__
 
+#include <atomic>
+#include "data_scheduler.h"
 #include "frame.h"
 #include "hpack.h"
 #include "stream.h"
@@ -54,15 +56,44 @@ struct Http2Settings {
 class Http2Stream : public AsyncSocketStream {
  public:
   typedef std::shared_ptr<Http2Stream> ptr;
+  typedef sylar::Mutex MutexType;
 
   Http2Stream(Socket::ptr sock, bool client);
   ~Http2Stream();
 
   int32_t sendFrame(Frame::ptr frame);
 
+  /**
+   * @brief 发送头部帧, 在写协程中做 HPACK 编码, 保证动态表与发送顺序一致
+   */
+  int32_t sendHeaders(
+      uint32_t id,
+      const std::vector<std::pair<std::string, std::string>>& headers,
+      bool end_stream);
+
+  /**
+   * @brief 发送数据, 按流控窗口切分为 DATA 帧, 由 DataScheduler 在各流之间调度
+   */
+  int32_t sendData(uint32_t id, const std::string& data, bool end_stream);
+  int32_t sendData(uint32_t id, std::string&& data, bool end_stream);
+
+  /**
+   * @brief 发送 trailers, 在该流已提交的 DATA 全部发出后以 HEADERS 帧结束流
+   */
+  int32_t sendTrailers(
+      uint32_t id,
+      const std::vector<std::pair<std::string, std::string>>& trailers);
+
   bool handleShakeClient();
   bool handleShakeServer();
 
+  /**
+   * @brief h2c 升级的服务端握手, 调用前已经发送 101 应答
+   * @details 按 HTTP2-Settings 设置对端参数, 发送 SETTINGS 后读取连接前言,
+   *          升级请求作为流 1 交给 ServletDispatch 处理
+   */
+  bool handleUpgradeServer(http::HttpRequest::ptr req);
+
   http::HttpResult::ptr request(http::HttpRequest::ptr req,
                                 uint64_t timeout_ms);
 
@@ -84,6 +115,12 @@ class Http2Stream : public AsyncSocketStream {
 
   DynamicTable& getSendTable() { return m_sendTable; }
   DynamicTable& getRecvTable() { return m_recvTable; }
+  DataScheduler& getDataScheduler() { return m_dataScheduler; }
+
+  /**
+   * @brief 对端通告的 INITIAL_WINDOW_SIZE, 即每个流的初始发送窗口
+   */
+  uint32_t getSendWindowSize() const { return m_owner.initial_window_size; }
 
  protected:
   struct FrameSendCtx : public SendCtx {
@@ -93,6 +130,28 @@ class Http2Stream : public AsyncSocketStream {
     virtual bool doSend(AsyncSocketStream::ptr stream) override;
   };
 
+  struct HeadersSendCtx : public SendCtx {
+    typedef std::shared_ptr<HeadersSendCtx> ptr;
+    uint32_t id = 0;
+    bool endStream = false;
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    virtual bool doSend(AsyncSocketStream::ptr stream) override;
+  };
+
+  struct DataSendCtx : public SendCtx {
+    typedef std::shared_ptr<DataSendCtx> ptr;
+    // 为 false 时只是继续发送被让出的数据
+    bool push = false;
+    uint32_t id = 0;
+    bool endStream = false;
+    std::string data;
+    bool hasTrailers = false;
+    DataScheduler::Headers trailers;
+
+    virtual bool doSend(AsyncSocketStream::ptr stream) override;
+  };
+
   struct RequestCtx : public Ctx {
     typedef std::shared_ptr<RequestCtx> ptr;
     http::HttpRequest::ptr request;
@@ -102,11 +161,41 @@ class Http2Stream : public AsyncSocketStream {
   };
 
   virtual Ctx::ptr doRecv() override;
+  virtual bool doFlush() override;
 
  private:
+  /**
+   * @brief 读取客户端的连接前言和第一个 SETTINGS 帧
+   */
+  Frame::ptr recvPreface();
   void updateSettings(Http2Settings& sts, SettingsFrame::ptr frame);
   void handleRequest(http::HttpRequest::ptr req, http2::Stream::ptr stream);
 
+  /**
+   * @brief 在写协程中发送调度出的 DATA 帧, 每次最多发送一个配额,
+   *        之后让出给队列中的其它帧
+   */
+  bool pumpData();
+  void schedulePump();
+
+  /**
+   * @brief 在写协程中把帧加入发送缓冲, 缓冲过大时提前写出
+   */
+  bool writeFrame(Frame::ptr frame);
+  void handleWindowUpdate(Frame::ptr frame);
+
+  /**
+   * @brief 接收 DATA 帧的流控, 连接窗口消耗过半时补充,
+   *        流式处理的流在数据被读走后由 Stream::recvData 补充
+   */
+  bool handleRecvData(Frame::ptr frame, http2::Stream::ptr stream);
+
+  /**
+   * @brief 按配置 http2.recv_window_size 设置接收窗口
+   * @return 需要在 SETTINGS 中通告的项
+   */
+  std::vector<SettingsItem> initRecvWindow();
+
  protected:
   DynamicTable m_sendTable;
   DynamicTable m_recvTable;
@@ -118,6 +207,14 @@ class Http2Stream : public AsyncSocketStream {
   Http2Settings m_peer;
   StreamManager m_streamMgr;
   Http2Server* m_server;
+  MutexType m_newStreamMutex;
+  DataScheduler m_dataScheduler;
+  std::atomic<bool> m_pumpQueued = {false};
+  // 只在写协程中使用, 一批发送事件产生的帧合并为一次 writev
+  FrameBuffer m_sendBuffer;
+  // 连接级的接收窗口, 以及已接收但未通过 WINDOW_UPDATE 归还的字节数
+  uint32_t m_recvWindow = DEFAULT_INITIAL_WINDOW_SIZE;
+  uint32_t m_recvConsumed = 0;
 };
 
 class Http2Session : public Http2Stream {
@@ -1,285 +1,122 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
 #include <cstdint>
+#include <vector>
 
 #include "huffman.h"
 #include "huffman_table.h"
 
-#define HEX_TO_HF_CODE(hex) huffman_codes[hex]
-#define HEX_TO_HF_CODE_LEN(hex) huffman_code_len[hex]
-#define SYLAR_MAX_HUFFMAN_BUFF_LEN(l) (l * 8 + 1)
-
 namespace sylar {
 namespace http2 {
 
-enum HM_RETURN {
-  HM_RETURN_SUCCESS = 0,
-  HM_RETURN_UNIMPLEMENT = -100,
-};
-
-struct node {
-  struct node* children[256];
-  unsigned char sym;
-  unsigned int code;
-  int code_len;
-  int size;
-};
-
-typedef struct node NODE;
-extern NODE* ROOT;
-
-int hf_init(NODE** h_node);
-void hf_finish(NODE* h_node);
-int hf_byte_encode(unsigned char ch, int remain, unsigned char* buff);
-int hf_integer_encode(unsigned int enc_binary, int nprefix,
-                      unsigned char* buff);
-int hf_integer_decode(const char* enc_buff, int nprefix, char* dec_buff);
-int hf_string_encode(const char* buff_in, int size, int prefix,
-                     unsigned char* buff_out, int* size_out);
-int hf_string_decode(NODE* h_node, unsigned char* enc, int enc_sz,
-                     char* out_buff, int out_sz);
-void hf_print_hex(unsigned char* buff, int size);
-int hf_string_encode_len(unsigned char* enc, int enc_sz);
-
-static NODE* node_create() {
-  NODE* nnode = (NODE*)malloc(1 * sizeof(NODE));
-  memset(nnode, 0, sizeof(NODE));
-  return nnode;
-}
-
-static int _hf_add_node(NODE* h_node, unsigned char sym, int code,
-                        int code_len) {
-  NODE* cur = h_node;
-  unsigned char i = 0;
-  int j = 0;
-  int shift = 0;
-  int start = 0;
-  int end = 0;
-
-  for (; code_len > 8;) {
-    code_len -= 8;
-    i = (unsigned char)(code >> code_len);
-    if (cur->children[i] == NULL) {
-      cur->children[i] = node_create();
-    }
-    cur = cur->children[i];
+namespace {
+
+/**
+ * @brief 哈夫曼解码状态机, 每次输入 4 位
+ * @details 状态为哈夫曼树的内部节点(含 EOS 共 257 个叶子, 256 个内部节点),
+ *          0 为根节点。最短的码长为 5 位, 所以每 4 位最多输出一个字符。
+ *          表在第一次使用时由 huffman_codes 生成
+ */
+class HuffmanDecoder {
+ public:
+  enum Flags {
+    // 输出 sym
+    SYM = 0x1,
+    // 非法的编码(包括 EOS)
+    FAIL = 0x2,
+    // 停在该状态时, 剩余的位是合法的填充(不超过 7 位的 1)
+    ACCEPT = 0x4,
+  };
+
+  struct Entry {
+    uint8_t state;
+    uint8_t flags;
+    uint8_t sym;
+  };
+
+  static const HuffmanDecoder& GetInstance() {
+    static HuffmanDecoder s_decoder;
+    return s_decoder;
   }
 
-  shift = (8 - code_len);
-  start = (unsigned char)(code << shift);
-  end = (1 << shift);
-
-  for (j = start; j < start + end; j++) {
-    if (cur->children[j] == NULL) {
-      cur->children[j] = node_create();
-    }
-    cur->children[j]->code = code;
-    cur->children[j]->sym = sym;
-    cur->children[j]->code_len = code_len;
-    cur->size++;
+  const Entry& next(uint8_t state, uint8_t nibble) const {
+    return m_table[state][nibble];
   }
 
-  return 0;
-}
-
-static int _hf_del_node(NODE* h_node) {
-  if (h_node) {
-    for (int i = 0; i < 256; i++) {
-      if (h_node->children[i]) {
-        _hf_del_node(h_node->children[i]);
+ private:
+  struct Node {
+    int child[2] = {-1, -1};
+    int sym = -1;
+  };
+
+  HuffmanDecoder() {
+    std::vector<Node> nodes(1);
+    for (int i = 0; i < 257; ++i) {
+      uint32_t code = i < 256 ? huffman_codes[i] : 0x3fffffff;
+      int len = i < 256 ? huffman_code_len[i] : 30;
+      int cur = 0;
+      for (int b = len - 1; b >= 0; --b) {
+        int bit = (code >> b) & 1;
+        if (nodes[cur].child[bit] == -1) {
+          nodes[cur].child[bit] = nodes.size();
+          nodes.push_back(Node());
+        }
+        cur = nodes[cur].child[bit];
       }
+      nodes[cur].sym = i;
     }
-    free(h_node);
-  }
-  return 0;
-}
 
-int hf_init(NODE** h_node) {
-  int i = 0;
-  *h_node = node_create();
-  for (i = 0; i < 256; i++) {
-    _hf_add_node(*h_node, i, huffman_codes[i], huffman_code_len[i]);
-  }
-  return 0;
-}
-
-void hf_finish(NODE* h_node) {
-  int i = 0;
-  for (i = 0; i < 256; i++) {
-    _hf_del_node(h_node->children[i]);
-  }
-
-  free(h_node);
-}
-
-int hf_byte_encode(unsigned char ch, int remain, unsigned char* buff) {
-  unsigned char t = 0;
-  int i = 0;
-  int codes = HEX_TO_HF_CODE(ch);
-  int nbits = HEX_TO_HF_CODE_LEN(ch);
-  // printf("'%c'|codes(%d)|len(%d)\n", ch, codes, nbits );
-  for (;;) {
-    if (remain > nbits) {
-      t = (unsigned char)(codes << (remain - nbits));
-      buff[i++] |= t;
-      return remain - nbits;
-    } else {
-      t = (unsigned char)(codes >> (nbits - remain));
-      buff[i++] |= t;
-      nbits -= remain;
-      remain = 8;
+    // 内部节点编号为状态, 沿全 1 路径深度不超过 7 的节点可以结束
+    std::vector<int> states(nodes.size(), -1);
+    std::vector<int> internals;
+    std::vector<bool> accepts;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (nodes[i].sym == -1) {
+        states[i] = internals.size();
+        internals.push_back(i);
+        accepts.push_back(false);
+      }
     }
-    buff[i] = 0;
-    if (nbits == 0)
-      return remain;
-  }
-}
-
-int hf_string_encode(const char* buff_in, int size, int prefix,
-                     unsigned char* buff_out, int* size_out) {
-  int i = 0;
-  int remain = (8 - prefix);
-  int j = 0;  // j is instead currently index of buff_out and it is size of
-              // buff_out after it has been done.
-  int nbytes = 0;
-
-  for (i = 0; i < size; i++) {
-
-    if (remain > HEX_TO_HF_CODE_LEN((uint8_t)buff_in[i])) {
-      nbytes = (remain - HEX_TO_HF_CODE_LEN((uint8_t)buff_in[i])) / 8;
-    } else {
-      nbytes = ((HEX_TO_HF_CODE_LEN((uint8_t)buff_in[i]) - remain) / 8) + 1;
+    for (int depth = 0, cur = 0; depth <= 7; ++depth) {
+      accepts[states[cur]] = true;
+      cur = nodes[cur].child[1];
     }
-    remain = hf_byte_encode(buff_in[i], remain, &buff_out[j]);
-    j += nbytes;
-  }
-
-  // Special EOS sybol
-  if (remain < 8) {
-    unsigned int codes = 0x3fffffff;
-    int nbits = (char)30;
-    buff_out[j++] |= (unsigned char)(codes >> (nbits - remain));
-  }
-
-  *size_out = j;
-  return 0;
-}
 
-int hf_string_decode(NODE* h_node, unsigned char* enc, int enc_sz,
-                     char* out_buff, int out_sz) {
-  NODE* n = h_node;
-  unsigned int cur = 0;
-  int nbits = 0;
-  int i = 0;
-  int idx = 0;
-  int at = 0;
-  for (i = 0; i < enc_sz; i++) {
-    cur = (cur << 8) | enc[i];
-    nbits += 8;
-    for (; nbits >= 8;) {
-      idx = (unsigned char)(cur >> (nbits - 8));
-      n = n->children[idx];
-      if (n == NULL) {
-        printf("invalid huffmand code\n");
-        return -1;  // invalid huffmand code
-      }
-      // printf("n->sym : %c , n->size = %d\n", n->sym, n->size);
-      // if( n->children == NULL){
-      if (n->size == 0) {
-        if (out_sz > 0 && at > out_sz) {
-          printf("out of length\n");
-          return -2;  // lenght out of bound
+    for (size_t s = 0; s < internals.size(); ++s) {
+      for (int nibble = 0; nibble < 16; ++nibble) {
+        Entry& e = m_table[s][nibble];
+        e.state = 0;
+        e.flags = 0;
+        e.sym = 0;
+        int cur = internals[s];
+        for (int b = 3; b >= 0; --b) {
+          cur = nodes[cur].child[(nibble >> b) & 1];
+          if (nodes[cur].sym == 256) {
+            e.flags = FAIL;
+            break;
+          }
+          if (nodes[cur].sym != -1) {
+            e.flags |= SYM;
+            e.sym = nodes[cur].sym;
+            cur = 0;
+          }
+        }
+        if (e.flags & FAIL) {
+          continue;
+        }
+        e.state = states[cur];
+        if (accepts[e.state]) {
+          e.flags |= ACCEPT;
         }
-        out_buff[at++] = (char)n->sym;
-        nbits -= n->code_len;
-        n = h_node;
-      } else {
-        nbits -= 8;
       }
     }
   }
 
-  for (; nbits > 0;) {
-    n = n->children[(unsigned char)(cur << (8 - nbits))];
-    if (n->size != 0 || n->code_len > nbits) {
-      break;
-    }
-
-    out_buff[at++] = (char)n->sym;
-    nbits -= n->code_len;
-    n = h_node;
-  }
-
-  return at;
-}
-
-int hf_integer_encode(unsigned int enc_binary, int nprefix,
-                      unsigned char* buff) {
-  int i = 0;
-  unsigned int ch = enc_binary;
-  unsigned int ch2 = 0;
-  unsigned int prefix = (1 << nprefix) - 1;
-
-  if (ch < prefix && (ch < 0xff)) {
-    buff[i++] = ch & prefix;
-  } else {
-    buff[i++] = prefix;
-    ch -= prefix;
-    while (ch > 128) {
-      ch2 = (ch % 128);
-      ch2 += 128;
-      buff[i++] = ch2;
-      ch = ch / 128;
-    }
-    buff[i++] = ch;
-  }
-  return i;
-}
-
-int hf_integer_decode(const char* enc_buff, int nprefix, char* dec_buff) {
-  int i = 0;
-  int j = 0;
-  unsigned int M = 0;
-  unsigned int B = 0;
-  unsigned int ch = enc_buff[i++];
-  unsigned int prefix = (1 << nprefix) - 1;
-
-  if (ch < prefix) {
-    dec_buff[j++] = ch;
-  } else {
-    M = 0;
-    do {
-      B = enc_buff[i++];
-      ch = ch + ((B & 127) * (1 << M));
-      M = M + 7;
-    } while (B & 128);
-    dec_buff[j] = ch;
-  }
-  return i;
-}
-
-int hf_string_encode_len(unsigned char* enc, int enc_sz) {
-  int i = 0;
-  int len = 0;
-  for (i = 0; i < enc_sz; i++) {
-    len += huffman_code_len[(int)enc[i]];
-  }
+ private:
+  Entry m_table[256][16];
+};
 
-  return (len + 7) / 8;
-}
+static const HuffmanDecoder& s_huffman_decoder = HuffmanDecoder::GetInstance();
 
-void hf_print_hex(unsigned char* buff, int size) {
-  static char hex[] = {'0', '1', '2', '3', '4', '5', '6', '7',
-                       '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
-  int i = 0;
-  for (i = 0; i < size; i++) {
-    unsigned char ch = buff[i];
-    printf("(%u)%c", ch, hex[(ch >> 4)]);
-    printf("%c ", hex[(ch & 0x0f)]);
-  }
-  printf("\n");
-}
+}  // namespace
 
 int Huffman::EncodeString(const std::string& in, std::string& out, int prefix) {
   return EncodeString(in.c_str(), in.length(), out, prefix);
@@ -287,11 +124,37 @@ int Huffman::EncodeString(const std::string& in, std::string& out, int prefix) {
 
 int Huffman::EncodeString(const char* in, int in_len, std::string& out,
                           int prefix) {
-  int len = SYLAR_MAX_HUFFMAN_BUFF_LEN(in_len);
-  out.resize(len);
-  int rt = hf_string_encode(in, in_len, prefix, (unsigned char*)&out[0], &len);
-  out.resize(len);
-  return rt;
+  const uint8_t* p = (const uint8_t*)in;
+  int len = prefix;
+  for (int i = 0; i < in_len; ++i) {
+    len += huffman_code_len[p[i]];
+  }
+  out.resize((len + 7) / 8);
+  uint8_t* o = (uint8_t*)&out[0];
+  // 前 prefix 位保留为 0, 编码在 bits 中累积, 满 32 位输出
+  uint64_t bits = 0;
+  int nbits = prefix;
+  for (int i = 0; i < in_len; ++i) {
+    bits = (bits << huffman_code_len[p[i]]) | huffman_codes[p[i]];
+    nbits += huffman_code_len[p[i]];
+    if (nbits >= 32) {
+      nbits -= 32;
+      uint32_t v = bits >> nbits;
+      *o++ = v >> 24;
+      *o++ = v >> 16;
+      *o++ = v >> 8;
+      *o++ = v;
+    }
+  }
+  while (nbits >= 8) {
+    nbits -= 8;
+    *o++ = bits >> nbits;
+  }
+  if (nbits > 0) {
+    // 用 EOS 的高位(全 1)填充
+    *o++ = (bits << (8 - nbits)) | (0xFF >> nbits);
+  }
+  return 0;
 }
 
 int Huffman::DecodeString(const std::string& in, std::string& out) {
@@ -299,21 +162,47 @@ int Huffman::DecodeString(const std::string& in, std::string& out) {
 }
 
 int Huffman::DecodeString(const char* in, int in_len, std::string& out) {
-  NODE* h_node;
-  hf_init(&h_node);
-  int len = SYLAR_MAX_HUFFMAN_BUFF_LEN(in_len);
-  out.resize(len);
-  int rt = hf_string_decode(h_node, (unsigned char*)in, in_len, &out[0], len);
-  hf_finish(h_node);
-  out.resize(rt);
-  return rt;
+  // 最短码长 5 位, 输出不会超过输入的 8/5
+  out.resize(in_len * 8 / 5 + 1);
+  char* o = &out[0];
+  const uint8_t* p = (const uint8_t*)in;
+  uint8_t state = 0;
+  uint8_t flags = HuffmanDecoder::ACCEPT;
+  for (int i = 0; i < in_len; ++i) {
+    const HuffmanDecoder::Entry& hi = s_huffman_decoder.next(state, p[i] >> 4);
+    const HuffmanDecoder::Entry& lo =
+        s_huffman_decoder.next(hi.state, p[i] & 0xF);
+    if ((hi.flags | lo.flags) & HuffmanDecoder::FAIL) {
+      out.clear();
+      return -1;
+    }
+    // SYM 为 1, 不输出时下一次写入会覆盖
+    *o = hi.sym;
+    o += hi.flags & HuffmanDecoder::SYM;
+    *o = lo.sym;
+    o += lo.flags & HuffmanDecoder::SYM;
+    state = lo.state;
+    flags = lo.flags;
+  }
+  out.resize(o - &out[0]);
+  if (!(flags & HuffmanDecoder::ACCEPT)) {
+    // 填充超过 7 位, 或者不是 EOS 的前缀
+    out.clear();
+    return -1;
+  }
+  return out.size();
 }
 
 int Huffman::EncodeLen(const std::string& in) {
   return EncodeLen(in.c_str(), in.length());
 }
+
 int Huffman::EncodeLen(const char* in, int in_len) {
-  return hf_string_encode_len((uint8_t*)in, in_len);
+  int len = 0;
+  for (int i = 0; i < in_len; ++i) {
+    len += huffman_code_len[(uint8_t)in[i]];
+  }
+  return (len + 7) / 8;
 }
 
 bool Huffman::ShouldEncode(const std::string& in) {
@@ -324,23 +213,5 @@ bool Huffman::ShouldEncode(const char* in, int in_len) {
   return EncodeLen(in, in_len) < in_len;
 }
 
-// void testHuffman() {
-//     std::string str = "hello huffman,你好,世界";
-//     std::string out;
-//     Huffman::EncodeString(str, out, 0);
-//     std::cout << "str.size=" << str.size()
-//               << " out.size=" << out.size()
-//               << std::endl;
-//     hf_print_hex((unsigned char*)out.c_str(), out.length());
-//     std::string str2;
-//     Huffman::DecodeString(out, str2);
-//     std::cout << str2 << std::endl;
-//     std::cout << "str.size=" << str.size()
-//               << " out.size=" << out.size() << std::endl;
-//
-//     std::cout << "hf_string_encode_len: " <<
-//     hf_string_encode_len((uint8_t*)str.c_str(), str.size()) << std::endl;
-// }
-
 }  // namespace http2
 }  // namespace sylar
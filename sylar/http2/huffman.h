@@ -6,6 +6,11 @@
 namespace sylar {
 namespace http2 {
 
+/**
+ * @brief HPACK 哈夫曼编解码(RFC 7541 附录 B)
+ * @details 编码按字符查表, 在 64 位整数中累积后按字节输出;
+ *          解码使用每次 4 位的状态机, 非法编码返回 -1
+ */
 class Huffman {
  public:
   static int EncodeString(const char* in, int in_len, std::string& out,
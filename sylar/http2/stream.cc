@@ -34,13 +34,39 @@ std::shared_ptr<Http2Stream> Stream::getStream() const {
 
 int32_t Stream::handleRstStreamFrame(Frame::ptr frame, bool is_client) {
   m_state = State::CLOSED;
+  cancel();
   return 0;
 }
 
+void Stream::initRequest() {
+  if (!m_request) {
+    m_request = std::make_shared<http::HttpRequest>(0x20);
+  }
+  if (m_recvHPack) {
+    auto& m = m_recvHPack->getHeaders();
+    for (auto& i : m) {
+      m_request->setHeader(i.name, i.value);
+    }
+  }
+  Http2InitRequestForRead(m_request);
+}
+
+void Stream::setUpgradeRequest(http::HttpRequest::ptr req) {
+  m_request = req;
+  m_state = State::HALF_CLOSE_REMOTE;
+  MutexType::Lock lock(m_recvMutex);
+  m_recvEnd = true;
+}
+
 int32_t Stream::handleFrame(Frame::ptr frame, bool is_client) {
   int rt = 0;
   if (frame->header.type == (uint8_t)FrameType::HEADERS) {
     rt = handleHeadersFrame(frame, is_client);
+    if (!is_client && rt >= 0 &&
+        (frame->header.flags & (uint8_t)FrameFlagHeaders::END_HEADERS)) {
+      // 请求头部完整后就可以开始处理流式请求, 之后的 HEADERS 为 trailers
+      initRequest();
+    }
   } else if (frame->header.type == (uint8_t)FrameType::DATA) {
     rt = handleDataFrame(frame, is_client);
   } else if (frame->header.type == (uint8_t)FrameType::RST_STREAM) {
@@ -48,10 +74,18 @@ int32_t Stream::handleFrame(Frame::ptr frame, bool is_client) {
   }
   if (frame->header.flags & (uint8_t)FrameFlagHeaders::END_STREAM) {
     m_state = State::CLOSED;
+    {
+      MutexType::Lock lock(m_recvMutex);
+      m_recvEnd = true;
+    }
+    m_recvSem.notify();
     if (is_client) {
       if (!m_response) {
         m_response = std::make_shared<http::HttpResponse>(0x20);
       }
+      if (!m_body.empty()) {
+        m_response->setBody(m_body);
+      }
       if (m_recvHPack) {
         auto& m = m_recvHPack->getHeaders();
         for (auto& i : m) {
@@ -62,15 +96,11 @@ int32_t Stream::handleFrame(Frame::ptr frame, bool is_client) {
     } else {
       // 服务端解析收到的请求
       if (!m_request) {
-        m_request = std::make_shared<http::HttpRequest>(0x20);
+        initRequest();
       }
-      if (m_recvHPack) {
-        auto& m = m_recvHPack->getHeaders();
-        for (auto& i : m) {
-          m_request->setHeader(i.name, i.value);
-        }
+      if (!m_body.empty()) {
+        m_request->setBody(m_body);
       }
-      Http2InitRequestForRead(m_request);
     }
     SYLAR_LOG_DEBUG(g_logger) << "id=" << m_id << " is_client=" << is_client
                               << " req=" << m_request << " rsp=" << m_response;
@@ -115,16 +145,135 @@ int32_t Stream::handleDataFrame(Frame::ptr frame, bool is_client) {
         << frame->toString();
     return -1;
   }
-  if (is_client) {
-    m_response = std::make_shared<http::HttpResponse>(0x20);
-    m_response->setBody(data->data);
-  } else {
-    m_request = std::make_shared<http::HttpRequest>(0x20);
-    m_request->setBody(data->data);
+  if (m_streaming) {
+    if (!data->data.empty()) {
+      MutexType::Lock lock(m_recvMutex);
+      m_recvDatas.push_back(std::move(data->data));
+    }
+    m_recvSem.notify();
+    return 0;
   }
+  // 大的 body 会分成多个 DATA 帧
+  m_body.append(data->data);
   return 0;
 }
 
+int64_t Stream::consumeRecvWindow(uint32_t n, uint32_t payload,
+                                  uint32_t window) {
+  MutexType::Lock lock(m_recvMutex);
+  m_recvWindow = window;
+  m_recvConsumed += n;
+  if (m_recvConsumed > window) {
+    return -1;
+  }
+  // 流式处理的数据等 recvData 读走后再归还
+  m_recvReleased += m_streaming ? n - payload : n;
+  return takeRecvReleased();
+}
+
+int64_t Stream::takeRecvReleased() {
+  if (m_recvReleased < m_recvWindow / 2) {
+    return 0;
+  }
+  int64_t v = m_recvReleased;
+  m_recvConsumed -= m_recvReleased;
+  m_recvReleased = 0;
+  return v;
+}
+
+int32_t Stream::recvData(std::string& data) {
+  while (true) {
+    bool got = false;
+    int64_t v = 0;
+    {
+      MutexType::Lock lock(m_recvMutex);
+      if (m_cancelled) {
+        return -1;
+      }
+      if (!m_recvDatas.empty()) {
+        data.swap(m_recvDatas.front());
+        m_recvDatas.pop_front();
+        got = true;
+        m_recvReleased += data.size();
+        // 对端已发送完毕就不需要再补充窗口
+        if (!m_recvEnd) {
+          v = takeRecvReleased();
+        }
+      } else if (m_recvEnd) {
+        return 0;
+      }
+    }
+    if (got) {
+      auto stream = getStream();
+      if (v > 0 && stream) {
+        stream->sendWindowUpdate(m_id, v);
+      }
+      return 1;
+    }
+    // 信号量可能有多余的计数, 醒来后重新检查
+    m_recvSem.wait();
+  }
+}
+
+void Stream::addSendPending(size_t n) {
+  MutexType::Lock lock(m_sendMutex);
+  m_sendPending += n;
+}
+
+void Stream::onDataSent(size_t n) {
+  MutexType::Lock lock(m_sendMutex);
+  // 未经 addSendPending 提交的数据(如 sendResponse)不计数
+  m_sendPending -= std::min(m_sendPending, n);
+  if (m_sendWaiters == 0 || m_sendPending > m_sendWaitLimit) {
+    return;
+  }
+  uint32_t waiters = m_sendWaiters;
+  m_sendWaiters = 0;
+  lock.unlock();
+  for (uint32_t i = 0; i < waiters; ++i) {
+    m_sendSem.notify();
+  }
+}
+
+bool Stream::waitSendable(size_t limit) {
+  while (true) {
+    {
+      MutexType::Lock lock(m_sendMutex);
+      if (isCancelled()) {
+        return false;
+      }
+      if (m_sendPending <= limit) {
+        return true;
+      }
+      ++m_sendWaiters;
+      m_sendWaitLimit = limit;
+    }
+    m_sendSem.wait();
+  }
+}
+
+void Stream::cancel() {
+  {
+    MutexType::Lock lock(m_recvMutex);
+    m_cancelled = true;
+  }
+  m_recvSem.notify();
+  uint32_t waiters = 0;
+  {
+    MutexType::Lock lock(m_sendMutex);
+    waiters = m_sendWaiters;
+    m_sendWaiters = 0;
+  }
+  for (uint32_t i = 0; i < waiters; ++i) {
+    m_sendSem.notify();
+  }
+}
+
+bool Stream::isCancelled() {
+  MutexType::Lock lock(m_recvMutex);
+  return m_cancelled;
+}
+
 int32_t Stream::sendResponse(http::HttpResponse::ptr rsp) {
   auto stream = getStream();
   if (!stream) {
@@ -135,39 +284,18 @@ int32_t Stream::sendResponse(http::HttpResponse::ptr rsp) {
 
   Http2InitResponseForWrite(rsp);
 
-  Frame::ptr headers = std::make_shared<Frame>();
-  headers->header.type = (uint8_t)FrameType::HEADERS;
-  headers->header.flags = (uint8_t)FrameFlagHeaders::END_HEADERS;
-  if (rsp->getBody().empty()) {
-    headers->header.flags |= (uint8_t)FrameFlagHeaders::END_STREAM;
-  }
-  headers->header.identifier = m_id;
-  HeadersFrame::ptr data;
-  auto m = rsp->getHeaders();
-  data = std::make_shared<HeadersFrame>();
-
-  HPack hp(stream->getSendTable());
   std::vector<std::pair<std::string, std::string>> hs;
-  for (auto& i : m) {
+  for (auto& i : rsp->getHeaders()) {
     hs.push_back(std::make_pair(sylar::ToLower(i.first), i.second));
   }
-  hp.pack(hs, data->data);
-  headers->data = data;
-  int ok = stream->sendFrame(headers);
+  int ok = stream->sendHeaders(m_id, hs, rsp->getBody().empty());
   if (ok < 0) {
     SYLAR_LOG_ERROR(g_logger)
         << "Stream id=" << m_id << " sendResponse send Headers fail";
     return ok;
   }
   if (!rsp->getBody().empty()) {
-    Frame::ptr body = std::make_shared<Frame>();
-    body->header.type = (uint8_t)FrameType::DATA;
-    body->header.flags = (uint8_t)FrameFlagData::END_STREAM;
-    body->header.identifier = m_id;
-    auto data = std::make_shared<DataFrame>();
-    data->data = rsp->getBody();
-    body->data = data;
-    ok = stream->sendFrame(body);
+    ok = stream->sendData(m_id, rsp->getBody(), true);
   }
   return ok;
 }
@@ -192,5 +320,16 @@ void StreamManager::del(uint32_t id) {
   m_streams.erase(id);
 }
 
+void StreamManager::clear() {
+  std::unordered_map<uint32_t, Stream::ptr> streams;
+  {
+    RWMutexType::WriteLock lock(m_mutex);
+    streams.swap(m_streams);
+  }
+  for (auto& i : streams) {
+    i.second->cancel();
+  }
+}
+
 }  // namespace http2
 }  // namespace sylar
@@ -1,6 +1,7 @@
 #ifndef __SYLAR_HTTP2_STREAM_H__
 #define __SYLAR_HTTP2_STREAM_H__
 
+#include <list>
 #include <unordered_map>
 #include "frame.h"
 #include "hpack.h"
@@ -54,6 +55,7 @@ class Http2Stream;
 class Stream {
  public:
   typedef std::shared_ptr<Stream> ptr;
+  typedef sylar::Spinlock MutexType;
   enum class State {
     IDLE = 0x0,
     OPEN = 0x1,
@@ -79,7 +81,64 @@ class Stream {
   http::HttpRequest::ptr getRequest() const { return m_request; }
   http::HttpResponse::ptr getResponse() const { return m_response; }
 
+  /**
+   * @brief h2c 升级时, 把 HTTP/1.1 的升级请求作为流 1 的请求,
+   *        流进入 half-closed(remote) 状态
+   */
+  void setUpgradeRequest(http::HttpRequest::ptr req);
+
+  /**
+   * @brief 接收 DATA 帧后扣减流的接收窗口
+   * @details 流式处理时数据在 recvData 读走后才归还窗口, 对端最多积压一个窗口,
+   *          其余情况(以及填充)收到即可归还
+   * @param[in] n DATA 帧的长度(包括填充)
+   * @param[in] payload 去掉填充后的数据长度
+   * @param[in] window 通告给对端的 INITIAL_WINDOW_SIZE
+   * @return 超出窗口返回 -1, 需要发送 WINDOW_UPDATE 时返回增量, 否则返回 0
+   */
+  int64_t consumeRecvWindow(uint32_t n, uint32_t payload, uint32_t window);
+
+  /**
+   * @brief 服务端以流的方式处理请求, 之后的 DATA 不再合并为 body,
+   *        由处理协程通过 recvData 逐块读取
+   */
+  void setStreaming(bool v) { m_streaming = v; }
+  bool isStreaming() const { return m_streaming; }
+
+  /**
+   * @brief 读取一块 DATA 数据, 没有数据时挂起当前协程
+   * @details 读走的数据累计过半个窗口时发送流级的 WINDOW_UPDATE
+   * @return 1 读到数据, 0 对端已发送完毕, -1 流已取消
+   */
+  int32_t recvData(std::string& data);
+
+  /**
+   * @brief 提交 DATA 前计入待发送的字节数
+   */
+  void addSendPending(size_t n);
+
+  /**
+   * @brief 写协程发出 DATA 帧后扣减待发送的字节数, 唤醒 waitSendable
+   */
+  void onDataSent(size_t n);
+
+  /**
+   * @brief 等待对端的流窗口, 已提交但未发出的数据不超过 limit 时返回
+   * @return 流已取消返回 false
+   */
+  bool waitSendable(size_t limit);
+
+  /**
+   * @brief 取消流(收到 RST_STREAM、连接断开或者超时), 唤醒 recvData
+   *        和 waitSendable
+   */
+  void cancel();
+  bool isCancelled();
+
  private:
+  void initRequest();
+  int64_t takeRecvReleased();
+
   int32_t handleHeadersFrame(Frame::ptr frame, bool is_client);
   int32_t handleDataFrame(Frame::ptr frame, bool is_client);
   int32_t handleRstStreamFrame(Frame::ptr frame, bool is_client);
@@ -91,6 +150,27 @@ class Stream {
   http::HttpRequest::ptr m_request;
   http::HttpResponse::ptr m_response;
   HPack::ptr m_recvHPack;
+  // DATA 帧的数据, 收到 END_STREAM 后设置为请求或应答的 body
+  std::string m_body;
+
+  bool m_streaming = false;
+  MutexType m_recvMutex;
+  // 已接收但未通过 WINDOW_UPDATE 归还的字节数, 其中已读走可以归还的字节数
+  uint32_t m_recvConsumed = 0;
+  uint32_t m_recvReleased = 0;
+  uint32_t m_recvWindow = 0;
+  std::list<std::string> m_recvDatas;
+  bool m_recvEnd = false;
+  bool m_cancelled = false;
+  FiberSemaphore m_recvSem;
+
+  MutexType m_sendMutex;
+  // 已提交但写协程尚未发出的 DATA 字节数
+  size_t m_sendPending = 0;
+  // waitSendable 挂起的协程数及其阈值
+  uint32_t m_sendWaiters = 0;
+  size_t m_sendWaitLimit = 0;
+  FiberSemaphore m_sendSem;
 };
 
 class StreamManager {
@@ -102,6 +182,11 @@ class StreamManager {
   void add(Stream::ptr stream);
   void del(uint32_t id);
 
+  /**
+   * @brief 删除并取消所有的流, 连接断开时唤醒仍在等待数据的处理协程
+   */
+  void clear();
+
  private:
   RWMutexType m_mutex;
   std::unordered_map<uint32_t, Stream::ptr> m_streams;
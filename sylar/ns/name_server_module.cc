@@ -1,4 +1,6 @@
 #include "name_server_module.h"
+#include <algorithm>
+#include "sylar/config.h"
 #include "sylar/log.h"
 #include "sylar/worker.h"
 
@@ -7,9 +9,54 @@ namespace ns {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_ns_sync_log_size =
+    sylar::Config::Lookup("ns.sync_log_size", (uint32_t)128,
+                          "name server change log size per domain");
+
+static uint32_t s_ns_sync_log_size = 0;
+
+namespace {
+
+struct _NSSyncIniter {
+  _NSSyncIniter() {
+    s_ns_sync_log_size = g_ns_sync_log_size->getValue();
+    g_ns_sync_log_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_ns_sync_log_size = nv;
+        });
+  }
+};
+
+static _NSSyncIniter s_sync_init;
+
+CmdDelta* get_cmd(std::map<std::string, DomainSync>& syncs,
+                  const std::string& domain, uint32_t cmd) {
+  auto& sync = syncs[domain];
+  for (auto& i : *sync.mutable_cmds()) {
+    if (i.cmd() == cmd) {
+      return &i;
+    }
+  }
+  auto rt = sync.add_cmds();
+  rt->set_cmd(cmd);
+  return rt;
+}
+
+void add_node(CmdDelta* cmd, NSNode::ptr node) {
+  auto n = cmd->add_updates();
+  n->set_ip(node->getIp());
+  n->set_port(node->getPort());
+  n->set_weight(node->getWeight());
+}
+
+}  // namespace
+
 uint64_t s_request_count = 0;
 uint64_t s_on_connect = 0;
 uint64_t s_on_disconnect = 0;
+uint64_t s_sync_delta = 0;
+uint64_t s_sync_snapshot = 0;
+uint64_t s_sync_notify = 0;
 
 NameServerModule::NameServerModule()
     : RockModule("NameServerModule", "1.0.0", "") {
@@ -27,6 +74,8 @@ bool NameServerModule::handleRockRequest(sylar::RockRequest::ptr request,
       return handleQuery(request, response, stream);
     case (int)NSCommand::TICK:
       return handleTick(request, response, stream);
+    case (int)NSCommand::SUBSCRIBE:
+      return handleSubscribe(request, response, stream);
     default:
       SYLAR_LOG_WARN(g_logger)
           << "invalid cmd=0x" << std::hex << request->getCmd();
@@ -66,7 +115,7 @@ bool NameServerModule::onDisconnect(sylar::Stream::ptr stream) {
     SYLAR_LOG_INFO(g_logger) << "onDisconnect: " << *addr;
   }
   set(rockstream, nullptr);
-  // setQueryDomain(rockstream, {});
+  setQueryDomain(rockstream, {});
   return true;
 }
 
@@ -199,6 +248,7 @@ void NameServerModule::set(sylar::RockStream::ptr rs,
     new_value = nullptr;
   }
 
+  sylar::Mutex::Lock sync_lock(m_syncMutex);
   auto old_value = get(rs);
 
   std::map<std::string, std::set<uint32_t>> old_v;
@@ -206,9 +256,7 @@ void NameServerModule::set(sylar::RockStream::ptr rs,
   std::map<std::string, std::set<uint32_t>> dels;
   std::map<std::string, std::set<uint32_t>> news;
   std::map<std::string, std::set<uint32_t>> comms;
-
-  // auto nty = std::make_shared<NotifyMessage>();
-  // std::set<std::string> ds;
+  std::map<std::string, DomainSync> syncs;
 
   if (old_value) {
     old_v = old_value->m_domain2cmds;
@@ -218,67 +266,28 @@ void NameServerModule::set(sylar::RockStream::ptr rs,
   }
   diff(old_v, new_v, dels, news, comms);
   for (auto& i : dels) {
-    auto d = m_domains->get(i.first);
-    if (d) {
-      for (auto& c : i.second) {
-        d->del(c, old_value->m_node->getId());
-        // auto info = nty->add_dels();
-        // info->set_domain(i.first);
-        // info->set_cmd(c);
-        // auto ninfo = info->add_nodes();
-        // ninfo->set_ip(old_value->m_node->getIp());
-        // ninfo->set_port(old_value->m_node->getPort());
-        // ninfo->set_weight(old_value->m_node->getWeight());
-      }
-      // ds.insert(i.first);
+    if (!m_domains->get(i.first)) {
+      continue;
+    }
+    for (auto& c : i.second) {
+      get_cmd(syncs, i.first, c)->add_dels(old_value->m_node->getId());
     }
   }
   for (auto& i : news) {
-    auto d = m_domains->get(i.first);
-    if (!d) {
-      d = std::make_shared<NSDomain>(i.first);
-      m_domains->add(d);
-    }
     for (auto& c : i.second) {
-      d->add(c, new_value->m_node);
-
-      // auto info = nty->add_updates();
-      // info->set_domain(i.first);
-      // info->set_cmd(c);
-      // auto ninfo = info->add_nodes();
-      // ninfo->set_ip(new_value->m_node->getIp());
-      // ninfo->set_port(new_value->m_node->getPort());
-      // ninfo->set_weight(new_value->m_node->getWeight());
+      add_node(get_cmd(syncs, i.first, c), new_value->m_node);
     }
-    // ds.insert(i.first);
   }
   if (!comms.empty()) {
     if (old_value->m_node->getWeight() != new_value->m_node->getWeight()) {
       for (auto& i : comms) {
-        auto d = m_domains->get(i.first);
-        if (!d) {
-          d = std::make_shared<NSDomain>(i.first);
-          m_domains->add(d);
-        }
         for (auto& c : i.second) {
-          d->add(c, new_value->m_node);
-
-          // auto info = nty->add_updates();
-          // info->set_domain(i.first);
-          // info->set_cmd(c);
-          // auto ninfo = info->add_nodes();
-          // ninfo->set_ip(new_value->m_node->getIp());
-          // ninfo->set_port(new_value->m_node->getPort());
-          // ninfo->set_weight(new_value->m_node->getWeight());
+          add_node(get_cmd(syncs, i.first, c), new_value->m_node);
         }
-
-        // ds.insert(i.first);
       }
     }
   }
-
-  // sylar::WorkerMgr::GetInstance()->schedule("notify",
-  //         std::bind(&NameServerModule::doNotify, this, ds, nty));
+  commit(syncs);
 
   sylar::RWMutex::WriteLock lock(m_mutex);
   if (new_value) {
@@ -288,6 +297,109 @@ void NameServerModule::set(sylar::RockStream::ptr rs,
   }
 }
 
+void NameServerModule::commit(std::map<std::string, DomainSync>& syncs) {
+  std::map<sylar::RockStream::ptr, SyncNotify> ntys;
+  for (auto& i : syncs) {
+    auto d = m_domains->get(i.first, true);
+    auto& sync = i.second;
+    d->apply(sync);
+
+    // 新域名的版本从当前时间开始, 重启后不会和客户端持有的旧版本重复
+    uint64_t from = d->getRevision();
+    uint64_t to = from ? from + 1 : sylar::GetCurrentUS();
+    d->setRevision(to);
+    sync.set_domain(i.first);
+    sync.set_from_revision(from);
+    sync.set_revision(to);
+
+    auto& log = m_logs[i.first];
+    log.push_back(std::make_shared<DomainSync>(sync));
+    while (log.size() > s_ns_sync_log_size) {
+      log.pop_front();
+    }
+    for (auto& s : getStreams(i.first)) {
+      *ntys[s].add_syncs() = sync;
+    }
+  }
+  for (auto& i : ntys) {
+    RockNotify::ptr notify = std::make_shared<RockNotify>();
+    notify->setNotify((int)NSNotify::DOMAIN_SYNC);
+    notify->setAsPB(i.second);
+    if (i.first->sendMessage(notify) > 0) {
+      sylar::Atomic::addFetch(s_sync_notify, 1);
+    }
+  }
+}
+
+bool NameServerModule::buildSync(const std::string& domain, uint64_t revision,
+                                 DomainSync& sync) {
+  auto d = m_domains->get(domain);
+  if (!d) {
+    if (!revision) {
+      return false;
+    }
+    // 客户端有数据而服务端没有(比如重启), 下发空的全量
+    sync.set_domain(domain);
+    sync.set_revision(0);
+    sync.set_snapshot(true);
+    sylar::Atomic::addFetch(s_sync_snapshot, 1);
+    return true;
+  }
+  if (d->getRevision() == revision) {
+    return false;
+  }
+
+  auto& log = m_logs[domain];
+  auto it = std::find_if(log.begin(), log.end(),
+                         [revision](std::shared_ptr<const DomainSync> v) {
+                           return v->from_revision() == revision;
+                         });
+  if (it == log.end()) {
+    d->snapshot(sync);
+    sylar::Atomic::addFetch(s_sync_snapshot, 1);
+    return true;
+  }
+
+  // 合并日志, 同一个节点只保留最后一次变化
+  std::map<uint32_t, std::map<uint64_t, const Node*>> updates;
+  std::map<uint32_t, std::set<uint64_t>> dels;
+  for (; it != log.end(); ++it) {
+    for (auto& c : (*it)->cmds()) {
+      auto& us = updates[c.cmd()];
+      auto& ds = dels[c.cmd()];
+      for (auto& id : c.dels()) {
+        us.erase(id);
+        ds.insert(id);
+      }
+      for (auto& n : c.updates()) {
+        uint64_t id = NSNode::GetID(n.ip(), n.port());
+        us[id] = &n;
+        ds.erase(id);
+      }
+    }
+  }
+  sync.set_domain(domain);
+  sync.set_from_revision(revision);
+  sync.set_revision(d->getRevision());
+  sync.set_snapshot(false);
+  for (auto& i : updates) {
+    auto& ds = dels[i.first];
+    if (i.second.empty() && ds.empty()) {
+      continue;
+    }
+    auto cmd = sync.add_cmds();
+    cmd->set_cmd(i.first);
+    for (auto& n : i.second) {
+      *cmd->add_updates() = *n.second;
+    }
+    for (auto& id : ds) {
+      cmd->add_dels(id);
+    }
+  }
+  sylar::Atomic::addFetch(s_sync_delta, 1);
+  return true;
+}
+
 std::set<sylar::RockStream::ptr> NameServerModule::getStreams(
     const std::string& domain) {
   sylar::RWMutex::ReadLock lock(m_mutex);
@@ -372,7 +484,7 @@ void NameServerModule::setQueryDomain(sylar::RockStream::ptr rs,
     }
   }
   sylar::RWMutex::WriteLock lock(m_mutex);
-  if (!rs->isConnected()) {
+  if (!rs->isConnected() && !ds.empty()) {
     return;
   }
   for (auto& i : old_ds) {
@@ -394,12 +506,44 @@ bool NameServerModule::handleTick(sylar::RockRequest::ptr request,
   return true;
 }
 
+bool NameServerModule::handleSubscribe(sylar::RockRequest::ptr request,
+                                       sylar::RockResponse::ptr response,
+                                       sylar::RockStream::ptr stream) {
+  auto sreq = request->getAsPB<SubscribeRequest>();
+  if (!sreq) {
+    SYLAR_LOG_ERROR(g_logger) << "invalid subscribe request from: "
+                              << stream->getRemoteAddressString();
+    return false;
+  }
+  std::set<std::string> ds;
+  SubscribeResponse srsp;
+  {
+    // 同步数据和订阅关系一起生成, 之后的推送都基于返回的版本
+    sylar::Mutex::Lock lock(m_syncMutex);
+    for (auto& i : sreq->domains()) {
+      ds.insert(i.domain());
+      DomainSync sync;
+      if (buildSync(i.domain(), i.revision(), sync)) {
+        srsp.add_syncs()->Swap(&sync);
+      }
+    }
+    setQueryDomain(stream, ds);
+  }
+  response->setResult(0);
+  response->setResultStr("ok");
+  response->setAsPB(srsp);
+  return true;
+}
+
 std::string NameServerModule::statusString() {
   std::stringstream ss;
   ss << RockModule::statusString() << std::endl;
   ss << "s_request_count: " << s_request_count << std::endl;
   ss << "s_on_connect: " << s_on_connect << std::endl;
   ss << "s_on_disconnect: " << s_on_disconnect << std::endl;
+  ss << "s_sync_delta: " << s_sync_delta << std::endl;
+  ss << "s_sync_snapshot: " << s_sync_snapshot << std::endl;
+  ss << "s_sync_notify: " << s_sync_notify << std::endl;
   m_domains->dump(ss);
 
   ss << "domainToSession: " << std::endl;
@@ -1,6 +1,7 @@
 #ifndef __SYLAR_NS_NAME_SERVER_MODULE_H__
 #define __SYLAR_NS_NAME_SERVER_MODULE_H__
 
+#include <deque>
 #include "ns_protocol.h"
 #include "sylar/module.h"
 
@@ -43,6 +44,9 @@ class NameServerModule : public RockModule {
   bool handleTick(sylar::RockRequest::ptr request,
                   sylar::RockResponse::ptr response,
                   sylar::RockStream::ptr stream);
+  bool handleSubscribe(sylar::RockRequest::ptr request,
+                       sylar::RockResponse::ptr response,
+                       sylar::RockStream::ptr stream);
 
  private:
   NSClientInfo::ptr get(sylar::RockStream::ptr rs);
@@ -56,6 +60,19 @@ class NameServerModule : public RockModule {
 
   std::set<sylar::RockStream::ptr> getStreams(const std::string& domain);
 
+  /**
+   * @brief 应用节点变化, 版本加 1, 记录变更日志并推送给订阅的 session
+   * @param[in] syncs 域名对应的变化, 只需填 cmds
+   */
+  void commit(std::map<std::string, DomainSync>& syncs);
+  /**
+   * @brief 生成从 revision 到当前版本的同步数据
+   * @details 日志覆盖 revision 时合并成增量, 否则为全量
+   * @return 已经是最新版本时返回 false
+   */
+  bool buildSync(const std::string& domain, uint64_t revision,
+                 DomainSync& sync);
+
  private:
   NSDomainSet::ptr m_domains;
 
@@ -66,6 +83,11 @@ class NameServerModule : public RockModule {
   std::map<sylar::RockStream::ptr, std::set<std::string>> m_queryDomains;
   /// 域名对应关注的session
   std::map<std::string, std::set<sylar::RockStream::ptr>> m_domainToSessions;
+
+  /// 串行化节点变化, 版本号, 变更日志和推送的顺序
+  sylar::Mutex m_syncMutex;
+  /// 域名最近的变更日志, 按版本顺序, 长度由 ns.sync_log_size 限制
+  std::map<std::string, std::deque<std::shared_ptr<const DomainSync>>> m_logs;
 };
 
 }  // namespace ns
@@ -9,6 +9,7 @@ static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
 NSClient::NSClient() {
   m_domains = std::make_shared<sylar::ns::NSDomainSet>();
+  m_snapshot = NSSnapshot::Create(m_domains);
 }
 
 NSClient::~NSClient() {
@@ -47,6 +48,118 @@ void NSClient::delQueryDomain(const std::string& domain) {
 }
 
 RockResult::ptr NSClient::query() {
+  std::set<std::string> ds;
+  {
+    sylar::RWMutex::ReadLock lock(m_mutex);
+    if (m_queryDomains.empty()) {
+      return std::make_shared<RockResult>(0, "ok", 0, nullptr, nullptr);
+    }
+    ds = m_queryDomains;
+  }
+  if (m_subscribeUnsupported) {
+    return querySnapshot();
+  }
+
+  sylar::RockRequest::ptr req = std::make_shared<sylar::RockRequest>();
+  req->setSn(sylar::Atomic::addFetch(m_sn, 1));
+  req->setCmd((int)NSCommand::SUBSCRIBE);
+  auto data = std::make_shared<sylar::ns::SubscribeRequest>();
+  for (auto& i : ds) {
+    auto item = data->add_domains();
+    item->set_domain(i);
+    auto d = m_domains->get(i);
+    item->set_revision(d ? d->getRevision() : 0);
+  }
+  req->setAsPB(*data);
+  auto rt = request(req, 1000);
+  if (!rt->response) {
+    SYLAR_LOG_ERROR(g_logger) << "subscribe error result=" << rt->result;
+    return rt;
+  }
+  if (rt->response->getResult() != 0) {
+    // 老版本的服务端不认识 SUBSCRIBE, 可能随后关闭连接, 这时本次 QUERY
+    // 会失败, 重连后 onConnect 直接使用 QUERY
+    SYLAR_LOG_WARN(g_logger) << "subscribe unsupported result="
+                             << rt->response->getResult()
+                             << ", fallback to query";
+    m_subscribeUnsupported = true;
+    return querySnapshot();
+  }
+  auto rsp = rt->response->getAsPB<sylar::ns::SubscribeResponse>();
+  if (!rsp) {
+    SYLAR_LOG_ERROR(g_logger) << "invalid data not SubscribeResponse";
+    return rt;
+  }
+
+  sylar::Mutex::Lock lock(m_syncMutex);
+  std::set<std::string> changed;
+  std::vector<NSDomain::ptr> domains;
+  m_domains->listAll(domains);
+  for (auto& i : domains) {
+    if (!ds.count(i->getDomain())) {
+      m_domains->del(i->getDomain());
+      changed.insert(i->getDomain());
+    }
+  }
+  bool ok = true;
+  for (auto& i : rsp->syncs()) {
+    ok = applySync(i) && ok;
+    changed.insert(i.domain());
+  }
+  if (!changed.empty()) {
+    publish(changed);
+  }
+  lock.unlock();
+  if (!ok) {
+    resync();
+  }
+  return rt;
+}
+
+bool NSClient::applySync(const DomainSync& sync) {
+  if (!hasQueryDomain(sync.domain())) {
+    return true;
+  }
+  if (sync.snapshot()) {
+    // 比本地旧的快照(如订阅应答晚于推送到达)直接丢弃,
+    // 版本 0 的快照表示服务端已丢失该域名, 总是应用
+    auto old = m_domains->get(sync.domain());
+    if (old && sync.revision() && sync.revision() < old->getRevision()) {
+      return true;
+    }
+    auto domain = std::make_shared<NSDomain>(sync.domain());
+    domain->apply(sync);
+    domain->setRevision(sync.revision());
+    m_domains->add(domain);
+    return true;
+  }
+  auto domain = m_domains->get(sync.domain(), true);
+  if (sync.from_revision() != domain->getRevision()) {
+    // 已经包含在本地版本里的推送直接丢弃, 缺了中间的版本才重新订阅
+    return sync.revision() <= domain->getRevision();
+  }
+  domain->apply(sync);
+  domain->setRevision(sync.revision());
+  return true;
+}
+
+void NSClient::resync() {
+  if (!sylar::Atomic::compareAndSwapBool(m_resyncing, false, true)) {
+    return;
+  }
+  auto self = std::dynamic_pointer_cast<NSClient>(shared_from_this());
+  m_iomanager->schedule([self]() {
+    self->m_resyncing = false;
+    self->query();
+  });
+}
+
+void NSClient::publish(const std::set<std::string>& changed) {
+  auto old = std::atomic_load(&m_snapshot);
+  std::atomic_store(&m_snapshot, old->update(m_domains, changed));
+}
+
+RockResult::ptr NSClient::querySnapshot() {
   sylar::RockRequest::ptr req = std::make_shared<sylar::RockRequest>();
   req->setSn(sylar::Atomic::addFetch(m_sn, 1));
   req->setCmd((int)NSCommand::QUERY);
@@ -75,10 +188,12 @@ RockResult::ptr NSClient::query() {
     }
 
     NSDomainSet::ptr domains = std::make_shared<NSDomainSet>();
+    std::set<std::string> changed;
     for (auto& i : rsp->infos()) {
       if (!hasQueryDomain(i.domain())) {
         continue;
       }
+      changed.insert(i.domain());
       auto domain = domains->get(i.domain(), true);
       uint32_t cmd = i.cmd();
 
@@ -92,7 +207,9 @@ RockResult::ptr NSClient::query() {
         domain->add(cmd, node);
       }
     }
+    sylar::Mutex::Lock lock(m_syncMutex);
     m_domains->swap(*domains);
+    publish(changed);
   } while (false);
   return rt;
 }
@@ -141,7 +258,6 @@ void NSClient::onTimer() {
   if (!rt->response) {
     SYLAR_LOG_ERROR(g_logger) << "tick error result=" << rt->result;
   }
-  sleep(1000);
   query();
 }
 
@@ -150,6 +266,26 @@ void NSClient::onDisconnect(sylar::AsyncSocketStream::ptr stream) {}
 bool NSClient::onNotify(sylar::RockNotify::ptr nty,
                         sylar::RockStream::ptr stream) {
   do {
+    if (nty->getNotify() == (uint32_t)NSNotify::DOMAIN_SYNC) {
+      auto sn = nty->getAsPB<sylar::ns::SyncNotify>();
+      if (!sn) {
+        SYLAR_LOG_ERROR(g_logger) << "invalid domain_sync data";
+        break;
+      }
+      bool ok = true;
+      std::set<std::string> changed;
+      sylar::Mutex::Lock lock(m_syncMutex);
+      for (auto& i : sn->syncs()) {
+        ok = applySync(i) && ok;
+        changed.insert(i.domain());
+      }
+      publish(changed);
+      lock.unlock();
+      if (!ok) {
+        resync();
+      }
+      break;
+    }
     if (nty->getNotify() == (uint32_t)NSNotify::NODE_CHANGE) {
       auto nm = nty->getAsPB<sylar::ns::NotifyMessage>();
       if (!nm) {
@@ -157,6 +293,8 @@ bool NSClient::onNotify(sylar::RockNotify::ptr nty,
         break;
       }
 
+      std::set<std::string> changed;
+      sylar::Mutex::Lock lock(m_syncMutex);
       for (auto& i : nm->dels()) {
         if (!hasQueryDomain(i.domain())) {
           continue;
@@ -165,6 +303,7 @@ bool NSClient::onNotify(sylar::RockNotify::ptr nty,
         if (!domain) {
           continue;
         }
+        changed.insert(i.domain());
         int cmd = i.cmd();
         for (auto& n : i.nodes()) {
           NSNode::ptr node =
@@ -178,6 +317,7 @@ bool NSClient::onNotify(sylar::RockNotify::ptr nty,
           continue;
         }
         auto domain = m_domains->get(i.domain(), true);
+        changed.insert(i.domain());
         int cmd = i.cmd();
         for (auto& n : i.nodes()) {
           NSNode::ptr node =
@@ -189,6 +329,7 @@ bool NSClient::onNotify(sylar::RockNotify::ptr nty,
           }
         }
       }
+      publish(changed);
     }
   } while (false);
   return true;
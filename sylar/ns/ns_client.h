@@ -21,11 +21,20 @@ class NSClient : public RockConnection {
 
   bool hasQueryDomain(const std::string& domain);
 
+  /**
+   * @brief 订阅关注的域名, 带上本地版本, 服务端返回增量或者全量
+   * @details 之后的变化由服务端通过 DOMAIN_SYNC 推送。服务端不支持订阅时
+   *          (老版本可能回复错误后断开连接), 之后一直使用 QUERY 全量查询
+   */
   RockResult::ptr query();
 
   void init();
   void uninit();
   NSDomainSet::ptr getDomains() const { return m_domains; }
+  /**
+   * @brief 当前注册表的只读快照, 查询不加锁, 路由时使用
+   */
+  NSSnapshot::ptr getSnapshot() const { return std::atomic_load(&m_snapshot); }
 
  private:
   void onQueryDomainChange();
@@ -35,12 +44,30 @@ class NSClient : public RockConnection {
 
   void onTimer();
 
+  RockResult::ptr querySnapshot();
+  /**
+   * @brief 应用一个域名的同步数据, 需持有 m_syncMutex
+   * @details 版本低于本地的快照被丢弃, 版本 0 的快照除外
+   * @return 增量和本地版本接不上时返回 false, 需要重新订阅
+   */
+  bool applySync(const DomainSync& sync);
+  /// 合并重新订阅, 同一时间只有一个在排队
+  void resync();
+  /// 根据 m_domains 发布新的快照, 需持有 m_syncMutex
+  void publish(const std::set<std::string>& changed);
+
  private:
   sylar::RWMutex m_mutex;
   std::set<std::string> m_queryDomains;
   NSDomainSet::ptr m_domains;
+  /// m_domains 的只读快照, 通过 std::atomic_load/std::atomic_store 访问
+  NSSnapshot::ptr m_snapshot;
   uint32_t m_sn = 0;
   sylar::Timer::ptr m_timer;
+  sylar::Mutex m_syncMutex;
+  bool m_resyncing = false;
+  /// 服务端不认识 SUBSCRIBE, 重连后也不再尝试
+  bool m_subscribeUnsupported = false;
 };
 
 }  // namespace ns
@@ -2,6 +2,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <algorithm>
 #include <sstream>
 
 namespace sylar {
@@ -152,6 +153,41 @@ void NSDomain::listAll(std::vector<NSNodeSet::ptr>& infos) {
     }
 }
 
+void NSDomain::apply(const DomainSync& sync) {
+    for(auto& i : sync.cmds()) {
+        for(auto& id : i.dels()) {
+            del(i.cmd(), id);
+        }
+        for(auto& n : i.updates()) {
+            NSNode::ptr node = std::make_shared<NSNode>(
+                    n.ip(), n.port(), n.weight());
+            if(node->getId() >> 32) {
+                add(i.cmd(), node);
+            }
+        }
+    }
+}
+
+void NSDomain::snapshot(DomainSync& sync) {
+    sync.set_domain(m_domain);
+    sync.set_revision(m_revision);
+    sync.set_snapshot(true);
+    std::vector<NSNodeSet::ptr> nss;
+    listAll(nss);
+    for(auto& i : nss) {
+        auto cmd = sync.add_cmds();
+        cmd->set_cmd(i->getCmd());
+        std::vector<NSNode::ptr> ns;
+        i->listAll(ns);
+        for(auto& n : ns) {
+            auto node = cmd->add_updates();
+            node->set_ip(n->getIp());
+            node->set_port(n->getPort());
+            node->set_weight(n->getWeight());
+        }
+    }
+}
+
 void NSDomainSet::add(NSDomain::ptr info) {
     sylar::RWMutex::WriteLock lock(m_mutex);
     m_datas[info->getDomain()] = info;
@@ -224,5 +260,85 @@ void NSDomainSet::swap(NSDomainSet& ds) {
     m_datas.swap(ds.m_datas);
 }
 
+const std::vector<NSNode::ptr>* NSSnapshot::Domain::get(uint32_t cmd) const {
+    auto it = std::lower_bound(cmds.begin(), cmds.end(), cmd,
+            [](const Cmd& a, uint32_t b) { return a.cmd < b; });
+    return (it == cmds.end() || it->cmd != cmd) ? nullptr : &it->nodes;
+}
+
+NSNode::ptr NSSnapshot::Domain::get(uint32_t cmd, uint64_t id) const {
+    auto ns = get(cmd);
+    if(!ns) {
+        return nullptr;
+    }
+    auto it = std::lower_bound(ns->begin(), ns->end(), id,
+            [](const NSNode::ptr& a, uint64_t b) { return a->getId() < b; });
+    return (it == ns->end() || (*it)->getId() != id) ? nullptr : *it;
+}
+
+NSSnapshot::Domain::ptr NSSnapshot::Build(NSDomain::ptr d) {
+    auto rt = std::make_shared<Domain>();
+    rt->domain = d->getDomain();
+    rt->revision = d->getRevision();
+    std::vector<NSNodeSet::ptr> nss;
+    d->listAll(nss);
+    rt->cmds.resize(nss.size());
+    for(size_t i = 0; i < nss.size(); ++i) {
+        rt->cmds[i].cmd = nss[i]->getCmd();
+        nss[i]->listAll(rt->cmds[i].nodes);
+    }
+    return rt;
+}
+
+NSSnapshot::ptr NSSnapshot::Create(NSDomainSet::ptr ds, uint64_t version) {
+    std::shared_ptr<NSSnapshot> rt = std::make_shared<NSSnapshot>();
+    rt->m_version = version;
+    std::vector<NSDomain::ptr> domains;
+    ds->listAll(domains);
+    rt->m_domains.reserve(domains.size());
+    for(auto& i : domains) {
+        rt->m_domains.push_back(Build(i));
+    }
+    return rt;
+}
+
+NSSnapshot::ptr NSSnapshot::update(NSDomainSet::ptr ds,
+        const std::set<std::string>& changed) const {
+    std::shared_ptr<NSSnapshot> rt = std::make_shared<NSSnapshot>();
+    rt->m_version = m_version + 1;
+    std::vector<NSDomain::ptr> domains;
+    ds->listAll(domains);
+    rt->m_domains.reserve(domains.size());
+    // 两边都按域名排序, 归并一遍即可
+    auto it = m_domains.begin();
+    for(auto& i : domains) {
+        while(it != m_domains.end() && (*it)->domain < i->getDomain()) {
+            ++it;
+        }
+        if(it != m_domains.end() && (*it)->domain == i->getDomain()
+                && !changed.count(i->getDomain())) {
+            rt->m_domains.push_back(*it);
+        } else {
+            rt->m_domains.push_back(Build(i));
+        }
+    }
+    return rt;
+}
+
+const NSSnapshot::Domain* NSSnapshot::get(const std::string& domain) const {
+    auto it = std::lower_bound(m_domains.begin(), m_domains.end(), domain,
+            [](const Domain::ptr& a, const std::string& b) {
+                return a->domain < b;
+            });
+    return (it == m_domains.end() || (*it)->domain != domain)
+                ? nullptr : it->get();
+}
+
+const std::vector<NSNode::ptr>* NSSnapshot::get(const std::string& domain,
+        uint32_t cmd) const {
+    auto d = get(domain);
+    return d ? d->get(cmd) : nullptr;
+}
+
 }
 }
@@ -5,7 +5,9 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 #include "ns_protobuf.pb.h"
 #include "sylar/mutex.h"
 
@@ -23,10 +25,14 @@ enum class NSCommand {
   QUERY_BLACKLIST = 0x10004,
   /// 心跳
   TICK = 0x10005,
+  /// 订阅域名, 带上已有的版本, 返回增量或者全量, 之后的变化通过 DOMAIN_SYNC 推送
+  SUBSCRIBE = 0x10006,
 };
 
 enum class NSNotify {
   NODE_CHANGE = 0x10001,
+  /// SyncNotify, 订阅的域名的增量
+  DOMAIN_SYNC = 0x10002,
 };
 
 class NSNode {
@@ -98,10 +104,26 @@ class NSDomain {
   std::string toString(const std::string& prefix = "");
   size_t size();
 
+  /**
+   * @brief 版本号, 服务端每次变化加 1, 客户端为已经应用的版本
+   */
+  uint64_t getRevision() const { return m_revision; }
+  void setRevision(uint64_t v) { m_revision = v; }
+
+  /**
+   * @brief 应用 DomainSync 中的节点变化, 不检查和修改版本
+   */
+  void apply(const DomainSync& sync);
+  /**
+   * @brief 把全部节点写入 sync, snapshot 为 true
+   */
+  void snapshot(DomainSync& sync);
+
  private:
   std::string m_domain;
   sylar::RWMutex m_mutex;
   std::map<uint32_t, NSNodeSet::ptr> m_datas;
+  uint64_t m_revision = 0;
 };
 
 class NSDomainSet {
@@ -125,6 +147,60 @@ class NSDomainSet {
   std::map<std::string, NSDomain::ptr> m_datas;
 };
 
+/**
+ * @brief 注册表的只读快照(RCU)
+ * @details 由 NSDomainSet 生成, 生成后不再修改, 域名, 命令字, 节点都是
+ *          排好序的数组, 查询时二分查找不加锁. 修改时生成新版本整体替换,
+ *          没有变化的域名和旧版本共享. 节点和 NSDomainSet 共享, 不能修改
+ */
+class NSSnapshot {
+ public:
+  typedef std::shared_ptr<const NSSnapshot> ptr;
+
+  struct Cmd {
+    uint32_t cmd;
+    /// 按节点id排序
+    std::vector<NSNode::ptr> nodes;
+  };
+
+  struct Domain {
+    typedef std::shared_ptr<const Domain> ptr;
+    std::string domain;
+    uint64_t revision;
+    /// 按命令字排序
+    std::vector<Cmd> cmds;
+
+    const std::vector<NSNode::ptr>* get(uint32_t cmd) const;
+    NSNode::ptr get(uint32_t cmd, uint64_t id) const;
+  };
+
+  /**
+   * @brief 生成全部域名的快照
+   */
+  static ptr Create(NSDomainSet::ptr ds, uint64_t version = 1);
+
+  /**
+   * @brief 生成下一个版本, 只重建 changed 中的域名, ds 中没有的域名删除
+   */
+  ptr update(NSDomainSet::ptr ds, const std::set<std::string>& changed) const;
+
+  const Domain* get(const std::string& domain) const;
+  const std::vector<NSNode::ptr>* get(const std::string& domain,
+                                      uint32_t cmd) const;
+
+  uint64_t getVersion() const { return m_version; }
+  size_t size() const { return m_domains.size(); }
+  const std::vector<Domain::ptr>& getDomains() const { return m_domains; }
+
+ private:
+  static Domain::ptr Build(NSDomain::ptr d);
+
+ private:
+  uint64_t m_version = 0;
+  /// 按域名排序
+  std::vector<Domain::ptr> m_domains;
+};
+
 }  // namespace ns
 }  // namespace sylar
 
@@ -1,4 +1,7 @@
 #include "rock_protocol.h"
+#include <algorithm>
+#include <deque>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
 #include "sylar/config.h"
 #include "sylar/endian.h"
 #include "sylar/log.h"
@@ -19,16 +22,74 @@ static sylar::ConfigVar<uint32_t>::ptr g_rock_protocol_gzip_min_length =
                           (uint32_t)(1024 * 1024 * 64),
                           "rock protocol gizp min length");
 
+const std::string& RockBody::getBody() const {
+  if (m_bodyBuffer) {
+    std::vector<iovec> iovs;
+    m_bodyBuffer->getReadBuffers(iovs, m_bodyLength, m_bodyOffset);
+    m_body.clear();
+    m_body.reserve(m_bodyLength);
+    for (auto& i : iovs) {
+      m_body.append((const char*)i.iov_base, i.iov_len);
+    }
+    m_bodyBuffer = nullptr;
+  }
+  return m_body;
+}
+
+uint32_t RockBody::getBodySize() const {
+  return m_bodyBuffer ? m_bodyLength : m_body.size();
+}
+
 bool RockBody::serializeToByteArray(ByteArray::ptr bytearray) {
-  bytearray->writeStringF32(m_body);
+  if (!m_bodyBuffer) {
+    bytearray->writeStringF32(m_body);
+    return true;
+  }
+  // 转发收到的消息体, 直接从接收缓冲写入
+  bytearray->writeFuint32(m_bodyLength);
+  std::vector<iovec> iovs;
+  m_bodyBuffer->getReadBuffers(iovs, m_bodyLength, m_bodyOffset);
+  for (auto& i : iovs) {
+    bytearray->write(i.iov_base, i.iov_len);
+  }
   return true;
 }
 
 bool RockBody::parseFromByteArray(ByteArray::ptr bytearray) {
-  m_body = bytearray->readStringF32();
+  uint32_t len = bytearray->readFuint32();
+  if (len > bytearray->getReadSize()) {
+    throw std::out_of_range("not enough len");
+  }
+  m_body.clear();
+  m_bodyBuffer = bytearray;
+  m_bodyOffset = bytearray->getPosition();
+  m_bodyLength = len;
+  bytearray->setPosition(m_bodyOffset + len);
   return true;
 }
 
+bool RockBody::parseBody(google::protobuf::Message& message) const {
+  if (!m_bodyBuffer) {
+    return message.ParseFromString(m_body);
+  }
+  std::vector<iovec> iovs;
+  m_bodyBuffer->getReadBuffers(iovs, m_bodyLength, m_bodyOffset);
+  if (iovs.size() <= 1) {
+    return message.ParseFromArray(iovs.empty() ? nullptr : iovs[0].iov_base,
+                                  m_bodyLength);
+  }
+  // 跨越多个节点时按节点拼接成一个输入流
+  std::deque<google::protobuf::io::ArrayInputStream> arrays;
+  std::vector<google::protobuf::io::ZeroCopyInputStream*> streams;
+  for (auto& i : iovs) {
+    arrays.emplace_back(i.iov_base, i.iov_len);
+    streams.push_back(&arrays.back());
+  }
+  google::protobuf::io::ConcatenatingInputStream input(&streams[0],
+                                                       streams.size());
+  return message.ParseFromZeroCopyStream(&input);
+}
+
 std::shared_ptr<RockResponse> RockRequest::createResponse() {
   RockResponse::ptr rt = std::make_shared<RockResponse>();
   rt->setSn(m_sn);
@@ -39,7 +100,7 @@ std::shared_ptr<RockResponse> RockRequest::createResponse() {
 std::string RockRequest::toString() const {
   std::stringstream ss;
   ss << "[RockRequest sn=" << m_sn << " cmd=" << m_cmd
-     << " body.length=" << m_body.size() << "]";
+     << " body.length=" << getBodySize() << "]";
   return ss.str();
 }
 
@@ -81,7 +142,7 @@ std::string RockResponse::toString() const {
   std::stringstream ss;
   ss << "[RockResponse sn=" << m_sn << " cmd=" << m_cmd
      << " result=" << m_result << " result_msg=" << m_resultStr
-     << " body.length=" << m_body.size() << "]";
+     << " body.length=" << getBodySize() << "]";
   return ss.str();
 }
 
@@ -120,7 +181,7 @@ bool RockResponse::parseFromByteArray(ByteArray::ptr bytearray) {
 
 std::string RockNotify::toString() const {
   std::stringstream ss;
-  ss << "[RockNotify notify=" << m_notify << " body.length=" << m_body.size()
+  ss << "[RockNotify notify=" << m_notify << " body.length=" << getBodySize()
      << "]";
   return ss.str();
 }
@@ -163,6 +224,37 @@ static const uint8_t s_rock_magic[2] = {0x12, 0x21};
 RockMsgHeader::RockMsgHeader()
     : magic{s_rock_magic[0], s_rock_magic[1]}, version(1), flag(0), length(0) {}
 
+static const uint8_t s_rock_flag_gzip = 0x1;
+
+// 压缩阈值在 flag 高 4 位中的编码 k: 0 没有通告,
+// 1~14 表示 1 << (k + 8), 15 表示不希望压缩
+static uint8_t EncodeCompressMinLength(uint32_t v) {
+  for (uint8_t k = 1; k < 15; ++k) {
+    if (v <= (1u << (k + 8))) {
+      return k;
+    }
+  }
+  return 15;
+}
+
+static uint32_t DecodeCompressMinLength(uint8_t k) {
+  if (k == 0) {
+    return 0;
+  }
+  return k < 15 ? 1u << (k + 8) : (uint32_t)-1;
+}
+
+RockMessageDecoder::RockMessageDecoder()
+    : m_compressMinLength(g_rock_protocol_gzip_min_length->getValue()) {}
+
+uint32_t RockMessageDecoder::getSendCompressMinLength() const {
+  uint32_t peer = m_peerCompressMinLength;
+  if (!peer) {
+    return m_compressMinLength;
+  }
+  return std::max(m_compressMinLength, peer);
+}
+
 Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream) {
   try {
     RockMsgHeader header;
@@ -184,6 +276,10 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream) {
       return nullptr;
     }
 
+    if (header.flag >> 4) {
+      m_peerCompressMinLength = DecodeCompressMinLength(header.flag >> 4);
+    }
+
     header.length = sylar::byteswapOnLittleEndian(header.length);
     if ((uint32_t)header.length >= g_rock_protocol_max_length->getValue()) {
       SYLAR_LOG_ERROR(g_logger)
@@ -191,7 +287,9 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream) {
           << ") >=" << g_rock_protocol_max_length->getValue();
       return nullptr;
     }
-    sylar::ByteArray::ptr ba = std::make_shared<sylar::ByteArray>();
+    // 整个消息读到一个节点中, 消息体可以直接从连续的内存解析
+    sylar::ByteArray::ptr ba = std::make_shared<sylar::ByteArray>(
+        header.length > 0 ? header.length : 1);
     rt = stream->readFixSize(ba, header.length);
     if (rt <= 0) {
       SYLAR_LOG_ERROR(g_logger)
@@ -201,7 +299,7 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream) {
     }
 
     ba->setPosition(0);
-    if (header.flag & 0x1) {  // gizp
+    if (header.flag & s_rock_flag_gzip) {
       auto zstream = sylar::ZlibStream::CreateGzip(false);
       if (zstream->write(ba, -1) != Z_OK) {
         SYLAR_LOG_ERROR(g_logger) << "RockMessageDecoder ungzip error";
@@ -246,42 +344,64 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream) {
 }
 
 int32_t RockMessageDecoder::serializeTo(Stream::ptr stream, Message::ptr msg) {
-  RockMsgHeader header;
-  auto ba = msg->toByteArray();
+  ByteArray::ptr ba = std::make_shared<ByteArray>();
+  int32_t len = serializeTo(ba, msg);
+  if (len <= 0) {
+    return len;
+  }
+  // 头部和消息体一次写出
   ba->setPosition(0);
-  header.length = ba->getSize();
-  if ((uint32_t)header.length >= g_rock_protocol_gzip_min_length->getValue()) {
+  int rt = stream->writeFixSize(ba, len);
+  if (rt <= 0) {
+    SYLAR_LOG_ERROR(g_logger)
+        << "RockMessageDecoder serializeTo write fail rt=" << rt
+        << " errno=" << errno << " - " << strerror(errno);
+    return -4;
+  }
+  return len;
+}
+
+int32_t RockMessageDecoder::serializeTo(ByteArray::ptr ba, Message::ptr msg) {
+  size_t start = ba->getPosition();
+  size_t body = start + sizeof(RockMsgHeader);
+  RockMsgHeader header;
+  ba->write(&header, sizeof(header));
+  if (!msg->serializeToByteArray(ba)) {
+    SYLAR_LOG_ERROR(g_logger)
+        << "RockMessageDecoder serializeTo serializeToByteArray fail "
+        << msg->toString();
+    ba->setPosition(start);
+    return -3;
+  }
+  size_t end = ba->getPosition();
+  header.length = end - body;
+  header.flag = EncodeCompressMinLength(m_compressMinLength) << 4;
+  if ((uint32_t)header.length >= getSendCompressMinLength()) {
+    ba->setPosition(body);
     auto zstream = sylar::ZlibStream::CreateGzip(true);
-    if (zstream->write(ba, -1) != Z_OK) {
+    if (zstream->write(ba, header.length) != Z_OK) {
       SYLAR_LOG_ERROR(g_logger) << "RockMessageDecoder serializeTo gizp error";
+      ba->setPosition(start);
       return -1;
     }
     if (zstream->flush() != Z_OK) {
       SYLAR_LOG_ERROR(g_logger)
           << "RockMessageDecoder serializeTo gizp flush error";
+      ba->setPosition(start);
       return -2;
     }
-
-    ba = zstream->getByteArray();
-    header.flag |= 0x1;
-    header.length = ba->getSize();
+    std::string data = zstream->getByteArray()->toString();
+    ba->setPosition(body);
+    ba->write(data.c_str(), data.size());
+    header.flag |= s_rock_flag_gzip;
+    header.length = data.size();
+    end = ba->getPosition();
   }
   header.length = sylar::byteswapOnLittleEndian(header.length);
-  int rt = stream->writeFixSize(&header, sizeof(header));
-  if (rt <= 0) {
-    SYLAR_LOG_ERROR(g_logger)
-        << "RockMessageDecoder serializeTo write header fail rt=" << rt
-        << " errno=" << errno << " - " << strerror(errno);
-    return -3;
-  }
-  rt = stream->writeFixSize(ba, ba->getReadSize());
-  if (rt <= 0) {
-    SYLAR_LOG_ERROR(g_logger)
-        << "RockMessageDecoder serializeTo write body fail rt=" << rt
-        << " errno=" << errno << " - " << strerror(errno);
-    return -4;
-  }
-  return sizeof(header) + ba->getSize();
+  ba->setPosition(start);
+  ba->write(&header, sizeof(header));
+  ba->setPosition(end);
+  return end - start;
 }
 
 }  // namespace sylar
@@ -1,27 +1,43 @@
 #ifndef __SYLAR_ROCK_ROCK_PROTOCOL_H__
 #define __SYLAR_ROCK_ROCK_PROTOCOL_H__
 
+#include <atomic>
 #include "google/protobuf/message.h"
 #include "sylar/protocol.h"
 
 namespace sylar {
 
+/**
+ * @brief rock 消息体
+ * @details 接收到的消息体不复制, 只记录它在接收缓冲中的位置,
+ *          getAsPB 直接从缓冲链中解析, 第一次调用 getBody 时才复制出来。
+ *          同一个消息不要在多个协程中同时读取
+ */
 class RockBody {
  public:
   typedef std::shared_ptr<RockBody> ptr;
   virtual ~RockBody() {}
 
-  void setBody(const std::string& v) { m_body = v; }
-  const std::string& getBody() const { return m_body; }
+  void setBody(const std::string& v) {
+    m_body = v;
+    m_bodyBuffer = nullptr;
+  }
+  const std::string& getBody() const;
+  uint32_t getBodySize() const;
 
   virtual bool serializeToByteArray(ByteArray::ptr bytearray);
   virtual bool parseFromByteArray(ByteArray::ptr bytearray);
 
+  /**
+   * @brief 把消息体解析为 protobuf, 接收的消息直接从接收缓冲中解析
+   */
+  bool parseBody(google::protobuf::Message& message) const;
+
   template <class T>
   std::shared_ptr<T> getAsPB() const {
     try {
       std::shared_ptr<T> data = std::make_shared<T>();
-      if (data->ParseFromString(m_body)) {
+      if (parseBody(*data)) {
         return data;
       }
     } catch (...) {}
@@ -31,13 +47,18 @@ class RockBody {
   template <class T>
   bool setAsPB(const T& v) {
     try {
+      m_bodyBuffer = nullptr;
       return v.SerializeToString(&m_body);
     } catch (...) {}
     return false;
   }
 
  protected:
-  std::string m_body;
+  mutable std::string m_body;
+  // 不为空时消息体是 m_bodyBuffer 中 [m_bodyOffset, +m_bodyLength) 的数据
+  mutable ByteArray::ptr m_bodyBuffer;
+  size_t m_bodyOffset = 0;
+  uint32_t m_bodyLength = 0;
 };
 
 class RockResponse;
@@ -79,6 +100,11 @@ class RockNotify : public Notify, public RockBody {
   virtual bool parseFromByteArray(ByteArray::ptr bytearray) override;
 };
 
+/**
+ * @brief rock 消息头
+ * @details flag 的 bit0 表示消息体经过 gzip 压缩, 高 4 位是发送方希望接收
+ *          压缩消息的最小长度(见 RockMessageDecoder), 老版本忽略这 4 位
+ */
 struct RockMsgHeader {
   RockMsgHeader();
   uint8_t magic[2];
@@ -87,12 +113,51 @@ struct RockMsgHeader {
   int32_t length;
 };
 
+/**
+ * @brief rock 消息编解码, 每个连接一个
+ * @details 压缩阈值按连接协商: 每个消息头都带上本端的阈值, 收到对端的
+ *          阈值后, 发送时取两者中较大的一个, 即双方都认为值得压缩时才压缩。
+ *          阈值在消息头中按 2 的幂次向上取整, 范围 512B ~ 2MB,
+ *          更大的阈值表示不希望压缩
+ */
 class RockMessageDecoder : public MessageDecoder {
  public:
   typedef std::shared_ptr<RockMessageDecoder> ptr;
 
+  RockMessageDecoder();
+
   virtual Message::ptr parseFrom(Stream::ptr stream) override;
   virtual int32_t serializeTo(Stream::ptr stream, Message::ptr msg) override;
+
+  /**
+   * @brief 本端的压缩阈值, 消息体不小于该长度时压缩,
+   *        默认为 rock.protocol.gzip_min_length
+   */
+  uint32_t getCompressMinLength() const { return m_compressMinLength; }
+  void setCompressMinLength(uint32_t v) { m_compressMinLength = v; }
+
+  /**
+   * @brief 对端通告的压缩阈值, 0 表示对端没有通告, -1 表示对端不希望压缩
+   */
+  uint32_t getPeerCompressMinLength() const { return m_peerCompressMinLength; }
+
+  /**
+   * @brief 发送时实际使用的压缩阈值, 对端没有通告时使用本端的阈值
+   */
+  uint32_t getSendCompressMinLength() const;
+
+  /**
+   * @brief 把消息(头部 + 消息体)编码到 ba 的当前位置, 用于多个消息合并发送
+   * @details 压缩时消息体会被覆盖为更短的数据, 有效数据以结束后的
+   *          position 为准, 不能用 getSize()
+   * @return 写入的字节数, 小于 0 表示失败(position 回到开始位置)
+   */
+  int32_t serializeTo(ByteArray::ptr ba, Message::ptr msg);
+
+ private:
+  uint32_t m_compressMinLength;
+  /// 读协程写入, 写协程读取
+  std::atomic<uint32_t> m_peerCompressMinLength{0};
 };
 
 }  // namespace sylar
@@ -16,6 +16,47 @@ static sylar::ConfigVar<std::unordered_map<
                            std::unordered_map<std::string, std::string>>(),
         "rock_services");
 
+static sylar::ConfigVar<uint32_t>::ptr g_rock_write_coalesce_us =
+    sylar::Config::Lookup("rock.write_coalesce_us", (uint32_t)0,
+                          "rock microseconds the writer waits for more "
+                          "messages before writing, 0 disables");
+static sylar::ConfigVar<uint32_t>::ptr g_rock_write_max_batch =
+    sylar::Config::Lookup("rock.write_max_batch", (uint32_t)128,
+                          "rock max messages per write");
+static sylar::ConfigVar<uint32_t>::ptr g_rock_send_buffer_size =
+    sylar::Config::Lookup("rock.send_buffer_size", (uint32_t)(256 * 1024),
+                          "rock bytes of messages buffered before one writev");
+
+static uint32_t s_rock_write_coalesce_us = 0;
+static uint32_t s_rock_write_max_batch = 0;
+static uint32_t s_rock_send_buffer_size = 0;
+
+namespace {
+
+struct _RockStreamIniter {
+  _RockStreamIniter() {
+    s_rock_write_coalesce_us = g_rock_write_coalesce_us->getValue();
+    g_rock_write_coalesce_us->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_rock_write_coalesce_us = nv;
+        });
+    s_rock_write_max_batch = g_rock_write_max_batch->getValue();
+    g_rock_write_max_batch->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_rock_write_max_batch = nv;
+        });
+    s_rock_send_buffer_size = g_rock_send_buffer_size->getValue();
+    g_rock_send_buffer_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_rock_send_buffer_size = nv;
+        });
+  }
+};
+
+static _RockStreamIniter s_init;
+
+}  // namespace
+
 // static sylar::ConfigVar<std::unordered_map<std::string
 //     ,std::unordered_map<std::string, std::string> > >::ptr g_rock_services =
 //     sylar::Config::Lookup("rock_services", std::unordered_map<std::string
@@ -33,7 +74,9 @@ std::string RockResult::toString() const {
 
 RockStream::RockStream(Socket::ptr sock)
     : AsyncSocketStream(sock, true),
-      m_decoder(std::make_shared<RockMessageDecoder>()) {
+      m_decoder(std::make_shared<RockMessageDecoder>()),
+      m_sendBuffer(std::make_shared<ByteArray>(64 * 1024)) {
+  setWriteCoalesce(s_rock_write_coalesce_us, s_rock_write_max_batch);
   SYLAR_LOG_DEBUG(g_logger) << "RockStream::RockStream " << this << " "
                             << (sock ? sock->toString() : "");
 }
@@ -65,10 +108,15 @@ RockResult::ptr RockStream::request(RockRequest::ptr req, uint32_t timeout_ms) {
     ctx->timeout = timeout_ms;
     ctx->scheduler = sylar::Scheduler::GetThis();
     ctx->fiber = sylar::Fiber::GetThis();
-    addCtx(ctx);
     uint64_t ts = sylar::GetCurrentMS();
-    ctx->timer = sylar::IOManager::GetThis()->addTimer(
-        timeout_ms, std::bind(&RockStream::onTimeOut, shared_from_this(), ctx));
+    if (!addCtx(ctx)) {
+      // 调用方指定的 sn 与在途请求重复
+      auto rt = std::make_shared<RockResult>(
+          AsyncSocketStream::DUPLICATE_SN,
+          "duplicate_sn " + std::to_string(ctx->sn), 0, nullptr, req);
+      rt->server = getRemoteAddressString();
+      return rt;
+    }
     enqueue(ctx);
     sylar::Fiber::YieldToHold();
     auto rt = std::make_shared<RockResult>(ctx->result, ctx->resultStr,
@@ -86,13 +134,38 @@ RockResult::ptr RockStream::request(RockRequest::ptr req, uint32_t timeout_ms) {
 }
 
 bool RockStream::RockSendCtx::doSend(AsyncSocketStream::ptr stream) {
-  return std::dynamic_pointer_cast<RockStream>(stream)->m_decoder->serializeTo(
-             stream, msg) > 0;
+  return std::dynamic_pointer_cast<RockStream>(stream)->writeMessage(msg);
 }
 
 bool RockStream::RockCtx::doSend(AsyncSocketStream::ptr stream) {
-  return std::dynamic_pointer_cast<RockStream>(stream)->m_decoder->serializeTo(
-             stream, request) > 0;
+  return std::dynamic_pointer_cast<RockStream>(stream)->writeMessage(request);
+}
+
+bool RockStream::writeMessage(Message::ptr msg) {
+  if (m_decoder->serializeTo(m_sendBuffer, msg) <= 0) {
+    return false;
+  }
+  if (m_sendBuffer->getPosition() >= s_rock_send_buffer_size) {
+    return doFlush();
+  }
+  return true;
+}
+
+bool RockStream::doFlush() {
+  size_t len = m_sendBuffer->getPosition();
+  if (len == 0) {
+    return true;
+  }
+  m_sendBuffer->setPosition(0);
+  int rt = writeFixSize(m_sendBuffer, len);
+  m_sendBuffer->clear();
+  if (rt <= 0) {
+    SYLAR_LOG_ERROR(g_logger) << "RockStream flush fail, len=" << len
+                              << " rt=" << rt << " errno=" << errno << " - "
+                              << strerror(errno);
+    return false;
+  }
+  return true;
 }
 
 AsyncSocketStream::Ctx::ptr RockStream::doRecv() {
@@ -266,21 +339,24 @@ RockResult::ptr RockSDLoadBalance::request(const std::string& domain,
     return std::make_shared<RockResult>(ILoadBalance::NO_CONNECTION,
                                         "no_connection", 0, nullptr, req);
   }
-  uint64_t ts = sylar::GetCurrentMS();
-  auto& stats = conn->get(ts / 1000);
+  uint64_t ts = sylar::GetCurrentUS();
+  auto& stats = conn->get(ts / 1000000);
   stats.incDoing(1);
   stats.incTotal(1);
+  conn->onStart();
   auto r = conn->getStreamAs<RockStream>()->request(req, timeout_ms);
-  uint64_t ts2 = sylar::GetCurrentMS();
+  uint64_t used = sylar::GetCurrentUS() - ts;
   if (r->result == 0) {
     stats.incOks(1);
-    stats.incUsedTime(ts2 - ts);
+    stats.incUsedTime(used / 1000);
+    stats.addLatency(used);
   } else if (r->result == AsyncSocketStream::TIMEOUT) {
     stats.incTimeouts(1);
   } else if (r->result < 0) {
     stats.incErrs(1);
   }
   stats.decDoing(1);
+  conn->onFinish(r->result >= 0, used);
   return r;
 }
 
@@ -44,6 +44,17 @@ class RockStream : public sylar::AsyncSocketStream {
   int32_t sendMessage(Message::ptr msg);
   RockResult::ptr request(RockRequest::ptr req, uint32_t timeout_ms);
 
+  /**
+   * @brief 本连接的压缩阈值, 会通告给对端, 见 RockMessageDecoder
+   */
+  uint32_t getCompressMinLength() const {
+    return m_decoder->getCompressMinLength();
+  }
+  void setCompressMinLength(uint32_t v) { m_decoder->setCompressMinLength(v); }
+  uint32_t getPeerCompressMinLength() const {
+    return m_decoder->getPeerCompressMinLength();
+  }
+
   request_handler getRequestHandler() const { return m_requestHandler; }
   notify_handler getNotifyHandler() const { return m_notifyHandler; }
 
@@ -80,12 +91,20 @@ class RockStream : public sylar::AsyncSocketStream {
   };
 
   virtual Ctx::ptr doRecv() override;
+  virtual bool doFlush() override;
 
   void handleRequest(sylar::RockRequest::ptr req);
   void handleNotify(sylar::RockNotify::ptr nty);
 
+  /**
+   * @brief 在写协程中把消息编码到发送缓冲, 缓冲过大时提前写出
+   */
+  bool writeMessage(Message::ptr msg);
+
  private:
   RockMessageDecoder::ptr m_decoder;
+  // 只在写协程中使用, 一批消息编码后一次写出, 清空时保留基础容量
+  ByteArray::ptr m_sendBuffer;
   request_handler m_requestHandler;
   notify_handler m_notifyHandler;
   boost::any m_data;
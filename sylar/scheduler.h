@@ -27,6 +27,9 @@ class Scheduler {
 
   const std::string& getName() const { return m_name; }
 
+  // 线程池各线程的 id, start 之后有效
+  const std::vector<int>& getThreadIds() const { return m_threadIds; }
+
   static Scheduler* GetThis();
   static Fiber* GetMainFiber();
 
@@ -490,6 +490,21 @@ struct _SSLInit {
 
 static _SSLInit s_init;
 
+// 服务端按自己的顺序选择第一个客户端也支持的协议
+int SSLAlpnSelect(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                  const unsigned char* in, unsigned int inlen, void* arg) {
+  const std::string* protos = (const std::string*)arg;
+  unsigned char* selected = nullptr;
+  if (SSL_select_next_proto(&selected, outlen,
+                            (const unsigned char*)protos->c_str(),
+                            protos->size(), in,
+                            inlen) != OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
 }  // namespace
 
 SSLSocket::SSLSocket(int family, int type, int protocol)
@@ -505,6 +520,7 @@ Socket::ptr SSLSocket::accept() {
     return nullptr;
   }
   sock->m_ctx = m_ctx;
+  sock->m_alpn = m_alpn;
   if (sock->init(newsock)) {
     return sock;
   }
@@ -520,6 +536,10 @@ bool SSLSocket::connect(const Address::ptr addr, uint64_t timeout_ms) {
   if (v) {
     m_ctx.reset(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
     m_ssl.reset(SSL_new(m_ctx.get()), SSL_free);
+    if (m_alpn) {
+      SSL_set_alpn_protos(m_ssl.get(), (const unsigned char*)m_alpn->c_str(),
+                          m_alpn->size());
+    }
     SSL_set_fd(m_ssl.get(), m_sock);
     v = (SSL_connect(m_ssl.get()) == 1);
   }
@@ -573,6 +593,9 @@ int SSLSocket::sendTo(const iovec* buffers, size_t length,
 
 int SSLSocket::recv(void* buffer, size_t length, int flags) {
   if (m_ssl) {
+    if (flags & MSG_PEEK) {
+      return SSL_peek(m_ssl.get(), buffer, length);
+    }
     return SSL_read(m_ssl.get(), buffer, length);
   }
   return -1;
@@ -638,9 +661,41 @@ bool SSLSocket::loadCertificates(const std::string& cert_file,
         << " key_file=" << key_file;
     return false;
   }
+  initAlpn();
   return true;
 }
 
+void SSLSocket::setAlpnProtocols(const std::vector<std::string>& protos) {
+  auto alpn = std::make_shared<std::string>();
+  for (auto& i : protos) {
+    if (i.empty() || i.size() > 255) {
+      continue;
+    }
+    alpn->push_back((char)i.size());
+    alpn->append(i);
+  }
+  m_alpn = alpn->empty() ? nullptr : alpn;
+  initAlpn();
+}
+
+void SSLSocket::initAlpn() {
+  // 客户端的 SSL_CTX 在 connect 时才创建
+  if (m_ctx && !m_ssl) {
+    SSL_CTX_set_alpn_select_cb(m_ctx.get(), m_alpn ? SSLAlpnSelect : nullptr,
+                               m_alpn.get());
+  }
+}
+
+std::string SSLSocket::getAlpnProtocol() const {
+  if (!m_ssl) {
+    return "";
+  }
+  const unsigned char* data = nullptr;
+  unsigned int len = 0;
+  SSL_get0_alpn_selected(m_ssl.get(), &data, &len);
+  return data ? std::string((const char*)data, len) : "";
+}
+
 SSLSocket::ptr SSLSocket::CreateTCP(sylar::Address::ptr address) {
   return std::make_shared<SSLSocket>(address->getFamily(), TCP, 0);
 }
@@ -176,14 +176,32 @@ class SSLSocket : public Socket {
 
   bool loadCertificates(const std::string& cert_file,
                         const std::string& key_file);
+
+  /**
+   * @brief 设置 ALPN 协议列表(如 h2, http/1.1)
+   * @details 服务端按列表顺序选择客户端也支持的协议, 没有交集时不协商;
+   *          客户端在 connect 时通告。对已接受的连接不生效
+   */
+  void setAlpnProtocols(const std::vector<std::string>& protos);
+
+  /**
+   * @brief 握手时协商出的 ALPN 协议, 没有协商时返回空
+   */
+  std::string getAlpnProtocol() const;
+
   virtual std::ostream& dump(std::ostream& os) const override;
 
  protected:
   virtual bool init(int sock) override;
 
+ private:
+  void initAlpn();
+
  private:
   std::shared_ptr<SSL_CTX> m_ctx;
   std::shared_ptr<SSL> m_ssl;
+  // ALPN 协议列表, 长度前缀的编码格式, 由监听 socket 和接受的连接共享
+  std::shared_ptr<std::string> m_alpn;
 };
 
 std::ostream& operator<<(std::ostream& os, const Socket& sock);
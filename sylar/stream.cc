@@ -1,4 +1,5 @@
 #include "stream.h"
+#include <limits.h>
 #include "sylar/config.h"
 #include "sylar/log.h"
 
@@ -78,4 +79,55 @@ int Stream::writeFixSize(ByteArray::ptr ba, size_t length) {
   return length;
 }
 
+int Stream::writev(const iovec* buffers, size_t length) {
+  int total = 0;
+  for (size_t i = 0; i < length; ++i) {
+    if (buffers[i].iov_len == 0) {
+      continue;
+    }
+    int rt = write(buffers[i].iov_base, buffers[i].iov_len);
+    if (rt <= 0) {
+      return total ? total : rt;
+    }
+    total += rt;
+    if (rt != (int)buffers[i].iov_len) {
+      break;
+    }
+  }
+  return total;
+}
+
+int Stream::writevFixSize(const iovec* buffers, size_t length) {
+  std::vector<iovec> iovs(buffers, buffers + length);
+  size_t idx = 0;
+  int64_t total = 0;
+  while (idx < iovs.size()) {
+    if (iovs[idx].iov_len == 0) {
+      ++idx;
+      continue;
+    }
+    int64_t len = writev(&iovs[idx], std::min<size_t>(iovs.size() - idx,
+                                                       IOV_MAX));
+    if (len <= 0) {
+      SYLAR_LOG_ERROR(g_logger)
+          << "writevFixSize fail iovcnt=" << length << " len=" << len
+          << " errno=" << errno << ", " << strerror(errno);
+      return len;
+    }
+    total += len;
+    // 跳过已写完的块, 调整写了一部分的块
+    while (len > 0 && idx < iovs.size()) {
+      if ((size_t)len >= iovs[idx].iov_len) {
+        len -= iovs[idx].iov_len;
+        ++idx;
+      } else {
+        iovs[idx].iov_base = (char*)iovs[idx].iov_base + len;
+        iovs[idx].iov_len -= len;
+        len = 0;
+      }
+    }
+  }
+  return total;
+}
+
 }  // namespace sylar
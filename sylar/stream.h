@@ -19,6 +19,16 @@ class Stream {
   virtual int write(ByteArray::ptr ba, size_t length) = 0;
   virtual int writeFixSize(const void* buffer, size_t length);
   virtual int writeFixSize(ByteArray::ptr ba, size_t length);
+  /**
+   * @brief 聚集写, 一次写出多块数据
+   * @return 写入的字节数, 可能小于总长度; <=0 表示出错
+   */
+  virtual int writev(const iovec* buffers, size_t length);
+  /**
+   * @brief 聚集写出全部数据
+   * @return 写入的总字节数; <=0 表示出错
+   */
+  virtual int writevFixSize(const iovec* buffers, size_t length);
   virtual void close() = 0;
 };
 
@@ -1,4 +1,6 @@
 #include "async_socket_stream.h"
+#include <algorithm>
+#include "sylar/config.h"
 #include "sylar/log.h"
 #include "sylar/macro.h"
 #include "sylar/util.h"
@@ -7,8 +9,45 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_async_socket_stream_ctx_ring_size =
+    sylar::Config::Lookup("async_socket_stream.ctx_ring_size", (uint32_t)1024,
+                          "async socket stream in-flight ctx ring size, "
+                          "rounded up to a power of two");
+
+static uint32_t s_ctx_ring_size = 0;
+
+namespace {
+
+uint32_t RoundUpPowerOfTwo(uint32_t v) {
+  uint32_t rt = 1;
+  while (rt < v && rt < (1u << 31)) {
+    rt <<= 1;
+  }
+  return rt;
+}
+
+struct _AsyncSocketStreamIniter {
+  _AsyncSocketStreamIniter() {
+    s_ctx_ring_size =
+        RoundUpPowerOfTwo(g_async_socket_stream_ctx_ring_size->getValue());
+    g_async_socket_stream_ctx_ring_size->addListener(
+        [](const uint32_t& ov, const uint32_t& nv) {
+          s_ctx_ring_size = RoundUpPowerOfTwo(nv);
+        });
+  }
+};
+
+static _AsyncSocketStreamIniter s_init;
+
+}  // namespace
+
 AsyncSocketStream::Ctx::Ctx()
-    : sn(0), timeout(0), result(0), timed(false), scheduler(nullptr) {}
+    : sn(0),
+      timeout(0),
+      result(0),
+      timed(false),
+      deadline(0),
+      scheduler(nullptr) {}
 
 void AsyncSocketStream::Ctx::doRsp() {
   Scheduler* scd = scheduler;
@@ -19,10 +58,6 @@ void AsyncSocketStream::Ctx::doRsp() {
   if (!scd || !fiber) {
     return;
   }
-  if (timer) {
-    timer->cancel();
-    timer = nullptr;
-  }
 
   if (timed) {
     result = TIMEOUT;
@@ -40,6 +75,11 @@ AsyncSocketStream::AsyncSocketStream(Socket::ptr sock, bool owner)
       m_iomanager(nullptr),
       m_worker(nullptr) {}
 
+AsyncSocketStream::~AsyncSocketStream() {
+  // 释放队列中节点对自己的引用
+  dequeueAll();
+}
+
 bool AsyncSocketStream::start() {
   if (!m_iomanager) {
     m_iomanager = sylar::IOManager::GetThis();
@@ -124,32 +164,64 @@ void AsyncSocketStream::doWrite() {
       // 注意这里是循环，连接有效协程就不结束
       // 等待发送事件入队
       m_sem.wait();
-      std::list<SendCtx::ptr> ctxs;
-      {
-        RWMutexType::WriteLock lock(m_queueMutex);
-        m_queue.swap(ctxs);
+      if (m_coalesceWindow) {
+        waitCoalesce();
       }
+      std::vector<SendCtx::ptr> ctxs = dequeueAll();
       auto self = shared_from_this();
+      bool ok = true;
+      uint32_t count = 0;
       for (auto& i : ctxs) {
         // 响应所有事件
         if (!i->doSend(self)) {
-          innerClose();
+          ok = false;
           break;
         }
+        if (m_maxBatch && ++count % m_maxBatch == 0 && !doFlush()) {
+          ok = false;
+          break;
+        }
+      }
+      if (!ok || !doFlush()) {
+        innerClose();
       }
     }
   } catch (...) {
     // TODO log
   }
   SYLAR_LOG_DEBUG(g_logger) << "doWrite out " << this;
-  {
-    RWMutexType::WriteLock lock(m_queueMutex);
-    m_queue.clear();
-  }
+  dequeueAll();
   // 通知 AsyncSocketStream::start 所在的协程，doWrite 协程结束了
   m_waitSem.notify();
 }
 
+void AsyncSocketStream::waitCoalesce() {
+  m_coalescing = true;
+  // 先标记再检查, 与 enqueue 的顺序相反, 队列在这之间填满时不会漏掉唤醒
+  // 每次标记都只对应一次 notify, 这里也要 wait 把它取走
+  if (!isConnected() || (m_maxBatch && m_queueSize >= m_maxBatch)) {
+    wakeCoalesce();
+    m_coalesceSem.wait();
+    return;
+  }
+  std::weak_ptr<AsyncSocketStream> weak = shared_from_this();
+  sylar::Timer::ptr timer = m_iomanager->addTimer(
+      (m_coalesceWindow + 999) / 1000, [weak]() {
+        auto self = weak.lock();
+        if (self) {
+          self->wakeCoalesce();
+        }
+      });
+  m_coalesceSem.wait();
+  timer->cancel();
+}
+
+void AsyncSocketStream::wakeCoalesce() {
+  if (m_coalescing.exchange(false)) {
+    m_coalesceSem.notify();
+  }
+}
+
 void AsyncSocketStream::startRead() {
   m_iomanager->schedule(
       std::bind(&AsyncSocketStream::doRead, shared_from_this()));
@@ -162,47 +234,195 @@ void AsyncSocketStream::startWrite() {
 
 void AsyncSocketStream::onTimeOut(Ctx::ptr ctx) {
   SYLAR_LOG_DEBUG(g_logger) << "onTimeOut " << ctx;
-  {
-    RWMutexType::WriteLock lock(m_mutex);
-    m_ctxs.erase(ctx->sn);
-  }
   ctx->timed = true;
   ctx->doRsp();
 }
 
+std::vector<AsyncSocketStream::SendCtx::ptr> AsyncSocketStream::dequeueAll() {
+  SendCtx* head = m_queueHead.exchange(nullptr);
+  std::vector<SendCtx::ptr> ctxs;
+  // 链表是后入队的在前, 反转为入队顺序
+  for (SendCtx* i = head; i; i = i->next) {
+    ctxs.push_back(nullptr);
+    ctxs.back().swap(i->self);
+  }
+  std::reverse(ctxs.begin(), ctxs.end());
+  m_queueSize -= ctxs.size();
+  return ctxs;
+}
+
+bool AsyncSocketStream::enqueue(SendCtx::ptr ctx) {
+  SYLAR_ASSERT(ctx);
+  ctx->self = ctx;
+  ++m_queueSize;
+  SendCtx* head = m_queueHead.load(std::memory_order_relaxed);
+  do {
+    ctx->next = head;
+  } while (!m_queueHead.compare_exchange_weak(head, ctx.get(),
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+  // 队列由空变为非空时唤醒写协程, 写协程每次都会取走全部事件
+  if (!head) {
+    m_sem.notify();
+  } else if (m_maxBatch && m_queueSize >= m_maxBatch && m_coalescing) {
+    wakeCoalesce();
+  }
+  return !head;
+}
+
+AsyncSocketStream::Ctx::ptr* AsyncSocketStream::findRingCtx(uint32_t sn) {
+  if (m_ctxRing.empty()) {
+    return nullptr;
+  }
+  Ctx::ptr& slot = m_ctxRing[sn & (m_ctxRing.size() - 1)];
+  return slot && slot->sn == sn ? &slot : nullptr;
+}
+
 AsyncSocketStream::Ctx::ptr AsyncSocketStream::getCtx(uint32_t sn) {
-  RWMutexType::ReadLock lock(m_mutex);
-  auto it = m_ctxs.find(sn);
-  return it != m_ctxs.end() ? it->second : nullptr;
+  MutexType::Lock lock(m_ctxMutex);
+  Ctx::ptr* slot = findRingCtx(sn);
+  if (slot) {
+    return *slot;
+  }
+  auto it = m_ctxOverflow.find(sn);
+  return it != m_ctxOverflow.end() ? it->second : nullptr;
 }
 
 AsyncSocketStream::Ctx::ptr AsyncSocketStream::getAndDelCtx(uint32_t sn) {
   Ctx::ptr ctx;
-  RWMutexType::WriteLock lock(m_mutex);
-  auto it = m_ctxs.find(sn);
-  if (it != m_ctxs.end()) {
-    ctx = it->second;
-    m_ctxs.erase(it);
+  MutexType::Lock lock(m_ctxMutex);
+  Ctx::ptr* slot = findRingCtx(sn);
+  if (slot) {
+    ctx.swap(*slot);
+  } else {
+    auto it = m_ctxOverflow.find(sn);
+    if (it == m_ctxOverflow.end()) {
+      return nullptr;
+    }
+    ctx.swap(it->second);
+    m_ctxOverflow.erase(it);
   }
+  --m_ctxCount;
   return ctx;
 }
 
 bool AsyncSocketStream::addCtx(Ctx::ptr ctx) {
-  RWMutexType::WriteLock lock(m_mutex);
-  m_ctxs.insert(std::make_pair(ctx->sn, ctx));
+  uint64_t now = sylar::GetCurrentMS();
+  ctx->deadline = ctx->timeout ? now + ctx->timeout : 0;
+  MutexType::Lock lock(m_ctxMutex);
+  if (m_ctxRing.empty()) {
+    m_ctxRing.resize(s_ctx_ring_size);
+  }
+  if (findRingCtx(ctx->sn) || m_ctxOverflow.count(ctx->sn)) {
+    return false;
+  }
+  Ctx::ptr& slot = m_ctxRing[ctx->sn & (m_ctxRing.size() - 1)];
+  if (!slot) {
+    slot = ctx;
+  } else {
+    m_ctxOverflow[ctx->sn] = ctx;
+  }
+  ++m_ctxCount;
+
+  if (!ctx->deadline || (m_ctxDeadline && m_ctxDeadline <= ctx->deadline)) {
+    return true;
+  }
+  m_ctxDeadline = ctx->deadline;
+  if (m_ctxTimer && m_ctxTimer->reset(ctx->timeout, true)) {
+    return true;
+  }
+  std::weak_ptr<AsyncSocketStream> weak_self(shared_from_this());
+  sylar::IOManager* iom =
+      m_iomanager ? m_iomanager : sylar::IOManager::GetThis();
+  m_ctxTimer = iom->addTimer(ctx->timeout, [weak_self]() {
+    auto self = weak_self.lock();
+    if (self) {
+      self->checkTimeout();
+    }
+  });
   return true;
 }
 
-bool AsyncSocketStream::enqueue(SendCtx::ptr ctx) {
-  SYLAR_ASSERT(ctx);
-  RWMutexType::WriteLock lock(m_queueMutex);
-  bool empty = m_queue.empty();
-  m_queue.push_back(ctx);
-  lock.unlock();
-  if (empty) {
-    m_sem.notify();
+void AsyncSocketStream::checkTimeout() {
+  std::vector<Ctx::ptr> timeouts;
+  {
+    MutexType::Lock lock(m_ctxMutex);
+    uint64_t now = sylar::GetCurrentMS();
+    uint64_t next = 0;
+    auto check = [&timeouts, &next, now](Ctx::ptr& ctx) {
+      if (!ctx || !ctx->deadline) {
+        return false;
+      }
+      if (ctx->deadline <= now) {
+        timeouts.push_back(nullptr);
+        timeouts.back().swap(ctx);
+        return true;
+      }
+      if (!next || ctx->deadline < next) {
+        next = ctx->deadline;
+      }
+      return false;
+    };
+    if (m_ctxCount) {
+      for (auto& i : m_ctxRing) {
+        check(i);
+      }
+      for (auto it = m_ctxOverflow.begin(); it != m_ctxOverflow.end();) {
+        if (check(it->second)) {
+          it = m_ctxOverflow.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      m_ctxCount -= timeouts.size();
+    }
+
+    m_ctxDeadline = next;
+    // 当前的定时器已经触发, 不能 reset; 期间 addCtx 新建的定时器也取消
+    if (m_ctxTimer) {
+      m_ctxTimer->cancel();
+    }
+    if (next) {
+      std::weak_ptr<AsyncSocketStream> weak_self(shared_from_this());
+      sylar::IOManager* iom =
+          m_iomanager ? m_iomanager : sylar::IOManager::GetThis();
+      m_ctxTimer = iom->addTimer(next - now, [weak_self]() {
+        auto self = weak_self.lock();
+        if (self) {
+          self->checkTimeout();
+        }
+      });
+    } else {
+      m_ctxTimer = nullptr;
+    }
+  }
+  for (auto& i : timeouts) {
+    onTimeOut(i);
   }
-  return empty;
+}
+
+std::vector<AsyncSocketStream::Ctx::ptr> AsyncSocketStream::takeAllCtxs() {
+  std::vector<Ctx::ptr> ctxs;
+  MutexType::Lock lock(m_ctxMutex);
+  if (m_ctxCount) {
+    for (auto& i : m_ctxRing) {
+      if (i) {
+        ctxs.push_back(nullptr);
+        ctxs.back().swap(i);
+      }
+    }
+    for (auto& i : m_ctxOverflow) {
+      ctxs.push_back(i.second);
+    }
+    m_ctxOverflow.clear();
+    m_ctxCount = 0;
+  }
+  if (m_ctxTimer) {
+    m_ctxTimer->cancel();
+    m_ctxTimer = nullptr;
+  }
+  m_ctxDeadline = 0;
+  return ctxs;
 }
 
 bool AsyncSocketStream::innerClose() {
@@ -212,19 +432,12 @@ bool AsyncSocketStream::innerClose() {
   }
   SocketStream::close();
   m_sem.notify();
-  std::unordered_map<uint32_t, Ctx::ptr> ctxs;
-  {
-    RWMutexType::WriteLock lock(m_mutex);
-    ctxs.swap(m_ctxs);
-  }
-  {
-    RWMutexType::WriteLock lock(m_queueMutex);
-    m_queue.clear();
-  }
+  std::vector<Ctx::ptr> ctxs = takeAllCtxs();
+  dequeueAll();
   for (auto& i : ctxs) {
-    i.second->result = IO_ERROR;
-    i.second->resultStr = "io_error";
-    i.second->doRsp();
+    i->result = IO_ERROR;
+    i->resultStr = "io_error";
+    i->doRsp();
   }
   return true;
 }
@@ -1,9 +1,10 @@
 #ifndef __SYLAR_STREAMS_ASYNC_SOCKET_STREAM_H__
 #define __SYLAR_STREAMS_ASYNC_SOCKET_STREAM_H__
 
+#include <atomic>
 #include <boost/any.hpp>
-#include <list>
 #include <unordered_map>
+#include <vector>
 #include "socket_stream.h"
 
 namespace sylar {
@@ -14,11 +15,12 @@ class AsyncSocketStream
  public:
   typedef std::shared_ptr<AsyncSocketStream> ptr;
   typedef sylar::RWMutex RWMutexType;
+  typedef sylar::Mutex MutexType;
   typedef std::function<bool(AsyncSocketStream::ptr)> connect_callback;
   typedef std::function<void(AsyncSocketStream::ptr)> disconnect_callback;
 
   AsyncSocketStream(Socket::ptr sock, bool owner = true);
-  virtual ~AsyncSocketStream() {}
+  virtual ~AsyncSocketStream();
 
   virtual bool start();
   virtual void close() override;
@@ -29,6 +31,7 @@ class AsyncSocketStream
     TIMEOUT = -1,
     IO_ERROR = -2,
     NOT_CONNECT = -3,
+    DUPLICATE_SN = -4,
   };
 
  protected:
@@ -38,6 +41,12 @@ class AsyncSocketStream
     virtual ~SendCtx() {}
 
     virtual bool doSend(AsyncSocketStream::ptr stream) = 0;
+
+   private:
+    friend class AsyncSocketStream;
+    // 发送队列的侵入式链表, 在队列中时通过 self 持有自己
+    SendCtx* next = nullptr;
+    SendCtx::ptr self;
   };
 
   struct Ctx : public SendCtx {
@@ -46,14 +55,14 @@ class AsyncSocketStream
     virtual ~Ctx() {}
     Ctx();
 
-    uint32_t sn;       // 序列号
-    uint32_t timeout;  // 超时时间
-    uint32_t result;   // 结果
+    uint32_t sn;        // 序列号
+    uint32_t timeout;   // 超时时间
+    uint32_t result;    // 结果
     bool timed;
+    uint64_t deadline;  // 超时的时间点(毫秒), 由 addCtx 设置, 0 表示不超时
 
     Scheduler* scheduler;
     Fiber::ptr fiber;
-    Timer::ptr timer;
 
     std::string resultStr = "ok";
 
@@ -70,6 +79,21 @@ class AsyncSocketStream
   bool isAutoConnect() const { return m_autoConnect; }
   void setAutoConnect(bool v) { m_autoConnect = v; }
 
+  /**
+   * @brief 写合并
+   * @param[in] window_us 写协程被唤醒后, 挂起等待更多发送事件入队的
+   *            最长时间(微秒), 0 表示不等待。由定时器唤醒, 精度为毫秒,
+   *            不足 1 毫秒按 1 毫秒计
+   * @param[in] max_batch 每 max_batch 个发送事件调用一次 doFlush,
+   *            队列达到该数量时也不再等待, 0 表示不限制
+   */
+  void setWriteCoalesce(uint32_t window_us, uint32_t max_batch) {
+    m_coalesceWindow = window_us;
+    m_maxBatch = max_batch;
+  }
+  uint32_t getCoalesceWindow() const { return m_coalesceWindow; }
+  uint32_t getMaxBatch() const { return m_maxBatch; }
+
   connect_callback getConnectCb() const { return m_connectCb; }
   disconnect_callback getDisconnectCb() const { return m_disconnectCb; }
   void setConnectCb(connect_callback v) { m_connectCb = v; }
@@ -96,6 +120,12 @@ class AsyncSocketStream
   virtual void onTimeOut(Ctx::ptr ctx);
   virtual Ctx::ptr doRecv() = 0;
 
+  /**
+   * @brief 一批发送事件的 doSend 全部执行后调用,
+   *        子类可以在 doSend 中只做缓存, 在这里合并写出
+   */
+  virtual bool doFlush() { return true; }
+
   Ctx::ptr getCtx(uint32_t sn);
   Ctx::ptr getAndDelCtx(uint32_t sn);
 
@@ -117,22 +147,67 @@ class AsyncSocketStream
     return nullptr;
   }
 
+  /**
+   * @brief 加入在途请求表, 按 ctx->timeout 设置超时, 超时后调用 onTimeOut
+   * @return sn 已经存在时返回 false, 此时 ctx 不在表中, 回包和超时都不会
+   *         唤醒它, 调用方不能再入队等待, 应直接以 DUPLICATE_SN 失败
+   */
   bool addCtx(Ctx::ptr ctx);
   bool enqueue(SendCtx::ptr ctx);
 
   bool innerClose();
   bool waitFiber();
 
+  /**
+   * @brief 在合并窗口内挂起, 直到窗口结束或者队列达到 max_batch
+   */
+  void waitCoalesce();
+  /**
+   * @brief 唤醒 waitCoalesce 中挂起的写协程, 多次调用只唤醒一次
+   */
+  void wakeCoalesce();
+
+ private:
+  /**
+   * @brief 取出发送队列中的全部事件, 按入队顺序排列
+   */
+  std::vector<SendCtx::ptr> dequeueAll();
+
+  /**
+   * @brief 超时定时器的回调, 扫描在途请求表, 之后按最早的超时时间重新设置
+   */
+  void checkTimeout();
+
+  /**
+   * @brief 环形表中 sn 所在的槽位, 不在环形表中时返回 nullptr
+   */
+  Ctx::ptr* findRingCtx(uint32_t sn);
+  std::vector<Ctx::ptr> takeAllCtxs();
+
  protected:
   sylar::FiberSemaphore m_sem;
   sylar::FiberSemaphore m_waitSem;
-  RWMutexType m_queueMutex;
-  std::list<SendCtx::ptr> m_queue;
-  RWMutexType m_mutex;
-  std::unordered_map<uint32_t, Ctx::ptr> m_ctxs;
+  // 发送队列, 生产者无锁地压入链表头部, 写协程一次取走整个链表
+  std::atomic<SendCtx*> m_queueHead = {nullptr};
+  std::atomic<uint32_t> m_queueSize = {0};
+  // 写协程在合并窗口内等待, 由定时器或者 enqueue 通过 m_coalesceSem 唤醒
+  sylar::FiberSemaphore m_coalesceSem;
+  std::atomic<bool> m_coalescing = {false};
+
+  MutexType m_ctxMutex;
+  // 在途请求表, 按 sn 的低位索引(sn 单调递增), 第一次使用时分配;
+  // 槽位被未返回的请求占用或者 sn 不连续时放到 m_ctxOverflow
+  std::vector<Ctx::ptr> m_ctxRing;
+  std::unordered_map<uint32_t, Ctx::ptr> m_ctxOverflow;
+  uint32_t m_ctxCount = 0;
+  // 整个连接共用一个超时定时器, 到期时间为最早的超时时间
+  sylar::Timer::ptr m_ctxTimer;
+  uint64_t m_ctxDeadline = 0;
 
   uint32_t m_sn;
   bool m_autoConnect;
+  uint32_t m_coalesceWindow = 0;
+  uint32_t m_maxBatch = 0;
   sylar::Timer::ptr m_timer;
   sylar::IOManager* m_iomanager;
   sylar::IOManager* m_worker;
@@ -1,25 +1,178 @@
 #include "load_balance.h"
 #include <math.h>
+#include <string.h>
+#include <thread>
+#include "sylar/config.h"
 #include "sylar/log.h"
 #include "sylar/macro.h"
+#include "sylar/util/hash_util.h"
 #include "sylar/worker.h"
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
-HolderStats HolderStatsSet::getTotal() {
-  HolderStats rt;
-  for (auto& i : m_stats) {
-#define XX(f) rt.f += i.f
-    XX(m_usedTime);
-    XX(m_total);
-    XX(m_doing);
-    XX(m_timeouts);
-    XX(m_oks);
-    XX(m_errs);
+static sylar::ConfigVar<uint32_t>::ptr g_p2c_decay_ms = sylar::Config::Lookup(
+    "load_balance.p2c.decay_ms", (uint32_t)10000,
+    "p2c load balance ewma latency decay time constant(ms)");
+static sylar::ConfigVar<float>::ptr g_p2c_eject_error_rate =
+    sylar::Config::Lookup("load_balance.p2c.eject_error_rate", 0.5f,
+                          "p2c load balance eject node when error rate "
+                          "(timeouts + errs) / total reaches this");
+static sylar::ConfigVar<uint32_t>::ptr g_p2c_eject_min_requests =
+    sylar::Config::Lookup("load_balance.p2c.eject_min_requests", (uint32_t)10,
+                          "p2c load balance min requests before ejecting");
+static sylar::ConfigVar<uint32_t>::ptr g_p2c_eject_base_ms =
+    sylar::Config::Lookup("load_balance.p2c.eject_base_ms", (uint32_t)5000,
+                          "p2c load balance base ejection time(ms), "
+                          "multiplied by consecutive ejections");
+static sylar::ConfigVar<uint32_t>::ptr g_p2c_slow_start_ms =
+    sylar::Config::Lookup("load_balance.p2c.slow_start_ms", (uint32_t)10000,
+                          "p2c load balance slow start time(ms) of new node");
+static sylar::ConfigVar<uint32_t>::ptr g_hash_virtual_nodes =
+    sylar::Config::Lookup("load_balance.hash.virtual_nodes", (uint32_t)160,
+                          "consistent hash virtual nodes of weight 10000");
+static sylar::ConfigVar<uint32_t>::ptr g_maglev_table_size =
+    sylar::Config::Lookup("load_balance.maglev.table_size", (uint32_t)65537,
+                          "maglev lookup table size, rounded up to a prime");
+
+static sylar::ConfigVar<uint32_t>::ptr g_stats_shards = sylar::Config::Lookup(
+    "load_balance.stats_shards", (uint32_t)0,
+    "load balance stats shards, each thread writes to one shard, "
+    "0 means the number of cpu cores");
+
+static uint32_t s_p2c_decay_ms = 0;
+static float s_p2c_eject_error_rate = 0;
+static uint32_t s_p2c_eject_min_requests = 0;
+static uint32_t s_p2c_eject_base_ms = 0;
+static uint32_t s_p2c_slow_start_ms = 0;
+static uint32_t s_hash_virtual_nodes = 0;
+static uint32_t s_maglev_table_size = 0;
+static uint32_t s_stats_shards = 0;
+
+namespace {
+
+struct _LoadBalanceIniter {
+  _LoadBalanceIniter() {
+#define XX(name, type)                                               \
+  s_##name = g_##name->getValue();                                   \
+  g_##name->addListener(                                             \
+      [](const type& ov, const type& nv) { s_##name = nv; });
+    XX(p2c_decay_ms, uint32_t);
+    XX(p2c_eject_error_rate, float);
+    XX(p2c_eject_min_requests, uint32_t);
+    XX(p2c_eject_base_ms, uint32_t);
+    XX(p2c_slow_start_ms, uint32_t);
+    XX(hash_virtual_nodes, uint32_t);
+    XX(maglev_table_size, uint32_t);
+    XX(stats_shards, uint32_t);
 #undef XX
   }
+};
+
+static _LoadBalanceIniter s_init;
+
+// 每个线程独立的随机数, 避免 rand() 的全局状态
+uint32_t FastRand() {
+  static thread_local uint64_t s_seed =
+      sylar::GetCurrentUS() ^ (uint64_t)&s_seed;
+  s_seed ^= s_seed << 13;
+  s_seed ^= s_seed >> 7;
+  s_seed ^= s_seed << 17;
+  return s_seed >> 16;
+}
+
+// 线程第一次写统计时分配的序号, 用来选择分片
+uint32_t ThreadShardIdx() {
+  static std::atomic<uint32_t> s_count = {0};
+  static thread_local uint32_t s_idx = s_count++;
+  return s_idx;
+}
+
+uint32_t LatencyIdx(uint64_t v) {
+  if (v < 8) {
+    return v;
+  }
+  uint32_t e = 63 - __builtin_clzll(v);
+  if (e > 31) {
+    return HolderStats::LATENCY_BUCKETS - 1;
+  }
+  return 8 + (e - 3) * 4 + ((v >> (e - 2)) & 3);
+}
+
+// 桶的下界
+uint64_t LatencyLower(uint32_t idx) {
+  if (idx < 8) {
+    return idx;
+  }
+  uint32_t e = (idx - 8) / 4 + 3;
+  return (4ul + (idx - 8) % 4) << (e - 2);
+}
+
+}  // namespace
+
+void HolderStats::merge(const HolderStats& v) {
+#define XX(f) f += v.f
+  XX(m_usedTime);
+  XX(m_total);
+  XX(m_doing);
+  XX(m_timeouts);
+  XX(m_oks);
+  XX(m_errs);
+#undef XX
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    m_latency[i] += v.m_latency[i];
+  }
+}
+
+void HolderStats::addLatency(uint64_t used_us) {
+  sylar::Atomic::addFetch(m_latency[LatencyIdx(used_us)], 1);
+}
+
+uint32_t HolderStats::getPercentile(float p) const {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    total += m_latency[i];
+  }
+  if (!total) {
+    return 0;
+  }
+  uint64_t target = std::max((uint64_t)ceil(total * p), (uint64_t)1);
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    count += m_latency[i];
+    if (count >= target) {
+      // 取桶的中间值
+      uint64_t lower = LatencyLower(i);
+      if (i < 8 || i + 1 == LATENCY_BUCKETS) {
+        return lower;
+      }
+      return (lower + LatencyLower(i + 1)) / 2;
+    }
+  }
+  return 0;
+}
+
+HolderStats HolderStatsSet::getSecond(const uint32_t& t) {
+  HolderStats rt;
+  for (auto& shard : m_shards) {
+    auto& b = shard[t % m_size];
+    if (b.time == t) {
+      rt.merge(b.stats);
+    }
+  }
+  return rt;
+}
+
+HolderStats HolderStatsSet::getTotal(const uint32_t& now) {
+  HolderStats rt;
+  for (auto& shard : m_shards) {
+    for (auto& b : shard) {
+      if (b.time <= now && b.time + m_size > now) {
+        rt.merge(b.stats);
+      }
+    }
+  }
   return rt;
 }
 
@@ -31,6 +184,8 @@ std::string HolderStats::toString() {
      << " oks_rate=" << (m_total ? (m_oks * 100.0 / m_total) : 0)
      << " errs_rate=" << (m_total ? (m_errs * 100.0 / m_total) : 0)
      << " avg_used=" << (m_oks ? (m_usedTime * 1.0 / m_oks) : 0)
+     << " p50=" << getPercentile(0.5) << "us p90=" << getPercentile(0.9)
+     << "us p99=" << getPercentile(0.99) << "us"
      << " weight=" << getWeight(1) << "]";
   return ss.str();
 }
@@ -95,18 +250,31 @@ void LoadBalance::del(LoadBalanceItem::ptr v) {
 void LoadBalance::update(
     const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
     std::unordered_map<uint64_t, LoadBalanceItem::ptr>& dels) {
+  std::unordered_set<uint64_t> removed;
+  std::unordered_map<uint64_t, LoadBalanceItem::ptr> added;
   RWMutexType::WriteLock lock(m_mutex);
   for (auto& i : dels) {
     auto it = m_datas.find(i.first);
     if (it != m_datas.end()) {
       i.second = it->second;
       m_datas.erase(it);
+      removed.insert(i.first);
     }
   }
   for (auto& i : adds) {
-    m_datas[i.first] = i.second;
+    auto& v = m_datas[i.first];
+    if (v == i.second) {
+      continue;
+    }
+    if (v) {
+      removed.insert(i.first);
+    }
+    v = i.second;
+    added.insert(i);
+  }
+  if (!removed.empty() || !added.empty()) {
+    applyNolock(added, removed);
   }
-  initNolock();
 }
 
 void LoadBalance::set(const std::vector<LoadBalanceItem::ptr>& vs) {
@@ -154,6 +322,23 @@ void RoundRobinLoadBalance::initNolock() {
   items.swap(m_items);
 }
 
+void RoundRobinLoadBalance::applyNolock(
+    const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+    const std::unordered_set<uint64_t>& dels) {
+  if (!dels.empty()) {
+    m_items.erase(std::remove_if(m_items.begin(), m_items.end(),
+                                 [&dels](const LoadBalanceItem::ptr& i) {
+                                   return dels.count(i->getId()) > 0;
+                                 }),
+                  m_items.end());
+  }
+  for (auto& i : adds) {
+    if (i.second->isValid()) {
+      m_items.push_back(i.second);
+    }
+  }
+}
+
 LoadBalanceItem::ptr RoundRobinLoadBalance::get(uint64_t v) {
   RWMutexType::ReadLock lock(m_mutex);
   if (m_items.empty()) {
@@ -202,7 +387,28 @@ void WeightLoadBalance::initNolock() {
     }
   }
   items.swap(m_items);
+  initWeights();
+}
+
+void WeightLoadBalance::applyNolock(
+    const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+    const std::unordered_set<uint64_t>& dels) {
+  if (!dels.empty()) {
+    m_items.erase(std::remove_if(m_items.begin(), m_items.end(),
+                                 [&dels](const LoadBalanceItem::ptr& i) {
+                                   return dels.count(i->getId()) > 0;
+                                 }),
+                  m_items.end());
+  }
+  for (auto& i : adds) {
+    if (i.second->isValid()) {
+      m_items.push_back(i.second);
+    }
+  }
+  initWeights();
+}
 
+void WeightLoadBalance::initWeights() {
   int64_t total = 0;
   m_weights.resize(m_items.size());
   for (size_t i = 0; i < m_items.size(); ++i) {
@@ -223,12 +429,18 @@ int32_t WeightLoadBalance::getIdx(uint64_t v) {
 }
 
 void HolderStats::clear() {
-  m_usedTime = 0;
-  m_total = 0;
-  m_doing = 0;
-  m_timeouts = 0;
-  m_oks = 0;
-  m_errs = 0;
+  // 逐个字段原子清零, 与并发的 inc* 不会互相覆盖
+#define XX(f) __atomic_exchange_n(&f, 0, __ATOMIC_RELAXED)
+  XX(m_usedTime);
+  XX(m_total);
+  XX(m_doing);
+  XX(m_timeouts);
+  XX(m_oks);
+  XX(m_errs);
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    XX(m_latency[i]);
+  }
+#undef XX
 }
 
 float HolderStats::getWeight(float rate) {
@@ -249,30 +461,33 @@ float HolderStats::getWeight(float rate) {
   //     * std::min((base / (m_errs * 5.0 + 1)) / 100.0, 10.0);
 }
 
-HolderStatsSet::HolderStatsSet(uint32_t size) {
-  m_stats.resize(size);
-}
-
-void HolderStatsSet::init(const uint32_t& now) {
-  if (m_lastUpdateTime < now) {
-    for (uint32_t t = m_lastUpdateTime + 1, i = 0;
-         t <= now && i < m_stats.size(); ++t, ++i) {
-      m_stats[t % m_stats.size()].clear();
-    }
-    m_lastUpdateTime = now;
+HolderStatsSet::HolderStatsSet(uint32_t size) : m_size(size ? size : 1) {
+  // 分片数不少于线程数时每个线程独占一个分片, 轮转时不会丢失其它线程的计数
+  uint32_t shards = s_stats_shards;
+  if (!shards) {
+    shards = std::thread::hardware_concurrency();
+  }
+  m_shards.resize(std::max(shards, (uint32_t)1));
+  for (auto& i : m_shards) {
+    i = std::vector<Bucket>(m_size);
   }
 }
 
 HolderStats& HolderStatsSet::get(const uint32_t& now) {
-  init(now);
-  return m_stats[now % m_stats.size()];
+  auto& b = m_shards[ThreadShardIdx() % m_shards.size()][now % m_size];
+  uint32_t t = b.time;
+  // 抢到新一秒的线程负责清空. 只有分片数少于线程数时才会有其它线程
+  // 写同一个桶, 它们在抢到与清空之间写入的计数会丢失
+  if (t < now && __sync_bool_compare_and_swap(&b.time, t, now)) {
+    b.stats.clear();
+  }
+  return b.stats;
 }
 
 float HolderStatsSet::getWeight(const uint32_t& now) {
-  init(now);
   float v = 0;
-  for (size_t i = 1; i < m_stats.size(); ++i) {
-    v += m_stats[(now - i) % m_stats.size()].getWeight(1 - 0.1 * i);
+  for (size_t i = 1; i < m_size; ++i) {
+    v += getSecond(now - i).getWeight(1 - 0.1 * i);
   }
   return v;
   // return getTotal().getWeight(1.0);
@@ -290,6 +505,388 @@ HolderStats& LoadBalanceItem::get(const uint32_t& now) {
   return m_stats.get(now);
 }
 
+HolderStats LoadBalanceItem::getTotal(const uint32_t& now) {
+  return m_stats.getTotal(now);
+}
+
+P2CLoadBalanceItem::P2CLoadBalanceItem()
+    : m_createTime(sylar::GetCurrentMS()) {}
+
+void P2CLoadBalanceItem::onStart() {
+  ++m_inflight;
+}
+
+void P2CLoadBalanceItem::onFinish(bool ok, uint64_t used_us) {
+  --m_inflight;
+  uint64_t now = sylar::GetCurrentUS();
+  {
+    MutexType::Lock lock(m_mutex);
+    double sample = used_us;
+    if (!ok && sample < m_ewma) {
+      // 快速失败不能拉低延迟, 否则故障节点反而会吸引流量
+      sample = m_ewma;
+    }
+    if (m_ewma == 0 || sample > m_ewma) {
+      m_ewma = sample;
+    } else {
+      double w = exp(-(double)(now - m_ewmaTime) / 1000.0 /
+                     (s_p2c_decay_ms ? s_p2c_decay_ms : 1));
+      m_ewma = m_ewma * w + sample * (1 - w);
+    }
+    m_ewmaTime = now;
+    if (ok && !isEjected(now / 1000)) {
+      // 摘除结束后恢复正常, 下次摘除重新计时
+      m_ejectCount = 0;
+    }
+  }
+  if (!ok) {
+    checkEject(now / 1000);
+  }
+}
+
+void P2CLoadBalanceItem::checkEject(uint64_t now_ms) {
+  if (isEjected(now_ms)) {
+    return;
+  }
+  HolderStats stats = m_stats.getTotal(now_ms / 1000);
+  uint32_t fails = stats.getTimeouts() + stats.getErrs();
+  if (stats.getTotal() < s_p2c_eject_min_requests ||
+      fails < stats.getTotal() * s_p2c_eject_error_rate) {
+    return;
+  }
+  MutexType::Lock lock(m_mutex);
+  if (m_ejectCount < 10) {
+    ++m_ejectCount;
+  }
+  m_ejectUntil = now_ms + (uint64_t)s_p2c_eject_base_ms * m_ejectCount;
+  SYLAR_LOG_WARN(g_logger) << "p2c eject " << m_id << " for "
+                           << s_p2c_eject_base_ms * m_ejectCount
+                           << "ms, " << stats.toString();
+}
+
+double P2CLoadBalanceItem::getEwma() {
+  MutexType::Lock lock(m_mutex);
+  return m_ewma;
+}
+
+double P2CLoadBalanceItem::getCost() {
+  double ewma = getEwma();
+  if (ewma == 0) {
+    // 还没有样本时不知道真实延迟, 有在途请求就按 1s 计算, 避免新节点在
+    // 第一个应答返回前吸走全部流量
+    return 1000000.0 * m_inflight;
+  }
+  return ewma * (m_inflight + 1);
+}
+
+float P2CLoadBalanceItem::getSlowStartRate(uint64_t now_ms) const {
+  uint64_t create_time = m_createTime;
+  if (!s_p2c_slow_start_ms || now_ms >= create_time + s_p2c_slow_start_ms) {
+    return 1;
+  }
+  // 至少保留 10% 的流量, 用来获得延迟样本
+  return std::max(0.1f, (float)(now_ms - create_time) / s_p2c_slow_start_ms);
+}
+
+std::string P2CLoadBalanceItem::toString() {
+  std::stringstream ss;
+  uint64_t now = sylar::GetCurrentMS();
+  ss << "[P2C ewma=" << getEwma() << "us inflight=" << m_inflight
+     << " ejected=" << isEjected(now)
+     << " slow_start=" << getSlowStartRate(now) << " "
+     << LoadBalanceItem::toString() << "]";
+  return ss.str();
+}
+
+void P2CLoadBalance::initNolock() {
+  auto items = std::make_shared<ItemList>();
+  for (auto& i : m_datas) {
+    if (i.second->isValid()) {
+      items->push_back(std::static_pointer_cast<P2CLoadBalanceItem>(i.second));
+    }
+  }
+  store(items);
+}
+
+void P2CLoadBalance::applyNolock(
+    const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+    const std::unordered_set<uint64_t>& dels) {
+  auto old = std::atomic_load(&m_items);
+  auto items = std::make_shared<ItemList>();
+  if (old) {
+    items->reserve(old->size() + adds.size());
+    for (auto& i : *old) {
+      if (dels.count(i->getId()) == 0) {
+        items->push_back(i);
+      }
+    }
+  }
+  for (auto& i : adds) {
+    if (i.second->isValid()) {
+      items->push_back(std::static_pointer_cast<P2CLoadBalanceItem>(i.second));
+    }
+  }
+  store(items);
+}
+
+void P2CLoadBalance::store(std::shared_ptr<ItemList> items) {
+  auto old = std::atomic_load(&m_items);
+  if (!old || old->empty()) {
+    // 没有已经预热的节点可以分担流量, 全部直接放量
+    for (auto& i : *items) {
+      i->skipSlowStart();
+    }
+  }
+  std::atomic_store(&m_items, std::shared_ptr<const ItemList>(items));
+}
+
+bool P2CLoadBalance::isAvailable(P2CLoadBalanceItem::ptr item,
+                                 uint64_t now_ms) {
+  if (!item->isValid() || item->isEjected(now_ms)) {
+    return false;
+  }
+  float rate = item->getSlowStartRate(now_ms);
+  return rate >= 1 || FastRand() % 1000 < rate * 1000;
+}
+
+LoadBalanceItem::ptr P2CLoadBalance::get(uint64_t v) {
+  auto items = std::atomic_load(&m_items);
+  if (!items || items->empty()) {
+    return nullptr;
+  }
+  size_t size = items->size();
+  uint64_t now = sylar::GetCurrentMS();
+  size_t a = (v == (uint64_t)-1 ? FastRand() : v) % size;
+  P2CLoadBalanceItem::ptr first = (*items)[a];
+  P2CLoadBalanceItem::ptr second;
+  if (size > 1) {
+    size_t b = FastRand() % (size - 1);
+    second = (*items)[b >= a ? b + 1 : b];
+  }
+  bool first_ok = isAvailable(first, now);
+  bool second_ok = second && isAvailable(second, now);
+  if (first_ok && second_ok) {
+    return first->getCost() <= second->getCost() ? first : second;
+  }
+  if (first_ok) {
+    return first;
+  }
+  if (second_ok) {
+    return second;
+  }
+
+  // 两个候选都不可用, 依次找没有被摘除的, 再找任意连接可用的
+  for (size_t i = 0; i < size; ++i) {
+    auto& h = (*items)[(a + i) % size];
+    if (h->isValid() && !h->isEjected(now)) {
+      return h;
+    }
+  }
+  for (size_t i = 0; i < size; ++i) {
+    auto& h = (*items)[(a + i) % size];
+    if (h->isValid()) {
+      return h;
+    }
+  }
+  return nullptr;
+}
+
+uint32_t HashLoadBalance::HashKey(uint64_t v) {
+  return sylar::murmur3_hash(&v, sizeof(v));
+}
+
+void HashLoadBalance::initNolock() {
+  std::vector<LoadBalanceItem::ptr> items;
+  decltype(m_members) members;
+  for (auto& i : m_datas) {
+    if (i.second->isValid() && i.second->getWeight() > 0) {
+      items.push_back(i.second);
+      members[i.first] = std::make_pair(i.second->getWeight(), i.second.get());
+    }
+  }
+  if (members == m_members && !items.empty()) {
+    return;
+  }
+  std::sort(items.begin(), items.end(),
+            [](const LoadBalanceItem::ptr& a, const LoadBalanceItem::ptr& b) {
+              return a->getId() < b->getId();
+            });
+
+  std::unordered_set<uint64_t> dels;
+  std::vector<LoadBalanceItem::ptr> adds;
+  for (auto& i : m_members) {
+    auto it = members.find(i.first);
+    if (it == members.end() || it->second != i.second) {
+      dels.insert(i.first);
+    }
+  }
+  for (auto& i : items) {
+    auto it = m_members.find(i->getId());
+    if (it == m_members.end() || it->second != members[i->getId()]) {
+      adds.push_back(i);
+    }
+  }
+  m_members.swap(members);
+  rebuild(items, dels, adds);
+}
+
+void ConsistentHashLoadBalance::rebuild(
+    const std::vector<LoadBalanceItem::ptr>& items,
+    const std::unordered_set<uint64_t>& dels,
+    const std::vector<LoadBalanceItem::ptr>& adds) {
+  std::unordered_map<uint64_t, uint32_t> idxs;
+  for (size_t i = 0; i < items.size(); ++i) {
+    idxs[items[i]->getId()] = i;
+  }
+
+  // 只计算新增节点的虚拟节点, (hash, 节点下标) 排序, 下标按 id 递增
+  std::vector<std::pair<uint32_t, uint32_t>> added;
+  for (auto& i : adds) {
+    uint64_t count = (uint64_t)s_hash_virtual_nodes * i->getWeight() / 10000;
+    count = std::max(count, (uint64_t)1);
+    uint32_t idx = idxs[i->getId()];
+    for (uint64_t n = 0; n < count; ++n) {
+      uint64_t buf[2] = {i->getId(), n};
+      added.emplace_back(sylar::murmur3_hash(buf, sizeof(buf)), idx);
+    }
+  }
+  std::sort(added.begin(), added.end());
+
+  // 和旧环中保留下来的虚拟节点归并
+  auto old = std::atomic_load(&m_ring);
+  auto ring = std::make_shared<Ring>();
+  ring->items = items;
+  size_t reserve = added.size() + (old ? old->hashs.size() : 0);
+  ring->hashs.reserve(reserve);
+  ring->idxs.reserve(reserve);
+  size_t pos = 0;
+  auto push = [&ring](const std::pair<uint32_t, uint32_t>& p) {
+    ring->hashs.push_back(p.first);
+    ring->idxs.push_back(p.second);
+  };
+  if (old) {
+    for (size_t i = 0; i < old->hashs.size(); ++i) {
+      uint64_t id = old->items[old->idxs[i]]->getId();
+      if (dels.count(id)) {
+        continue;
+      }
+      std::pair<uint32_t, uint32_t> p(old->hashs[i], idxs[id]);
+      while (pos < added.size() && added[pos] < p) {
+        push(added[pos++]);
+      }
+      push(p);
+    }
+  }
+  while (pos < added.size()) {
+    push(added[pos++]);
+  }
+  std::atomic_store(&m_ring, Ring::ptr(ring));
+}
+
+size_t ConsistentHashLoadBalance::getPointCount() {
+  auto ring = std::atomic_load(&m_ring);
+  return ring ? ring->hashs.size() : 0;
+}
+
+LoadBalanceItem::ptr ConsistentHashLoadBalance::get(uint64_t v) {
+  auto ring = std::atomic_load(&m_ring);
+  if (!ring || ring->hashs.empty()) {
+    return nullptr;
+  }
+  size_t size = ring->hashs.size();
+  uint32_t hash = HashKey(v == (uint64_t)-1 ? FastRand() : v);
+  size_t pos = std::lower_bound(ring->hashs.begin(), ring->hashs.end(), hash) -
+               ring->hashs.begin();
+  // 节点不可用时沿顺时针方向找下一个
+  for (size_t i = 0; i < size; ++i) {
+    auto& h = ring->items[ring->idxs[(pos + i) % size]];
+    if (h->isValid()) {
+      return h;
+    }
+  }
+  return nullptr;
+}
+
+static bool IsPrime(uint32_t v) {
+  if (v < 2) {
+    return false;
+  }
+  for (uint32_t i = 2; (uint64_t)i * i <= v; ++i) {
+    if (v % i == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void MaglevLoadBalance::rebuild(const std::vector<LoadBalanceItem::ptr>& items,
+                                const std::unordered_set<uint64_t>& dels,
+                                const std::vector<LoadBalanceItem::ptr>& adds) {
+  auto table = std::make_shared<Table>();
+  table->items = items;
+  size_t count = items.size();
+  if (count) {
+    uint32_t size = std::max(s_maglev_table_size, (uint32_t)3);
+    while (!IsPrime(size)) {
+      ++size;
+    }
+    std::vector<uint32_t> offsets(count);
+    std::vector<uint32_t> skips(count);
+    std::vector<uint32_t> nexts(count, 0);
+    std::vector<int64_t> credits(count, 0);
+    int64_t max_weight = 0;
+    for (size_t i = 0; i < count; ++i) {
+      uint64_t id = items[i]->getId();
+      offsets[i] = sylar::murmur3_hash(&id, sizeof(id), 0x9e3779b9) % size;
+      skips[i] =
+          sylar::murmur3_hash(&id, sizeof(id), 0x85ebca6b) % (size - 1) + 1;
+      max_weight = std::max(max_weight, (int64_t)items[i]->getWeight());
+    }
+
+    // 每一轮各节点累加自己的权重, 攒够最大权重时按排列占一个空槽
+    table->slots.assign(size, (uint32_t)-1);
+    uint32_t filled = 0;
+    while (filled < size) {
+      for (size_t i = 0; i < count && filled < size; ++i) {
+        credits[i] += items[i]->getWeight();
+        if (credits[i] < max_weight) {
+          continue;
+        }
+        credits[i] -= max_weight;
+        uint32_t slot = 0;
+        do {
+          slot = (offsets[i] + (uint64_t)nexts[i]++ * skips[i]) % size;
+        } while (table->slots[slot] != (uint32_t)-1);
+        table->slots[slot] = i;
+        ++filled;
+      }
+    }
+  }
+  std::atomic_store(&m_table, Table::ptr(table));
+}
+
+uint32_t MaglevLoadBalance::getTableSize() {
+  auto table = std::atomic_load(&m_table);
+  return table ? table->slots.size() : 0;
+}
+
+LoadBalanceItem::ptr MaglevLoadBalance::get(uint64_t v) {
+  auto table = std::atomic_load(&m_table);
+  if (!table || table->slots.empty()) {
+    return nullptr;
+  }
+  size_t size = table->slots.size();
+  size_t pos = HashKey(v == (uint64_t)-1 ? FastRand() : v) % size;
+  // 节点不可用时顺序查找下一个槽位, 相邻槽位通常属于不同节点
+  for (size_t i = 0; i < size; ++i) {
+    auto& h = table->items[table->slots[(pos + i) % size]];
+    if (h->isValid()) {
+      return h;
+    }
+  }
+  return nullptr;
+}
+
 // LoadBalanceItem::ptr FairLoadBalance::get() {
 //     RWMutexType::ReadLock lock(m_mutex);
 //     int32_t idx = getIdx();
@@ -392,6 +989,12 @@ LoadBalance::ptr SDLoadBalance::createLoadBalance(ILoadBalance::Type type) {
     return std::make_shared<WeightLoadBalance>();
   } else if (type == ILoadBalance::FAIR) {
     return std::make_shared<WeightLoadBalance>();
+  } else if (type == ILoadBalance::P2C) {
+    return std::make_shared<P2CLoadBalance>();
+  } else if (type == ILoadBalance::HASH) {
+    return std::make_shared<ConsistentHashLoadBalance>();
+  } else if (type == ILoadBalance::MAGLEV) {
+    return std::make_shared<MaglevLoadBalance>();
   }
   return nullptr;
 }
@@ -405,34 +1008,31 @@ LoadBalanceItem::ptr SDLoadBalance::createLoadBalanceItem(
     item = std::make_shared<LoadBalanceItem>();
   } else if (type == ILoadBalance::FAIR) {
     item = std::make_shared<FairLoadBalanceItem>();
+  } else if (type == ILoadBalance::P2C) {
+    item = std::make_shared<P2CLoadBalanceItem>();
+  } else if (type == ILoadBalance::HASH || type == ILoadBalance::MAGLEV) {
+    item = std::make_shared<LoadBalanceItem>();
   }
   return item;
 }
 
 void SDLoadBalance::onServiceChange(
     const std::string& domain, const std::string& service,
-    const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& old_value,
-    const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& new_value) {
-  // SYLAR_LOG_INFO(g_logger) << "onServiceChange domain=" << domain
-  //                          << " service=" << service;
+    const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& adds,
+    const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& dels) {
   auto type = getType(domain, service);
   auto lb = get(domain, service, true);
-  std::unordered_map<uint64_t, ServiceItemInfo::ptr> add_values;
   std::unordered_map<uint64_t, LoadBalanceItem::ptr> del_infos;
-
-  for (auto& i : old_value) {
-    if (new_value.find(i.first) == new_value.end()) {
-      del_infos[i.first];
-    }
-  }
-  for (auto& i : new_value) {
-    if (old_value.find(i.first) == old_value.end()) {
-      add_values.insert(i);
-    }
+  for (auto& i : dels) {
+    del_infos[i.first];
   }
 
   std::unordered_map<uint64_t, LoadBalanceItem::ptr> add_infos;
-  for (auto& i : add_values) {
+  for (auto& i : adds) {
+    if (lb->getById(i.first)) {
+      // 节点已经在负载均衡中, 复用原来的连接
+      continue;
+    }
     auto stream = m_cb(domain, service, i.second);
     if (!stream) {
       SYLAR_LOG_ERROR(g_logger)
@@ -515,6 +1115,12 @@ void SDLoadBalance::initConf(
         t = ILoadBalance::WEIGHT;
       } else if (n.second == "fair") {
         t = ILoadBalance::FAIR;
+      } else if (n.second == "p2c") {
+        t = ILoadBalance::P2C;
+      } else if (n.second == "hash") {
+        t = ILoadBalance::HASH;
+      } else if (n.second == "maglev") {
+        t = ILoadBalance::MAGLEV;
       }
       types[i.first][n.first] = t;
       query_infos[i.first].insert(n.first);
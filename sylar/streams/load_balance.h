@@ -1,6 +1,9 @@
 #ifndef __SYLAR_STREAMS_SOCKET_STREAM_POOL_H__
 #define __SYLAR_STREAMS_SOCKET_STREAM_POOL_H__
 
+#include <atomic>
+#include <map>
+#include <unordered_set>
 #include <unordered_map>
 #include <vector>
 #include "sylar/mutex.h"
@@ -15,6 +18,9 @@ class HolderStats {
   friend class HolderStatsSet;
 
  public:
+  // 延迟直方图的桶数: 8us 以内每 1us 一个桶, 之后每个 2 的幂区间 4 个桶
+  static const uint32_t LATENCY_BUCKETS = 124;
+
   uint32_t getUsedTime() const { return m_usedTime; }
   uint32_t getTotal() const { return m_total; }
   uint32_t getDoing() const { return m_doing; }
@@ -34,12 +40,29 @@ class HolderStats {
   uint32_t incErrs(uint32_t v) { return sylar::Atomic::addFetch(m_errs, v); }
 
   uint32_t decDoing(uint32_t v) { return sylar::Atomic::subFetch(m_doing, v); }
+
+  /**
+   * @brief 记录一次请求的延迟
+   * @param[in] used_us 耗时(微秒)
+   */
+  void addLatency(uint64_t used_us);
+
+  /**
+   * @brief 延迟的分位数(微秒), 相对误差在 12.5% 以内
+   * @param[in] p 分位, (0, 1]
+   * @return 没有样本时返回 0
+   */
+  uint32_t getPercentile(float p) const;
+
   void clear();
 
   float getWeight(float rate = 1.0f);
 
   std::string toString();
 
+ private:
+  void merge(const HolderStats& v);
+
  private:
   uint32_t m_usedTime = 0;
   uint32_t m_total = 0;
@@ -47,23 +70,47 @@ class HolderStats {
   uint32_t m_timeouts = 0;
   uint32_t m_oks = 0;
   uint32_t m_errs = 0;
+  uint32_t m_latency[LATENCY_BUCKETS] = {0};
 };
 
+/**
+ * @brief 最近 size 秒的滑动窗口统计
+ * @details 每个线程固定写入一个分片(load_balance.stats_shards 个, 默认为 CPU
+ *          核数), 分片内是按秒轮转的 HolderStats, 避免所有 IO 线程在同一组
+ *          计数器上竞争缓存行。
+ *          每秒的桶记录自己所属的秒, 第一次写入新的一秒时清空, 读取时合并所有
+ *          分片中仍在窗口内的桶
+ */
 class HolderStatsSet {
  public:
   HolderStatsSet(uint32_t size = 5);
-  HolderStats& get(const uint32_t& now = time(0));
 
-  float getWeight(const uint32_t& now = time(0));
+  /**
+   * @brief 当前线程所在分片中第 now 秒的统计, 用于累加
+   */
+  HolderStats& get(const uint32_t& now = GetCurrentCoarseMS() / 1000);
 
-  HolderStats getTotal();
+  float getWeight(const uint32_t& now = GetCurrentCoarseMS() / 1000);
 
- private:
-  void init(const uint32_t& now);
+  /**
+   * @brief 合并所有分片中 (now - size, now] 秒内的统计
+   */
+  HolderStats getTotal(const uint32_t& now = GetCurrentCoarseMS() / 1000);
+
+  /**
+   * @brief 合并所有分片中第 t 秒的统计
+   */
+  HolderStats getSecond(const uint32_t& t);
 
  private:
-  uint32_t m_lastUpdateTime = 0;  // seconds
-  std::vector<HolderStats> m_stats;
+  struct Bucket {
+    uint32_t time = 0;  // seconds
+    HolderStats stats;
+  };
+
+  uint32_t m_size;
+  // 每个分片单独分配, 不同线程的计数器不在同一个缓存行
+  std::vector<std::vector<Bucket>> m_shards;
 };
 
 class LoadBalanceItem {
@@ -77,7 +124,11 @@ class LoadBalanceItem {
   void setId(uint64_t v) { m_id = v; }
   uint64_t getId() const { return m_id; }
 
-  HolderStats& get(const uint32_t& now = time(0));
+  HolderStats& get(const uint32_t& now = GetCurrentCoarseMS() / 1000);
+  /**
+   * @brief 滑动窗口内合并后的统计
+   */
+  HolderStats getTotal(const uint32_t& now = GetCurrentCoarseMS() / 1000);
 
   template <class T>
   std::shared_ptr<T> getStreamAs() {
@@ -90,7 +141,15 @@ class LoadBalanceItem {
   virtual bool isValid();
   void close();
 
-  std::string toString();
+  /**
+   * @brief 请求开始和结束时由调用方通知, 用于按延迟和错误率调整流量
+   * @param[in] ok 是否收到应答, 超时和连接错误为 false
+   * @param[in] used_us 耗时(微秒)
+   */
+  virtual void onStart() {}
+  virtual void onFinish(bool ok, uint64_t used_us) {}
+
+  virtual std::string toString();
 
  protected:
   uint64_t m_id = 0;
@@ -101,7 +160,14 @@ class LoadBalanceItem {
 
 class ILoadBalance {
  public:
-  enum Type { ROUNDROBIN = 1, WEIGHT = 2, FAIR = 3 };
+  enum Type {
+    ROUNDROBIN = 1,
+    WEIGHT = 2,
+    FAIR = 3,
+    P2C = 4,
+    HASH = 5,
+    MAGLEV = 6
+  };
 
   enum Error {
     NO_SERVICE = -101,
@@ -121,6 +187,11 @@ class LoadBalance : public ILoadBalance {
   void set(const std::vector<LoadBalanceItem::ptr>& vs);
 
   LoadBalanceItem::ptr getById(uint64_t id);
+  /**
+   * @brief 增删节点, 只调整变化的部分, 没有变化时不重建
+   * @param[in] adds 新增的节点, id 已存在时替换
+   * @param[in,out] dels 删除的节点 id, 返回时填入被删除的节点
+   */
   void update(const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
               std::unordered_map<uint64_t, LoadBalanceItem::ptr>& dels);
   void init();
@@ -131,6 +202,16 @@ class LoadBalance : public ILoadBalance {
 
  protected:
   virtual void initNolock() = 0;
+  /**
+   * @brief 在当前选择用的节点列表上应用增删, 默认全量重建
+   * @param[in] adds 新增的节点
+   * @param[in] dels 删除的节点 id, 包括被替换的节点
+   */
+  virtual void applyNolock(
+      const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+      const std::unordered_set<uint64_t>& dels) {
+    initNolock();
+  }
 
  protected:
   RWMutexType m_mutex;
@@ -145,6 +226,9 @@ class RoundRobinLoadBalance : public LoadBalance {
 
  protected:
   virtual void initNolock() override;
+  virtual void applyNolock(
+      const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+      const std::unordered_set<uint64_t>& dels) override;
 
  protected:
   std::vector<LoadBalanceItem::ptr> m_items;
@@ -169,9 +253,13 @@ class WeightLoadBalance : public LoadBalance {
 
  protected:
   virtual void initNolock() override;
+  virtual void applyNolock(
+      const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+      const std::unordered_set<uint64_t>& dels) override;
 
  private:
   int32_t getIdx(uint64_t v = -1);
+  void initWeights();
 
  protected:
   std::vector<LoadBalanceItem::ptr> m_items;
@@ -180,6 +268,179 @@ class WeightLoadBalance : public LoadBalance {
   std::vector<int64_t> m_weights;
 };
 
+/**
+ * @brief P2C 负载均衡的节点
+ * @details 延迟使用 peak EWMA: 比当前值大的样本直接生效, 否则按时间衰减,
+ *          失败的请求按不低于当前值计入。最近窗口内的失败率过高时摘除一段
+ *          时间, 连续摘除时时间递增。新节点在 slow start 时间内按比例放量
+ */
+class P2CLoadBalanceItem : public LoadBalanceItem {
+ public:
+  typedef std::shared_ptr<P2CLoadBalanceItem> ptr;
+  typedef Spinlock MutexType;
+
+  P2CLoadBalanceItem();
+
+  virtual void onStart() override;
+  virtual void onFinish(bool ok, uint64_t used_us) override;
+  virtual std::string toString() override;
+
+  /**
+   * @brief 选择的代价: EWMA 延迟 * (在途请求数 + 1)
+   * @details 没有样本的节点只允许一个在途请求
+   */
+  double getCost();
+  uint32_t getInflight() const { return m_inflight; }
+  double getEwma();
+
+  bool isEjected(uint64_t now_ms) const { return m_ejectUntil > now_ms; }
+
+  /**
+   * @brief slow start 期间的放量比例, (0, 1]
+   */
+  float getSlowStartRate(uint64_t now_ms) const;
+  /**
+   * @brief 跳过 slow start, 用于负载均衡第一次加入的一批节点
+   */
+  void skipSlowStart() { m_createTime = 0; }
+
+ private:
+  void checkEject(uint64_t now_ms);
+
+ private:
+  MutexType m_mutex;
+  // 延迟的 EWMA(微秒), 0 表示还没有样本
+  double m_ewma = 0;
+  uint64_t m_ewmaTime = 0;
+  std::atomic<uint32_t> m_inflight = {0};
+  std::atomic<uint64_t> m_ejectUntil = {0};
+  uint32_t m_ejectCount = 0;
+  std::atomic<uint64_t> m_createTime;
+};
+
+/**
+ * @brief power of two choices: 随机选两个可用节点, 取代价较小的一个
+ * @details get 不加锁, 读取 initNolock 生成的节点快照。两个候选都不可用时
+ *          顺序查找第一个可用节点, 全部被摘除时忽略摘除
+ */
+class P2CLoadBalance : public LoadBalance {
+ public:
+  typedef std::shared_ptr<P2CLoadBalance> ptr;
+  typedef std::vector<P2CLoadBalanceItem::ptr> ItemList;
+
+  virtual LoadBalanceItem::ptr get(uint64_t v = -1) override;
+
+ protected:
+  virtual void initNolock() override;
+  virtual void applyNolock(
+      const std::unordered_map<uint64_t, LoadBalanceItem::ptr>& adds,
+      const std::unordered_set<uint64_t>& dels) override;
+
+ private:
+  bool isAvailable(P2CLoadBalanceItem::ptr item, uint64_t now_ms);
+  void store(std::shared_ptr<ItemList> items);
+
+ private:
+  // 通过 std::atomic_load/atomic_store 读写
+  std::shared_ptr<const ItemList> m_items;
+};
+
+/**
+ * @brief 按 key 选择节点的负载均衡基类
+ * @details get(v) 的 v 是请求的 key(比如用户 id), 经过 murmur3 打散后查表,
+ *          同一个 key 在节点集合不变时总是落到同一个节点; v 为 -1 时随机选择。
+ *          checkInit 会定期调用 initNolock, 只有可用节点或者权重变化时才重建,
+ *          get 读取重建后的只读快照, 不加锁
+ */
+class HashLoadBalance : public LoadBalance {
+ public:
+  typedef std::shared_ptr<HashLoadBalance> ptr;
+
+  static uint32_t HashKey(uint64_t v);
+
+ protected:
+  virtual void initNolock() override;
+
+  /**
+   * @brief 节点集合变化后重建查找表
+   * @param[in] items 当前可用且权重大于 0 的节点, 按 id 排序
+   * @param[in] dels 删除或者权重变化的节点 id
+   * @param[in] adds 新增或者权重变化的节点
+   */
+  virtual void rebuild(const std::vector<LoadBalanceItem::ptr>& items,
+                       const std::unordered_set<uint64_t>& dels,
+                       const std::vector<LoadBalanceItem::ptr>& adds) = 0;
+
+ private:
+  // 上次重建时的节点: id -> (权重, 节点)
+  std::map<uint64_t, std::pair<int32_t, LoadBalanceItem*>> m_members;
+};
+
+/**
+ * @brief ketama 一致性哈希环
+ * @details 每个节点按权重在环上放置虚拟节点, 权重 10000(SDLoadBalance 的默认
+ *          权重)对应 load_balance.hash.virtual_nodes 个。key 落到顺时针方向
+ *          第一个虚拟节点, 增删一个节点只影响它相邻区间的 key。重建时保留未变化
+ *          节点的虚拟节点, 只计算新增节点的哈希再归并
+ */
+class ConsistentHashLoadBalance : public HashLoadBalance {
+ public:
+  typedef std::shared_ptr<ConsistentHashLoadBalance> ptr;
+
+  virtual LoadBalanceItem::ptr get(uint64_t v = -1) override;
+
+  size_t getPointCount();
+
+ protected:
+  virtual void rebuild(const std::vector<LoadBalanceItem::ptr>& items,
+                       const std::unordered_set<uint64_t>& dels,
+                       const std::vector<LoadBalanceItem::ptr>& adds) override;
+
+ private:
+  struct Ring {
+    typedef std::shared_ptr<const Ring> ptr;
+    // 虚拟节点的哈希值, 升序
+    std::vector<uint32_t> hashs;
+    // 与 hashs 一一对应的节点下标
+    std::vector<uint32_t> idxs;
+    std::vector<LoadBalanceItem::ptr> items;
+  };
+
+  // 通过 std::atomic_load/atomic_store 读写
+  std::shared_ptr<const Ring> m_ring;
+};
+
+/**
+ * @brief Maglev 一致性哈希
+ * @details 每个节点根据 id 生成一个查找表的排列, 各节点按权重轮流填充大小为
+ *          素数 M(load_balance.maglev.table_size) 的表, 查找是一次取模。
+ *          节点变化时整表重建, 大部分槽位仍然分给原来的节点
+ */
+class MaglevLoadBalance : public HashLoadBalance {
+ public:
+  typedef std::shared_ptr<MaglevLoadBalance> ptr;
+
+  virtual LoadBalanceItem::ptr get(uint64_t v = -1) override;
+
+  uint32_t getTableSize();
+
+ protected:
+  virtual void rebuild(const std::vector<LoadBalanceItem::ptr>& items,
+                       const std::unordered_set<uint64_t>& dels,
+                       const std::vector<LoadBalanceItem::ptr>& adds) override;
+
+ private:
+  struct Table {
+    typedef std::shared_ptr<const Table> ptr;
+    // 每个槽位对应的节点下标
+    std::vector<uint32_t> slots;
+    std::vector<LoadBalanceItem::ptr> items;
+  };
+
+  // 通过 std::atomic_load/atomic_store 读写
+  std::shared_ptr<const Table> m_table;
+};
+
 // class FairLoadBalance : public LoadBalance {
 // public:
 //     typedef std::shared_ptr<FairLoadBalance> ptr;
@@ -230,8 +491,8 @@ class SDLoadBalance {
  private:
   void onServiceChange(
       const std::string& domain, const std::string& service,
-      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& old_value,
-      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& new_value);
+      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& adds,
+      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& dels);
 
   ILoadBalance::Type getType(const std::string& domain,
                              const std::string& service);
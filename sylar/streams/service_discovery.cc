@@ -16,6 +16,10 @@ static sylar::ConfigVar<uint32_t>::ptr g_service_discover_redis_ttl =
 static sylar::ConfigVar<uint32_t>::ptr g_service_discover_redis_check =
     sylar::Config::Lookup("service_discovery.redis.check_interval", (uint32_t)3,
                           "service discovery redis check interval");
+static sylar::ConfigVar<uint32_t>::ptr g_service_discover_batch =
+    sylar::Config::Lookup("service_discovery.batch_ms", (uint32_t)50,
+                          "service discovery merge changes within batch_ms "
+                          "before notify");
 
 static std::string MapToStr(const std::map<std::string, std::string>& m) {
   std::stringstream ss;
@@ -131,6 +135,109 @@ void IServiceDiscovery::listQueryServer(
   infos = m_queryInfos;
 }
 
+// 节点的 data 中包含权重等元数据, 内容变化也需要通知
+static bool SameInfo(const ServiceItemInfo::ptr& a,
+                     const ServiceItemInfo::ptr& b) {
+  return a->getData() == b->getData();
+}
+
+void IServiceDiscovery::updateServer(const std::string& domain,
+                                     const std::string& service,
+                                     ServiceItemMap& infos) {
+  sylar::RWMutex::WriteLock lock(m_mutex);
+  auto& old = m_datas[domain][service];
+  bool changed = old.size() != infos.size();
+  for (auto it = infos.begin(); !changed && it != infos.end(); ++it) {
+    auto oit = old.find(it->first);
+    changed = oit == old.end() || !SameInfo(oit->second, it->second);
+  }
+  old.swap(infos);
+  if (!changed) {
+    return;
+  }
+  m_dirtys[domain].insert(service);
+  // 第一次查询到的服务立即通知, 启动时不需要等待
+  auto it = m_notifieds.find(domain);
+  bool first = it == m_notifieds.end() || it->second.count(service) == 0;
+  if (m_flushPending && !first) {
+    return;
+  }
+  uint32_t batch = g_service_discover_batch->getValue();
+  sylar::IOManager* iom =
+      m_iomanager ? m_iomanager : sylar::IOManager::GetThis();
+  if (first || batch == 0 || !iom || m_self.expired()) {
+    lock.unlock();
+    flush();
+    return;
+  }
+  m_flushPending = true;
+  // 对象销毁后定时器不再回调, stop 和析构时通过 cancelFlush 取消
+  m_flushTimer = iom->addConditionTimer(
+      batch, std::bind(&IServiceDiscovery::flush, this), m_self);
+}
+
+void IServiceDiscovery::cancelFlush() {
+  sylar::RWMutex::WriteLock lock(m_mutex);
+  if (m_flushTimer) {
+    m_flushTimer->cancel();
+    m_flushTimer = nullptr;
+  }
+  m_flushPending = false;
+}
+
+void IServiceDiscovery::flush() {
+  struct Change {
+    std::string domain;
+    std::string service;
+    ServiceItemMap adds;
+    ServiceItemMap dels;
+  };
+  std::vector<Change> changes;
+
+  sylar::RWMutex::WriteLock lock(m_mutex);
+  m_flushPending = false;
+  m_flushTimer = nullptr;
+  decltype(m_dirtys) dirtys;
+  dirtys.swap(m_dirtys);
+  for (auto& i : dirtys) {
+    for (auto& n : i.second) {
+      auto& cur = m_datas[i.first][n];
+      auto& old = m_notifieds[i.first][n];
+      Change c;
+      for (auto& x : cur) {
+        auto it = old.find(x.first);
+        if (it == old.end() || !SameInfo(it->second, x.second)) {
+          c.adds.insert(x);
+        }
+      }
+      for (auto& x : old) {
+        if (cur.count(x.first) == 0) {
+          c.dels.insert(x);
+        }
+      }
+      old = cur;
+      if (c.adds.empty() && c.dels.empty()) {
+        continue;
+      }
+      c.domain = i.first;
+      c.service = n;
+      changes.push_back(std::move(c));
+    }
+  }
+  auto cb = m_cb;
+  lock.unlock();
+
+  if (!cb) {
+    return;
+  }
+  for (auto& i : changes) {
+    SYLAR_LOG_INFO(g_logger)
+        << "service change domain=" << i.domain << " service=" << i.service
+        << " adds=" << i.adds.size() << " dels=" << i.dels.size();
+    cb(i.domain, i.service, i.adds, i.dels);
+  }
+}
+
 std::string IServiceDiscovery::toString() {
   std::stringstream ss;
   sylar::RWMutex::ReadLock lock(m_mutex);
@@ -188,6 +295,8 @@ void ZKServiceDiscovery::start() {
     return;
   }
   auto self = shared_from_this();
+  m_self = self;
+  m_iomanager = sylar::IOManager::GetThis();
   m_client = std::make_shared<sylar::ZKClient>();
   bool b =
       m_client->init(m_hosts, 6000,
@@ -216,6 +325,7 @@ void ZKServiceDiscovery::stop() {
     m_timer->cancel();
     m_timer = nullptr;
   }
+  cancelFlush();
 }
 
 void ZKServiceDiscovery::onZKConnect(const std::string& path,
@@ -414,23 +524,15 @@ bool ZKServiceDiscovery::getChildren(const std::string& path) {
         << v << ")";
     return false;
   }
-  std::unordered_map<uint64_t, ServiceItemInfo::ptr> infos;
+  ServiceItemMap infos;
   for (auto& i : vals) {
     auto info = ServiceItemInfo::Create(i, "");
     if (!info) {
       continue;
     }
     infos[info->getId()] = info;
-    SYLAR_LOG_INFO(g_logger) << "domain=" << domain << " service=" << service
-                             << " info=" << info->toString();
   }
-
-  auto new_vals = infos;
-  sylar::RWMutex::WriteLock lock(m_mutex);
-  m_datas[domain][service].swap(infos);
-  lock.unlock();
-
-  m_cb(domain, service, infos, new_vals);
+  updateServer(domain, service, infos);
   return true;
 }
 
@@ -557,7 +659,7 @@ bool RedisServiceDiscovery::queryInfo() {
       services.erase("all");
     }
     for (auto& n : services) {
-      std::unordered_map<uint64_t, ServiceItemInfo::ptr> sinfos;
+      ServiceItemMap sinfos;
       auto rpy = sylar::RedisUtil::TryCmd(m_name, 5, "hgetall sylar:%s:%s",
                                           i.first.c_str(), n.c_str());
       if (!rpy) {
@@ -583,18 +685,15 @@ bool RedisServiceDiscovery::queryInfo() {
         sinfos[info->getId()] = info;
       }
 
-      auto new_vals = sinfos;
-      sylar::RWMutex::WriteLock lock(m_mutex);
-      m_datas[i.first][n].swap(sinfos);
-      lock.unlock();
-
-      m_cb(i.first, n, sinfos, new_vals);
+      updateServer(i.first, n, sinfos);
     }
   }
   return true;
 }
 
 void RedisServiceDiscovery::start() {
+  m_self = shared_from_this();
+  m_iomanager = sylar::IOManager::GetThis();
   queryInfo();
 
   if (!m_timer) {
@@ -624,6 +723,7 @@ void RedisServiceDiscovery::stop() {
     m_timer->cancel();
     m_timer = nullptr;
   }
+  cancelFlush();
 }
 
 }  // namespace sylar
@@ -43,15 +43,28 @@ class ServiceItemInfo {
   std::map<std::string, std::string> m_datas;
 };
 
+/**
+ * @brief 服务发现
+ * @details 子类查询到一个服务的全部节点后调用 updateServer, 变化的服务在
+ *          service_discovery.batch_ms 内合并, 窗口结束时和上次通知的节点比较,
+ *          只把新增、数据变化和删除的节点交给回调。窗口内下线又上线且数据
+ *          不变的节点不会通知
+ */
 class IServiceDiscovery {
  public:
   typedef std::shared_ptr<IServiceDiscovery> ptr;
+  typedef std::unordered_map<uint64_t, ServiceItemInfo::ptr> ServiceItemMap;
+  /**
+   * @brief 服务节点变化的回调
+   * @param[in] adds 新增或数据变化的节点
+   * @param[in] dels 删除的节点
+   */
   typedef std::function<void(
       const std::string& domain, const std::string& service,
-      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& old_value,
-      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& new_value)>
+      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& adds,
+      const std::unordered_map<uint64_t, ServiceItemInfo::ptr>& dels)>
       service_callback;
-  virtual ~IServiceDiscovery() {}
+  virtual ~IServiceDiscovery() { cancelFlush(); }
 
   virtual bool doRegister() = 0;
   virtual bool doQuery() = 0;
@@ -94,6 +107,24 @@ class IServiceDiscovery {
 
   std::string toString();
 
+  /**
+   * @brief 立即通知所有等待合并的变化
+   */
+  void flush();
+
+ protected:
+  /**
+   * @brief 用查询到的全部节点替换 m_datas 中的服务, 节点集合变化时等待通知
+   * @param[in] infos 查询到的节点, 调用后内容未定义
+   */
+  void updateServer(const std::string& domain, const std::string& service,
+                    ServiceItemMap& infos);
+
+  /**
+   * @brief 取消等待中的合并通知, stop 和析构时调用
+   */
+  void cancelFlush();
+
  protected:
   sylar::RWMutex m_mutex;
   // domain -> [service -> [id -> ServiceItemInfo] ]
@@ -112,6 +143,18 @@ class IServiceDiscovery {
   std::unordered_map<std::string, std::unordered_set<std::string>> m_queryInfos;
 
   service_callback m_cb;
+  // 最近一次通知给回调的节点, 结构同 m_datas
+  std::unordered_map<std::string,
+                     std::unordered_map<std::string, ServiceItemMap>>
+      m_notifieds;
+  // domain -> [service], 等待通知的服务
+  std::unordered_map<std::string, std::unordered_set<std::string>> m_dirtys;
+  bool m_flushPending = false;
+  sylar::Timer::ptr m_flushTimer;
+  // 用于合并通知的定时器, start 时设置
+  sylar::IOManager* m_iomanager = nullptr;
+  // 合并通知定时器的条件, 子类 start 时设置为自身
+  std::weak_ptr<IServiceDiscovery> m_self;
 
   std::string m_selfInfo;
   std::string m_selfData;
@@ -26,10 +26,20 @@ bool SocketStream::checkConnected() {
   return m_socket && m_socket->checkConnected();
 }
 
+void SocketStream::unread(const void* data, size_t length) {
+  m_unread.insert(0, (const char*)data, length);
+}
+
 int SocketStream::read(void* buffer, size_t length) {
   if (!isConnected()) {
     return -1;
   }
+  if (!m_unread.empty()) {
+    size_t n = std::min(length, m_unread.size());
+    memcpy(buffer, m_unread.c_str(), n);
+    m_unread.erase(0, n);
+    return n;
+  }
   return m_socket->recv(buffer, length);
 }
 
@@ -37,6 +47,12 @@ int SocketStream::read(ByteArray::ptr ba, size_t length) {
   if (!isConnected()) {
     return -1;
   }
+  if (!m_unread.empty()) {
+    size_t n = std::min(length, m_unread.size());
+    ba->write(m_unread.c_str(), n);
+    m_unread.erase(0, n);
+    return n;
+  }
   std::vector<iovec> iovs;
   ba->getWriteBuffers(iovs, length);
   int rt = m_socket->recv(&iovs[0], iovs.size());
@@ -53,6 +69,13 @@ int SocketStream::write(const void* buffer, size_t length) {
   return m_socket->send(buffer, length);
 }
 
+int SocketStream::writev(const iovec* buffers, size_t length) {
+  if (!isConnected()) {
+    return -1;
+  }
+  return m_socket->send(buffers, length);
+}
+
 int SocketStream::write(ByteArray::ptr ba, size_t length) {
   if (!isConnected()) {
     return -1;
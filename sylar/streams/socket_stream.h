@@ -18,6 +18,7 @@ class SocketStream : public Stream {
   virtual int read(ByteArray::ptr ba, size_t length) override;
   virtual int write(const void* buffer, size_t length) override;
   virtual int write(ByteArray::ptr ba, size_t length) override;
+  virtual int writev(const iovec* buffers, size_t length) override;
   virtual void close() override;
 
   Socket::ptr getSocket() const { return m_socket; }
@@ -31,8 +32,15 @@ class SocketStream : public Stream {
 
   uint64_t getId() const { return m_id; }
 
+  /**
+   * @brief 放回已经从 socket 读出的数据, 之后的 read 先返回这部分
+   * @details 用于探测协议后把读出的字节交给选定的协议栈, 需要在开始读之前调用
+   */
+  void unread(const void* data, size_t length);
+
  protected:
   Socket::ptr m_socket;
+  std::string m_unread;  // read 优先返回的数据
   uint64_t m_id : 63;
   bool m_owner : 1;
 };
@@ -55,9 +55,9 @@ int ZlibStream::write(const void* buffer, size_t length) {
   ivc.iov_base = (void*)buffer;
   ivc.iov_len = length;
   if (m_encode) {
-    return encode(&ivc, 1, false);
+    return encode(&ivc, 1, Z_NO_FLUSH);
   } else {
-    return decode(&ivc, 1, false);
+    return decode(&ivc, 1, Z_NO_FLUSH);
   }
 }
 
@@ -65,9 +65,9 @@ int ZlibStream::write(ByteArray::ptr ba, size_t length) {
   std::vector<iovec> buffers;
   ba->getReadBuffers(buffers, length);
   if (m_encode) {
-    return encode(&buffers[0], buffers.size(), false);
+    return encode(&buffers[0], buffers.size(), Z_NO_FLUSH);
   } else {
-    return decode(&buffers[0], buffers.size(), false);
+    return decode(&buffers[0], buffers.size(), Z_NO_FLUSH);
   }
 }
 
@@ -107,14 +107,14 @@ int ZlibStream::init(Type type, int level, int window_bits, int memlevel,
   }
 }
 
-int ZlibStream::encode(const iovec* v, const uint64_t& size, bool finish) {
+int ZlibStream::encode(const iovec* v, const uint64_t& size, int flush) {
   int ret = 0;
-  int flush = 0;
-  for (uint64_t i = 0; i < size; ++i) {
+  int cur_flush = Z_NO_FLUSH;
+  for (uint64_t i = 0; i < size && !m_streamEnd; ++i) {
     m_zstream.avail_in = v[i].iov_len;
     m_zstream.next_in = (Bytef*)v[i].iov_base;
 
-    flush = finish ? (i == size - 1 ? Z_FINISH : Z_NO_FLUSH) : Z_NO_FLUSH;
+    cur_flush = i == size - 1 ? flush : Z_NO_FLUSH;
 
     iovec* ivc = nullptr;
     do {
@@ -131,27 +131,27 @@ int ZlibStream::encode(const iovec* v, const uint64_t& size, bool finish) {
       m_zstream.avail_out = m_buffSize - ivc->iov_len;
       m_zstream.next_out = (Bytef*)ivc->iov_base + ivc->iov_len;
 
-      ret = deflate(&m_zstream, flush);
+      ret = deflate(&m_zstream, cur_flush);
       if (ret == Z_STREAM_ERROR) {
         return ret;
       }
       ivc->iov_len = m_buffSize - m_zstream.avail_out;
     } while (m_zstream.avail_out == 0);
   }
-  if (flush == Z_FINISH) {
+  if (cur_flush == Z_FINISH) {
     deflateEnd(&m_zstream);
   }
   return Z_OK;
 }
 
-int ZlibStream::decode(const iovec* v, const uint64_t& size, bool finish) {
+int ZlibStream::decode(const iovec* v, const uint64_t& size, int flush) {
   int ret = 0;
-  int flush = 0;
-  for (uint64_t i = 0; i < size; ++i) {
+  int cur_flush = Z_NO_FLUSH;
+  for (uint64_t i = 0; i < size && !m_streamEnd; ++i) {
     m_zstream.avail_in = v[i].iov_len;
     m_zstream.next_in = (Bytef*)v[i].iov_base;
 
-    flush = finish ? (i == size - 1 ? Z_FINISH : Z_NO_FLUSH) : Z_NO_FLUSH;
+    cur_flush = i == size - 1 ? flush : Z_NO_FLUSH;
 
     iovec* ivc = nullptr;
     do {
@@ -168,15 +168,25 @@ int ZlibStream::decode(const iovec* v, const uint64_t& size, bool finish) {
       m_zstream.avail_out = m_buffSize - ivc->iov_len;
       m_zstream.next_out = (Bytef*)ivc->iov_base + ivc->iov_len;
 
-      ret = inflate(&m_zstream, flush);
-      if (ret == Z_STREAM_ERROR) {
+      ret = inflate(&m_zstream, cur_flush);
+      if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR ||
+          ret == Z_NEED_DICT) {
         return ret;
       }
+      m_outputSize += m_buffSize - m_zstream.avail_out - ivc->iov_len;
       ivc->iov_len = m_buffSize - m_zstream.avail_out;
+      if (m_maxOutputSize && m_outputSize > m_maxOutputSize) {
+        return Z_BUF_ERROR;
+      }
+      if (ret == Z_STREAM_END) {
+        // 压缩流已结束, 之后的输入不再解压
+        m_streamEnd = true;
+        break;
+      }
     } while (m_zstream.avail_out == 0);
   }
 
-  if (flush == Z_FINISH) {
+  if (cur_flush == Z_FINISH) {
     inflateEnd(&m_zstream);
   }
   return Z_OK;
@@ -188,10 +198,55 @@ int ZlibStream::flush() {
   ivc.iov_len = 0;
 
   if (m_encode) {
-    return encode(&ivc, 1, true);
+    return encode(&ivc, 1, Z_FINISH);
+  } else {
+    return decode(&ivc, 1, Z_FINISH);
+  }
+}
+
+int ZlibStream::syncFlush() {
+  iovec ivc;
+  ivc.iov_base = nullptr;
+  ivc.iov_len = 0;
+
+  if (m_encode) {
+    return encode(&ivc, 1, Z_SYNC_FLUSH);
   } else {
-    return decode(&ivc, 1, true);
+    return decode(&ivc, 1, Z_SYNC_FLUSH);
+  }
+}
+
+int ZlibStream::reset(bool keep_window) {
+  if (m_encode) {
+    return deflateReset(&m_zstream);
+  }
+  m_streamEnd = false;
+  if (!keep_window) {
+    return inflateReset(&m_zstream);
+  }
+  // 原始 deflate 流不校验字典, 把旧窗口作为字典设置给新的流
+  // 协程栈较小, 窗口放在堆上
+  std::vector<Bytef> dict(32768);
+  uInt len = dict.size();
+  int rt = inflateGetDictionary(&m_zstream, &dict[0], &len);
+  if (rt != Z_OK) {
+    return rt;
+  }
+  rt = inflateReset(&m_zstream);
+  if (rt != Z_OK || len == 0) {
+    return rt;
+  }
+  return inflateSetDictionary(&m_zstream, &dict[0], len);
+}
+
+void ZlibStream::clearBuffers() {
+  if (m_free) {
+    for (auto& i : m_buffs) {
+      free(i.iov_base);
+    }
   }
+  m_buffs.clear();
+  m_outputSize = 0;
 }
 
 std::string ZlibStream::getResult() const {
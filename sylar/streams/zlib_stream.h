@@ -52,9 +52,40 @@ class ZlibStream : public Stream {
 
   int flush();
 
+  /**
+   * @brief Z_SYNC_FLUSH, 输出已写入的全部数据但不结束压缩流
+   * @details 输出以 00 00 ff ff 结尾, 之后可以继续 write
+   */
+  int syncFlush();
+
+  /**
+   * @brief 重置压缩/解压状态(清空滑动窗口), 不释放输出
+   * @param[in] keep_window 解压时保留滑动窗口, 用于接着解压下一个原始
+   *                        deflate 流
+   */
+  int reset(bool keep_window = false);
+
+  /**
+   * @brief 解压时是否已读到压缩流的结尾(Z_STREAM_END), reset 后清除
+   */
+  bool isStreamEnd() const { return m_streamEnd; }
+
+  /**
+   * @brief 释放已输出的数据
+   */
+  void clearBuffers();
+
   bool isFree() const { return m_free; }
   void setFree(bool v) { m_free = v; }
 
+  /**
+   * @brief 解压输出的上限, 0 表示不限制
+   * @details 未 clearBuffers 的输出超过上限时立即停止解压,
+   *          write/flush 返回 Z_BUF_ERROR, 最多多分配一块 buff_size
+   */
+  size_t getMaxOutputSize() const { return m_maxOutputSize; }
+  void setMaxOutputSize(size_t v) { m_maxOutputSize = v; }
+
   bool isEncode() const { return m_encode; }
   void setEndcode(bool v) { m_encode = v; }
 
@@ -66,8 +97,12 @@ class ZlibStream : public Stream {
   int init(Type type = DEFLATE, int level = DEFAULT_COMPRESSION,
            int window_bits = 15, int memlevel = 8, Strategy strategy = DEFAULT);
 
-  int encode(const iovec* v, const uint64_t& size, bool finish);
-  int decode(const iovec* v, const uint64_t& size, bool finish);
+  /**
+   * @param[in] flush 最后一块数据使用的 flush 方式(Z_NO_FLUSH, Z_SYNC_FLUSH,
+   *                  Z_FINISH)
+   */
+  int encode(const iovec* v, const uint64_t& size, int flush);
+  int decode(const iovec* v, const uint64_t& size, int flush);
 
  private:
   z_stream m_zstream;
@@ -75,6 +110,10 @@ class ZlibStream : public Stream {
   bool m_encode;
   bool m_free;
   std::vector<iovec> m_buffs;
+  size_t m_maxOutputSize = 0;
+  // m_buffs 中已输出的字节数
+  size_t m_outputSize = 0;
+  bool m_streamEnd = false;
 };
 
 }  // namespace sylar
@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "fiber.h"
@@ -86,6 +87,12 @@ uint64_t GetCurrentUS() {
   return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+uint64_t GetCurrentCoarseMS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
 std::string Time2Str(time_t ts, const std::string& format) {
   struct tm tm;
   localtime_r(&ts, &tm);
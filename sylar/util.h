@@ -36,6 +36,9 @@ std::string BacktraceToString(int size = 64, int skip = 2,
 // 时间ms
 uint64_t GetCurrentMS();
 uint64_t GetCurrentUS();
+// 粗粒度的时间ms, 读取内核缓存的时钟, 精度为一个 tick(1~4ms), 开销比
+// GetCurrentMS 小, 用于按秒统计之类不需要精确时间的场景
+uint64_t GetCurrentCoarseMS();
 
 std::string ToUpper(const std::string& name);
 std::string ToLower(const std::string& name);
@@ -0,0 +1,88 @@
+#include "sylar/http/async_http_connection.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::string s_url = "http://127.0.0.1:8020/";
+static int s_count = 50;
+
+sylar::http::HttpRequest::ptr make_request() {
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setPath("/");
+  return req;
+}
+
+void run() {
+  auto conn = sylar::http::AsyncHttpConnection::Create(s_url, false);
+  if (!conn) {
+    SYLAR_LOG_ERROR(g_logger) << "create connection fail, url=" << s_url;
+    return;
+  }
+
+  // 单个请求, 挂起当前协程等待
+  auto rt = conn->request(make_request(), 1000);
+  SYLAR_LOG_INFO(g_logger) << "request: " << rt->result << " " << rt->error
+                           << " status="
+                           << (rt->response ? (int)rt->response->getStatus()
+                                            : 0);
+
+  // 同一连接上流水线发送
+  std::vector<sylar::http::HttpRequest::ptr> reqs;
+  for (int i = 0; i < s_count; ++i) {
+    reqs.push_back(make_request());
+  }
+  uint64_t ts = sylar::GetCurrentMS();
+  auto rts = conn->requestAll(reqs, 3000);
+  int ok = 0;
+  for (auto& i : rts) {
+    ok += i->result == 0;
+  }
+  SYLAR_LOG_INFO(g_logger) << "pipelined " << s_count << " requests ok=" << ok
+                           << " used=" << (sylar::GetCurrentMS() - ts) << "ms";
+
+  // 扇出到多个连接, 一次等待
+  std::vector<sylar::http::AsyncHttpConnection::ptr> conns;
+  for (int i = 0; i < 4; ++i) {
+    auto c = sylar::http::AsyncHttpConnection::Create(s_url, false);
+    if (c) {
+      conns.push_back(c);
+    }
+  }
+  if (conns.empty()) {
+    return;
+  }
+  std::vector<std::pair<sylar::http::AsyncHttpConnection::ptr,
+                        sylar::http::HttpRequest::ptr>>
+      items;
+  for (int i = 0; i < s_count; ++i) {
+    items.push_back(std::make_pair(conns[i % conns.size()], make_request()));
+  }
+  ts = sylar::GetCurrentMS();
+  rts = sylar::http::AsyncHttpConnection::DoRequestAll(items, 3000);
+  ok = 0;
+  for (auto& i : rts) {
+    ok += i->result == 0;
+  }
+  SYLAR_LOG_INFO(g_logger) << "fan out " << s_count << " requests to "
+                           << conns.size() << " connections ok=" << ok
+                           << " used=" << (sylar::GetCurrentMS() - ts) << "ms";
+
+  // 异步回调
+  conn->request(make_request(), 1000, [](sylar::http::HttpResult::ptr r) {
+    SYLAR_LOG_INFO(g_logger) << "callback: " << r->result << " " << r->error;
+  });
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_url = argv[1];
+  }
+  if (argc > 2) {
+    s_count = atoi(argv[2]);
+  }
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "sylar/http/servlets/cache_servlet.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_calls = {0};
+
+sylar::http::HttpResponse::ptr do_request(
+    sylar::http::Servlet::ptr slt, const std::string& path,
+    const std::map<std::string, std::string>& headers = {}) {
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+  req->setPath(path);
+  for (auto& i : headers) {
+    req->setHeader(i.first, i.second);
+  }
+  slt->handle(req, rsp, nullptr);
+  return rsp;
+}
+
+void run() {
+  sylar::http::FunctionServlet::ptr slt(new sylar::http::FunctionServlet(
+      [](sylar::http::HttpRequest::ptr req,
+         sylar::http::HttpResponse::ptr rsp,
+         sylar::http::HttpSession::ptr session) {
+        ++s_calls;
+        // 模拟较慢的处理
+        usleep(100 * 1000);
+        rsp->setHeader("Content-Type", "text/plain");
+        if (req->getPath() == "/private") {
+          rsp->setHeader("Cache-Control", "private");
+        }
+        rsp->setBody("hello " + req->getPath());
+        return 0;
+      }));
+  sylar::http::CacheServlet::ptr cache(
+      new sylar::http::CacheServlet(slt, {"Accept-Language"}));
+
+  // 并发未命中合并为一次调用
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  for (int i = 0; i < 10; ++i) {
+    iom->schedule([cache, &sem]() {
+      do_request(cache, "/index");
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < 10; ++i) {
+    sem.wait();
+  }
+  SYLAR_LOG_INFO(g_logger) << "10 concurrent requests, servlet calls="
+                           << s_calls;
+
+  auto rsp = do_request(cache, "/index");
+  std::string etag = rsp->getHeader("ETag");
+  SYLAR_LOG_INFO(g_logger) << "x-cache=" << rsp->getHeader("X-Cache")
+                           << " etag=" << etag << " calls=" << s_calls;
+
+  rsp = do_request(cache, "/index", {{"If-None-Match", etag}});
+  SYLAR_LOG_INFO(g_logger) << "If-None-Match status=" << (int)rsp->getStatus()
+                           << " body_size=" << rsp->getBody().size();
+
+  rsp = do_request(cache, "/index", {{"Accept-Language", "en"}});
+  SYLAR_LOG_INFO(g_logger) << "vary header x-cache="
+                           << rsp->getHeader("X-Cache");
+
+  rsp = do_request(cache, "/index", {{"Cache-Control", "no-cache"}});
+  SYLAR_LOG_INFO(g_logger) << "no-cache x-cache=" << rsp->getHeader("X-Cache");
+
+  do_request(cache, "/private");
+  rsp = do_request(cache, "/private");
+  SYLAR_LOG_INFO(g_logger) << "private x-cache=" << rsp->getHeader("X-Cache");
+
+  cache->clear();
+  rsp = do_request(cache, "/index");
+  SYLAR_LOG_INFO(g_logger) << "after clear x-cache="
+                           << rsp->getHeader("X-Cache");
+  SYLAR_LOG_INFO(g_logger) << sylar::http::CacheServlet::ToStatusString();
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,229 @@
+#include "sylar/config.h"
+#include "sylar/dns.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/socket.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 本地的 TCP 服务, 连接保持打开, 收到 http 请求时延迟 delay_ms 后返回 200
+class StubServer {
+ public:
+  typedef std::shared_ptr<StubServer> ptr;
+
+  StubServer(uint32_t delay_ms = 0) : m_delay(delay_ms) {}
+
+  bool start(sylar::Address::ptr addr = nullptr) {
+    m_sock = sylar::Socket::CreateTCPSocket();
+    if (!addr) {
+      addr = sylar::IPAddress::Create("127.0.0.1", 0);
+    }
+    if (!m_sock->bind(addr) || !m_sock->listen()) {
+      return false;
+    }
+    m_addr = m_sock->getLocalAddress();
+    sylar::IOManager::GetThis()->schedule(
+        std::bind(&StubServer::acceptLoop, this));
+    return true;
+  }
+
+  void stop() {
+    m_sock->close();
+    for (auto& i : m_clients) {
+      i->close();
+    }
+    m_clients.clear();
+    // 等待被取消的协程退出, 避免 fd 立即被复用
+    usleep(10 * 1000);
+  }
+
+  sylar::Address::ptr getAddress() const { return m_addr; }
+
+ private:
+  void acceptLoop() {
+    while (true) {
+      auto client = m_sock->accept();
+      if (!client) {
+        break;
+      }
+      m_clients.push_back(client);
+      sylar::IOManager::GetThis()->schedule(
+          std::bind(&StubServer::handle, this, client));
+    }
+  }
+
+  void handle(sylar::Socket::ptr client) {
+    char buf[4096];
+    while (client->recv(buf, sizeof(buf)) > 0) {
+      usleep(m_delay * 1000);
+      const char* rsp = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+      client->send(rsp, strlen(rsp));
+    }
+  }
+
+ private:
+  uint32_t m_delay;
+  sylar::Socket::ptr m_sock;
+  sylar::Address::ptr m_addr;
+  std::vector<sylar::Socket::ptr> m_clients;
+};
+
+template <class T>
+void set_config(const std::string& name, const T& v) {
+  sylar::Config::Lookup<T>(name)->setValue(v);
+}
+
+// 借出次数多时连接池扩大, 空闲后逐步缩小并淘汰空闲超时的连接
+void test_pool() {
+  StubServer::ptr server = std::make_shared<StubServer>();
+  SYLAR_ASSERT(server->start());
+  set_config<uint32_t>("dns.pool.idle_timeout", 50);
+
+  auto dns = std::make_shared<sylar::Dns>("pool", sylar::Dns::TYPE_ADDRESS, 1);
+  dns->set({server->getAddress()->toString()});
+  auto item = dns->getItems()[0];
+  SYLAR_ASSERT(item->isValid() && item->getIdleSize() == 1);
+
+  std::vector<sylar::Socket::ptr> socks;
+  for (int i = 0; i < 5; ++i) {
+    socks.push_back(dns->getSock());
+    SYLAR_ASSERT(socks.back());
+  }
+  SYLAR_ASSERT(item->hit == 1 && item->miss == 4 && item->inflight == 5);
+  usleep(20 * 1000);
+  socks.clear();
+  SYLAR_ASSERT(item->getIdleSize() == 5 && item->inflight == 0);
+
+  dns->refresh();
+  SYLAR_ASSERT(item->target_size == 5 && item->getIdleSize() == 5);
+  SYLAR_LOG_INFO(g_logger) << "grow: " << item->toString();
+
+  usleep(100 * 1000);
+  for (int i = 0; i < 6; ++i) {
+    dns->refresh();
+    usleep(10 * 1000);
+  }
+  SYLAR_ASSERT(item->target_size == 1 && item->getIdleSize() == 1);
+  SYLAR_ASSERT(item->evict == 4);
+  SYLAR_ASSERT(dns->getSock() && item->hit == 2);
+  SYLAR_LOG_INFO(g_logger) << "shrink: " << item->toString();
+
+  set_config<uint32_t>("dns.pool.idle_timeout", 60000);
+  server->stop();
+  SYLAR_LOG_INFO(g_logger) << "test_pool ok";
+}
+
+// 连不上的地址按指数退避探测, 恢复后重新可用
+void test_backoff() {
+  StubServer::ptr server = std::make_shared<StubServer>();
+  SYLAR_ASSERT(server->start());
+  sylar::Address::ptr dead;
+  {
+    auto sock = sylar::Socket::CreateTCPSocket();
+    SYLAR_ASSERT(sock->bind(sylar::IPAddress::Create("127.0.0.1", 0)));
+    dead = sock->getLocalAddress();
+  }
+  usleep(10 * 1000);
+  set_config<uint32_t>("dns.check.backoff_base", 100);
+  set_config<uint32_t>("dns.check.backoff_max", 400);
+
+  auto dns = std::make_shared<sylar::Dns>("backoff", sylar::Dns::TYPE_ADDRESS);
+  dns->set({server->getAddress()->toString(), dead->toString()});
+  auto items = dns->getItems();
+  auto dead_item = items[0]->addr->toString() == dead->toString() ? items[0]
+                                                                   : items[1];
+  // 不断言探测次数, 只检查每次失败后的退避: 100/200/400ms 乘以
+  // [0.5, 1.5), 且下次探测时间单调递增
+  uint32_t fail_count = dead_item->fail_count;
+  uint64_t next_probe = dead_item->next_probe;
+  SYLAR_ASSERT(fail_count >= 1);
+  uint64_t ts = sylar::GetCurrentMS();
+  int refreshs = 0;
+  while (sylar::GetCurrentMS() - ts < 1000) {
+    uint64_t before = sylar::GetCurrentMS();
+    dns->refresh();
+    uint64_t after = sylar::GetCurrentMS();
+    ++refreshs;
+    SYLAR_ASSERT(dns->get()->toString() == server->getAddress()->toString());
+    if (dead_item->fail_count != fail_count) {
+      SYLAR_ASSERT(dead_item->fail_count == fail_count + 1);
+      SYLAR_ASSERT(dead_item->next_probe > next_probe);
+      fail_count = dead_item->fail_count;
+      next_probe = dead_item->next_probe;
+      uint64_t wait = std::min<uint64_t>(100ull << (fail_count - 1), 400);
+      // backoff 时的 now 在 [before, after] 之间
+      SYLAR_ASSERT(next_probe >= before + wait / 2);
+      SYLAR_ASSERT(next_probe < after + wait / 2 + wait);
+    }
+    usleep(10 * 1000);
+  }
+  SYLAR_LOG_INFO(g_logger) << "refreshs=" << refreshs << " "
+                           << dead_item->toString();
+  SYLAR_ASSERT(!dead_item->isValid());
+  SYLAR_ASSERT(dead_item->fail_count == dead_item->probe);
+
+  StubServer::ptr revived = std::make_shared<StubServer>();
+  SYLAR_ASSERT(revived->start(dead));
+  ts = sylar::GetCurrentMS();
+  while (!dead_item->isValid() && sylar::GetCurrentMS() - ts < 1000) {
+    dns->refresh();
+    usleep(10 * 1000);
+  }
+  SYLAR_ASSERT(dead_item->isValid() && dead_item->fail_count == 0);
+  SYLAR_LOG_INFO(g_logger) << "revived after " << sylar::GetCurrentMS() - ts
+                           << "ms";
+
+  set_config<uint32_t>("dns.check.backoff_base", 1000);
+  set_config<uint32_t>("dns.check.backoff_max", 30000);
+  server->stop();
+  revived->stop();
+  SYLAR_LOG_INFO(g_logger) << "test_backoff ok";
+}
+
+// 所有地址并发探测, 总耗时接近单个地址的耗时
+void test_parallel() {
+  const int count = 4;
+  const uint32_t delay = 100;
+  std::vector<StubServer::ptr> servers;
+  std::set<std::string> addrs;
+  for (int i = 0; i < count; ++i) {
+    servers.push_back(std::make_shared<StubServer>(delay));
+    SYLAR_ASSERT(servers.back()->start());
+    addrs.insert(servers.back()->getAddress()->toString());
+  }
+  set_config<uint32_t>("dns.check.timeout", 1000);
+
+  auto dns =
+      std::make_shared<sylar::Dns>("parallel", sylar::Dns::TYPE_ADDRESS);
+  dns->setCheckPath("/health");
+  uint64_t ts = sylar::GetCurrentMS();
+  dns->set(addrs);
+  uint64_t used = sylar::GetCurrentMS() - ts;
+  SYLAR_LOG_INFO(g_logger) << "probe " << count << " addrs used " << used
+                           << "ms " << dns->toString();
+  for (auto& i : dns->getItems()) {
+    SYLAR_ASSERT(i->isValid());
+  }
+  SYLAR_ASSERT(used >= delay && used < delay * 2);
+
+  set_config<uint32_t>("dns.check.timeout", 50);
+  for (auto& i : servers) {
+    i->stop();
+  }
+  SYLAR_LOG_INFO(g_logger) << "test_parallel ok";
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+  test_pool();
+  test_backoff();
+  test_parallel();
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(1);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,442 @@
+#include <fstream>
+#include <map>
+#include "sylar/config.h"
+#include "sylar/dns_resolver.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/socket.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+sylar::DnsSrv make_srv(uint16_t priority, uint16_t weight, uint16_t port,
+                       const std::string& target) {
+  sylar::DnsSrv srv;
+  srv.priority = priority;
+  srv.weight = weight;
+  srv.port = port;
+  srv.target = target;
+  return srv;
+}
+
+// 本地的 DNS 服务, UDP 和 TCP 使用同一个端口, 按名字返回固定的应答
+class StubDnsServer {
+ public:
+  typedef std::shared_ptr<StubDnsServer> ptr;
+
+  bool start() {
+    m_udp = sylar::Socket::CreateUDPSocket();
+    if (!m_udp->bind(sylar::IPAddress::Create("127.0.0.1", 0))) {
+      return false;
+    }
+    m_addr = m_udp->getLocalAddress();
+    m_tcp = sylar::Socket::CreateTCPSocket();
+    if (!m_tcp->bind(m_addr) || !m_tcp->listen()) {
+      return false;
+    }
+    auto iom = sylar::IOManager::GetThis();
+    iom->schedule(std::bind(&StubDnsServer::udpLoop, this));
+    iom->schedule(std::bind(&StubDnsServer::tcpLoop, this));
+    return true;
+  }
+
+  void stop() {
+    m_udp->close();
+    m_tcp->close();
+  }
+
+  sylar::Address::ptr getAddress() const { return m_addr; }
+  int getCount(const std::string& name) { return m_counts[name]; }
+
+ private:
+  static sylar::Address::ptr Ip(const char* ip) {
+    return sylar::IPAddress::Create(ip, 0);
+  }
+
+  void answer(const sylar::DnsMessage& req, sylar::DnsMessage& rsp,
+              bool tcp) {
+    rsp.id = req.id;
+    rsp.flags = sylar::DnsMessage::QR | sylar::DnsMessage::RA;
+    rsp.qname = req.qname;
+    rsp.qtype = req.qtype;
+    auto add = [&rsp, &req](sylar::DnsRecord r) {
+      if (r.type == req.qtype) {
+        rsp.answers.push_back(r);
+      }
+    };
+    const std::string& n = req.qname;
+    if (n == "a.test") {
+      add(sylar::DnsRecord::CreateAddress(n, 1, Ip("10.0.0.1")));
+      add(sylar::DnsRecord::CreateAddress(n, 5, Ip("10.0.0.2")));
+    } else if (n == "slow.test") {
+      add(sylar::DnsRecord::CreateAddress(n, 60, Ip("10.0.0.3")));
+    } else if (n == "v6.test") {
+      add(sylar::DnsRecord::CreateAddress(n, 60, Ip("::1")));
+    } else if (n == "_rock._tcp.test") {
+      add(sylar::DnsRecord::CreateSrv(n, 60, make_srv(20, 10, 8082, "b.test")));
+      add(sylar::DnsRecord::CreateSrv(n, 60, make_srv(10, 40, 8081, "a.test")));
+      add(sylar::DnsRecord::CreateSrv(n, 60, make_srv(10, 60, 8080, "a.test")));
+    } else if (n == "big.test") {
+      if (!tcp) {
+        rsp.flags |= sylar::DnsMessage::TC;
+      } else {
+        for (int i = 0; i < 100; ++i) {
+          std::string ip = "10.1.0." + std::to_string(i);
+          add(sylar::DnsRecord::CreateAddress(n, 60, Ip(ip.c_str())));
+        }
+      }
+    } else if (n == "fail.test") {
+      rsp.setRcode(sylar::DnsMessage::SERVFAIL);
+    } else {
+      rsp.setRcode(sylar::DnsMessage::NXDOMAIN);
+    }
+    if (rsp.answers.empty() && !rsp.getRcode()) {
+      // NODATA
+      rsp.authorities.push_back(sylar::DnsRecord::CreateSoa("test", 60, 60));
+    } else if (rsp.getRcode() == sylar::DnsMessage::NXDOMAIN) {
+      rsp.authorities.push_back(sylar::DnsRecord::CreateSoa("test", 60, 1));
+    }
+  }
+
+  void udpLoop() {
+    std::string buf(65536, '\0');
+    while (true) {
+      sylar::Address::ptr from = std::make_shared<sylar::IPv4Address>();
+      int rt = m_udp->recvFrom(&buf[0], buf.size(), from);
+      if (rt <= 0) {
+        break;
+      }
+      sylar::DnsMessage req;
+      SYLAR_ASSERT(req.decode(buf.c_str(), rt));
+      ++m_counts[req.qname];
+      if (req.qname == "drop.test") {
+        continue;
+      }
+      auto rsp = std::make_shared<sylar::DnsMessage>();
+      answer(req, *rsp, false);
+      // 先回一个 id 不匹配的应答, 客户端应当忽略
+      auto bad = *rsp;
+      ++bad.id;
+      std::string data = bad.encode();
+      m_udp->sendTo(data.c_str(), data.size(), from);
+      auto udp = m_udp;
+      int delay = req.qname == "slow.test" ? 50 : 0;
+      sylar::IOManager::GetThis()->schedule([udp, rsp, from, delay]() {
+        if (delay) {
+          usleep(delay * 1000);
+        }
+        std::string data = rsp->encode();
+        udp->sendTo(data.c_str(), data.size(), from);
+      });
+    }
+  }
+
+  void tcpLoop() {
+    while (true) {
+      auto client = m_tcp->accept();
+      if (!client) {
+        break;
+      }
+      uint8_t len[2];
+      SYLAR_ASSERT(client->recv(len, 2) == 2);
+      std::string buf((len[0] << 8) | len[1], '\0');
+      SYLAR_ASSERT(client->recv(&buf[0], buf.size()) == (int)buf.size());
+      sylar::DnsMessage req;
+      SYLAR_ASSERT(req.decode(buf.c_str(), buf.size()));
+      ++m_counts["tcp:" + req.qname];
+      sylar::DnsMessage rsp;
+      answer(req, rsp, true);
+      std::string data = rsp.encode();
+      std::string out;
+      out.push_back(data.size() >> 8);
+      out.push_back(data.size() & 0xff);
+      out += data;
+      client->send(out.c_str(), out.size());
+      client->close();
+    }
+  }
+
+ private:
+  sylar::Socket::ptr m_udp;
+  sylar::Socket::ptr m_tcp;
+  sylar::Address::ptr m_addr;
+  std::map<std::string, int> m_counts;
+};
+
+static StubDnsServer::ptr s_server;
+
+void write_file(const std::string& path, const std::string& data) {
+  std::ofstream ofs(path);
+  ofs << data;
+}
+
+std::set<std::string> to_set(const std::vector<sylar::Address::ptr>& addrs) {
+  std::set<std::string> rt;
+  for (auto& i : addrs) {
+    rt.insert(i->toString());
+  }
+  return rt;
+}
+
+sylar::DnsResolver::ptr make_resolver() {
+  auto resolver = std::make_shared<sylar::DnsResolver>();
+  resolver->setServers({s_server->getAddress()});
+  resolver->setTimeout(100);
+  resolver->setAttempts(2);
+  // 不受本机 resolv.conf 的 search 影响
+  resolver->setSearch({});
+  return resolver;
+}
+
+void test_codec() {
+  sylar::DnsMessage msg;
+  msg.id = 1234;
+  msg.flags = sylar::DnsMessage::QR | sylar::DnsMessage::NXDOMAIN;
+  msg.qname = "Www.Example.COM.";
+  msg.qtype = sylar::DnsRecord::SRV;
+  msg.answers.push_back(
+      sylar::DnsRecord::CreateSrv("x.example.com", 30,
+                                  make_srv(1, 2, 3, "t.com")));
+  msg.authorities.push_back(
+      sylar::DnsRecord::CreateSoa("example.com", 60, 10));
+  std::string data = msg.encode();
+
+  sylar::DnsMessage out;
+  SYLAR_ASSERT(out.decode(data.c_str(), data.size()));
+  SYLAR_ASSERT(out.id == 1234 && out.getRcode() == sylar::DnsMessage::NXDOMAIN);
+  SYLAR_ASSERT(out.isResponse() && !out.isTruncated());
+  SYLAR_ASSERT(out.qname == "www.example.com");
+  sylar::DnsSrv srv;
+  SYLAR_ASSERT(out.answers.size() == 1 && out.answers[0].getSrv(srv));
+  SYLAR_ASSERT(srv.priority == 1 && srv.weight == 2 && srv.port == 3);
+  SYLAR_ASSERT(srv.target == "t.com" && out.answers[0].ttl == 30);
+  SYLAR_ASSERT(out.authorities[0].getSoaMinimum() == 10);
+  // 截断的报文
+  SYLAR_ASSERT(!out.decode(data.c_str(), data.size() - 1));
+  SYLAR_LOG_INFO(g_logger) << "test_codec ok";
+}
+
+void test_files() {
+  write_file("/tmp/test_dns_resolv.conf",
+             "# comment\n"
+             "search example.com\n"
+             "nameserver 127.0.0.2\n"
+             "nameserver ::1 # local\n"
+             "options ndots:1 timeout:3 attempts:4\n");
+  write_file("/tmp/test_dns_hosts",
+             "127.0.0.1 localhost\n"
+             "10.9.9.9  myhost myhost.local # comment\n"
+             "::2       myhost\n");
+  sylar::DnsResolver resolver;
+  SYLAR_ASSERT(resolver.loadResolvConf("/tmp/test_dns_resolv.conf"));
+  auto servers = resolver.getServers();
+  SYLAR_ASSERT(servers.size() == 2);
+  SYLAR_ASSERT(servers[0]->toString() == "127.0.0.2:53");
+  SYLAR_ASSERT(servers[1]->toString() == "[::1]:53");
+  SYLAR_ASSERT(resolver.getTimeout() == 3000 && resolver.getAttempts() == 4);
+  SYLAR_ASSERT(resolver.getSearch() ==
+               std::vector<std::string>({"example.com"}));
+  SYLAR_ASSERT(resolver.getNdots() == 1);
+
+  // hosts 中的名字不查询 nameserver
+  SYLAR_ASSERT(resolver.loadHosts("/tmp/test_dns_hosts"));
+  resolver.setServers({});
+  std::vector<sylar::Address::ptr> addrs;
+  SYLAR_ASSERT(resolver.lookup(addrs, "MyHost.local.", AF_INET) == 0);
+  SYLAR_ASSERT(to_set(addrs) == std::set<std::string>({"10.9.9.9:0"}));
+  addrs.clear();
+  SYLAR_ASSERT(resolver.lookup(addrs, "myhost", AF_UNSPEC) == 0);
+  SYLAR_ASSERT(addrs.size() == 2);
+  SYLAR_ASSERT(resolver.lookup(addrs, "other", AF_INET) ==
+               sylar::DnsResolver::NO_SERVER);
+  SYLAR_ASSERT(resolver.getSendCount() == 0);
+  SYLAR_LOG_INFO(g_logger) << "test_files ok";
+}
+
+void test_query() {
+  auto resolver = make_resolver();
+  auto rt = resolver->query("a.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == 0 && rt->ttl == 1);
+  SYLAR_ASSERT(to_set(rt->addrs) ==
+               std::set<std::string>({"10.0.0.1:0", "10.0.0.2:0"}));
+  SYLAR_ASSERT(s_server->getCount("a.test") == 1);
+
+  // 缓存命中, 过期后重新查询
+  rt = resolver->query("A.TEST.", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == 0 && s_server->getCount("a.test") == 1);
+  usleep(1100 * 1000);
+  rt = resolver->query("a.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == 0 && s_server->getCount("a.test") == 2);
+
+  // NXDOMAIN 按 SOA minimum 缓存 1 秒
+  for (int i = 0; i < 3; ++i) {
+    rt = resolver->query("none.test", sylar::DnsRecord::A);
+    SYLAR_ASSERT(rt->result == sylar::DnsResolver::NOT_FOUND && rt->ttl == 1);
+  }
+  SYLAR_ASSERT(s_server->getCount("none.test") == 1);
+  usleep(1100 * 1000);
+  resolver->query("none.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(s_server->getCount("none.test") == 2);
+
+  // NODATA
+  rt = resolver->query("v6.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == sylar::DnsResolver::NOT_FOUND && rt->ttl == 30);
+  std::vector<sylar::Address::ptr> addrs;
+  SYLAR_ASSERT(resolver->lookup(addrs, "v6.test", AF_UNSPEC) == 0);
+  SYLAR_ASSERT(to_set(addrs) == std::set<std::string>({"[::1]:0"}));
+
+  rt = resolver->query("_rock._tcp.test", sylar::DnsRecord::SRV);
+  SYLAR_ASSERT(rt->result == 0 && rt->srvs.size() == 3);
+  SYLAR_ASSERT(rt->srvs[0].port == 8080 && rt->srvs[1].port == 8081);
+  SYLAR_ASSERT(rt->srvs[2].port == 8082 && rt->srvs[2].target == "b.test");
+
+  // 应答被截断时改用 TCP
+  rt = resolver->query("big.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == 0 && rt->addrs.size() == 100);
+  SYLAR_ASSERT(s_server->getCount("tcp:big.test") == 1);
+
+  rt = resolver->query("fail.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == sylar::DnsResolver::SERVER_FAIL);
+  SYLAR_ASSERT(s_server->getCount("fail.test") == 2);
+  rt = resolver->query("bad..name", sylar::DnsRecord::A);
+  SYLAR_ASSERT(rt->result == sylar::DnsResolver::INVALID_NAME);
+  SYLAR_LOG_INFO(g_logger) << "test_query ok " << resolver->toString();
+}
+
+// 相对名字按 search/ndots 展开
+void test_search() {
+  auto resolver = make_resolver();
+  resolver->setSearch({"svc.test", "test"});
+  std::vector<sylar::Address::ptr> addrs;
+  // 点数少于 ndots, 先尝试 search 域
+  SYLAR_ASSERT(resolver->lookup(addrs, "a", AF_INET) == 0);
+  SYLAR_ASSERT(addrs.size() == 2);
+  SYLAR_ASSERT(s_server->getCount("a.svc.test") == 1);
+  SYLAR_ASSERT(s_server->getCount("a") == 0);
+
+  // 点数达到 ndots, 先按绝对域名查询
+  addrs.clear();
+  SYLAR_ASSERT(resolver->lookup(addrs, "v6.test", AF_INET6) == 0);
+  SYLAR_ASSERT(s_server->getCount("v6.test.svc.test") == 0);
+
+  resolver->setNdots(2);
+  addrs.clear();
+  SYLAR_ASSERT(resolver->lookup(addrs, "v6.test", AF_INET6) == 0);
+  SYLAR_ASSERT(s_server->getCount("v6.test.svc.test") == 1);
+  SYLAR_ASSERT(s_server->getCount("v6.test.test") == 1);
+
+  // 以 '.' 结尾的名字不展开
+  SYLAR_ASSERT(resolver->lookup(addrs, "b.", AF_INET) ==
+               sylar::DnsResolver::NOT_FOUND);
+  SYLAR_ASSERT(s_server->getCount("b.svc.test") == 0);
+  SYLAR_ASSERT(resolver->lookup(addrs, "fail", AF_INET) ==
+               sylar::DnsResolver::SERVER_FAIL);
+  SYLAR_LOG_INFO(g_logger) << "test_search ok";
+}
+
+// 超时的查询不阻塞线程, 同一线程上的其它协程继续运行
+void test_timeout() {
+  auto resolver = make_resolver();
+  int ticks = 0;
+  bool done = false;
+  sylar::IOManager::GetThis()->schedule([&ticks, &done]() {
+    while (!done) {
+      ++ticks;
+      usleep(10 * 1000);
+    }
+  });
+  uint64_t ts = sylar::GetCurrentMS();
+  auto rt = resolver->query("drop.test", sylar::DnsRecord::A);
+  uint64_t used = sylar::GetCurrentMS() - ts;
+  done = true;
+  SYLAR_ASSERT(rt->result == sylar::DnsResolver::TIMEOUT);
+  SYLAR_ASSERT(used >= 200 && used < 400);
+  SYLAR_ASSERT(s_server->getCount("drop.test") == 2);
+  SYLAR_ASSERT(ticks >= 10);
+  // 失败不缓存
+  resolver->query("drop.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(s_server->getCount("drop.test") == 4);
+  SYLAR_LOG_INFO(g_logger) << "test_timeout ok ticks=" << ticks;
+}
+
+// 并发查询同一个名字只发送一次
+void test_coalesce() {
+  auto resolver = make_resolver();
+  sylar::FiberSemaphore sem;
+  const int count = 20;
+  for (int i = 0; i < count; ++i) {
+    sylar::IOManager::GetThis()->schedule([resolver, &sem]() {
+      auto rt = resolver->query("slow.test", sylar::DnsRecord::A);
+      SYLAR_ASSERT(rt->result == 0 && rt->addrs.size() == 1);
+      SYLAR_ASSERT(rt->addrs[0]->toString() == "10.0.0.3:0");
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < count; ++i) {
+    sem.wait();
+  }
+  SYLAR_ASSERT(s_server->getCount("slow.test") == 1);
+  SYLAR_ASSERT(resolver->getSendCount() == 1);
+  SYLAR_LOG_INFO(g_logger) << "test_coalesce ok";
+}
+
+void test_lru() {
+  auto resolver = make_resolver();
+  sylar::Config::Lookup<uint32_t>("dns.resolver.cache_size")->setValue(2);
+  resolver->query("v6.test", sylar::DnsRecord::AAAA);
+  resolver->query("_rock._tcp.test", sylar::DnsRecord::SRV);
+  resolver->query("v6.test", sylar::DnsRecord::AAAA);
+  resolver->query("big.test", sylar::DnsRecord::A);
+  SYLAR_ASSERT(resolver->getCacheSize() == 2);
+  uint64_t sends = resolver->getSendCount();
+  // 最近使用过的 v6.test 还在缓存中, SRV 被淘汰
+  resolver->query("v6.test", sylar::DnsRecord::AAAA);
+  SYLAR_ASSERT(resolver->getSendCount() == sends);
+  resolver->query("_rock._tcp.test", sylar::DnsRecord::SRV);
+  SYLAR_ASSERT(resolver->getSendCount() == sends + 1);
+  sylar::Config::Lookup<uint32_t>("dns.resolver.cache_size")->setValue(10000);
+  SYLAR_LOG_INFO(g_logger) << "test_lru ok";
+}
+
+// Address::Lookup 在协程中使用 DnsResolverMgr
+void test_address() {
+  sylar::Config::Lookup<bool>("dns.resolver.enable")->setValue(true);
+  auto resolver = sylar::DnsResolverMgr::GetInstance();
+  resolver->setServers({s_server->getAddress()});
+  resolver->setTimeout(100);
+  SYLAR_ASSERT(resolver->loadHosts("/tmp/test_dns_hosts"));
+  auto addr = sylar::Address::LookupAnyIPAddress("slow.test:8080");
+  SYLAR_ASSERT(addr && addr->toString() == "10.0.0.3:8080");
+  addr = sylar::Address::LookupAnyIPAddress("myhost:80");
+  SYLAR_ASSERT(addr && addr->toString() == "10.9.9.9:80");
+  std::vector<sylar::Address::ptr> addrs;
+  SYLAR_ASSERT(sylar::Address::Lookup(addrs, "v6.test:53", AF_INET6));
+  SYLAR_ASSERT(to_set(addrs) == std::set<std::string>({"[::1]:53"}));
+  SYLAR_ASSERT(!sylar::Address::LookupAny("none.test"));
+  addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:81");
+  SYLAR_ASSERT(addr && addr->toString() == "127.0.0.1:81");
+  SYLAR_LOG_INFO(g_logger) << "test_address ok";
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+  s_server = std::make_shared<StubDnsServer>();
+  SYLAR_ASSERT(s_server->start());
+
+  test_codec();
+  test_files();
+  test_query();
+  test_search();
+  test_timeout();
+  test_coalesce();
+  test_lru();
+  test_address();
+  s_server->stop();
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(1);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,460 @@
+#include <set>
+#include "sylar/db/fiber_redis.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/tcp_server.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef sylar::FiberRedisConnection Conn;
+
+std::string bulk(const std::string& v) {
+  return "$" + std::to_string(v.size()) + "\r\n" + v + "\r\n";
+}
+
+// 只实现测试用到的命令的 RESP 服务, cluster 时按槽位回复 MOVED/ASK
+class RespServer : public sylar::TcpServer {
+ public:
+  typedef std::shared_ptr<RespServer> ptr;
+
+  std::string passwd;
+  bool cluster = false;
+  uint16_t slot_begin = 0;
+  uint16_t slot_end = 16383;
+  /// 不属于自己的槽位 MOVED 到这里
+  std::string peer;
+  /// 正在迁出的槽位, 回复 ASK
+  std::map<uint16_t, std::string> asks;
+  /// 正在迁入的槽位, 带 ASKING 时处理
+  std::set<uint16_t> importing;
+  /// CLUSTER SLOTS 的回复
+  std::string slots_reply;
+  /// 每次回复前的延迟
+  uint32_t delay_ms = 0;
+
+  uint64_t reads = 0;
+  uint64_t cmds = 0;
+  uint64_t moved = 0;
+  uint64_t asked = 0;
+
+  std::string host() {
+    auto addr = std::dynamic_pointer_cast<sylar::IPAddress>(
+        getSocks()[0]->getLocalAddress());
+    return "127.0.0.1:" + std::to_string(addr->getPort());
+  }
+
+  // 断开所有客户端
+  void kick() {
+    for (auto& i : m_clients) {
+      i->close();
+    }
+    m_clients.clear();
+  }
+
+ protected:
+  struct Session {
+    bool authed = false;
+    bool asking = false;
+    bool multi = false;
+    bool abort = false;
+    std::vector<std::string> queued;
+  };
+
+  void handleClient(sylar::Socket::ptr client) override {
+    m_clients.push_back(client);
+    Session s;
+    std::string buf;
+    char tmp[4096];
+    while (true) {
+      int n = client->recv(tmp, sizeof(tmp));
+      if (n <= 0) {
+        break;
+      }
+      ++reads;
+      buf.append(tmp, n);
+      std::string out;
+      std::vector<std::string> argv;
+      size_t pos = 0;
+      while (parse(buf, pos, argv)) {
+        ++cmds;
+        out += execute(s, argv);
+      }
+      buf.erase(0, pos);
+      if (delay_ms) {
+        usleep(delay_ms * 1000);
+      }
+      for (size_t off = 0; off < out.size();) {
+        n = client->send(out.c_str() + off, out.size() - off);
+        if (n <= 0) {
+          break;
+        }
+        off += n;
+      }
+    }
+    client->close();
+  }
+
+  bool parse(const std::string& buf, size_t& pos,
+             std::vector<std::string>& argv) {
+    argv.clear();
+    size_t p = pos;
+    size_t end = buf.find("\r\n", p);
+    if (end == std::string::npos) {
+      return false;
+    }
+    int count = atoi(buf.c_str() + p + 1);
+    p = end + 2;
+    for (int i = 0; i < count; ++i) {
+      end = buf.find("\r\n", p);
+      if (end == std::string::npos) {
+        return false;
+      }
+      size_t len = atoi(buf.c_str() + p + 1);
+      if (end + 2 + len + 2 > buf.size()) {
+        return false;
+      }
+      argv.push_back(buf.substr(end + 2, len));
+      p = end + 2 + len + 2;
+    }
+    pos = p;
+    return true;
+  }
+
+  std::string check(Session& s, const std::string& key) {
+    if (!cluster) {
+      return "";
+    }
+    uint16_t slot = sylar::FiberRedisCluster::GetSlot(key);
+    if (asks.count(slot)) {
+      ++asked;
+      return "-ASK " + std::to_string(slot) + " " + asks[slot] + "\r\n";
+    }
+    if ((slot < slot_begin || slot > slot_end) &&
+        !(s.asking && importing.count(slot))) {
+      ++moved;
+      return "-MOVED " + std::to_string(slot) + " " + peer + "\r\n";
+    }
+    return "";
+  }
+
+  std::string execute(Session& s, const std::vector<std::string>& argv) {
+    std::string name = sylar::ToUpper(argv[0]);
+    if (name == "AUTH") {
+      s.authed = argv[1] == passwd;
+      return s.authed ? "+OK\r\n" : "-ERR invalid password\r\n";
+    }
+    if (!passwd.empty() && !s.authed) {
+      return "-NOAUTH Authentication required.\r\n";
+    }
+    if (name == "ASKING") {
+      s.asking = true;
+      return "+OK\r\n";
+    }
+    if (name == "MULTI") {
+      s.multi = true;
+      return "+OK\r\n";
+    }
+    if (name == "EXEC") {
+      std::string rt = "*" + std::to_string(s.queued.size()) + "\r\n";
+      for (auto& i : s.queued) {
+        rt += i;
+      }
+      if (s.abort) {
+        rt = "-EXECABORT Transaction discarded\r\n";
+      }
+      bool authed = s.authed;
+      s = Session();
+      s.authed = authed;
+      return rt;
+    }
+    std::string rt;
+    if (name == "SET" || name == "GET" || name == "INCR") {
+      rt = check(s, argv[1]);
+    }
+    if (rt.empty()) {
+      rt = doCmd(name, argv);
+    }
+    if (s.multi) {
+      if (rt[0] == '-') {
+        s.abort = true;
+        return rt;
+      }
+      s.queued.push_back(rt);
+      return "+QUEUED\r\n";
+    }
+    s.asking = false;
+    return rt;
+  }
+
+  std::string doCmd(const std::string& name,
+                    const std::vector<std::string>& argv) {
+    if (name == "PING") {
+      return "+PONG\r\n";
+    } else if (name == "SET") {
+      m_data[argv[1]] = argv[2];
+      return "+OK\r\n";
+    } else if (name == "GET") {
+      auto it = m_data.find(argv[1]);
+      return it == m_data.end() ? "$-1\r\n" : bulk(it->second);
+    } else if (name == "INCR") {
+      auto& v = m_data[argv[1]];
+      v = std::to_string(atoll(v.c_str()) + 1);
+      return ":" + v + "\r\n";
+    } else if (name == "CLUSTER") {
+      return slots_reply;
+    }
+    return "-ERR unknown command '" + argv[0] + "'\r\n";
+  }
+
+ private:
+  std::map<std::string, std::string> m_data;
+  std::vector<sylar::Socket::ptr> m_clients;
+};
+
+RespServer::ptr start_server() {
+  auto server = std::make_shared<RespServer>();
+  SYLAR_ASSERT(server->bind(sylar::IPAddress::Create("127.0.0.1", 0)));
+  server->start();
+  return server;
+}
+
+// CLUSTER SLOTS: [[begin, end, [ip, port]], ...]
+std::string slots_reply(
+    const std::vector<std::pair<std::pair<int, int>, std::string>>& slots) {
+  std::string rt = "*" + std::to_string(slots.size()) + "\r\n";
+  for (auto& i : slots) {
+    auto pos = i.second.find(':');
+    rt += "*3\r\n:" + std::to_string(i.first.first) + "\r\n:" +
+          std::to_string(i.first.second) + "\r\n*2\r\n" +
+          bulk(i.second.substr(0, pos)) + ":" + i.second.substr(pos + 1) +
+          "\r\n";
+  }
+  return rt;
+}
+
+std::map<std::string, std::string> make_conf(const std::string& host) {
+  return {{"host", host}, {"pool", "1"}, {"timeout", "1000"}};
+}
+
+void test_codec() {
+  std::string cmd = Conn::Encode({"SET", "k", std::string("a\r\nb\0c", 6)});
+  SYLAR_ASSERT(cmd == "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$6\r\n" +
+                         std::string("a\r\nb\0c", 6) + "\r\n");
+  auto argv = Conn::Decode(cmd);
+  SYLAR_ASSERT(argv.size() == 3 && argv[2] == std::string("a\r\nb\0c", 6));
+  SYLAR_ASSERT(Conn::Decode(cmd, 2).size() == 2);
+
+  // CRC16("123456789") = 0x31C3
+  SYLAR_ASSERT(sylar::FiberRedisCluster::GetSlot("123456789") == 0x31C3);
+  SYLAR_ASSERT(sylar::FiberRedisCluster::GetSlot("{user1000}.following") ==
+               sylar::FiberRedisCluster::GetSlot("{user1000}.followers"));
+  SYLAR_ASSERT(sylar::FiberRedisCluster::GetSlot("foo{}{bar}") !=
+               sylar::FiberRedisCluster::GetSlot("bar"));
+  SYLAR_LOG_INFO(g_logger) << "test_codec ok";
+}
+
+// 并发的命令在一个连接上合并发送
+void test_pipeline() {
+  auto server = start_server();
+  sylar::FiberRedis rds(make_conf(server->host()));
+  SYLAR_ASSERT(rds.cmd({"PING"}));
+  SYLAR_ASSERT(rds.cmd("SET %s %s", "fmt", "v")->type == REDIS_REPLY_STATUS);
+  SYLAR_ASSERT(std::string(rds.cmd({"GET", "fmt"})->str) == "v");
+  SYLAR_ASSERT(rds.cmd({"GET", "none"})->type == REDIS_REPLY_NIL);
+  SYLAR_ASSERT(!rds.cmd({"UNKNOWN"}));
+
+  // 大于接收缓冲的值
+  std::string big(100 * 1024, 'x');
+  big[5000] = '\r';
+  big[5001] = '\n';
+  SYLAR_ASSERT(rds.cmd({"SET", "big", big}));
+  auto rpy = rds.cmd({"GET", "big"});
+  SYLAR_ASSERT(rpy->len == big.size() &&
+               std::string(rpy->str, rpy->len) == big);
+
+  const int fibers = 100;
+  const int count = 100;
+  uint64_t reads = server->reads;
+  uint64_t ts = sylar::GetCurrentUS();
+  sylar::FiberSemaphore sem;
+  for (int f = 0; f < fibers; ++f) {
+    sylar::IOManager::GetThis()->schedule([&rds, &sem]() {
+      for (int i = 0; i < count; ++i) {
+        auto r = rds.cmd({"INCR", "counter"});
+        SYLAR_ASSERT(r && r->type == REDIS_REPLY_INTEGER);
+      }
+      sem.notify();
+    });
+  }
+  for (int f = 0; f < fibers; ++f) {
+    sem.wait();
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  SYLAR_ASSERT(rds.cmd({"GET", "counter"})->str ==
+               std::to_string(fibers * count));
+  SYLAR_LOG_INFO(g_logger) << fibers * count << " cmds from " << fibers
+                           << " fibers: " << server->reads - reads
+                           << " reads on server, " << used / 1000 << "ms";
+  SYLAR_ASSERT(server->reads - reads < fibers * count / 10);
+
+  std::vector<std::vector<std::string>> cmds;
+  for (int i = 0; i < 50; ++i) {
+    cmds.push_back({"SET", "p" + std::to_string(i), std::to_string(i)});
+  }
+  cmds.push_back({"GET", "p49"});
+  cmds.push_back({"UNKNOWN"});
+  reads = server->reads;
+  auto rpys = rds.pipeline(cmds);
+  // 一次写出, 服务端读的次数取决于 TCP 分段, 只要求少于命令数
+  SYLAR_ASSERT(rpys.size() == 52 && server->reads - reads < cmds.size());
+  for (int i = 0; i < 50; ++i) {
+    SYLAR_ASSERT(rpys[i]->type == REDIS_REPLY_STATUS &&
+                 std::string(rpys[i]->str) == "OK");
+  }
+  SYLAR_ASSERT(std::string(rpys[50]->str) == "49");
+  SYLAR_ASSERT(rpys[51]->type == REDIS_REPLY_ERROR);
+
+  server->stop();
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_pipeline ok";
+}
+
+void test_multi() {
+  auto server = start_server();
+  sylar::FiberRedis rds(make_conf(server->host()));
+  auto rpy = rds.multi({{"SET", "m", "1"}, {"INCR", "m"}, {"GET", "m"}});
+  SYLAR_ASSERT(rpy && rpy->type == REDIS_REPLY_ARRAY && rpy->elements == 3);
+  SYLAR_ASSERT(rpy->element[1]->integer == 2);
+  SYLAR_ASSERT(std::string(rpy->element[2]->str) == "2");
+  SYLAR_ASSERT(!rds.multi({{"SET", "m", "1"}, {"UNKNOWN"}}));
+  server->stop();
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_multi ok";
+}
+
+// AUTH, 超时, 断开后自动重连
+void test_connection() {
+  auto server = start_server();
+  server->passwd = "secret";
+  auto conf = make_conf(server->host());
+  {
+    sylar::FiberRedis rds(conf);
+    SYLAR_ASSERT(!rds.cmd({"PING"}));
+  }
+  usleep(10 * 1000);
+  conf["passwd"] = "secret";
+  sylar::FiberRedis rds(conf);
+  SYLAR_ASSERT(rds.cmd({"PING"}));
+
+  // 回复延迟远大于超时, 留足余量区分超时返回和等到回复
+  server->delay_ms = 500;
+  rds.setTimeout(20);
+  uint64_t ts = sylar::GetCurrentMS();
+  SYLAR_ASSERT(!rds.cmd({"PING"}));
+  SYLAR_ASSERT(sylar::GetCurrentMS() - ts < 400);
+  server->delay_ms = 0;
+  rds.setTimeout(1000);
+  // 超时请求的回复被丢弃, 不会错给后面的请求
+  usleep(600 * 1000);
+  SYLAR_ASSERT(std::string(rds.cmd({"SET", "a", "1"})->str) == "OK");
+
+  server->kick();
+  usleep(50 * 1000);
+  SYLAR_ASSERT(std::string(rds.cmd({"GET", "a"})->str) == "1");
+
+  server->stop();
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_connection ok";
+}
+
+std::string key_in(uint16_t begin, uint16_t end, const std::string& prefix) {
+  for (int i = 0;; ++i) {
+    std::string key = prefix + std::to_string(i);
+    uint16_t slot = sylar::FiberRedisCluster::GetSlot(key);
+    if (slot >= begin && slot <= end) {
+      return key;
+    }
+  }
+}
+
+void test_cluster() {
+  auto a = start_server();
+  auto b = start_server();
+  a->cluster = b->cluster = true;
+  a->slot_end = 8191;
+  b->slot_begin = 8192;
+  a->peer = b->host();
+  b->peer = a->host();
+  // 开始时 a 认为自己拥有全部槽位
+  a->slots_reply = slots_reply({{{0, 16383}, a->host()}});
+  b->slots_reply =
+      slots_reply({{{0, 8191}, a->host()}, {{8192, 16383}, b->host()}});
+
+  sylar::FiberRedisCluster rds(make_conf(a->host()));
+  std::string ka = key_in(0, 8191, "a");
+  std::string kb = key_in(8192, 16383, "b");
+  SYLAR_ASSERT(rds.cmd({"SET", ka, "1"}));
+  a->slots_reply = b->slots_reply;
+  SYLAR_ASSERT(rds.cmd({"SET", kb, "2"}));
+  SYLAR_ASSERT(a->moved == 1);
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_ASSERT(std::string(rds.cmd({"GET", kb})->str) == "2");
+    std::string k = key_in(8192, 16383, "k" + std::to_string(i) + "_");
+    SYLAR_ASSERT(rds.cmd({"SET", k, "3"}));
+  }
+  SYLAR_ASSERT(a->moved == 1);
+
+  // 跨节点的 pipeline 按节点分组发送
+  std::vector<std::vector<std::string>> cmds;
+  for (int i = 0; i < 20; ++i) {
+    cmds.push_back({"INCR", i % 2 ? ka : kb});
+  }
+  uint64_t reads = a->reads + b->reads;
+  auto rpys = rds.pipeline(cmds);
+  SYLAR_ASSERT(a->reads + b->reads - reads == 2);
+  SYLAR_ASSERT(rpys[18]->integer == 12 && rpys[19]->integer == 11);
+
+  // 迁移中的槽位带 ASKING 发往目标节点, 不改变槽位表
+  std::string kc = key_in(0, 8191, "c");
+  uint16_t slot = sylar::FiberRedisCluster::GetSlot(kc);
+  a->asks[slot] = b->host();
+  b->importing.insert(slot);
+  SYLAR_ASSERT(rds.cmd({"SET", kc, "4"}));
+  SYLAR_ASSERT(std::string(rds.cmd({"GET", kc})->str) == "4");
+  SYLAR_ASSERT(a->asked == 2 && b->moved == 0);
+  auto rpy = rds.multi({{"INCR", kc}, {"GET", kc}});
+  SYLAR_ASSERT(rpy && std::string(rpy->element[1]->str) == "5");
+
+  // 事务按第一个 key 路由, 收到 MOVED 后整体重试
+  a->slot_end = 4095;
+  b->slot_begin = 4096;
+  a->asks.clear();
+  std::string kd = key_in(4096, 8191, "d");
+  rpy = rds.multi({{"SET", kd, "1"}, {"INCR", kd}});
+  SYLAR_ASSERT(rpy && rpy->element[1]->integer == 2);
+  SYLAR_ASSERT(a->moved == 3);
+
+  a->stop();
+  b->stop();
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_cluster ok";
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::FATAL);
+  // 每个测试结束时析构客户端, 等关闭的连接的协程退出后再复用 fd
+  for (auto& test : {test_codec, test_pipeline, test_multi, test_connection,
+                     test_cluster}) {
+    test();
+    usleep(10 * 1000);
+  }
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(1);
+  iom.schedule(run);
+  return 0;
+}
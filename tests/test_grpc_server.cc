@@ -0,0 +1,274 @@
+#include <algorithm>
+#include "sylar/grpc/grpc_server.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+#include "tests/test.pb.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string s_service = "test.HelloService";
+
+struct CallResult {
+  int32_t status = -1;
+  std::string message;
+  std::vector<test::HelloResponse> responses;
+};
+
+// 客户端一次发送全部请求消息, 收到完整应答后解析出所有应答消息
+CallResult call(sylar::http2::Http2Connection::ptr conn,
+                const std::string& method,
+                const std::vector<test::HelloRequest>& reqs,
+                const std::string& grpc_timeout = "") {
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest(0x20, false));
+  req->setMethod(sylar::http::HttpMethod::POST);
+  req->setPath("/" + s_service + "/" + method);
+  req->setHeader("content-type", "application/grpc");
+  if (!grpc_timeout.empty()) {
+    req->setHeader("grpc-timeout", grpc_timeout);
+  }
+  std::string body;
+  for (auto& i : reqs) {
+    SYLAR_ASSERT(sylar::grpc::GrpcEncodeMessage(i, body));
+  }
+  req->setBody(body);
+
+  CallResult rt;
+  auto result = conn->request(req, 3000);
+  SYLAR_ASSERT(result->result == 0 && result->response);
+  rt.status = atoi(result->response->getHeader("grpc-status", "-1").c_str());
+  rt.message = result->response->getHeader("grpc-message");
+
+  sylar::grpc::GrpcMessageDecoder decoder;
+  decoder.append(std::string(result->response->getBody()));
+  const char* data = nullptr;
+  uint32_t length = 0;
+  while (decoder.next(data, length) > 0) {
+    test::HelloResponse rsp;
+    SYLAR_ASSERT(rsp.ParseFromArray(data, length));
+    rt.responses.push_back(rsp);
+  }
+  SYLAR_ASSERT(decoder.empty());
+  return rt;
+}
+
+test::HelloRequest make_request(const std::string& id, const std::string& msg) {
+  test::HelloRequest req;
+  req.set_id(id);
+  req.set_msg(msg);
+  return req;
+}
+
+void add_methods(sylar::grpc::GrpcServer::ptr server) {
+  server->getServletDispatch()->addServlet(
+      "/ping", [](sylar::http::HttpRequest::ptr req,
+                  sylar::http::HttpResponse::ptr rsp,
+                  sylar::http::HttpSession::ptr session) {
+        rsp->setBody("pong");
+        return 0;
+      });
+
+  server->addUnary<test::HelloRequest, test::HelloResponse>(
+      s_service, "Hello",
+      [](sylar::grpc::GrpcCall::ptr call, const test::HelloRequest& req,
+         test::HelloResponse& rsp) {
+        rsp.set_id(req.id());
+        rsp.set_msg("hello " + req.msg());
+        return 0;
+      });
+
+  // 处理时间超过 grpc-timeout 时以 DEADLINE_EXCEEDED 结束
+  server->addUnary<test::HelloRequest, test::HelloResponse>(
+      s_service, "Slow",
+      [](sylar::grpc::GrpcCall::ptr call, const test::HelloRequest& req,
+         test::HelloResponse& rsp) {
+        SYLAR_ASSERT(call->getTimeout() <= 50);
+        usleep(200 * 1000);
+        return 0;
+      });
+
+  server->addClientStreaming<test::HelloResponse>(
+      s_service, "Join",
+      [](sylar::grpc::GrpcCall::ptr call, test::HelloResponse& rsp) {
+        test::HelloRequest req;
+        int count = 0;
+        while (call->recv(req) > 0) {
+          rsp.set_msg(rsp.msg() + req.msg());
+          ++count;
+        }
+        rsp.set_id(std::to_string(count));
+        return 0;
+      });
+
+  server->addServerStreaming<test::HelloRequest>(
+      s_service, "Repeat",
+      [](sylar::grpc::GrpcCall::ptr call, const test::HelloRequest& req) {
+        int n = atoi(req.id().c_str());
+        for (int i = 0; i < n; ++i) {
+          test::HelloResponse rsp;
+          rsp.set_id(std::to_string(i));
+          rsp.set_msg(req.msg());
+          if (!call->send(rsp)) {
+            return (int32_t)sylar::grpc::GrpcStatus::CANCELLED;
+          }
+        }
+        call->setError("repeated " + req.id());
+        return n > 0 ? 0 : (int32_t)sylar::grpc::GrpcStatus::INVALID_ARGUMENT;
+      });
+
+  server->addBidiStreaming(s_service, "Echo",
+                           [](sylar::grpc::GrpcCall::ptr call) {
+                             call->addMetadata("x-echo", "1");
+                             test::HelloRequest req;
+                             while (call->recv(req) > 0) {
+                               test::HelloResponse rsp;
+                               rsp.set_id(req.id());
+                               rsp.set_msg(req.msg());
+                               call->send(rsp);
+                             }
+                             return 0;
+                           });
+}
+
+void test_calls(sylar::http2::Http2Connection::ptr conn) {
+  auto rt = call(conn, "Hello", {make_request("1", "world")});
+  SYLAR_ASSERT(rt.status == 0 && rt.responses.size() == 1);
+  SYLAR_ASSERT(rt.responses[0].msg() == "hello world");
+
+  // 没有请求消息的一元调用
+  rt = call(conn, "Hello", {});
+  SYLAR_ASSERT(rt.status == (int32_t)sylar::grpc::GrpcStatus::INTERNAL);
+
+  uint64_t ts = sylar::GetCurrentMS();
+  rt = call(conn, "Slow", {make_request("1", "")}, "50m");
+  SYLAR_ASSERT(rt.status ==
+               (int32_t)sylar::grpc::GrpcStatus::DEADLINE_EXCEEDED);
+  SYLAR_ASSERT(sylar::GetCurrentMS() - ts < 150);
+
+  std::vector<test::HelloRequest> reqs;
+  std::string all;
+  for (int i = 0; i < 100; ++i) {
+    // 大消息会跨越多个 DATA 帧
+    std::string msg(i * 500, 'a' + i % 26);
+    reqs.push_back(make_request(std::to_string(i), msg));
+    all += msg;
+  }
+  rt = call(conn, "Join", reqs);
+  SYLAR_ASSERT(rt.status == 0 && rt.responses.size() == 1);
+  SYLAR_ASSERT(rt.responses[0].id() == "100" && rt.responses[0].msg() == all);
+  rt = call(conn, "Join", {});
+  SYLAR_ASSERT(rt.status == 0 && rt.responses[0].id() == "0");
+
+  rt = call(conn, "Repeat", {make_request("1000", std::string(100, 'r'))});
+  SYLAR_ASSERT(rt.status == 0 && rt.responses.size() == 1000);
+  SYLAR_ASSERT(rt.message == "repeated 1000");
+  SYLAR_ASSERT(rt.responses[999].id() == "999");
+  rt = call(conn, "Repeat", {make_request("0", "")});
+  SYLAR_ASSERT(rt.status == (int32_t)sylar::grpc::GrpcStatus::INVALID_ARGUMENT);
+  SYLAR_ASSERT(rt.responses.empty());
+
+  rt = call(conn, "Echo", reqs);
+  SYLAR_ASSERT(rt.status == 0 && rt.responses.size() == reqs.size());
+  for (size_t i = 0; i < reqs.size(); ++i) {
+    SYLAR_ASSERT(rt.responses[i].msg() == reqs[i].msg());
+  }
+
+  // 超过一个流窗口的请求和应答: 处理协程读走数据后才归还接收窗口,
+  // 发送方积压超过对端窗口时等待
+  std::vector<test::HelloRequest> bigs;
+  std::string big_all;
+  for (int i = 0; i < 48; ++i) {
+    std::string msg(64 * 1024, 'a' + i % 26);
+    bigs.push_back(make_request(std::to_string(i), msg));
+    big_all += msg;
+  }
+  rt = call(conn, "Join", bigs);
+  SYLAR_ASSERT(rt.status == 0 && rt.responses.size() == 1);
+  SYLAR_ASSERT(rt.responses[0].id() == "48" &&
+               rt.responses[0].msg() == big_all);
+  rt = call(conn, "Repeat", {make_request("64", std::string(64 * 1024, 'r'))});
+  SYLAR_ASSERT(rt.status == 0 && rt.responses.size() == 64);
+
+  rt = call(conn, "NotExists", {make_request("1", "")});
+  SYLAR_ASSERT(rt.status == (int32_t)sylar::grpc::GrpcStatus::UNIMPLEMENTED);
+
+  // 普通的 HTTP/2 请求仍然交给 Servlet
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setPath("/ping");
+  auto result = conn->request(req, 3000);
+  SYLAR_ASSERT(result->result == 0 && result->response->getBody() == "pong");
+
+  // 连接仍然可用
+  rt = call(conn, "Hello", {make_request("2", "again")});
+  SYLAR_ASSERT(rt.status == 0 && rt.responses[0].msg() == "hello again");
+  SYLAR_LOG_INFO(g_logger) << "test_calls ok";
+}
+
+// 多个协程在同一连接上并发一元调用, 统计 QPS 和延迟
+void bench(sylar::grpc::GrpcConnection::ptr conn, int count, int fibers) {
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  std::vector<uint64_t> used(count);
+  uint64_t start = sylar::GetCurrentUS();
+  for (int f = 0; f < fibers; ++f) {
+    iom->schedule([conn, count, fibers, &used, &sem, f]() {
+      test::HelloRequest req = make_request("bench", std::string(64, 'b'));
+      for (int i = f; i < count; i += fibers) {
+        uint64_t ts = sylar::GetCurrentUS();
+        auto rsp = conn->request("/" + s_service + "/Hello", req, 3000);
+        SYLAR_ASSERT(rsp->getResult() == 0 && rsp->getData());
+        used[i] = sylar::GetCurrentUS() - ts;
+      }
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < fibers; ++i) {
+    sem.wait();
+  }
+  uint64_t total = sylar::GetCurrentUS() - start;
+  std::sort(used.begin(), used.end());
+  SYLAR_LOG_INFO(g_logger) << "grpc unary " << count << " calls, " << fibers
+                           << " fibers: qps="
+                           << (uint64_t)count * 1000000 / (total ? total : 1)
+                           << " p50=" << used[count / 2]
+                           << "us p99=" << used[count * 99 / 100]
+                           << "us max=" << used.back() << "us";
+}
+
+static int s_count = 20000;
+static int s_fibers = 32;
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+
+  auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8096");
+  sylar::grpc::GrpcServer::ptr server(new sylar::grpc::GrpcServer);
+  add_methods(server);
+  SYLAR_ASSERT(server->bind(addr, false));
+  server->start();
+
+  sylar::grpc::GrpcConnection::ptr conn(new sylar::grpc::GrpcConnection);
+  SYLAR_ASSERT(conn->connect(addr, false));
+  conn->start();
+  sleep(1);
+
+  test_calls(conn);
+  bench(conn, s_count, s_fibers);
+
+  server->stop();
+  conn->close();
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_count = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_fibers = atoi(argv[2]);
+  }
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,200 @@
+#include "sylar/http2/hpack.h"
+#include "sylar/http2/huffman.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+typedef std::vector<std::pair<std::string, std::string>> Headers;
+
+static std::string s_token = "Bearer " + sylar::random_string(180);
+
+// grpc 请求头, x-request-id 每次不同, 会不断插入和淘汰动态表
+Headers grpc_request(int i) {
+  return {{":method", "POST"},
+          {":scheme", "http"},
+          {":path", "/helloworld.Greeter/SayHello"},
+          {":authority", "127.0.0.1:50051"},
+          {"content-type", "application/grpc"},
+          {"user-agent", "grpc-c++/1.37.0 grpc-c/15.0.0 (linux; chttp2)"},
+          {"te", "trailers"},
+          {"grpc-accept-encoding", "identity,deflate,gzip"},
+          {"grpc-timeout", "1S"},
+          {"authorization", s_token},
+          {"x-request-id", sylar::random_string(16) + std::to_string(i)}};
+}
+
+Headers grpc_response(int i) {
+  return {{":status", "200"},
+          {"content-type", "application/grpc"},
+          {"grpc-encoding", "identity"},
+          {"grpc-accept-encoding", "identity,deflate,gzip"},
+          {"grpc-status", "0"},
+          {"grpc-message", ""},
+          {"x-trace-id", std::to_string(i * 7919)}};
+}
+
+std::string to_hex(const std::string& str) {
+  static const char* s_hex = "0123456789abcdef";
+  std::string rt;
+  for (auto c : str) {
+    rt.push_back(s_hex[(uint8_t)c >> 4]);
+    rt.push_back(s_hex[(uint8_t)c & 0xF]);
+  }
+  return rt;
+}
+
+bool check(const Headers& hs, sylar::http2::HPack& hp) {
+  auto& rs = hp.getHeaders();
+  if (rs.size() != hs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < hs.size(); ++i) {
+    if (rs[i].name != hs[i].first || rs[i].value != hs[i].second) {
+      SYLAR_LOG_ERROR(g_logger) << "mismatch " << rs[i].toString() << " "
+                                << hs[i].first << ": " << hs[i].second;
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_huffman() {
+  std::vector<std::string> strs = {"", "a", "www.example.com", "no-cache",
+                                   "Mon, 21 Oct 2013 20:13:21 GMT",
+                                   sylar::random_string(1000)};
+  std::string all;
+  for (int i = 0; i < 256; ++i) {
+    all.push_back((char)i);
+  }
+  strs.push_back(all);
+  for (auto& s : strs) {
+    std::string enc;
+    std::string dec;
+    sylar::http2::Huffman::EncodeString(s, enc, 0);
+    SYLAR_ASSERT((int)enc.size() == sylar::http2::Huffman::EncodeLen(s));
+    sylar::http2::Huffman::DecodeString(enc, dec);
+    SYLAR_ASSERT(dec == s);
+  }
+  // RFC 7541 C.4.1
+  std::string enc;
+  sylar::http2::Huffman::EncodeString("www.example.com", enc, 0);
+  SYLAR_ASSERT(to_hex(enc) == "f1e3c2e5f23a6ba0ab90f4ff");
+
+  // 填充超过 7 位或者包含 EOS 的编码不合法
+  std::string out;
+  SYLAR_ASSERT(sylar::http2::Huffman::DecodeString(std::string("\xff\xff", 2),
+                                                   out) < 0);
+  SYLAR_ASSERT(sylar::http2::Huffman::DecodeString(
+                   std::string("\xff\xff\xff\xff", 4), out) < 0);
+}
+
+void test_table() {
+  sylar::http2::DynamicTable table;
+  table.setMaxDataSize(200);
+  table.update("custom-key", "custom-value");
+  table.update("custom-key", "v2");
+  auto p = table.findPair("custom-key", "custom-value");
+  SYLAR_ASSERT(p.first == 63 && p.second);
+  p = table.findPair("custom-key", "v3");
+  SYLAR_ASSERT(p.first == 62 && !p.second);
+  p = table.findPair(":method", "POST");
+  SYLAR_ASSERT(p.first == 3 && p.second);
+  p = table.findPair(":status", "201");
+  SYLAR_ASSERT(p.first == 8 && !p.second);
+  SYLAR_ASSERT(table.findIndex("x-unknown") == -1);
+
+  // 超过容量时淘汰最早插入的项
+  for (int i = 0; i < 10; ++i) {
+    table.update("k" + std::to_string(i), "v");
+  }
+  SYLAR_ASSERT(table.findIndex("custom-key") == -1);
+  SYLAR_ASSERT(table.findIndex("k9") == 62);
+  SYLAR_ASSERT(table.getPair(62).first == "k9");
+  table.setMaxDataSize(0);
+  SYLAR_ASSERT(table.findIndex("k9") == -1);
+}
+
+void test_roundtrip() {
+  sylar::http2::DynamicTable send;
+  sylar::http2::DynamicTable recv;
+  for (int i = 0; i < 1000; ++i) {
+    Headers hs = i % 2 ? grpc_request(i) : grpc_response(i);
+    if (i % 100 == 0) {
+      // 长度超过 255 的值需要多字节的长度编码
+      hs.push_back(
+          std::make_pair("x-big", std::string(300 + i, 'a' + i % 26)));
+    }
+    std::string data;
+    sylar::http2::HPack(send).pack(hs, data);
+    sylar::http2::HPack hp(recv);
+    SYLAR_ASSERT(hp.parse(data) == (int)data.size());
+    SYLAR_ASSERT(check(hs, hp));
+  }
+}
+
+void bench(int n) {
+  std::vector<Headers> reqs;
+  std::vector<Headers> rsps;
+  for (int i = 0; i < 1000; ++i) {
+    reqs.push_back(grpc_request(i));
+    rsps.push_back(grpc_response(i));
+  }
+  std::vector<std::string> datas(n * 2);
+  sylar::http2::DynamicTable send;
+  sylar::http2::DynamicTable recv;
+  size_t bytes = 0;
+
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    sylar::http2::HPack(send).pack(reqs[i % reqs.size()], datas[i * 2]);
+    sylar::http2::HPack(send).pack(rsps[i % rsps.size()], datas[i * 2 + 1]);
+    bytes += datas[i * 2].size() + datas[i * 2 + 1].size();
+  }
+  uint64_t encode = sylar::GetCurrentUS() - ts;
+
+  ts = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    sylar::http2::HPack req(recv);
+    req.parse(datas[i * 2]);
+    sylar::http2::HPack rsp(recv);
+    rsp.parse(datas[i * 2 + 1]);
+    if (i < 1000) {
+      SYLAR_ASSERT(check(reqs[i % reqs.size()], req));
+      SYLAR_ASSERT(check(rsps[i % rsps.size()], rsp));
+    }
+  }
+  uint64_t decode = sylar::GetCurrentUS() - ts;
+
+  SYLAR_LOG_INFO(g_logger) << "hpack " << n << " grpc request+response: "
+                           << "encode=" << encode * 1000 / n << "ns "
+                           << "decode=" << decode * 1000 / n << "ns "
+                           << "avg_size=" << bytes / n;
+
+  std::string value = "grpc-c++/1.37.0 grpc-c/15.0.0 (linux; chttp2)";
+  std::string enc;
+  std::string dec;
+  ts = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    sylar::http2::Huffman::EncodeString(value, enc, 0);
+  }
+  encode = sylar::GetCurrentUS() - ts;
+  ts = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    sylar::http2::Huffman::DecodeString(enc, dec);
+  }
+  decode = sylar::GetCurrentUS() - ts;
+  SYLAR_ASSERT(dec == value);
+  SYLAR_LOG_INFO(g_logger) << "huffman " << value.size()
+                           << " bytes: encode=" << encode * 1000 / n << "ns "
+                           << "decode=" << decode * 1000 / n << "ns";
+}
+
+int main(int argc, char** argv) {
+  test_huffman();
+  test_table();
+  test_roundtrip();
+  bench(argc > 1 ? atoi(argv[1]) : 100000);
+  return 0;
+}
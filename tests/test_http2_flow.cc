@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <atomic>
+#include "sylar/http2/data_scheduler.h"
+#include "sylar/http2/http2_server.h"
+#include "sylar/http2/http2_stream.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static size_t s_big_size = 8 * 1024 * 1024;
+static int s_big_count = 2;
+static int s_small_count = 200;
+
+sylar::http::HttpResult::ptr do_request(
+    sylar::http2::Http2Connection::ptr conn, size_t n,
+    const std::string& priority, const std::string& body = "") {
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setHeader(":path", "/bytes?n=" + std::to_string(n));
+  req->setHeader(":authority", "127.0.0.1");
+  if (!priority.empty()) {
+    req->setHeader("priority", priority);
+  }
+  if (!body.empty()) {
+    req->setMethod(sylar::http::HttpMethod::POST);
+    req->setBody(body);
+  }
+  auto rt = conn->request(req, 30000);
+  SYLAR_ASSERT(rt->result == 0 && rt->response);
+  SYLAR_ASSERT(rt->response->getBody().size() == n);
+  SYLAR_ASSERT(rt->response->getHeader("recv-size") ==
+               std::to_string(body.size()));
+  return rt;
+}
+
+// 同一连接上几个大响应与大量小响应并发, 统计小响应的延迟
+void bench(sylar::http2::Http2Connection::ptr conn, const std::string& name,
+           const std::string& priority) {
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  uint64_t start = sylar::GetCurrentUS();
+  std::vector<uint64_t> bigs(s_big_count);
+  for (int i = 0; i < s_big_count; ++i) {
+    iom->schedule([conn, priority, start, &bigs, &sem, i]() {
+      do_request(conn, s_big_size, priority);
+      bigs[i] = sylar::GetCurrentUS() - start;
+      sem.notify();
+    });
+  }
+  // 等大响应开始发送
+  usleep(20 * 1000);
+
+  std::vector<uint64_t> smalls(s_small_count);
+  const int fibers = 10;
+  for (int f = 0; f < fibers; ++f) {
+    iom->schedule([conn, priority, &smalls, &sem, f]() {
+      for (int i = f; i < s_small_count; i += fibers) {
+        uint64_t ts = sylar::GetCurrentUS();
+        do_request(conn, 1024, priority);
+        smalls[i] = sylar::GetCurrentUS() - ts;
+      }
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < s_big_count + fibers; ++i) {
+    sem.wait();
+  }
+  uint64_t used = sylar::GetCurrentUS() - start;
+
+  std::sort(smalls.begin(), smalls.end());
+  uint64_t total = 0;
+  for (auto i : smalls) {
+    total += i;
+  }
+  SYLAR_LOG_INFO(g_logger)
+      << name << ": small avg=" << total / smalls.size()
+      << "us p50=" << smalls[smalls.size() / 2]
+      << "us p99=" << smalls[smalls.size() * 99 / 100]
+      << "us max=" << smalls.back() << "us; big done="
+      << *std::max_element(bigs.begin(), bigs.end()) << "us; total "
+      << (s_big_size * s_big_count) / (used ? used : 1) << "MB/s";
+}
+
+// 统计客户端连接上的写调用次数, 每次对应一个 send/sendmsg 系统调用
+class CountedConnection : public sylar::http2::Http2Connection {
+ public:
+  typedef std::shared_ptr<CountedConnection> ptr;
+
+  int write(const void* buffer, size_t length) override {
+    ++m_writes;
+    return Http2Connection::write(buffer, length);
+  }
+
+  int write(sylar::ByteArray::ptr ba, size_t length) override {
+    ++m_writes;
+    return Http2Connection::write(ba, length);
+  }
+
+  int writev(const iovec* buffers, size_t length) override {
+    ++m_writes;
+    return Http2Connection::writev(buffers, length);
+  }
+
+  uint64_t getWrites() const { return m_writes; }
+
+ private:
+  std::atomic<uint64_t> m_writes = {0};
+};
+
+// 并发的带请求体的小请求, 统计每个请求平均的写调用次数
+void bench_writes(CountedConnection::ptr conn) {
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  const int fibers = 10;
+  const int count = 2000;
+  uint64_t writes = conn->getWrites();
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int f = 0; f < fibers; ++f) {
+    iom->schedule([conn, &sem]() {
+      for (int i = 0; i < count / fibers; ++i) {
+        do_request(conn, 100, "", "ping");
+      }
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < fibers; ++i) {
+    sem.wait();
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  SYLAR_LOG_INFO(g_logger) << "small requests: "
+                           << count * 1000000 / (used ? used : 1) << " qps, "
+                           << (double)(conn->getWrites() - writes) / count
+                           << " client writes per request";
+}
+
+// 连接窗口用尽后, 空的 END_STREAM 帧和 trailers 仍然可以发出
+void test_zero_conn_window() {
+  sylar::http2::DataScheduler sched;
+  sched.open(1, 1 << 20);
+  sched.open(3, 1 << 20);
+  sched.open(5, 1 << 20);
+  sched.push(1, std::string(65535, 'x'), false, 1 << 20);
+  SYLAR_ASSERT(sched.next(1 << 20));
+  SYLAR_ASSERT(sched.getConnWindow() == 0);
+
+  sched.push(1, "more", false, 1 << 20);
+  sched.push(3, "", true, 1 << 20);
+  sched.pushTrailers(5, sylar::http2::DataScheduler::Headers(), 1 << 20);
+  SYLAR_ASSERT(sched.hasSendable());
+  int end_streams = 0;
+  while (auto frame = sched.next(1 << 20)) {
+    SYLAR_ASSERT(frame->header.identifier != 1);
+    ++end_streams;
+  }
+  SYLAR_ASSERT(end_streams == 2);
+  SYLAR_ASSERT(!sched.hasSendable());
+  sched.updateWindow(0, 4);
+  auto frame = sched.next(1 << 20);
+  SYLAR_ASSERT(frame && frame->header.identifier == 1);
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+
+  test_zero_conn_window();
+
+  auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8097");
+  sylar::http2::Http2Server::ptr server(new sylar::http2::Http2Server);
+  server->getServletDispatch()->addServlet(
+      "/bytes", [](sylar::http::HttpRequest::ptr req,
+                   sylar::http::HttpResponse::ptr rsp,
+                   sylar::http::HttpSession::ptr session) {
+        rsp->setHeader("recv-size", std::to_string(req->getBody().size()));
+        rsp->setBody(std::string(atoi(req->getParam("n").c_str()), 'x'));
+        return 0;
+      });
+  SYLAR_ASSERT(server->bind(addr, false));
+  server->start();
+
+  CountedConnection::ptr conn(new CountedConnection);
+  SYLAR_ASSERT(conn->connect(addr, false));
+  conn->start();
+  sleep(1);
+
+  // 请求与应答都超过初始窗口, 依赖 WINDOW_UPDATE 才能完成
+  do_request(conn, 1024 * 1024, "", std::string(1024 * 1024, 'y'));
+  do_request(conn, 0, "", std::string(300000, 'z'));
+
+  bench_writes(conn);
+
+  // 没有 priority 头部: 同一 urgency 内加权公平, 小响应插在大响应之前
+  bench(conn, "fair", "");
+  // 显式非增量: 同一 urgency 内按到达顺序发送, 小响应排在大响应之后
+  bench(conn, "fifo", "u=3");
+
+  server->stop();
+  conn->close();
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_big_size = atoi(argv[1]) * 1024 * 1024;
+  }
+  if (argc > 2) {
+    s_small_count = atoi(argv[2]);
+  }
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,212 @@
+#include "sylar/http/http_connection.h"
+#include "sylar/http2/http2_server.h"
+#include "sylar/http2/http2_stream.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/streams/socket_stream.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::string s_cert_file;
+static std::string s_key_file;
+
+void add_servlets(sylar::http2::Http2Server::ptr server) {
+  server->getServletDispatch()->addServlet(
+      "/echo", [](sylar::http::HttpRequest::ptr req,
+                  sylar::http::HttpResponse::ptr rsp,
+                  sylar::http::HttpSession::ptr session) {
+        // HTTP/2 请求没有 HttpSession
+        rsp->setHeader("proto", session ? "http/1.1" : "h2");
+        rsp->setBody(req->getPath() + " " + req->getBody());
+        return 0;
+      });
+}
+
+// HTTP/1.1 长连接, 多个请求复用同一个 socket
+void test_http1(sylar::Address::ptr addr, bool ssl) {
+  std::string url = std::string(ssl ? "https" : "http") + "://" +
+                    addr->toString() + "/echo";
+  for (int i = 0; i < 3; ++i) {
+    auto rt = sylar::http::HttpConnection::DoGet(url, 1000);
+    SYLAR_ASSERT(rt->result == 0 && rt->response);
+    SYLAR_ASSERT(rt->response->getHeader("proto") == "http/1.1");
+    SYLAR_ASSERT(rt->response->getBody() == "/echo ");
+  }
+  SYLAR_LOG_INFO(g_logger) << "test_http1 ssl=" << ssl << " ok";
+}
+
+// prior-knowledge 或者 ALPN 协商的 HTTP/2
+void test_http2(sylar::Address::ptr addr, bool ssl) {
+  sylar::http2::Http2Connection::ptr conn(new sylar::http2::Http2Connection);
+  SYLAR_ASSERT(conn->connect(addr, ssl));
+  if (ssl) {
+    auto sock = std::dynamic_pointer_cast<sylar::SSLSocket>(conn->getSocket());
+    SYLAR_ASSERT(sock->getAlpnProtocol() == "h2");
+  }
+  conn->start();
+  for (int i = 0; i < 3; ++i) {
+    sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+    req->setPath("/echo");
+    req->setMethod(sylar::http::HttpMethod::POST);
+    req->setBody("h2-" + std::to_string(i));
+    auto rt = conn->request(req, 1000);
+    SYLAR_ASSERT(rt->result == 0 && rt->response);
+    SYLAR_ASSERT(rt->response->getHeader("proto") == "h2");
+    SYLAR_ASSERT(rt->response->getBody() == "/echo h2-" + std::to_string(i));
+  }
+  conn->close();
+  // 等读协程退出后再创建新的 socket, 避免复用同一个 fd
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_http2 ssl=" << ssl << " ok";
+}
+
+sylar::http2::Frame::ptr make_settings(bool ack) {
+  auto frame = std::make_shared<sylar::http2::Frame>();
+  frame->header.type = (uint8_t)sylar::http2::FrameType::SETTINGS;
+  if (ack) {
+    frame->header.flags = (uint8_t)sylar::http2::FrameFlagSettings::ACK;
+  }
+  frame->data = std::make_shared<sylar::http2::SettingsFrame>();
+  return frame;
+}
+
+// 读取流 id 的应答, 返回 :status 和 body
+std::pair<std::string, std::string> read_response(
+    sylar::SocketStream::ptr ss, sylar::http2::FrameCodec& codec,
+    sylar::http2::DynamicTable& table, uint32_t id) {
+  std::pair<std::string, std::string> rt;
+  while (true) {
+    auto frame = codec.parseFrom(ss);
+    SYLAR_ASSERT(frame);
+    if (frame->header.type == (uint8_t)sylar::http2::FrameType::SETTINGS &&
+        !(frame->header.flags &
+          (uint8_t)sylar::http2::FrameFlagSettings::ACK)) {
+      SYLAR_ASSERT(codec.serializeTo(ss, make_settings(true)) > 0);
+      continue;
+    }
+    if (frame->header.identifier != id) {
+      continue;
+    }
+    if (frame->header.type == (uint8_t)sylar::http2::FrameType::HEADERS) {
+      auto data =
+          std::dynamic_pointer_cast<sylar::http2::HeadersFrame>(frame->data);
+      sylar::http2::HPack hp(table);
+      SYLAR_ASSERT(hp.parse(data->data) >= 0);
+      for (auto& i : hp.getHeaders()) {
+        if (i.name == ":status") {
+          rt.first = i.value;
+        }
+      }
+    } else if (frame->header.type == (uint8_t)sylar::http2::FrameType::DATA) {
+      auto data =
+          std::dynamic_pointer_cast<sylar::http2::DataFrame>(frame->data);
+      rt.second += data->data;
+    }
+    if (frame->header.flags &
+        (uint8_t)sylar::http2::FrameFlagHeaders::END_STREAM) {
+      return rt;
+    }
+  }
+}
+
+// Upgrade: h2c, 101 之后升级请求的应答在流 1 上返回, 之后继续使用 HTTP/2
+void test_upgrade(sylar::Address::ptr addr) {
+  auto sock = sylar::Socket::CreateTCP(addr);
+  SYLAR_ASSERT(sock->connect(addr));
+  sock->setRecvTimeout(1000);
+  sylar::SocketStream::ptr ss = std::make_shared<sylar::SocketStream>(sock);
+
+  // HTTP2-Settings: SETTINGS_MAX_CONCURRENT_STREAMS = 100
+  std::string req =
+      "POST /echo HTTP/1.1\r\n"
+      "Host: 127.0.0.1\r\n"
+      "Connection: Upgrade, HTTP2-Settings\r\n"
+      "Upgrade: h2c\r\n"
+      "HTTP2-Settings: AAMAAABk\r\n"
+      "Content-Length: 7\r\n\r\n"
+      "upgrade";
+  SYLAR_ASSERT(ss->writeFixSize(req.c_str(), req.size()) > 0);
+
+  // 逐字节读取 101 应答, 不能多读后面的 HTTP/2 帧
+  std::string rsp;
+  while (rsp.size() < 4 || rsp.compare(rsp.size() - 4, 4, "\r\n\r\n")) {
+    char c;
+    SYLAR_ASSERT(ss->readFixSize(&c, 1) > 0);
+    rsp.push_back(c);
+  }
+  SYLAR_ASSERT(rsp.compare(0, 12, "HTTP/1.1 101") == 0);
+
+  static const std::string s_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  SYLAR_ASSERT(ss->writeFixSize(s_preface.c_str(), s_preface.size()) > 0);
+  sylar::http2::FrameCodec codec;
+  SYLAR_ASSERT(codec.serializeTo(ss, make_settings(false)) > 0);
+
+  sylar::http2::DynamicTable recv_table;
+  auto rt = read_response(ss, codec, recv_table, 1);
+  SYLAR_ASSERT(rt.first == "200" && rt.second == "/echo upgrade");
+
+  // 升级后的连接上发送新的 HTTP/2 请求
+  sylar::http2::DynamicTable send_table;
+  auto frame = std::make_shared<sylar::http2::Frame>();
+  frame->header.type = (uint8_t)sylar::http2::FrameType::HEADERS;
+  frame->header.flags = (uint8_t)sylar::http2::FrameFlagHeaders::END_HEADERS |
+                        (uint8_t)sylar::http2::FrameFlagHeaders::END_STREAM;
+  frame->header.identifier = 3;
+  auto headers = std::make_shared<sylar::http2::HeadersFrame>();
+  sylar::http2::HPack(send_table)
+      .pack({{":method", "GET"},
+             {":scheme", "http"},
+             {":path", "/echo"},
+             {":authority", "127.0.0.1"}},
+            headers->data);
+  frame->data = headers;
+  SYLAR_ASSERT(codec.serializeTo(ss, frame) > 0);
+  rt = read_response(ss, codec, recv_table, 3);
+  SYLAR_ASSERT(rt.first == "200" && rt.second == "/echo ");
+  ss->close();
+  SYLAR_LOG_INFO(g_logger) << "test_upgrade ok";
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+
+  auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8095");
+  sylar::http2::Http2Server::ptr server(new sylar::http2::Http2Server);
+  add_servlets(server);
+  SYLAR_ASSERT(server->bind(addr, false));
+  server->start();
+
+  test_http1(addr, false);
+  test_http2(addr, false);
+  test_upgrade(addr);
+
+  sylar::http2::Http2Server::ptr ssl_server;
+  if (!s_cert_file.empty()) {
+    auto ssl_addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8094");
+    ssl_server.reset(new sylar::http2::Http2Server);
+    add_servlets(ssl_server);
+    SYLAR_ASSERT(ssl_server->bind(ssl_addr, true));
+    SYLAR_ASSERT(ssl_server->loadCertificates(s_cert_file, s_key_file));
+    ssl_server->start();
+
+    test_http1(ssl_addr, true);
+    test_http2(ssl_addr, true);
+    ssl_server->stop();
+  } else {
+    SYLAR_LOG_INFO(g_logger)
+        << "skip ALPN test, usage: test_http2_upgrade cert_file key_file";
+  }
+  server->stop();
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    s_cert_file = argv[1];
+    s_key_file = argv[2];
+  }
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "sylar/http/http_compress.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_negotiate() {
+  std::vector<std::string> vals = {"",
+                                   "gzip",
+                                   "deflate",
+                                   "gzip, deflate, br",
+                                   "deflate;q=1.0, gzip;q=0.5",
+                                   "gzip;q=0, deflate;q=0",
+                                   "*",
+                                   "identity"};
+  for (auto& i : vals) {
+    SYLAR_LOG_INFO(g_logger)
+        << "Accept-Encoding: \"" << i << "\" -> "
+        << sylar::http::HttpCompress::EncodingToString(
+               sylar::http::HttpCompress::Negotiate(i));
+  }
+}
+
+std::string make_json(int count) {
+  std::stringstream ss;
+  ss << "[";
+  for (int i = 0; i < count; ++i) {
+    ss << (i ? "," : "") << "{\"id\":" << i << ",\"name\":\"user_" << i
+       << "\",\"status\":\"online\"}";
+  }
+  ss << "]";
+  return ss.str();
+}
+
+void test_response() {
+  std::string body = make_json(1000);
+  for (int n = 0; n < 3; ++n) {
+    sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+    req->setPath("/users");
+    req->setHeader("Accept-Encoding", n == 2 ? "deflate" : "gzip");
+    sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+    rsp->setHeader("Content-Type", "application/json;charset=utf8");
+    rsp->setHeader("ETag", "\"v1\"");
+    rsp->setBody(body);
+
+    uint64_t ts = sylar::GetCurrentUS();
+    bool rt = sylar::http::HttpCompress::CompressResponse(req, rsp);
+    uint64_t used = sylar::GetCurrentUS() - ts;
+    SYLAR_LOG_INFO(g_logger)
+        << "compress rt=" << rt
+        << " encoding=" << rsp->getHeader("Content-Encoding")
+        << " vary=" << rsp->getHeader("Vary") << " size=" << body.size()
+        << " -> " << rsp->getBody().size() << " used=" << used << "us";
+
+    sylar::http::HttpCompress::DecompressResponse(rsp);
+    SYLAR_LOG_INFO(g_logger) << "decompress equal=" << (rsp->getBody() == body)
+                             << " encoding=\""
+                             << rsp->getHeader("Content-Encoding") << "\"";
+  }
+
+  sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+  req->setHeader("Accept-Encoding", "gzip");
+  sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+  rsp->setHeader("Content-Type", "image/png");
+  rsp->setBody(body);
+  SYLAR_LOG_INFO(g_logger)
+      << "image/png compress="
+      << sylar::http::HttpCompress::CompressResponse(req, rsp);
+}
+
+// 64MB 的 0 压缩后只有几十 KB, 解压输出必须在上限处停下
+void test_bomb() {
+  std::string raw(64 * 1024 * 1024, '\0');
+  std::string zipped;
+  SYLAR_ASSERT(sylar::http::HttpCompress::Compress(
+      sylar::http::HttpCompress::GZIP, raw, zipped, 9));
+  raw.clear();
+  raw.shrink_to_fit();
+
+  std::string out;
+  SYLAR_ASSERT(!sylar::http::HttpCompress::Decompress(
+      sylar::http::HttpCompress::GZIP, zipped, out, 1024 * 1024));
+  SYLAR_ASSERT(sylar::http::HttpCompress::Decompress(
+      sylar::http::HttpCompress::GZIP, zipped, out, 64 * 1024 * 1024));
+  SYLAR_ASSERT(out.size() == 64 * 1024 * 1024);
+
+  sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+  rsp->setHeader("Content-Encoding", "gzip");
+  rsp->setBody(zipped);
+  SYLAR_ASSERT(!sylar::http::HttpCompress::DecompressResponse(rsp, 1024 * 1024));
+  SYLAR_LOG_INFO(g_logger) << "bomb " << zipped.size()
+                           << " -> 64MB, max_size=1MB rejected";
+}
+
+int main(int argc, char** argv) {
+  test_negotiate();
+  test_response();
+  test_bomb();
+  return 0;
+}
@@ -17,6 +17,7 @@ void test_pool() {
       [pool]() {
         auto r = pool->doGet("/", 300);
         SYLAR_LOG_INFO(g_logger) << r->toString();
+        SYLAR_LOG_INFO(g_logger) << pool->getStats().toString();
       },
       true);
 }
@@ -0,0 +1,86 @@
+#include <sched.h>
+#include "sylar/http/http_connection.h"
+#include "sylar/http/http_server.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 只有一个连接名额, 持有者在一个线程归还的同时另一个线程的协程开始等待.
+// 每轮只有这一次归还, 等待者错过它就只能等到超时
+void test_one_slot(sylar::IOManager* holder, sylar::IOManager* waiter,
+                   const std::string& url) {
+  auto pool = sylar::http::HttpConnectionPool::Create(url, "", 1, 60 * 1000,
+                                                      1000000);
+  const int rounds = 20000;
+  std::atomic<int> held = {0};
+  std::atomic<int> go = {0};
+  std::atomic<int> got = {0};
+  std::atomic<int> ok = {0};
+  std::atomic<int> done = {0};
+  uint64_t ts = sylar::GetCurrentMS();
+  holder->schedule([&]() {
+    for (int i = 1; i <= rounds; ++i) {
+      uint64_t timeout_ms = 1000;
+      auto conn = pool->getConnection(timeout_ms);
+      SYLAR_ASSERT(conn);
+      held = i;
+      while (go != i) {
+        sched_yield();
+      }
+      conn.reset();
+      while (got != i) {
+        sched_yield();
+      }
+    }
+    ++done;
+  });
+  waiter->schedule([&]() {
+    for (int i = 1; i <= rounds; ++i) {
+      while (held != i) {
+        sched_yield();
+      }
+      go = i;
+      uint64_t timeout_ms = 100;
+      auto conn = pool->getConnection(timeout_ms);
+      ok += !!conn;
+      conn.reset();
+      got = i;
+    }
+    ++done;
+  });
+  while (done != 2) {
+    usleep(10 * 1000);
+  }
+  auto stats = pool->getStats();
+  SYLAR_LOG_INFO(g_logger) << rounds << " handoffs ok=" << ok
+                           << " used=" << sylar::GetCurrentMS() - ts << "ms "
+                           << stats.toString();
+  SYLAR_ASSERT(ok == rounds && stats.waitTimeout == 0);
+  SYLAR_LOG_INFO(g_logger) << "test_one_slot ok";
+}
+
+int main(int argc, char** argv) {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  sylar::IOManager iom(1, false, "server");
+  sylar::IOManager holder(1, false, "holder");
+  sylar::IOManager waiter(1, false, "waiter");
+  std::string url;
+  sylar::http::HttpServer::ptr server;
+  iom.schedule([&url, &server]() {
+    server.reset(new sylar::http::HttpServer(true));
+    SYLAR_ASSERT(server->bind(sylar::IPAddress::Create("127.0.0.1", 0)));
+    server->start();
+    auto addr = std::dynamic_pointer_cast<sylar::IPAddress>(
+        server->getSocks()[0]->getLocalAddress());
+    url = "http://127.0.0.1:" + std::to_string(addr->getPort()) + "/";
+  });
+  while (url.empty()) {
+    usleep(1000);
+  }
+  test_one_slot(&holder, &waiter, url);
+  iom.schedule([server]() { server->stop(); });
+  return 0;
+}
@@ -0,0 +1,553 @@
+#include <algorithm>
+#include "sylar/config.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/streams/load_balance.h"
+#include "sylar/thread.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 模拟的后端节点, 不需要真实的连接
+class FakeItem : public sylar::P2CLoadBalanceItem {
+ public:
+  typedef std::shared_ptr<FakeItem> ptr;
+
+  FakeItem(uint64_t id, uint32_t latency_us) : m_latency(latency_us) {
+    setId(id);
+    setWeight(100);
+  }
+
+  virtual bool isValid() override { return true; }
+
+  uint32_t getLatency() const { return m_latency; }
+  void setLatency(uint32_t v) { m_latency = v; }
+  bool isFailing() const { return m_failing; }
+  void setFailing(bool v) { m_failing = v; }
+
+  std::atomic<uint64_t> picks = {0};
+
+ private:
+  uint32_t m_latency;
+  bool m_failing = false;
+};
+
+// 和 RockSDLoadBalance::request 一样记录统计
+uint64_t call(sylar::LoadBalance::ptr lb) {
+  auto item = std::static_pointer_cast<FakeItem>(lb->get());
+  SYLAR_ASSERT(item);
+  ++item->picks;
+  uint64_t ts = sylar::GetCurrentUS();
+  auto& stats = item->get(ts / 1000000);
+  stats.incTotal(1);
+  item->onStart();
+  bool ok = !item->isFailing();
+  if (ok) {
+    usleep(item->getLatency());
+    stats.incOks(1);
+  } else {
+    stats.incErrs(1);
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  item->onFinish(ok, used);
+  return used;
+}
+
+// 多个协程并发请求, 返回按耗时排序的结果
+std::vector<uint64_t> run_requests(sylar::LoadBalance::ptr lb, int count,
+                                   int fibers) {
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  std::vector<uint64_t> used(count);
+  for (int f = 0; f < fibers; ++f) {
+    iom->schedule([lb, f, fibers, count, &used, &sem]() {
+      for (int i = f; i < count; i += fibers) {
+        used[i] = call(lb);
+      }
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < fibers; ++i) {
+    sem.wait();
+  }
+  std::sort(used.begin(), used.end());
+  return used;
+}
+
+std::vector<FakeItem::ptr> make_items(sylar::LoadBalance::ptr lb) {
+  std::vector<FakeItem::ptr> items;
+  std::vector<sylar::LoadBalanceItem::ptr> vs;
+  for (int i = 0; i < 5; ++i) {
+    // 第 5 个节点明显更慢
+    items.push_back(std::make_shared<FakeItem>(i, i == 4 ? 20000 : 1000));
+    vs.push_back(items.back());
+  }
+  lb->set(vs);
+  return items;
+}
+
+void report(const std::string& name, const std::vector<FakeItem::ptr>& items,
+            const std::vector<uint64_t>& used) {
+  std::stringstream ss;
+  for (auto& i : items) {
+    ss << " " << i->picks;
+  }
+  SYLAR_LOG_INFO(g_logger) << name << ": picks=" << ss.str()
+                           << " p50=" << used[used.size() / 2]
+                           << "us p99=" << used[used.size() * 99 / 100]
+                           << "us";
+}
+
+// 慢节点只分到很少的流量, 尾延迟明显低于随机选择
+void test_latency() {
+  const int count = 4000;
+  const int fibers = 16;
+  sylar::LoadBalance::ptr rr(new sylar::RoundRobinLoadBalance);
+  auto rr_items = make_items(rr);
+  auto rr_used = run_requests(rr, count, fibers);
+  report("round_robin", rr_items, rr_used);
+
+  sylar::LoadBalance::ptr p2c(new sylar::P2CLoadBalance);
+  auto items = make_items(p2c);
+  auto used = run_requests(p2c, count, fibers);
+  report("p2c", items, used);
+
+  SYLAR_ASSERT(items[4]->picks < count / 100);
+  SYLAR_ASSERT(used[count * 99 / 100] < rr_used[count * 99 / 100]);
+}
+
+// 失败率高的节点被摘除, 摘除时间结束后恢复
+void test_eject() {
+  sylar::LoadBalance::ptr lb(new sylar::P2CLoadBalance);
+  auto items = make_items(lb);
+  items[4]->setLatency(1000);
+  items[0]->setFailing(true);
+  run_requests(lb, 1000, 8);
+  SYLAR_ASSERT(items[0]->isEjected(sylar::GetCurrentMS()));
+  uint64_t picks = items[0]->picks;
+  run_requests(lb, 1000, 8);
+  SYLAR_ASSERT(items[0]->picks == picks);
+  SYLAR_LOG_INFO(g_logger) << "ejected: " << items[0]->toString();
+
+  items[0]->setFailing(false);
+  usleep(1100 * 1000);
+  SYLAR_ASSERT(!items[0]->isEjected(sylar::GetCurrentMS()));
+  run_requests(lb, 1000, 8);
+  SYLAR_ASSERT(items[0]->picks > picks + 50);
+  SYLAR_LOG_INFO(g_logger) << "test_eject ok";
+}
+
+// 新节点在 slow start 期间逐步放量
+void test_slow_start() {
+  sylar::LoadBalance::ptr lb(new sylar::P2CLoadBalance);
+  auto items = make_items(lb);
+  items[4]->setLatency(1000);
+  run_requests(lb, 500, 8);
+
+  auto item = std::make_shared<FakeItem>(5, 1000);
+  items.push_back(item);
+  lb->add(item);
+  run_requests(lb, 1000, 8);
+  uint64_t early = item->picks;
+  usleep(500 * 1000);
+  item->picks = 0;
+  run_requests(lb, 1000, 8);
+  SYLAR_LOG_INFO(g_logger) << "slow start: early=" << early
+                           << " later=" << item->picks;
+  SYLAR_ASSERT(early < item->picks);
+  SYLAR_LOG_INFO(g_logger) << "test_slow_start ok";
+}
+
+// 选择本身的开销
+void bench_get() {
+  sylar::LoadBalance::ptr lb(new sylar::P2CLoadBalance);
+  auto items = make_items(lb);
+  const int count = 1000000;
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    SYLAR_ASSERT(lb->get());
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  SYLAR_LOG_INFO(g_logger) << "p2c get: " << used * 1000 / count << "ns";
+}
+
+// 一致性哈希测试用的节点, 可以模拟连接断开
+class HashItem : public sylar::LoadBalanceItem {
+ public:
+  typedef std::shared_ptr<HashItem> ptr;
+
+  HashItem(uint64_t id, int32_t weight) {
+    setId(id);
+    setWeight(weight);
+  }
+
+  virtual bool isValid() override { return m_valid; }
+  void setValid(bool v) { m_valid = v; }
+
+ private:
+  bool m_valid = true;
+};
+
+static const int s_keys = 100000;
+
+std::vector<uint64_t> lookup_all(sylar::LoadBalance::ptr lb) {
+  std::vector<uint64_t> rt(s_keys);
+  for (int i = 0; i < s_keys; ++i) {
+    rt[i] = lb->get(i)->getId();
+  }
+  return rt;
+}
+
+double moved_rate(const std::vector<uint64_t>& a,
+                  const std::vector<uint64_t>& b) {
+  int moved = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    moved += a[i] != b[i];
+  }
+  return (double)moved / a.size();
+}
+
+// 增删节点时迁移的 key 比例, 权重的分布, 查找耗时
+template <class LB>
+void test_hash(const std::string& name) {
+  const int nodes = 10;
+  std::shared_ptr<LB> lb = std::make_shared<LB>();
+  std::vector<HashItem::ptr> items;
+  std::vector<sylar::LoadBalanceItem::ptr> vs;
+  for (int i = 0; i < nodes; ++i) {
+    // 最后一个节点权重是其它节点的两倍
+    items.push_back(std::make_shared<HashItem>(1000 + i * 7,
+                                               i == nodes - 1 ? 20000 : 10000));
+    vs.push_back(items.back());
+  }
+  lb->set(vs);
+  auto before = lookup_all(lb);
+  std::map<uint64_t, int> counts;
+  for (auto& i : before) {
+    ++counts[i];
+  }
+  double avg = (double)s_keys / (nodes + 1);
+  for (int i = 0; i < nodes; ++i) {
+    double expect = i == nodes - 1 ? avg * 2 : avg;
+    double share = counts[items[i]->getId()] / expect;
+    SYLAR_ASSERT(share > 0.7 && share < 1.3);
+  }
+
+  // 删除一个节点, 基本上只有它上面的 key 迁移. Maglev 允许少量额外迁移
+  lb->del(items[3]);
+  auto after_del = lookup_all(lb);
+  int extra = 0;
+  for (int i = 0; i < s_keys; ++i) {
+    SYLAR_ASSERT(after_del[i] != items[3]->getId());
+    extra += before[i] != items[3]->getId() && before[i] != after_del[i];
+  }
+  double del_rate = moved_rate(before, after_del);
+  double del_extra = (double)extra / s_keys;
+  SYLAR_ASSERT(del_extra < 0.03);
+
+  // 新增一个节点, 迁移的 key 基本上都落到新节点上
+  auto added = std::make_shared<HashItem>(5000, 10000);
+  lb->add(added);
+  auto after_add = lookup_all(lb);
+  extra = 0;
+  for (int i = 0; i < s_keys; ++i) {
+    extra += after_add[i] != added->getId() && after_add[i] != after_del[i];
+  }
+  double add_rate = moved_rate(after_del, after_add);
+  double add_extra = (double)extra / s_keys;
+  SYLAR_ASSERT(add_extra < 0.03);
+
+  // 增量重建的结果和从头构建一致
+  std::shared_ptr<LB> fresh = std::make_shared<LB>();
+  vs.clear();
+  for (auto& i : items) {
+    if (i != items[3]) {
+      vs.push_back(i);
+    }
+  }
+  vs.push_back(added);
+  fresh->set(vs);
+  SYLAR_ASSERT(lookup_all(fresh) == after_add);
+
+  // 连接断开的节点, 在下一次 init 之前 get 直接跳过
+  items[0]->setValid(false);
+  auto after_invalid = lookup_all(lb);
+  for (int i = 0; i < s_keys; ++i) {
+    SYLAR_ASSERT(after_invalid[i] != items[0]->getId());
+    SYLAR_ASSERT(after_add[i] == items[0]->getId() ||
+                 after_add[i] == after_invalid[i]);
+  }
+  lb->init();
+  items[0]->setValid(true);
+  lb->init();
+  SYLAR_ASSERT(lookup_all(lb) == after_add);
+
+  const int count = 1000000;
+  uint64_t ts = sylar::GetCurrentUS();
+  uint64_t sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += lb->get(i * 2654435761u)->getId();
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  SYLAR_LOG_INFO(g_logger) << name << ": del moved=" << del_rate << " ("
+                           << del_extra << " from other nodes) add moved="
+                           << add_rate << " (" << add_extra << ")"
+                           << " get=" << used * 1000 / count << "ns"
+                           << " (" << sum % 10 << ")";
+}
+
+// 取模的方式作为对比, 增删节点时大部分 key 都会迁移
+void test_modulo() {
+  sylar::LoadBalance::ptr lb(new sylar::RoundRobinLoadBalance);
+  std::vector<sylar::LoadBalanceItem::ptr> vs;
+  for (int i = 0; i < 10; ++i) {
+    vs.push_back(std::make_shared<HashItem>(1000 + i * 7, 10000));
+  }
+  lb->set(vs);
+  auto before = lookup_all(lb);
+  lb->del(vs[3]);
+  auto after = lookup_all(lb);
+  SYLAR_LOG_INFO(g_logger) << "modulo: del moved=" << moved_rate(before, after);
+}
+
+// 滑动窗口和延迟分位数
+void test_stats() {
+  sylar::HolderStatsSet set(5);
+  set.get(100).incTotal(3);
+  set.get(101).incTotal(2);
+  SYLAR_ASSERT(set.getTotal(101).getTotal() == 5);
+  SYLAR_ASSERT(set.getTotal(104).getTotal() == 5);
+  SYLAR_ASSERT(set.getTotal(105).getTotal() == 2);
+  SYLAR_ASSERT(set.getTotal(99).getTotal() == 0);
+  SYLAR_ASSERT(set.getSecond(100).getTotal() == 3);
+  // 第 105 秒复用第 100 秒的桶
+  set.get(105).incTotal(1);
+  SYLAR_ASSERT(set.getSecond(100).getTotal() == 0);
+  SYLAR_ASSERT(set.getTotal(105).getTotal() == 3);
+
+  SYLAR_ASSERT(set.getTotal(105).getPercentile(0.5) == 0);
+  for (uint32_t i = 1; i <= 10000; ++i) {
+    set.get(105).addLatency(i);
+  }
+  auto stats = set.getTotal(105);
+  for (float p : {0.5f, 0.9f, 0.99f}) {
+    float v = stats.getPercentile(p) / (p * 10000);
+    SYLAR_ASSERT(v > 0.875 && v < 1.125);
+  }
+  set.get(106).addLatency(3);
+  SYLAR_ASSERT(set.getSecond(106).getPercentile(1) == 3);
+  SYLAR_LOG_INFO(g_logger) << "test_stats " << stats.toString();
+}
+
+// 多线程同时累加同一个节点的统计
+uint64_t bench_stats(uint32_t shards, int threads, int count) {
+  sylar::Config::Lookup<uint32_t>("load_balance.stats_shards")
+      ->setValue(shards);
+  sylar::HolderStatsSet set;
+  uint32_t now = sylar::GetCurrentCoarseMS() / 1000;
+  std::vector<sylar::Thread::ptr> thrs;
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int i = 0; i < threads; ++i) {
+    thrs.push_back(std::make_shared<sylar::Thread>(
+        [&set, now, count]() {
+          for (int n = 0; n < count; ++n) {
+            auto& stats = set.get(now);
+            stats.incTotal(1);
+            stats.incOks(1);
+            stats.addLatency(n & 1023);
+          }
+        },
+        "stats_" + std::to_string(i)));
+  }
+  for (auto& i : thrs) {
+    i->join();
+  }
+  uint64_t used = sylar::GetCurrentUS() - ts;
+  SYLAR_ASSERT(set.getTotal(now).getTotal() == (uint32_t)threads * count);
+  SYLAR_ASSERT(set.getTotal(now).getOks() == (uint32_t)threads * count);
+  sylar::Config::Lookup<uint32_t>("load_balance.stats_shards")->setValue(0);
+  return used * 1000 / count / threads;
+}
+
+std::set<uint64_t> get_ids(sylar::LoadBalance::ptr lb) {
+  std::set<uint64_t> ids;
+  for (int i = 0; i < 1000; ++i) {
+    ids.insert(lb->get(i)->getId());
+  }
+  return ids;
+}
+
+// update 只调整变化的节点, 替换同 id 的节点, 没有变化时不重建
+template <class LB>
+void test_update(const std::string& name) {
+  std::shared_ptr<LB> lb = std::make_shared<LB>();
+  auto items = make_items(lb);
+  SYLAR_ASSERT(get_ids(lb) == std::set<uint64_t>({0, 1, 2, 3, 4}));
+
+  std::unordered_map<uint64_t, sylar::LoadBalanceItem::ptr> adds;
+  std::unordered_map<uint64_t, sylar::LoadBalanceItem::ptr> dels;
+  auto replaced = std::make_shared<FakeItem>(2, 1000);
+  adds[5] = std::make_shared<FakeItem>(5, 1000);
+  adds[2] = replaced;
+  dels[0];
+  dels[9];
+  lb->update(adds, dels);
+  SYLAR_ASSERT(dels[0] == items[0] && !dels[9]);
+  SYLAR_ASSERT(get_ids(lb) == std::set<uint64_t>({1, 2, 3, 4, 5}));
+  SYLAR_ASSERT(lb->getById(2) == replaced);
+  bool found = false;
+  for (int i = 0; i < 1000; ++i) {
+    auto item = lb->get(i);
+    SYLAR_ASSERT(item != items[2]);
+    found |= item == replaced;
+  }
+  SYLAR_ASSERT(found);
+
+  dels.clear();
+  lb->update(adds, dels);
+  SYLAR_ASSERT(get_ids(lb) == std::set<uint64_t>({1, 2, 3, 4, 5}));
+  SYLAR_LOG_INFO(g_logger) << "test_update " << name << " ok";
+}
+
+// 不依赖注册中心, 直接设置查询结果
+class FakeServiceDiscovery
+    : public sylar::IServiceDiscovery,
+      public std::enable_shared_from_this<FakeServiceDiscovery> {
+ public:
+  typedef std::shared_ptr<FakeServiceDiscovery> ptr;
+
+  virtual bool doRegister() override { return true; }
+  virtual bool doQuery() override { return true; }
+  virtual void start() override {
+    m_self = shared_from_this();
+    m_iomanager = sylar::IOManager::GetThis();
+  }
+  virtual void stop() override { cancelFlush(); }
+
+  void set(const std::string& service, const std::vector<std::string>& addrs,
+           const std::string& data = "") {
+    ServiceItemMap infos;
+    for (auto& i : addrs) {
+      auto info = sylar::ServiceItemInfo::Create(i, data);
+      infos[info->getId()] = info;
+    }
+    updateServer("sylar.top", service, infos);
+  }
+};
+
+uint64_t sd_id(const std::string& addr) {
+  return sylar::ServiceItemInfo::Create(addr, "")->getId();
+}
+
+// 服务发现按增量通知, 窗口内的抖动被合并, 没有变化的节点复用连接
+void test_sd_delta() {
+  auto sd = std::make_shared<FakeServiceDiscovery>();
+  sd->start();
+  auto sdlb = std::make_shared<sylar::SDLoadBalance>(sd);
+  int streams = 0;
+  sdlb->setCb([&streams](const std::string& domain, const std::string& service,
+                         sylar::ServiceItemInfo::ptr info) {
+    ++streams;
+    return std::make_shared<sylar::SocketStream>(
+        sylar::Socket::CreateTCPSocket());
+  });
+  int notifies = 0;
+  auto cb = sd->getServiceCallback();
+  sd->setServiceCallback(
+      [&notifies, cb](const std::string& domain, const std::string& service,
+                      const sylar::IServiceDiscovery::ServiceItemMap& adds,
+                      const sylar::IServiceDiscovery::ServiceItemMap& dels) {
+        ++notifies;
+        cb(domain, service, adds, dels);
+      });
+  const std::string a = "10.0.0.1:80";
+  const std::string b = "10.0.0.2:80";
+  const std::string c = "10.0.0.3:80";
+  const std::string d = "10.0.0.4:80";
+
+  // 第一次查询到立即通知
+  sd->set("blog", {a, b, c});
+  SYLAR_ASSERT(notifies == 1 && streams == 3);
+  auto lb = sdlb->get("sylar.top", "blog");
+  auto item_c = lb->getById(sd_id(c));
+  SYLAR_ASSERT(item_c);
+
+  // c 下线又上线, 合并后没有变化
+  sd->set("blog", {a, b});
+  sd->set("blog", {a, b, c});
+  usleep(100 * 1000);
+  SYLAR_ASSERT(notifies == 1 && streams == 3);
+  SYLAR_ASSERT(lb->getById(sd_id(c)) == item_c);
+
+  // 多次变化合并成一次通知, 只给新增的节点建连
+  sd->set("blog", {a, b});
+  sd->set("blog", {a, b, d});
+  sd->set("blog", {b, d});
+  usleep(100 * 1000);
+  SYLAR_ASSERT(notifies == 2 && streams == 4);
+  SYLAR_ASSERT(!lb->getById(sd_id(a)) && !lb->getById(sd_id(c)));
+  SYLAR_ASSERT(lb->getById(sd_id(b)) && lb->getById(sd_id(d)));
+  SYLAR_ASSERT(!item_c->getStream()->isConnected());
+
+  // 节点集合不变只有数据变化, 也要通知, 已有节点复用连接
+  sylar::IServiceDiscovery::ServiceItemMap changed;
+  sd->setServiceCallback(
+      [&notifies, &changed, cb](
+          const std::string& domain, const std::string& service,
+          const sylar::IServiceDiscovery::ServiceItemMap& adds,
+          const sylar::IServiceDiscovery::ServiceItemMap& dels) {
+        ++notifies;
+        changed = adds;
+        SYLAR_ASSERT(dels.empty());
+        cb(domain, service, adds, dels);
+      });
+  auto item_b = lb->getById(sd_id(b));
+  sd->set("blog", {b, d}, "weight=200");
+  usleep(100 * 1000);
+  SYLAR_ASSERT(notifies == 3 && streams == 4 && changed.size() == 2);
+  SYLAR_ASSERT(changed[sd_id(b)]->getData("weight") == "200");
+  SYLAR_ASSERT(lb->getById(sd_id(b)) == item_b);
+  sd->stop();
+
+  std::unordered_map<
+      std::string,
+      std::unordered_map<std::string, sylar::IServiceDiscovery::ServiceItemMap>>
+      infos;
+  sd->listServer(infos);
+  SYLAR_ASSERT(infos["sylar.top"]["blog"].size() == 2);
+  SYLAR_LOG_INFO(g_logger) << "test_sd_delta ok";
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  sylar::Config::Lookup<uint32_t>("load_balance.p2c.eject_base_ms")
+      ->setValue(1000);
+  sylar::Config::Lookup<uint32_t>("load_balance.p2c.slow_start_ms")
+      ->setValue(400);
+  test_latency();
+  test_eject();
+  test_slow_start();
+  bench_get();
+  test_modulo();
+  test_hash<sylar::ConsistentHashLoadBalance>("ketama");
+  test_hash<sylar::MaglevLoadBalance>("maglev");
+  test_update<sylar::RoundRobinLoadBalance>("round_robin");
+  test_update<sylar::WeightLoadBalance>("weight");
+  test_update<sylar::P2CLoadBalance>("p2c");
+  test_update<sylar::ConsistentHashLoadBalance>("ketama");
+  test_sd_delta();
+
+  test_stats();
+  int threads = std::max(4, (int)sysconf(_SC_NPROCESSORS_ONLN));
+  uint64_t shared = bench_stats(1, threads, 1000000);
+  uint64_t sharded = bench_stats(threads, threads, 1000000);
+  SYLAR_LOG_INFO(g_logger) << "stats " << threads
+                           << " threads: shared=" << shared
+                           << "ns/op sharded=" << sharded << "ns/op";
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
@@ -0,0 +1,313 @@
+#include "sylar/config.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/module.h"
+#include "sylar/ns/name_server_module.h"
+#include "sylar/ns/ns_client.h"
+#include "sylar/rock/rock_server.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string s_domain = "sync.com";
+static sylar::Address::ptr g_addr;
+
+sylar::RockConnection::ptr connect() {
+  auto conn = std::make_shared<sylar::RockConnection>();
+  SYLAR_ASSERT(conn->connect(g_addr));
+  conn->setNotifyHandler(
+      [](sylar::RockNotify::ptr, sylar::RockStream::ptr) { return true; });
+  conn->start();
+  return conn;
+}
+
+// 以 127.0.0.1:port 注册到 s_domain 的 cmd 100
+sylar::RockConnection::ptr do_register(uint16_t port, uint32_t weight = 100,
+                                       sylar::RockConnection::ptr conn =
+                                           nullptr) {
+  if (!conn) {
+    conn = connect();
+  }
+  sylar::RockRequest::ptr req = std::make_shared<sylar::RockRequest>();
+  req->setCmd((int)sylar::ns::NSCommand::REGISTER);
+  sylar::ns::RegisterRequest rr;
+  auto info = rr.add_infos();
+  info->set_domain(s_domain);
+  info->add_cmds(100);
+  info->mutable_node()->set_ip("127.0.0.1");
+  info->mutable_node()->set_port(port);
+  info->mutable_node()->set_weight(weight);
+  req->setAsPB(rr);
+  auto rt = conn->request(req, 1000);
+  SYLAR_ASSERT(rt->result == 0);
+  return conn;
+}
+
+std::shared_ptr<sylar::ns::SubscribeResponse> subscribe(
+    sylar::RockConnection::ptr conn, const std::string& domain,
+    uint64_t revision) {
+  sylar::RockRequest::ptr req = std::make_shared<sylar::RockRequest>();
+  req->setCmd((int)sylar::ns::NSCommand::SUBSCRIBE);
+  sylar::ns::SubscribeRequest sr;
+  auto item = sr.add_domains();
+  item->set_domain(domain);
+  item->set_revision(revision);
+  req->setAsPB(sr);
+  auto rt = conn->request(req, 1000);
+  SYLAR_ASSERT(rt->result == 0 && rt->response);
+  return rt->response->getAsPB<sylar::ns::SubscribeResponse>();
+}
+
+size_t node_count(sylar::ns::NSClient::ptr client) {
+  auto ns = client->getSnapshot()->get(s_domain, 100);
+  return ns ? ns->size() : 0;
+}
+
+bool wait_for(std::function<bool()> cb, uint32_t timeout_ms = 1000) {
+  uint64_t ts = sylar::GetCurrentMS();
+  while (!cb() && sylar::GetCurrentMS() - ts < timeout_ms) {
+    usleep(1000);
+  }
+  return cb();
+}
+
+// 订阅的客户端靠推送收敛, 不依赖 30s 的定时查询
+void test_push() {
+  auto r1 = do_register(2001);
+
+  auto client = std::make_shared<sylar::ns::NSClient>();
+  client->init();
+  client->addQueryDomain(s_domain);
+  SYLAR_ASSERT(client->connect(g_addr));
+  client->start();
+  SYLAR_ASSERT(wait_for([client]() { return node_count(client) == 1; }));
+
+  uint64_t ts = sylar::GetCurrentMS();
+  auto r2 = do_register(2002);
+  SYLAR_ASSERT(wait_for([client]() { return node_count(client) == 2; }));
+  SYLAR_LOG_INFO(g_logger) << "add converged in "
+                           << sylar::GetCurrentMS() - ts << "ms";
+
+  do_register(2002, 50, r2);
+  uint64_t id = sylar::ns::NSNode::GetID("127.0.0.1", 2002);
+  SYLAR_ASSERT(wait_for([client, id]() {
+    auto n = client->getSnapshot()->get(s_domain)->get(100, id);
+    return n && n->getWeight() == 50;
+  }));
+
+  ts = sylar::GetCurrentMS();
+  r1->close();
+  SYLAR_ASSERT(wait_for([client]() { return node_count(client) == 1; }));
+  SYLAR_LOG_INFO(g_logger) << "del converged in "
+                           << sylar::GetCurrentMS() - ts << "ms";
+
+  client->uninit();
+  client->close();
+  r2->close();
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_push ok";
+}
+
+// 已知版本返回增量, 未知版本或者日志已经淘汰时返回全量
+void test_delta() {
+  std::vector<sylar::RockConnection::ptr> conns;
+  for (int i = 0; i < 50; ++i) {
+    conns.push_back(do_register(3000 + i));
+  }
+  auto sub = connect();
+  auto rsp = subscribe(sub, s_domain, 12345);
+  SYLAR_ASSERT(rsp->syncs_size() == 1 && rsp->syncs(0).snapshot());
+  SYLAR_ASSERT(rsp->syncs(0).cmds(0).updates_size() == 50);
+  uint64_t rev = rsp->syncs(0).revision();
+  size_t snapshot_size = rsp->ByteSizeLong();
+
+  rsp = subscribe(sub, s_domain, rev);
+  SYLAR_ASSERT(rsp->syncs_size() == 0);
+
+  conns.push_back(do_register(4000));
+  conns[0]->close();
+  SYLAR_ASSERT(wait_for([&sub, rev]() {
+    auto rsp = subscribe(sub, s_domain, rev);
+    return rsp->syncs_size() == 1 && rsp->syncs(0).revision() == rev + 2;
+  }));
+  rsp = subscribe(sub, s_domain, rev);
+  auto& sync = rsp->syncs(0);
+  SYLAR_ASSERT(!sync.snapshot() && sync.from_revision() == rev);
+  SYLAR_ASSERT(sync.cmds(0).updates_size() == 1);
+  SYLAR_ASSERT(sync.cmds(0).dels_size() == 1);
+  SYLAR_ASSERT(sync.cmds(0).dels(0) ==
+               sylar::ns::NSNode::GetID("127.0.0.1", 3000));
+  SYLAR_LOG_INFO(g_logger) << "snapshot " << snapshot_size << " bytes, delta "
+                           << rsp->ByteSizeLong() << " bytes";
+
+  sylar::Config::Lookup<uint32_t>("ns.sync_log_size")->setValue(2);
+  for (int i = 1; i < 4; ++i) {
+    conns[i]->close();
+  }
+  SYLAR_ASSERT(wait_for([&sub, rev]() {
+    return subscribe(sub, s_domain, rev)->syncs(0).snapshot();
+  }));
+  sylar::Config::Lookup<uint32_t>("ns.sync_log_size")->setValue(128);
+
+  rsp = subscribe(sub, "unknown.com", 100);
+  SYLAR_ASSERT(rsp->syncs_size() == 1 && rsp->syncs(0).snapshot());
+  SYLAR_ASSERT(rsp->syncs(0).revision() == 0);
+  SYLAR_ASSERT(rsp->syncs(0).cmds_size() == 0);
+  SYLAR_ASSERT(subscribe(sub, "unknown.com", 0)->syncs_size() == 0);
+
+  sub->close();
+  for (auto& i : conns) {
+    i->close();
+  }
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_delta ok";
+}
+
+// 只支持 QUERY 的老版本服务端, 不认识的命令回复 404 后断开连接
+class LegacyServer : public sylar::RockServer {
+ public:
+  typedef std::shared_ptr<LegacyServer> ptr;
+  std::atomic<uint32_t> subscribes = {0};
+  std::atomic<uint32_t> queries = {0};
+
+ protected:
+  virtual void handleClient(sylar::Socket::ptr client) override {
+    auto session = std::make_shared<sylar::RockSession>(client);
+    session->setWorker(m_worker);
+    session->setRequestHandler([this](sylar::RockRequest::ptr req,
+                                      sylar::RockResponse::ptr rsp,
+                                      sylar::RockStream::ptr conn) {
+      if (req->getCmd() != (uint32_t)sylar::ns::NSCommand::QUERY) {
+        if (req->getCmd() == (uint32_t)sylar::ns::NSCommand::SUBSCRIBE) {
+          ++subscribes;
+        }
+        return false;
+      }
+      ++queries;
+      sylar::ns::QueryResponse qr;
+      auto info = qr.add_infos();
+      info->set_domain(s_domain);
+      info->set_cmd(100);
+      auto node = info->add_nodes();
+      node->set_ip("127.0.0.1");
+      node->set_port(5001);
+      node->set_weight(100);
+      rsp->setResult(0);
+      rsp->setResultStr("ok");
+      rsp->setAsPB(qr);
+      return true;
+    });
+    session->start();
+  }
+};
+
+// 服务端不支持 SUBSCRIBE 时退回 QUERY, 不会反复重连
+void test_legacy() {
+  auto server = std::make_shared<LegacyServer>();
+  SYLAR_ASSERT(server->bind(sylar::IPAddress::Create("127.0.0.1", 0)));
+  server->start();
+
+  auto client = std::make_shared<sylar::ns::NSClient>();
+  client->init();
+  client->addQueryDomain(s_domain);
+  SYLAR_ASSERT(client->connect(server->getSocks()[0]->getLocalAddress()));
+  client->start();
+  SYLAR_ASSERT(
+      wait_for([client]() { return node_count(client) == 1; }, 2000));
+  SYLAR_ASSERT(wait_for([client]() { return client->isConnected(); }));
+
+  client->addQueryDomain("other.com");
+  SYLAR_ASSERT(wait_for([&server]() { return server->queries >= 2; }));
+  SYLAR_ASSERT(server->subscribes == 1);
+  SYLAR_ASSERT(client->isConnected() && node_count(client) == 1);
+
+  client->uninit();
+  client->close();
+  server->stop();
+  usleep(10 * 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_legacy ok";
+}
+
+// 快照查询正确, 更新时没有变化的域名和旧版本共享
+void test_snapshot() {
+  auto ds = std::make_shared<sylar::ns::NSDomainSet>();
+  for (int i = 0; i < 100; ++i) {
+    auto d = ds->get("d" + std::to_string(i) + ".com", true);
+    for (int n = 0; n < 10; ++n) {
+      d->add(100, std::make_shared<sylar::ns::NSNode>("10.0.0." +
+                                                          std::to_string(n),
+                                                      8000 + i, 100));
+      d->add(200, std::make_shared<sylar::ns::NSNode>("10.0.1." +
+                                                          std::to_string(n),
+                                                      8000 + i, 100));
+    }
+  }
+  auto snap = sylar::ns::NSSnapshot::Create(ds);
+  SYLAR_ASSERT(snap->size() == 100 && snap->getVersion() == 1);
+  SYLAR_ASSERT(snap->get("d7.com", 100)->size() == 10);
+  SYLAR_ASSERT(!snap->get("d7.com", 300) && !snap->get("x.com"));
+  uint64_t id = sylar::ns::NSNode::GetID("10.0.1.3", 8007);
+  SYLAR_ASSERT(snap->get("d7.com")->get(200, id)->getId() == id);
+  SYLAR_ASSERT(!snap->get("d7.com")->get(100, id));
+
+  ds->get("d7.com")->del(200, id);
+  ds->del("d8.com");
+  ds->get("new.com", true)->add(
+      100, std::make_shared<sylar::ns::NSNode>("10.0.2.1", 9000, 100));
+  auto next = snap->update(ds, {"d7.com", "d8.com", "new.com"});
+  SYLAR_ASSERT(next->size() == 100 && next->getVersion() == 2);
+  SYLAR_ASSERT(next->get("d7.com", 200)->size() == 9);
+  SYLAR_ASSERT(snap->get("d7.com", 200)->size() == 10);
+  SYLAR_ASSERT(!next->get("d8.com") && next->get("new.com", 100)->size() == 1);
+  SYLAR_ASSERT(next->get("d9.com") == snap->get("d9.com"));
+  SYLAR_ASSERT(next->get("d7.com") != snap->get("d7.com"));
+
+  std::vector<std::string> names;
+  for (int i = 0; i < 100; ++i) {
+    if (i != 8) {
+      names.push_back("d" + std::to_string(i) + ".com");
+    }
+  }
+  const int count = 1000000;
+  size_t total = 0;
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    std::vector<sylar::ns::NSNode::ptr> nodes;
+    ds->get(names[i % names.size()])->get(100)->listAll(nodes);
+    total += nodes.size();
+  }
+  uint64_t locked = sylar::GetCurrentUS() - ts;
+  ts = sylar::GetCurrentUS();
+  for (int i = 0; i < count; ++i) {
+    total += next->get(names[i % names.size()], 100)->size();
+  }
+  uint64_t rcu = sylar::GetCurrentUS() - ts;
+  SYLAR_LOG_INFO(g_logger) << count << " lookups: locked " << locked / 1000
+                           << "ms, snapshot " << rcu / 1000 << "ms";
+  SYLAR_ASSERT(total);
+  SYLAR_LOG_INFO(g_logger) << "test_snapshot ok";
+}
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+  sylar::ModuleMgr::GetInstance()->add(
+      std::make_shared<sylar::ns::NameServerModule>());
+
+  auto server = std::make_shared<sylar::RockServer>();
+  SYLAR_ASSERT(server->bind(sylar::IPAddress::Create("127.0.0.1", 0)));
+  g_addr = server->getSocks()[0]->getLocalAddress();
+  server->start();
+
+  test_snapshot();
+  test_push();
+  test_delta();
+  server->stop();
+  test_legacy();
+}
+
+int main(int argc, char** argv) {
+  sylar::IOManager iom(1);
+  iom.schedule(run);
+  return 0;
+}
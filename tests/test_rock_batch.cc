@@ -0,0 +1,191 @@
+#include <algorithm>
+#include "sylar/config.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/rock/rock_stream.h"
+#include "sylar/tcp_server.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 直接回显请求体的 rock 服务, 不经过 ModuleMgr
+class EchoServer : public sylar::TcpServer {
+ public:
+  typedef std::shared_ptr<EchoServer> ptr;
+
+ protected:
+  void handleClient(sylar::Socket::ptr client) override {
+    auto session = std::make_shared<sylar::RockSession>(client);
+    session->setWorker(m_worker);
+    session->setRequestHandler([](sylar::RockRequest::ptr req,
+                                  sylar::RockResponse::ptr rsp,
+                                  sylar::RockStream::ptr conn) {
+      if (req->getCmd() == 101) {
+        usleep(atoi(req->getBody().c_str()) * 1000);
+      }
+      rsp->setResult(0);
+      rsp->setBody(req->getBody());
+      return true;
+    });
+    session->start();
+  }
+};
+
+// 统计客户端的写调用次数
+class CountedConnection : public sylar::RockConnection {
+ public:
+  typedef std::shared_ptr<CountedConnection> ptr;
+
+  int write(const void* buffer, size_t length) override {
+    ++m_writes;
+    return RockConnection::write(buffer, length);
+  }
+
+  int write(sylar::ByteArray::ptr ba, size_t length) override {
+    ++m_writes;
+    return RockConnection::write(ba, length);
+  }
+
+  int writev(const iovec* buffers, size_t length) override {
+    ++m_writes;
+    return RockConnection::writev(buffers, length);
+  }
+
+  uint64_t getWrites() const { return m_writes; }
+
+ private:
+  std::atomic<uint64_t> m_writes = {0};
+};
+
+std::string make_body(int i) {
+  // 每 50 个请求夹一个超过 gzip_min_length 的大消息
+  if (i % 50 == 0) {
+    return std::string(8 * 1024 + i, 'a' + i % 26);
+  }
+  return "hello " + std::to_string(i);
+}
+
+// 多个协程在同一连接上并发请求, 校验应答并统计每个请求的写调用次数
+void bench(CountedConnection::ptr conn, int count, int fibers) {
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  std::vector<uint64_t> used(count);
+  uint64_t writes = conn->getWrites();
+  uint64_t start = sylar::GetCurrentUS();
+  for (int f = 0; f < fibers; ++f) {
+    iom->schedule([conn, count, fibers, &used, &sem, f]() {
+      for (int i = f; i < count; i += fibers) {
+        sylar::RockRequest::ptr req(new sylar::RockRequest);
+        req->setCmd(100);
+        req->setBody(make_body(i));
+        uint64_t ts = sylar::GetCurrentUS();
+        auto rt = conn->request(req, 3000);
+        SYLAR_ASSERT(rt->result == 0 && rt->response);
+        SYLAR_ASSERT(rt->response->getBody() == req->getBody());
+        used[i] = sylar::GetCurrentUS() - ts;
+      }
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < fibers; ++i) {
+    sem.wait();
+  }
+  uint64_t total = sylar::GetCurrentUS() - start;
+  writes = conn->getWrites() - writes;
+  std::sort(used.begin(), used.end());
+  SYLAR_LOG_INFO(g_logger) << "rock coalesce_us=" << conn->getCoalesceWindow()
+                           << " max_batch=" << conn->getMaxBatch() << " "
+                           << count << " requests, " << fibers
+                           << " fibers: writes=" << writes << " ("
+                           << (double)writes / count << "/req) qps="
+                           << (uint64_t)count * 1000000 / (total ? total : 1)
+                           << " p50=" << used[count / 2]
+                           << "us p99=" << used[count * 99 / 100] << "us";
+}
+
+// 慢请求超时不影响同一连接上的其它请求, 环形表很小时部分请求进入溢出表
+void test_timeout(sylar::Address::ptr addr) {
+  sylar::Config::Lookup<uint32_t>("async_socket_stream.ctx_ring_size")
+      ->setValue(8);
+  sylar::RockConnection::ptr conn(new sylar::RockConnection);
+  SYLAR_ASSERT(conn->connect(addr));
+  conn->start();
+
+  auto iom = sylar::IOManager::GetThis();
+  sylar::FiberSemaphore sem;
+  const int slow = 16;
+  const int fast = 64;
+  for (int i = 0; i < slow + fast; ++i) {
+    iom->schedule([conn, i, &sem]() {
+      sylar::RockRequest::ptr req(new sylar::RockRequest);
+      bool is_slow = i < slow;
+      req->setCmd(is_slow ? 101 : 100);
+      req->setBody(is_slow ? "200" : "fast");
+      auto rt = conn->request(req, is_slow ? 50 + i : 1000);
+      if (is_slow) {
+        SYLAR_ASSERT(rt->result == sylar::AsyncSocketStream::TIMEOUT);
+        SYLAR_ASSERT(rt->used >= 50 + i && rt->used < 150);
+      } else {
+        SYLAR_ASSERT(rt->result == 0 && rt->response->getBody() == "fast");
+      }
+      sem.notify();
+    });
+  }
+  for (int i = 0; i < slow + fast; ++i) {
+    sem.wait();
+  }
+  // 慢请求的应答到达时已经超时, 直接丢弃
+  usleep(300 * 1000);
+  sylar::RockRequest::ptr req(new sylar::RockRequest);
+  req->setCmd(100);
+  req->setBody("again");
+  auto rt = conn->request(req, 1000);
+  SYLAR_ASSERT(rt->result == 0 && rt->response->getBody() == "again");
+  conn->close();
+  usleep(10 * 1000);
+  sylar::Config::Lookup<uint32_t>("async_socket_stream.ctx_ring_size")
+      ->setValue(1024);
+  SYLAR_LOG_INFO(g_logger) << "test_timeout ok";
+}
+
+static int s_count = 20000;
+static int s_fibers = 32;
+
+void run() {
+  g_logger->setLevel(sylar::LogLevel::INFO);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+  sylar::Config::Lookup<uint32_t>("rock.protocol.gzip_min_length")
+      ->setValue(4096);
+
+  auto addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:8097");
+  EchoServer::ptr server(new EchoServer);
+  SYLAR_ASSERT(server->bind(addr, false));
+  server->start();
+
+  test_timeout(addr);
+  for (uint32_t window : {0, 50}) {
+    sylar::Config::Lookup<uint32_t>("rock.write_coalesce_us")
+        ->setValue(window);
+    CountedConnection::ptr conn(new CountedConnection);
+    SYLAR_ASSERT(conn->connect(addr));
+    conn->start();
+    bench(conn, s_count, s_fibers);
+    conn->close();
+    // 等读协程退出后再创建新的 socket, 避免复用同一个 fd
+    usleep(10 * 1000);
+  }
+  server->stop();
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_count = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_fibers = atoi(argv[2]);
+  }
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
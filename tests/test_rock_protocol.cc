@@ -0,0 +1,150 @@
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/ns/ns_protobuf.pb.h"
+#include "sylar/rock/rock_protocol.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 内存中的单向管道, 记录每个消息头的 flag
+class MemStream : public sylar::Stream {
+ public:
+  typedef std::shared_ptr<MemStream> ptr;
+
+  int read(void* buffer, size_t length) override {
+    length = std::min(length, m_data.size() - m_pos);
+    memcpy(buffer, &m_data[m_pos], length);
+    m_pos += length;
+    return length;
+  }
+
+  int read(sylar::ByteArray::ptr ba, size_t length) override {
+    length = std::min(length, m_data.size() - m_pos);
+    ba->write(&m_data[m_pos], length);
+    m_pos += length;
+    return length;
+  }
+
+  int write(const void* buffer, size_t length) override {
+    m_data.append((const char*)buffer, length);
+    return length;
+  }
+
+  int write(sylar::ByteArray::ptr ba, size_t length) override {
+    std::string data = ba->toString().substr(0, length);
+    ba->setPosition(ba->getPosition() + data.size());
+    return write(data.c_str(), data.size());
+  }
+
+  void close() override {}
+
+  // 下一个未读消息头的 flag
+  uint8_t peekFlag() const { return m_data[m_pos + 3]; }
+  size_t pending() const { return m_data.size() - m_pos; }
+
+ private:
+  std::string m_data;
+  size_t m_pos = 0;
+};
+
+sylar::ns::RegisterRequest make_pb(int n) {
+  sylar::ns::RegisterRequest pb;
+  for (int i = 0; i < n; ++i) {
+    auto info = pb.add_infos();
+    info->set_domain("domain_" + std::to_string(i % 7));
+    info->add_cmds(i);
+    info->mutable_node()->set_ip("10.0.0." + std::to_string(i % 255));
+    info->mutable_node()->set_port(8000 + i);
+  }
+  return pb;
+}
+
+sylar::RockRequest::ptr make_request(int n) {
+  sylar::RockRequest::ptr req = std::make_shared<sylar::RockRequest>();
+  req->setSn(n);
+  req->setCmd(100);
+  SYLAR_ASSERT(req->setAsPB(make_pb(n)));
+  return req;
+}
+
+sylar::RockRequest::ptr transfer(sylar::RockMessageDecoder& from,
+                                 sylar::RockMessageDecoder& to,
+                                 sylar::Message::ptr msg, bool& gzip) {
+  MemStream::ptr ms = std::make_shared<MemStream>();
+  int32_t len = from.serializeTo(ms, msg);
+  SYLAR_ASSERT(len > 0 && (size_t)len == ms->pending());
+  gzip = ms->peekFlag() & 0x1;
+  auto rt = std::dynamic_pointer_cast<sylar::RockRequest>(to.parseFrom(ms));
+  SYLAR_ASSERT(rt && ms->pending() == 0);
+  return rt;
+}
+
+void check_body(sylar::RockRequest::ptr req, int n) {
+  auto pb = req->getAsPB<sylar::ns::RegisterRequest>();
+  SYLAR_ASSERT(pb);
+  SYLAR_ASSERT(pb->SerializeAsString() == make_pb(n).SerializeAsString());
+  SYLAR_ASSERT(req->getSn() == (uint32_t)n);
+}
+
+// 双方各自的阈值通过消息头协商
+void test_negotiate() {
+  sylar::RockMessageDecoder client;
+  sylar::RockMessageDecoder server;
+  client.setCompressMinLength(1000);
+  SYLAR_ASSERT(client.getPeerCompressMinLength() == 0);
+
+  // 对端还没有通告, 按本端阈值压缩; 解压后的消息体跨越多个节点
+  bool gzip = false;
+  auto req = transfer(client, server, make_request(1000), gzip);
+  SYLAR_ASSERT(gzip);
+  SYLAR_ASSERT(server.getPeerCompressMinLength() == 1024);
+  check_body(req, 1000);
+
+  // 服务端默认阈值很大, 通告不希望压缩
+  req = transfer(server, client, make_request(1000), gzip);
+  SYLAR_ASSERT(!gzip);
+  SYLAR_ASSERT(client.getPeerCompressMinLength() == (uint32_t)-1);
+  check_body(req, 1000);
+
+  // 之后客户端也不再压缩
+  req = transfer(client, server, make_request(1000), gzip);
+  SYLAR_ASSERT(!gzip);
+  check_body(req, 1000);
+
+  // 双方都愿意压缩时取较大的阈值
+  server.setCompressMinLength(8192);
+  transfer(server, client, make_request(1), gzip);
+  SYLAR_ASSERT(client.getPeerCompressMinLength() == 8192);
+  SYLAR_ASSERT(client.getSendCompressMinLength() == 8192);
+  req = transfer(client, server, make_request(100), gzip);
+  SYLAR_ASSERT(!gzip && req->getBodySize() < 8192);
+  req = transfer(client, server, make_request(1000), gzip);
+  SYLAR_ASSERT(gzip && req->getBodySize() > 8192);
+  check_body(req, 1000);
+  SYLAR_LOG_INFO(g_logger) << "test_negotiate ok";
+}
+
+// 收到的消息体不复制也可以直接转发
+void test_forward() {
+  sylar::RockMessageDecoder a;
+  sylar::RockMessageDecoder b;
+  sylar::RockMessageDecoder c;
+  bool gzip = false;
+  auto req = transfer(a, b, make_request(300), gzip);
+  std::string body = make_request(300)->getBody();
+  SYLAR_ASSERT(req->getBodySize() == body.size());
+  auto fwd = transfer(b, c, req, gzip);
+  SYLAR_ASSERT(fwd->getBody() == body);
+  SYLAR_ASSERT(req->getBody() == body);
+  check_body(fwd, 300);
+
+  // setBody 之后不再引用接收缓冲
+  fwd->setBody("replaced");
+  SYLAR_ASSERT(fwd->getBody() == "replaced" && fwd->getBodySize() == 8);
+  SYLAR_LOG_INFO(g_logger) << "test_forward ok";
+}
+
+int main(int argc, char** argv) {
+  test_negotiate();
+  test_forward();
+  return 0;
+}
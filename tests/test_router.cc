@@ -0,0 +1,108 @@
+#include <fnmatch.h>
+#include "sylar/http/servlet.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_route_count = 300;
+static const int s_loop = 100000;
+
+sylar::http::FunctionServlet::callback make_cb(const std::string& name) {
+  return [name](sylar::http::HttpRequest::ptr req,
+                sylar::http::HttpResponse::ptr rsp,
+                sylar::http::HttpSession::ptr session) {
+    rsp->setBody(name);
+    return 0;
+  };
+}
+
+void test_match() {
+  sylar::http::ServletDispatch::ptr sd(new sylar::http::ServletDispatch);
+  sd->addServlet("/sylar/xx", make_cb("exact"));
+  sd->addGlobServlet("/sylar/*", make_cb("glob"));
+  sd->addGlobServlet("/sylar/*.html", make_cb("glob_html"));
+  sd->addRoute(sylar::http::HttpMethod::GET, "/user/:id/profile",
+               make_cb("get_profile"));
+  sd->addRoute(sylar::http::HttpMethod::POST, "/user/:uid/profile",
+               make_cb("post_profile"));
+  sd->addRoute(sylar::http::HttpMethod::INVALID_METHOD, "/static/*path",
+               make_cb("static"));
+
+  auto check = [sd](sylar::http::HttpMethod method, const std::string& path) {
+    sylar::http::HttpRequest::ptr req(new sylar::http::HttpRequest);
+    sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse);
+    req->setMethod(method);
+    req->setPath(path);
+    sd->handle(req, rsp, nullptr);
+    std::stringstream ss;
+    for (auto& i : req->getRouteParams()) {
+      ss << " " << i.first << "=" << i.second;
+    }
+    SYLAR_LOG_INFO(g_logger)
+        << sylar::http::HttpMethodToString(method) << " " << path << " -> "
+        << (int)rsp->getStatus() << " "
+        << rsp->getBody().substr(0, 16) << ss.str();
+  };
+  check(sylar::http::HttpMethod::GET, "/sylar/xx");
+  check(sylar::http::HttpMethod::GET, "/sylar/yy");
+  check(sylar::http::HttpMethod::GET, "/sylar/a/b.html");
+  check(sylar::http::HttpMethod::GET, "/user/10/profile");
+  check(sylar::http::HttpMethod::POST, "/user/11/profile");
+  check(sylar::http::HttpMethod::PUT, "/user/12/profile");
+  check(sylar::http::HttpMethod::GET, "/static/js/app.js");
+  check(sylar::http::HttpMethod::GET, "/not/found");
+}
+
+void bench() {
+  std::vector<std::string> globs;
+  sylar::http::ServletDispatch::ptr sd(new sylar::http::ServletDispatch);
+  for (int i = 0; i < s_route_count; ++i) {
+    std::string glob = "/api/v1/module" + std::to_string(i) + "/*";
+    globs.push_back(glob);
+    sd->addGlobServlet(glob, make_cb(glob));
+  }
+  std::vector<std::string> paths = {"/api/v1/module0/x",
+                                    "/api/v1/module150/list",
+                                    "/api/v1/module299/a/b/c",
+                                    "/api/v2/unknown", "/favicon.ico"};
+
+  uint64_t hits = 0;
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int n = 0; n < s_loop; ++n) {
+    for (auto& p : paths) {
+      for (auto& g : globs) {
+        if (!fnmatch(g.c_str(), p.c_str(), 0)) {
+          ++hits;
+          break;
+        }
+      }
+    }
+  }
+  uint64_t fnmatch_us = sylar::GetCurrentUS() - ts;
+
+  ts = sylar::GetCurrentUS();
+  for (int n = 0; n < s_loop; ++n) {
+    for (auto& p : paths) {
+      if (sd->getMatchedServlet(p) != sd->getDefault()) {
+        ++hits;
+      }
+    }
+  }
+  uint64_t radix_us = sylar::GetCurrentUS() - ts;
+
+  double total = 1.0 * s_loop * paths.size();
+  SYLAR_LOG_INFO(g_logger) << "routes=" << s_route_count
+                           << " lookups=" << (uint64_t)total
+                           << " hits=" << hits;
+  SYLAR_LOG_INFO(g_logger) << "fnmatch scan: " << fnmatch_us << "us, "
+                           << (fnmatch_us * 1000.0 / total) << "ns/op";
+  SYLAR_LOG_INFO(g_logger) << "radix router: " << radix_us << "us, "
+                           << (radix_us * 1000.0 / total) << "ns/op";
+}
+
+int main(int argc, char** argv) {
+  test_match();
+  bench();
+  return 0;
+}
@@ -0,0 +1,171 @@
+#include <zlib.h>
+#include "sylar/http/ws_session.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 内存中的 Stream
+class StringStream : public sylar::Stream {
+ public:
+  virtual int read(void* buffer, size_t length) override {
+    length = std::min(length, m_data.size() - m_pos);
+    memcpy(buffer, &m_data[m_pos], length);
+    m_pos += length;
+    return length;
+  }
+  virtual int read(sylar::ByteArray::ptr ba, size_t length) override {
+    return -1;
+  }
+  virtual int write(const void* buffer, size_t length) override {
+    m_data.append((const char*)buffer, length);
+    return length;
+  }
+  virtual int write(sylar::ByteArray::ptr ba, size_t length) override {
+    return -1;
+  }
+  virtual void close() override {}
+
+  size_t size() const { return m_data.size(); }
+
+ private:
+  std::string m_data;
+  size_t m_pos = 0;
+};
+
+void test_negotiate() {
+  std::string offer = sylar::http::WSDeflate::ClientOffer();
+  std::string response;
+  auto server = sylar::http::WSDeflate::ServerAccept(offer, response);
+  SYLAR_LOG_INFO(g_logger) << "offer: " << offer << " response: " << response;
+  SYLAR_ASSERT(server);
+
+  // 第一个 offer 不合法时接受第二个
+  server = sylar::http::WSDeflate::ServerAccept(
+      "permessage-deflate; foo=1, permessage-deflate; "
+      "server_no_context_takeover; client_max_window_bits=10",
+      response);
+  SYLAR_LOG_INFO(g_logger) << "response: " << response;
+  SYLAR_ASSERT(server && server->getParams().serverNoContextTakeover);
+
+  bool error = false;
+  auto client = sylar::http::WSDeflate::ClientAccept(response, error);
+  SYLAR_ASSERT(client && !error);
+  SYLAR_ASSERT(client->getParams().clientMaxWindowBits == 10);
+
+  client = sylar::http::WSDeflate::ClientAccept("x-unknown", error);
+  SYLAR_ASSERT(!client && error);
+}
+
+std::string make_json(int i) {
+  std::stringstream ss;
+  ss << "{\"id\":" << i << ",\"items\":[";
+  for (int n = 0; n < 20; ++n) {
+    ss << (n ? "," : "") << "{\"name\":\"item_" << n
+       << "\",\"price\":" << n * 100 << ",\"status\":\"online\"}";
+  }
+  ss << "]}";
+  return ss.str();
+}
+
+void test_roundtrip(const std::string& exts) {
+  std::string response;
+  auto server = sylar::http::WSDeflate::ServerAccept(exts, response);
+  bool error = false;
+  auto client = sylar::http::WSDeflate::ClientAccept(response, error);
+  SYLAR_ASSERT(server && client);
+
+  StringStream ss;
+  sylar::http::WSFrameWriter writer;
+  writer.setDeflate(client);
+  std::vector<sylar::http::WSFrameMessage::ptr> msgs;
+  size_t raw_size = 0;
+  for (int i = 0; i < 100; ++i) {
+    msgs.push_back(std::make_shared<sylar::http::WSFrameMessage>(
+        sylar::http::WSFrameHead::TEXT_FRAME, make_json(i)));
+    raw_size += msgs.back()->getData().size();
+  }
+  // 小于阈值的消息不压缩
+  msgs.push_back(std::make_shared<sylar::http::WSFrameMessage>(
+      sylar::http::WSFrameHead::TEXT_FRAME, "hello"));
+  for (auto& i : msgs) {
+    writer.send(&ss, i, true);
+  }
+  for (auto& i : msgs) {
+    auto msg = sylar::http::WSRecvMessage(&ss, false, nullptr, server.get());
+    SYLAR_ASSERT(msg);
+    SYLAR_ASSERT(msg->getData() == i->getData());
+  }
+  SYLAR_LOG_INFO(g_logger) << "[" << response << "] " << msgs.size()
+                           << " messages raw=" << raw_size
+                           << " wire=" << ss.size();
+}
+
+// 16MB 的 0 压缩后很小, 解压到上限时就应当失败
+void test_bomb() {
+  std::string response;
+  auto server =
+      sylar::http::WSDeflate::ServerAccept("permessage-deflate", response);
+  bool error = false;
+  auto client = sylar::http::WSDeflate::ClientAccept(response, error);
+  SYLAR_ASSERT(server && client);
+
+  std::string zipped;
+  SYLAR_ASSERT(client->compress(std::string(16 * 1024 * 1024, '\0'), zipped));
+  std::string out;
+  SYLAR_ASSERT(!server->decompress(zipped, out, 1024 * 1024));
+  SYLAR_ASSERT(out.empty());
+  SYLAR_LOG_INFO(g_logger) << "bomb " << zipped.size()
+                           << " -> 16MB, max_size=1MB rejected";
+}
+
+// 用 BFINAL 结束的原始 deflate 流, dict 非空时引用上一条消息的窗口
+std::string deflate_final(const std::string& in, const std::string& dict) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  SYLAR_ASSERT(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                            Z_DEFAULT_STRATEGY) == Z_OK);
+  if (!dict.empty()) {
+    deflateSetDictionary(&zs, (const Bytef*)dict.c_str(), dict.size());
+  }
+  std::string out(deflateBound(&zs, in.size()), '\0');
+  zs.next_in = (Bytef*)in.c_str();
+  zs.avail_in = in.size();
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  SYLAR_ASSERT(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+// 对端每条消息都以 BFINAL 结束压缩流, 后续消息仍然可以解压
+void test_final_block(const std::string& exts, bool takeover) {
+  std::string response;
+  auto server = sylar::http::WSDeflate::ServerAccept(exts, response);
+  SYLAR_ASSERT(server);
+  std::string prev;
+  for (int i = 0; i < 3; ++i) {
+    std::string msg = make_json(i);
+    std::string out;
+    SYLAR_ASSERT(server->decompress(deflate_final(msg, takeover ? prev : ""),
+                                    out, 1024 * 1024));
+    SYLAR_ASSERT(out == msg);
+    prev = msg;
+  }
+  SYLAR_LOG_INFO(g_logger) << "final block [" << exts << "] ok";
+}
+
+int main(int argc, char** argv) {
+  test_negotiate();
+  test_bomb();
+  test_roundtrip("permessage-deflate; client_max_window_bits");
+  test_roundtrip(
+      "permessage-deflate; client_no_context_takeover; "
+      "server_no_context_takeover");
+  test_roundtrip("permessage-deflate; client_max_window_bits=9");
+  test_final_block("permessage-deflate", true);
+  test_final_block("permessage-deflate; client_no_context_takeover", false);
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "sylar/http/ws_hub.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_sessions = 100;
+static int s_messages = 100;
+
+// 分片消息发送期间的广播要等 FIN 之后才写出, 不能插在分片之间
+void test_fragment(sylar::Socket::ptr listener) {
+  auto iom = sylar::IOManager::GetThis();
+  auto addr = listener->getLocalAddress();
+  sylar::http::WSHub::ptr hub = std::make_shared<sylar::http::WSHub>(iom);
+  auto sock = sylar::Socket::CreateTCP(addr);
+  SYLAR_ASSERT(sock->connect(addr));
+  auto client = std::make_shared<sylar::SocketStream>(sock);
+  auto session = std::make_shared<sylar::http::WSSession>(listener->accept());
+  hub->subscribe("t", session);
+
+  SYLAR_ASSERT(session->sendMessage(
+                   "part1,", sylar::http::WSFrameHead::TEXT_FRAME, false) > 0);
+  hub->publish("t", "broadcast");
+  usleep(10 * 1000);
+  SYLAR_ASSERT(session->sendMessage(
+                   "part2", sylar::http::WSFrameHead::CONTINUE, true) > 0);
+  auto msg = sylar::http::WSRecvMessage(client.get(), true);
+  SYLAR_ASSERT(msg && msg->getData() == "part1,part2");
+  msg = sylar::http::WSRecvMessage(client.get(), true);
+  SYLAR_ASSERT(msg && msg->getData() == "broadcast");
+
+  hub->unsubscribeAll(session);
+  session->close();
+  SYLAR_LOG_INFO(g_logger) << "test_fragment ok";
+}
+
+// 多个协程同时发送, 没有负责写出的协程也要等到自己的帧写出后才返回
+void test_concurrent_send(sylar::Socket::ptr listener) {
+  auto iom = sylar::IOManager::GetThis();
+  auto addr = listener->getLocalAddress();
+  auto sock = sylar::Socket::CreateTCP(addr);
+  SYLAR_ASSERT(sock->connect(addr));
+  auto client = std::make_shared<sylar::SocketStream>(sock);
+  auto session = std::make_shared<sylar::http::WSSession>(listener->accept());
+
+  // 返回帧长度: 2 字节帧头 + 2 字节扩展长度 + payload
+  SYLAR_ASSERT(session->sendMessage(std::string(200, 'h')) == 204);
+  auto first = sylar::http::WSRecvMessage(client.get(), true);
+  SYLAR_ASSERT(first && first->getData().size() == 200);
+
+  const int fibers = 8;
+  const int count = 200;
+  sylar::FiberSemaphore sem;
+  std::atomic<int> ok = {0};
+  for (int i = 0; i < fibers; ++i) {
+    iom->schedule([session, &sem, &ok]() {
+      std::string data(4096, 'c');
+      for (int n = 0; n < count; ++n) {
+        if (session->sendMessage(data) > 0) {
+          ++ok;
+        }
+      }
+      sem.notify();
+    });
+  }
+  int received = 0;
+  while (received < fibers * count) {
+    auto msg = sylar::http::WSRecvMessage(client.get(), true);
+    SYLAR_ASSERT(msg && msg->getData().size() == 4096);
+    ++received;
+  }
+  for (int i = 0; i < fibers; ++i) {
+    sem.wait();
+  }
+  SYLAR_ASSERT(ok == fibers * count);
+
+  session->close();
+  SYLAR_ASSERT(session->sendMessage("closed") == -1);
+  SYLAR_LOG_INFO(g_logger) << "test_concurrent_send ok";
+}
+
+void run() {
+  auto iom = sylar::IOManager::GetThis();
+  auto addr = sylar::Address::LookupAny("127.0.0.1:0");
+  auto listener = sylar::Socket::CreateTCP(addr);
+  SYLAR_ASSERT(listener->bind(addr) && listener->listen());
+  addr = listener->getLocalAddress();
+  test_fragment(listener);
+  test_concurrent_send(listener);
+
+  sylar::http::WSHub::ptr hub = std::make_shared<sylar::http::WSHub>(iom);
+  std::vector<sylar::http::WSSession::ptr> sessions;
+  std::vector<sylar::SocketStream::ptr> clients;
+  for (int i = 0; i < s_sessions; ++i) {
+    auto sock = sylar::Socket::CreateTCP(addr);
+    SYLAR_ASSERT(sock->connect(addr));
+    clients.push_back(std::make_shared<sylar::SocketStream>(sock));
+    sessions.push_back(
+        std::make_shared<sylar::http::WSSession>(listener->accept()));
+    hub->subscribe(i % 2 ? "odd" : "even", sessions.back());
+    hub->subscribe("all", sessions.back());
+  }
+  SYLAR_LOG_INFO(g_logger) << "subscribers all="
+                           << hub->getSubscriberCount("all")
+                           << " odd=" << hub->getSubscriberCount("odd");
+
+  // 每个客户端协程读出全部消息
+  sylar::FiberSemaphore sem;
+  std::atomic<int> received = {0};
+  for (auto& c : clients) {
+    iom->schedule([c, &sem, &received]() {
+      for (int i = 0; i < s_messages; ++i) {
+        auto msg = sylar::http::WSRecvMessage(c.get(), true);
+        if (!msg) {
+          break;
+        }
+        ++received;
+      }
+      sem.notify();
+    });
+  }
+
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int i = 0; i < s_messages; ++i) {
+    hub->publish("all", "{\"seq\":" + std::to_string(i) + "}");
+  }
+  for (size_t i = 0; i < clients.size(); ++i) {
+    sem.wait();
+  }
+  SYLAR_LOG_INFO(g_logger) << "fan out " << s_messages << " messages to "
+                           << s_sessions << " sessions received=" << received
+                           << " used=" << (sylar::GetCurrentUS() - ts) << "us "
+                           << hub->getStats().toString();
+
+  // 客户端不读, 队列超过上限后丢弃
+  hub->setMaxQueueBytes(1024 * 1024);
+  std::string big(256 * 1024, 'x');
+  for (int i = 0; i < 64; ++i) {
+    hub->publish("odd", big);
+  }
+  sleep(1);
+  SYLAR_LOG_INFO(g_logger) << "slow consumer drop_new "
+                           << hub->getStats().toString();
+
+  hub->setOverflowPolicy(sylar::http::WSFrameWriter::CLOSE);
+  for (int i = 0; i < 4; ++i) {
+    hub->publish("odd", big);
+  }
+  sleep(1);
+  SYLAR_LOG_INFO(g_logger) << "slow consumer close "
+                           << hub->getStats().toString();
+
+  // 取消最后一个订阅后不再保留连接的记录
+  SYLAR_ASSERT(hub->unsubscribe("all", sessions[0]));
+  SYLAR_ASSERT(hub->getStats().sessions == (uint32_t)s_sessions);
+  SYLAR_ASSERT(hub->unsubscribe("even", sessions[0]));
+  SYLAR_ASSERT(hub->getStats().sessions == (uint32_t)s_sessions - 1);
+
+  for (auto& s : sessions) {
+    hub->unsubscribeAll(s);
+    s->close();
+  }
+  SYLAR_ASSERT(hub->getStats().sessions == 0);
+  SYLAR_LOG_INFO(g_logger) << "after unsubscribe "
+                           << hub->getSubscriberCount("all") << " "
+                           << hub->getStats().toString();
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_sessions = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    s_messages = atoi(argv[2]);
+  }
+  sylar::IOManager iom(2);
+  iom.schedule(run);
+  return 0;
+}
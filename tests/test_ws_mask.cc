@@ -0,0 +1,111 @@
+#include "sylar/http/ws_session.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 内存中的 Stream, 记录 writev 调用次数
+class StringStream : public sylar::Stream {
+ public:
+  virtual int read(void* buffer, size_t length) override {
+    length = std::min(length, m_data.size() - m_pos);
+    memcpy(buffer, &m_data[m_pos], length);
+    m_pos += length;
+    return length;
+  }
+  virtual int read(sylar::ByteArray::ptr ba, size_t length) override {
+    return -1;
+  }
+  virtual int write(const void* buffer, size_t length) override {
+    m_data.append((const char*)buffer, length);
+    return length;
+  }
+  virtual int write(sylar::ByteArray::ptr ba, size_t length) override {
+    return -1;
+  }
+  virtual int writev(const iovec* buffers, size_t length) override {
+    ++m_writev;
+    return Stream::writev(buffers, length);
+  }
+  virtual void close() override {}
+
+  int m_writev = 0;
+
+ private:
+  std::string m_data;
+  size_t m_pos = 0;
+};
+
+static void mask_bytes(char* data, size_t len, const char* mask) {
+  for (size_t i = 0; i < len; ++i) {
+    data[i] ^= mask[i % 4];
+  }
+}
+
+void test_mask() {
+  const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+  for (size_t len = 0; len < 100; ++len) {
+    for (size_t off = 0; off < 8; ++off) {
+      std::string data = sylar::random_string(len + off);
+      std::string a = data.substr(off);
+      std::string b = a;
+      std::string c(len, '\0');
+      mask_bytes(&a[0], len, mask);
+      sylar::http::WSMask(&b[0], len, mask);
+      sylar::http::WSMask(&c[0], data.c_str() + off, len, mask);
+      SYLAR_ASSERT(a == b);
+      SYLAR_ASSERT(a == c);
+    }
+  }
+  SYLAR_LOG_INFO(g_logger) << "mask check ok";
+}
+
+void bench_mask() {
+  const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+  std::string data(1024 * 1024, 'a');
+  int loop = 200;
+
+  uint64_t ts = sylar::GetCurrentUS();
+  for (int i = 0; i < loop; ++i) {
+    mask_bytes(&data[0], data.size(), mask);
+  }
+  uint64_t byte_us = sylar::GetCurrentUS() - ts;
+
+  ts = sylar::GetCurrentUS();
+  for (int i = 0; i < loop; ++i) {
+    sylar::http::WSMask(&data[0], data.size(), mask);
+  }
+  uint64_t word_us = sylar::GetCurrentUS() - ts;
+
+  SYLAR_LOG_INFO(g_logger) << "mask " << loop << "MB byte_loop=" << byte_us
+                           << "us WSMask=" << word_us << "us";
+}
+
+void test_frame() {
+  StringStream ss;
+  sylar::http::WSFrameWriter writer;
+  std::vector<sylar::http::WSFrameMessage::ptr> msgs;
+  size_t sizes[] = {0, 10, 125, 126, 1000, 65535, 65536, 100000};
+  for (auto i : sizes) {
+    msgs.push_back(std::make_shared<sylar::http::WSFrameMessage>(
+        sylar::http::WSFrameHead::BIN_FRAME, sylar::random_string(i)));
+  }
+  // 客户端帧带掩码, 批量发送只调用一次 writev
+  writer.send(&ss, msgs, true);
+  SYLAR_LOG_INFO(g_logger) << "send " << msgs.size()
+                           << " frames, writev=" << ss.m_writev;
+  for (auto& i : msgs) {
+    auto msg = sylar::http::WSRecvMessage(&ss, false);
+    SYLAR_ASSERT(msg);
+    SYLAR_ASSERT(msg->getData() == i->getData());
+  }
+  SYLAR_LOG_INFO(g_logger) << "frame check ok";
+}
+
+int main(int argc, char** argv) {
+  test_mask();
+  bench_mask();
+  test_frame();
+  return 0;
+}